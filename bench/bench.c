@@ -0,0 +1,1807 @@
+/**
+ * @file    bench.c
+ * @author  Philippe Bouchet (philippe.bouchet@epita.fr)
+ * @brief   DeepSea benchmark suite. Times the matrix kernels, the network
+ *          passes, and end to end training / inference on synthetic data
+ *          with MNIST shapes, and emits the results as JSON.
+ *
+ *          Every section starts from the same seed, so its data and
+ *          weights do not depend on the timings of the sections before
+ *          it. With -r, the suite runs several trials and reports the
+ *          median of each metric with its median absolute deviation
+ *          (MAD). With -b, medians are compared to a baseline
+ *          JSON written by an earlier run: a metric regresses when it is
+ *          worse by more than the -t threshold and by more than
+ *          BENCH_MAD_SCALE MADs, and any regression fails the run.
+ *          Online update p99 latencies at or over BENCH_ONLINE_P99_US fail
+ *          it too, with or without a baseline.
+ *
+ *          Usage: ./bin/deepsea-bench [-q] [-r trials] [-b baseline.json]
+ *                                     [-t threshold] [-o results.json]
+ * 
+ * @copyright Copyright (c) 2022
+ * 
+ */
+
+#include <err.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "backend.h"
+#include "conv.h"
+#include "dist.h"
+#include "live.h"
+#include "matrix.h"
+#include "monitor.h"
+#include "network.h"
+#include "online.h"
+#include "prune.h"
+#include "topology.h"
+#include "utils.h"
+
+#define BENCH_MAX_RESULTS   256
+#define BENCH_MAX_METRICS   8
+#define BENCH_LATENCY_CALLS 256
+#define BENCH_LIVE_READERS  2
+#define BENCH_MAX_TRIALS    16
+#define BENCH_KEY_SIZE      32
+#define BENCH_MAD_SCALE     3.f     // Noise band of a regression, in MADs
+#define BENCH_SEED          0       // rand() seed of every section
+#define BENCH_ONLINE_P99_US 1000.f  // Latency budget of an online update
+
+#define MNIST_INPUT         784
+#define MNIST_HIDDEN        100
+#define MNIST_OUTPUT        10
+
+typedef enum
+{
+    K_MUL,
+    K_MUL_TN,
+    K_MUL_NT,
+    K_ADD,
+    K_HADAMARD,
+    K_ADD_ROW,
+    K_SUM_ROWS,
+    K_APPLY,
+    K_UPDATE,               // dst = m1 - lr * m2, eager m_* calls
+    K_UPDATE_FUSED,         // dst = m1 - lr * m2, fused m_eval
+    K_IM2COL,               // dst = im2col(m1)
+    K_COL2IM,               // m1 = col2im(dst)
+} kernel_t;
+
+typedef struct
+{
+    kernel_t    kernel;
+    matrix_t*   m1;
+    matrix_t*   m2;
+    matrix_t*   dst;
+    const conv_t* conv;     // K_IM2COL, K_COL2IM
+} kernel_args_t;
+
+typedef struct
+{
+    network_t*  net;
+    dataset_t*  data;
+    double*     out;
+    size_t      n;
+    train_config_t config;
+} net_args_t;
+
+typedef struct
+{
+    live_t*     live;
+    dataset_t*  data;
+    int*        stop;
+    size_t      calls;
+    double      lat[BENCH_LATENCY_CALLS];   // Ring of the last calls
+} live_args_t;
+
+typedef struct
+{
+    char        name[64];
+    size_t      n_metrics;
+    const char* keys[BENCH_MAX_METRICS];
+    size_t      n_values[BENCH_MAX_METRICS];    // One per trial
+    double      values[BENCH_MAX_METRICS][BENCH_MAX_TRIALS];
+} bench_result_t;
+
+typedef struct
+{
+    char        name[64];
+    size_t      n_metrics;   // Medians, and their MADs as <key>_mad
+    char        keys[2 * BENCH_MAX_METRICS][BENCH_KEY_SIZE];
+    double      values[2 * BENCH_MAX_METRICS];
+} bench_baseline_t;
+
+static bench_result_t   results[BENCH_MAX_RESULTS];
+static size_t           n_results = 0;
+static size_t           n_trials = 1;
+static double           min_time = 0.25f;
+
+static bench_baseline_t baseline[BENCH_MAX_RESULTS];
+static size_t           n_baseline = 0;
+
+static bench_result_t*  _bench_result(const char* name);
+static void             _bench_metric(bench_result_t* r, const char* key,
+                                      double value);
+static double           _bench_time(void (*fun)(void*), void* args);
+static int              _bench_cmp_double(const void* a, const void* b);
+static dataset_t*       _bench_dataset(size_t n);
+static dataset_t*       _bench_templates(size_t n);
+static network_t*       _bench_network(size_t batch_size);
+static void             _bench_run_kernel(void* args);
+static void             _bench_run_predict(void* args);
+static void             _bench_run_fit(void* args);
+static int              _bench_run_rank(dist_t* dist, void* args);
+static void*            _bench_run_reader(void* args);
+static void             _bench_kernel(kernel_t kernel, const char* name,
+                                      size_t M, size_t K, size_t N);
+static void             _bench_kernels(void);
+static void             _bench_forward(void);
+static void             _bench_train_step(void);
+static void             _bench_epoch(int sparse);
+static void             _bench_epoch_dense(void);
+static void             _bench_epoch_sparse(void);
+static void             _bench_latency(void);
+static void             _bench_prune_engine(network_t* net,
+                                            pruned_net_t* pnet,
+                                            dataset_t* test,
+                                            bench_result_t* r,
+                                            double* throughput,
+                                            double* p50);
+static void             _bench_pruning(void);
+static void             _bench_parallel(void);
+static void             _bench_pipeline(void);
+static void             _bench_checkpoint(void);
+static void             _bench_monitor(void);
+static void             _bench_live(void);
+static void             _bench_conv(void);
+static void             _bench_backends(void);
+static void             _bench_online(void);
+static double           _bench_median(const double* values, size_t n);
+static double           _bench_mad(const double* values, size_t n);
+static void             _bench_emit_json(FILE* fp);
+static int              _bench_json_string(const char** p, char* dst,
+                                           size_t size);
+static void             _bench_load_baseline(const char* path);
+static const double*    _bench_baseline(const char* name, const char* key);
+static int              _bench_direction(const char* key);
+static size_t           _bench_compare(double threshold);
+static size_t           _bench_budgets(void);
+
+
+int main(int argc, char* argv[])
+{
+    const char* output = NULL;
+    const char* base = NULL;
+    double threshold = 0.1f;
+    int opt;
+
+    void (*sections[])(void) = {
+        _bench_kernels, _bench_forward, _bench_train_step,
+        _bench_epoch_dense, _bench_epoch_sparse, _bench_latency,
+        _bench_pruning, _bench_parallel, _bench_pipeline,
+        _bench_checkpoint, _bench_monitor, _bench_live, _bench_conv,
+        _bench_backends, _bench_online,
+    };
+
+    while ((opt = getopt(argc, argv, "qr:b:t:o:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'q':
+                min_time = 0.05f;
+                break;
+
+            case 'r':
+                n_trials = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'b':
+                base = optarg;
+                break;
+
+            case 't':
+                threshold = strtod(optarg, NULL);
+                break;
+
+            case 'o':
+                output = optarg;
+                break;
+
+            default:
+                errx(-1, "Usage: %s [-q] [-r trials] [-b baseline.json] "
+                         "[-t threshold] [-o results.json]", argv[0]);
+        }
+    }
+
+    if (n_trials == 0 || n_trials > BENCH_MAX_TRIALS)
+    {
+        errx(-1, "BENCH::ERROR::TRIALS: "
+                 "Expected 1 to %d trials", BENCH_MAX_TRIALS);
+    }
+
+    // Loaded first, a missing baseline fails before the suite runs
+    if (base)
+        _bench_load_baseline(base);
+
+    for (size_t trial = 0; trial < n_trials; trial++)
+    {
+        if (n_trials > 1)
+            fprintf(stderr, "[BENCH] Trial %zu / %zu\n", trial + 1,
+                    n_trials);
+
+        for (size_t s = 0; s < sizeof(sections) / sizeof(*sections); s++)
+        {
+            // Timed loops draw from rand() a timing dependent number of
+            // times: reseeding keeps the data and initial weights of
+            // every section the same across runs and trials
+            srand(BENCH_SEED);
+            sections[s]();
+        }
+    }
+
+    FILE* fp = output ? fopen(output, "w") : stdout;
+
+    if (fp == NULL)
+        err(-1, "BENCH::ERROR::OUTPUT: Could not open %s", output);
+
+    _bench_emit_json(fp);
+
+    if (output)
+        fclose(fp);
+
+    size_t over_budget = _bench_budgets();
+
+    if (base && _bench_compare(threshold) > 0)
+        return EXIT_FAILURE;
+
+    if (over_budget > 0)
+        return EXIT_FAILURE;
+
+    return 0;
+}
+
+
+/* ==== BENCHMARK HELPERS ==== */
+
+
+/**
+ * @brief  Named result, appended on its first trial
+ * 
+ * @param  name Benchmark name
+ * @return bench_result_t* Result to add metrics to
+ */
+static bench_result_t* _bench_result(const char* name)
+{
+    fprintf(stderr, "[BENCH] %s\n", name);
+
+    for (size_t i = 0; i < n_results; i++)
+    {
+        if (strcmp(results[i].name, name) == 0)
+            return &results[i];
+    }
+
+    if (n_results == BENCH_MAX_RESULTS)
+        errx(-1, "BENCH::ERROR::RESULTS: Too many results");
+
+    bench_result_t* r = &results[n_results++];
+
+    snprintf(r->name, sizeof(r->name), "%s", name);
+    r->n_metrics = 0;
+
+    return r;
+}
+
+/**
+ * @brief Add the value of a metric in the current trial
+ * 
+ * @param r Result
+ * @param key Metric name
+ * @param value Metric value
+ */
+static void _bench_metric(bench_result_t* r, const char* key, double value)
+{
+    size_t m = 0;
+
+    while (m < r->n_metrics && strcmp(r->keys[m], key) != 0)
+        m++;
+
+    if (m == r->n_metrics)
+    {
+        if (r->n_metrics == BENCH_MAX_METRICS)
+        {
+            errx(-1, "BENCH::ERROR::RESULTS: Too many metrics for %s",
+                 r->name);
+        }
+
+        r->keys[m] = key;
+        r->n_values[m] = 0;
+        r->n_metrics++;
+    }
+
+    if (r->n_values[m] < BENCH_MAX_TRIALS)
+        r->values[m][r->n_values[m]++] = value;
+}
+
+/**
+ * @brief  Average time of a call to fun, repeated for at least min_time
+ *         seconds after one warm-up call
+ * 
+ * @param  fun Function to time
+ * @param  args Arguments of fun
+ * @return double Seconds per call
+ */
+static double _bench_time(void (*fun)(void*), void* args)
+{
+    fun(args);
+
+    size_t calls = 0;
+    double start = get_time();
+    double elapsed = 0.f;
+
+    while (elapsed < min_time || calls < 3)
+    {
+        fun(args);
+        calls++;
+        elapsed = get_time() - start;
+    }
+
+    return elapsed / calls;
+}
+
+static int _bench_cmp_double(const void* a, const void* b)
+{
+    double x = *(const double*) a;
+    double y = *(const double*) b;
+
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief  Synthetic dataset with MNIST shapes: one-hot labels, and inputs
+ *         in [-1, 1] with about 80% of them on the -1 background
+ * 
+ * @param  n Number of samples
+ * @return dataset_t* Dataset
+ */
+static dataset_t* _bench_dataset(size_t n)
+{
+    dataset_t* data = data_init(n, MNIST_INPUT, MNIST_OUTPUT);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        for (size_t j = 0; j < MNIST_INPUT; j++)
+            data->X[i][j] = rand() % 5 ? -1.f : normalized_rand();
+
+        data->y[i][rand() % MNIST_OUTPUT] = 1.f;
+    }
+
+    return data;
+}
+
+/**
+ * @brief  Learnable synthetic dataset: each class has a fixed random
+ *         template of about 20% lit pixels, and samples are copies of
+ *         their class template with 35% of the pixels flipped. The
+ *         templates only depend on the class, so training and test sets
+ *         drawn apart share them.
+ * 
+ * @param  n Number of samples
+ * @return dataset_t* Dataset
+ */
+static dataset_t* _bench_templates(size_t n)
+{
+    dataset_t* data = data_init(n, MNIST_INPUT, MNIST_OUTPUT);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        size_t c = rand() % MNIST_OUTPUT;
+
+        for (size_t j = 0; j < MNIST_INPUT; j++)
+        {
+            int lit = ((j * 2654435761u) ^ (c * 40503u)) % 5 == 0;
+
+            if (rand() % 100 < 35)
+                lit = !lit;
+
+            data->X[i][j] = lit ? normalized_rand() * 0.5f + 0.5f : -1.f;
+        }
+
+        data->y[i][c] = 1.f;
+    }
+
+    return data;
+}
+
+/**
+ * @brief  784 -> 100 -> 10 network, ReLU hidden layer and softmax output
+ * 
+ * @param  batch_size Training batch size
+ * @return network_t* Network
+ */
+static network_t* _bench_network(size_t batch_size)
+{
+    network_t* net = net_init(2, MNIST_INPUT, MNIST_HIDDEN, MNIST_OUTPUT,
+                              batch_size, 0.01f);
+
+    net_set_activation(net, 0, ACT_RELU);
+    net_set_activation(net, 1, ACT_SOFTMAX);
+
+    return net;
+}
+
+static void _bench_run_kernel(void* args)
+{
+    kernel_args_t* k = args;
+
+    switch (k->kernel)
+    {
+        case K_MUL:         m_mul(k->m1, k->m2, k->dst); break;
+        case K_MUL_TN:      m_mul_tn(k->m1, k->m2, k->dst); break;
+        case K_MUL_NT:      m_mul_nt(k->m1, k->m2, k->dst); break;
+        case K_ADD:         m_add(k->m1, k->m2, k->dst); break;
+        case K_HADAMARD:    m_hadamard(k->m1, k->m2, k->dst); break;
+        case K_ADD_ROW:     m_add_row(k->m1, k->m2, k->dst); break;
+        case K_SUM_ROWS:    m_sum_rows(k->m1, k->dst); break;
+        case K_APPLY:       m_apply_dst(k->m1, sigmoid, k->dst); break;
+
+        case K_UPDATE:
+            m_scalar_mul(k->m2, 0.01f, k->dst);
+            m_sub(k->m1, k->dst, k->dst);
+            break;
+
+        case K_UPDATE_FUSED:
+            m_eval(M_SUB(M_LEAF(k->m1), M_SCALE(0.01f, M_LEAF(k->m2))),
+                   k->dst);
+            break;
+
+        case K_IM2COL:      conv_im2col(k->conv, k->m1, k->dst); break;
+        case K_COL2IM:      conv_col2im(k->conv, k->dst, k->m1); break;
+    }
+}
+
+static void _bench_run_predict(void* args)
+{
+    net_args_t* a = args;
+    net_predict_batch(a->net, a->data->X, a->n, a->out);
+}
+
+static void _bench_run_fit(void* args)
+{
+    net_args_t* a = args;
+    net_fit(a->net, a->data, &a->config);
+}
+
+static void* _bench_run_reader(void* args)
+{
+    live_args_t* a = args;
+    live_reader_t* reader = live_reader(a->live);
+    double out[MNIST_OUTPUT];
+
+    while (!__atomic_load_n(a->stop, __ATOMIC_RELAXED))
+    {
+        double start = get_time();
+        live_predict_batch(reader, a->data->X + a->calls % a->data->n, 1,
+                           out);
+        a->lat[a->calls++ % BENCH_LATENCY_CALLS] = get_time() - start;
+    }
+
+    return NULL;
+}
+
+static int _bench_run_rank(dist_t* dist, void* args)
+{
+    net_args_t* a = args;
+    train_config_t config = a->config;
+
+    config.dist = dist;
+    net_fit(a->net, a->data, &config);
+
+    return 0;
+}
+
+
+/* ==== BENCHMARKS ==== */
+
+
+/**
+ * @brief Time one kernel. GEMM shapes are (M x K) . (K x N), elementwise
+ *        kernels run on (M x N) matrices.
+ * 
+ * @param kernel Kernel to time
+ * @param name Kernel name
+ * @param M Rows
+ * @param K Inner dimension (GEMM only)
+ * @param N Columns
+ */
+static void _bench_kernel(kernel_t kernel, const char* name,
+                          size_t M, size_t K, size_t N)
+{
+    kernel_args_t k = { .kernel = kernel };
+    double flops, bytes;
+
+    switch (kernel)
+    {
+        case K_MUL:
+            k.m1 = m_init(M, K);
+            k.m2 = m_init(K, N);
+            break;
+
+        case K_MUL_TN:
+            k.m1 = m_init(K, M);
+            k.m2 = m_init(K, N);
+            break;
+
+        case K_MUL_NT:
+            k.m1 = m_init(M, K);
+            k.m2 = m_init(N, K);
+            break;
+
+        case K_ADD_ROW:
+            k.m1 = m_init(M, N);
+            k.m2 = m_init(1, N);
+            break;
+
+        default:
+            k.m1 = m_init(M, N);
+            k.m2 = m_init(M, N);
+            break;
+    }
+
+    k.dst = kernel == K_SUM_ROWS ? m_init(1, N) : m_init(M, N);
+
+    m_fill(k.m1, normalized_rand);
+    m_fill(k.m2, normalized_rand);
+
+    if (kernel == K_MUL || kernel == K_MUL_TN || kernel == K_MUL_NT)
+    {
+        flops = 2.f * M * N * K;
+        bytes = (double) (M * K + K * N + M * N) * sizeof(double);
+    }
+
+    else
+    {
+        flops = (double) M * N;
+        bytes = (double) (k.m1->size + k.dst->size) * sizeof(double);
+
+        if (kernel == K_ADD || kernel == K_HADAMARD)
+            bytes += (double) k.m2->size * sizeof(double);
+
+        if (kernel == K_UPDATE || kernel == K_UPDATE_FUSED)
+        {
+            flops *= 2.f;
+            bytes += (double) k.m2->size * sizeof(double);
+        }
+    }
+
+    char label[64];
+
+    if (kernel == K_MUL || kernel == K_MUL_TN || kernel == K_MUL_NT)
+        snprintf(label, sizeof(label), "kernel/%s/%zux%zux%zu",
+                 name, M, K, N);
+    else
+        snprintf(label, sizeof(label), "kernel/%s/%zux%zu", name, M, N);
+
+    double t = _bench_time(_bench_run_kernel, &k);
+    bench_result_t* r = _bench_result(label);
+
+    _bench_metric(r, "time_us", t * 1e6);
+    _bench_metric(r, "gflops", flops / t * 1e-9);
+    _bench_metric(r, "gbps", bytes / t * 1e-9);
+
+    m_free(k.m1);
+    m_free(k.m2);
+    m_free(k.dst);
+}
+
+/**
+ * @brief Matrix kernels on the shapes of a 784 -> 100 -> 10 network
+ */
+static void _bench_kernels(void)
+{
+    size_t batches[] = { 1, 32, 128 };
+
+    for (size_t i = 0; i < sizeof(batches) / sizeof(size_t); i++)
+    {
+        size_t B = batches[i];
+
+        _bench_kernel(K_MUL, "mul", B, MNIST_INPUT, MNIST_HIDDEN);
+        _bench_kernel(K_MUL, "mul", B, MNIST_HIDDEN, MNIST_OUTPUT);
+        _bench_kernel(K_MUL_TN, "mul_tn", MNIST_INPUT, B, MNIST_HIDDEN);
+        _bench_kernel(K_MUL_NT, "mul_nt", B, MNIST_OUTPUT, MNIST_HIDDEN);
+        _bench_kernel(K_ADD_ROW, "add_row", B, 1, MNIST_HIDDEN);
+        _bench_kernel(K_SUM_ROWS, "sum_rows", B, 1, MNIST_HIDDEN);
+        _bench_kernel(K_APPLY, "apply_sigmoid", B, 1, MNIST_HIDDEN);
+    }
+
+    _bench_kernel(K_MUL, "mul", 256, 256, 256);
+    _bench_kernel(K_ADD, "add", MNIST_INPUT, 1, MNIST_HIDDEN);
+    _bench_kernel(K_HADAMARD, "hadamard", MNIST_INPUT, 1, MNIST_HIDDEN);
+    _bench_kernel(K_UPDATE, "update", MNIST_INPUT, 1, MNIST_HIDDEN);
+    _bench_kernel(K_UPDATE_FUSED, "update_fused",
+                  MNIST_INPUT, 1, MNIST_HIDDEN);
+}
+
+/**
+ * @brief Batched forward pass through the whole network
+ */
+static void _bench_forward(void)
+{
+    size_t B = 128;
+    network_t* net = _bench_network(B);
+    dataset_t* data = _bench_dataset(B);
+    double* out = malloc(B * MNIST_OUTPUT * sizeof(double));
+
+    net_args_t a = { .net = net, .data = data, .out = out, .n = B };
+
+    double t = _bench_time(_bench_run_predict, &a);
+    bench_result_t* r = _bench_result("net/forward/batch128");
+
+    _bench_metric(r, "time_us", t * 1e6);
+    _bench_metric(r, "samples_per_s", B / t);
+
+    free(out);
+    data_free(data);
+    net_free(net);
+}
+
+/**
+ * @brief One optimizer step: forward, backward and update of one batch
+ */
+static void _bench_train_step(void)
+{
+    size_t batches[] = { 32, 128 };
+
+    for (size_t i = 0; i < sizeof(batches) / sizeof(size_t); i++)
+    {
+        size_t B = batches[i];
+        network_t* net = _bench_network(B);
+        dataset_t* data = _bench_dataset(B);
+
+        net_args_t a = { .net = net, .data = data };
+        a.config = net_config_default(1);
+        a.config.verbose = 0;
+
+        char label[64];
+        snprintf(label, sizeof(label), "net/train_step/batch%zu", B);
+
+        double t = _bench_time(_bench_run_fit, &a);
+        bench_result_t* r = _bench_result(label);
+
+        _bench_metric(r, "time_us", t * 1e6);
+        _bench_metric(r, "samples_per_s", B / t);
+
+        data_free(data);
+        net_free(net);
+    }
+}
+
+/**
+ * @brief Full training epochs on a synthetic MNIST sized dataset
+ * 
+ * @param sparse Train through the sparse first layer path
+ */
+static void _bench_epoch(int sparse)
+{
+    size_t n = 8192;
+    size_t B = 32;
+    network_t* net = _bench_network(B);
+    dataset_t* data = _bench_dataset(n);
+
+    if (sparse)
+        data_sparsify(data, -1.f);
+
+    train_config_t config = net_config_default(1);
+    config.verbose = 0;
+
+    double start = get_time();
+    size_t epochs = 0;
+
+    while (epochs < 2 || get_time() - start < min_time)
+    {
+        net_fit(net, data, &config);
+        epochs++;
+    }
+
+    double t = (get_time() - start) / epochs;
+    bench_result_t* r = _bench_result(sparse
+                                      ? "net/epoch_sparse/8192x784/batch32"
+                                      : "net/epoch/8192x784/batch32");
+
+    _bench_metric(r, "time_s", t);
+    _bench_metric(r, "samples_per_s", n / t);
+    _bench_metric(r, "steps_per_s", (n / B) / t);
+
+    data_free(data);
+    net_free(net);
+}
+
+/**
+ * @brief Full training epochs, dense inputs
+ */
+static void _bench_epoch_dense(void)
+{
+    _bench_epoch(0);
+}
+
+/**
+ * @brief Full training epochs, through the sparse first layer path
+ */
+static void _bench_epoch_sparse(void)
+{
+    _bench_epoch(1);
+}
+
+/**
+ * @brief Inference latency distribution at several batch sizes
+ */
+static void _bench_latency(void)
+{
+    size_t batches[] = { 1, 8, 32, 128 };
+    double lat[BENCH_LATENCY_CALLS];
+
+    network_t* net = _bench_network(128);
+    dataset_t* data = _bench_dataset(128);
+    double* out = malloc(128 * MNIST_OUTPUT * sizeof(double));
+
+    for (size_t i = 0; i < sizeof(batches) / sizeof(size_t); i++)
+    {
+        size_t B = batches[i];
+
+        net_predict_batch(net, data->X, B, out);
+
+        for (size_t c = 0; c < BENCH_LATENCY_CALLS; c++)
+        {
+            double start = get_time();
+            net_predict_batch(net, data->X, B, out);
+            lat[c] = get_time() - start;
+        }
+
+        qsort(lat, BENCH_LATENCY_CALLS, sizeof(double), _bench_cmp_double);
+
+        char label[64];
+        snprintf(label, sizeof(label), "net/latency/batch%zu", B);
+
+        bench_result_t* r = _bench_result(label);
+
+        _bench_metric(r, "p50_us", lat[BENCH_LATENCY_CALLS / 2] * 1e6);
+        _bench_metric(r, "p99_us",
+                      lat[BENCH_LATENCY_CALLS * 99 / 100] * 1e6);
+        _bench_metric(r, "samples_per_s",
+                      B / lat[BENCH_LATENCY_CALLS / 2]);
+    }
+
+    free(out);
+    data_free(data);
+    net_free(net);
+}
+
+/**
+ * @brief Batch 128 throughput and batch 1 latencies of an inference
+ *        engine: the CSR engine if pnet is set, else the dense network
+ * 
+ * @param net Dense network
+ * @param pnet CSR engine, or NULL
+ * @param test Test set, of at least 128 samples
+ * @param r Result the metrics are added to
+ * @param throughput Batch 128 samples per second
+ * @param p50 Median batch 1 latency, in seconds
+ */
+static void _bench_prune_engine(network_t* net, pruned_net_t* pnet,
+                                dataset_t* test, bench_result_t* r,
+                                double* throughput, double* p50)
+{
+    double lat[BENCH_LATENCY_CALLS];
+    double* out = malloc(128 * MNIST_OUTPUT * sizeof(double));
+
+    double start = get_time();
+    size_t calls = 0;
+
+    while (calls < 3 || get_time() - start < min_time)
+    {
+        if (pnet)
+            pnet_predict_batch(pnet, test->X, 128, out);
+        else
+            net_predict_batch(net, test->X, 128, out);
+
+        calls++;
+    }
+
+    double t = (get_time() - start) / calls;
+
+    for (size_t c = 0; c < BENCH_LATENCY_CALLS; c++)
+    {
+        double s = get_time();
+
+        if (pnet)
+            pnet_predict_batch(pnet, test->X + c % test->n, 1, out);
+        else
+            net_predict_batch(net, test->X + c % test->n, 1, out);
+
+        lat[c] = get_time() - s;
+    }
+
+    qsort(lat, BENCH_LATENCY_CALLS, sizeof(double), _bench_cmp_double);
+
+    *throughput = 128 / t;
+    *p50 = lat[BENCH_LATENCY_CALLS / 2];
+
+    _bench_metric(r, "batch128_samples_per_s", *throughput);
+    _bench_metric(r, "batch1_p50_us", *p50 * 1e6);
+    _bench_metric(r, "batch1_p99_us",
+                  lat[BENCH_LATENCY_CALLS * 99 / 100] * 1e6);
+
+    free(out);
+}
+
+/**
+ * @brief Magnitude pruning: train a network on a learnable dataset and
+ *        measure the unpruned network with the dense engine, then prune
+ *        it to increasing sparsities with a short fine-tune, and compare
+ *        the accuracy and speed of the CSR engine with that baseline
+ */
+static void _bench_pruning(void)
+{
+    double sparsities[] = { 0.5f, 0.8f, 0.9f };
+
+    network_t* net = _bench_network(32);
+    dataset_t* train = _bench_templates(4096);
+    dataset_t* test = _bench_templates(1024);
+
+    train_config_t config = net_config_default(2);
+    config.verbose = 0;
+
+    net_fit(net, train, &config);
+
+    // Baseline: the unpruned network on the dense engine
+    double dense_acc = net_accuracy(net, test);
+    double dense_tput, dense_p50;
+    bench_result_t* r = _bench_result("prune/dense");
+
+    _bench_metric(r, "accuracy", dense_acc);
+    _bench_prune_engine(net, NULL, test, r, &dense_tput, &dense_p50);
+
+    config.epochs = 1;
+
+    for (size_t i = 0; i < sizeof(sparsities) / sizeof(double); i++)
+    {
+        char label[64];
+        snprintf(label, sizeof(label), "prune/sparsity%.0f",
+                 sparsities[i] * 100);
+
+        net_prune(net, sparsities[i]);
+        net_fit(net, train, &config);
+
+        pruned_net_t* pnet = pnet_init(net, 128);
+        double acc = pnet_accuracy(pnet, test);
+        double tput, p50;
+
+        r = _bench_result(label);
+        _bench_metric(r, "sparsity", pnet_sparsity(pnet));
+        _bench_metric(r, "accuracy", acc);
+        _bench_metric(r, "dense_accuracy", dense_acc);
+        _bench_prune_engine(net, pnet, test, r, &tput, &p50);
+        _bench_metric(r, "batch128_speedup", tput / dense_tput);
+        _bench_metric(r, "batch1_speedup", dense_p50 / p50);
+
+        pnet_free(pnet);
+    }
+
+    data_free(test);
+    data_free(train);
+    net_free(net);
+}
+
+/**
+ * @brief Data parallel epochs over 1, 2, 4... workers up to the number of
+ *        CPUs, for every placement of the weights the workers read, then
+ *        over as many forked processes (launch included)
+ */
+static void _bench_parallel(void)
+{
+    const char* placements[] = { "replicated", "interleaved", "shared" };
+    const topology_t* topo = topo_get();
+    size_t n = 8192;
+    size_t B = 256;
+    dataset_t* data = _bench_dataset(n);
+    double base = 0.f;
+
+    for (size_t threads = 1; threads == 1 || threads <= topo->n_cpus;
+         threads *= 2)
+    {
+        for (size_t p = 0; p < 3; p++)
+        {
+            if (threads == 1 && p > 0)
+                break;
+
+            network_t* net = _bench_network(B);
+            train_config_t config = net_config_default(1);
+            config.verbose = 0;
+            config.n_threads = threads;
+            config.weights = p;
+
+            double start = get_time();
+            size_t epochs = 0;
+
+            while (epochs < 2 || get_time() - start < min_time)
+            {
+                net_fit(net, data, &config);
+                epochs++;
+            }
+
+            double t = (get_time() - start) / epochs;
+
+            if (threads == 1)
+                base = t;
+
+            char name[64];
+            snprintf(name, sizeof(name), "parallel/epoch/threads%zu/%s",
+                     threads, threads == 1 ? "serial" : placements[p]);
+
+            bench_result_t* r = _bench_result(name);
+            _bench_metric(r, "time_s", t);
+            _bench_metric(r, "samples_per_s", n / t);
+            _bench_metric(r, "speedup", base / t);
+            _bench_metric(r, "nodes", topo->n_nodes);
+
+            net_free(net);
+        }
+    }
+
+    for (size_t world = 1; world == 1 || world <= topo->n_cpus; world *= 2)
+    {
+        size_t epochs = 2;
+        net_args_t args = {
+            .net = _bench_network(B),
+            .data = data,
+            .config = net_config_default(epochs),
+        };
+
+        args.config.verbose = 0;
+
+        double start = get_time();
+
+        if (dist_launch(world, net_dist_size(args.net), _bench_run_rank,
+                        &args) != 0)
+            errx(-1, "BENCH::ERROR::PARALLEL: A rank failed");
+
+        double t = (get_time() - start) / epochs;
+
+        char name[64];
+        snprintf(name, sizeof(name), "parallel/epoch/procs%zu", world);
+
+        bench_result_t* r = _bench_result(name);
+        _bench_metric(r, "time_s", t);
+        _bench_metric(r, "samples_per_s", n / t);
+        _bench_metric(r, "speedup", base / t);
+        _bench_metric(r, "nodes", topo->n_nodes);
+
+        net_free(args.net);
+    }
+
+    data_free(data);
+}
+
+/**
+ * @brief Pipelined epochs of a deep, narrow network over 1, 2, 4...
+ *        stages up to the number of CPUs, 8 micro-batches per step
+ */
+static void _bench_pipeline(void)
+{
+    const topology_t* topo = topo_get();
+    size_t L = 16;
+    size_t n = 4096;
+    size_t B = 32;
+    dataset_t* data = _bench_dataset(n);
+    double base = 0.f;
+
+    for (size_t stages = 1; stages == 1
+         || (stages <= topo->n_cpus && stages <= L); stages *= 2)
+    {
+        network_t* net = net_init(L, MNIST_INPUT, 128, MNIST_OUTPUT, B,
+                                  0.01f);
+        train_config_t config = net_config_default(1);
+        config.verbose = 0;
+        config.accum_steps = 8;
+        config.n_stages = stages;
+
+        for (size_t l = 0; l + 1 < L; l++)
+            net_set_activation(net, l, ACT_RELU);
+
+        double start = get_time();
+        size_t epochs = 0;
+
+        while (epochs < 2 || get_time() - start < min_time)
+        {
+            net_fit(net, data, &config);
+            epochs++;
+        }
+
+        double t = (get_time() - start) / epochs;
+
+        if (stages == 1)
+            base = t;
+
+        char name[64];
+        snprintf(name, sizeof(name), "pipeline/epoch/layers%zu/stages%zu",
+                 L, stages);
+
+        bench_result_t* r = _bench_result(name);
+        _bench_metric(r, "time_s", t);
+        _bench_metric(r, "samples_per_s", n / t);
+        _bench_metric(r, "speedup", base / t);
+
+        net_free(net);
+    }
+
+    data_free(data);
+}
+
+/**
+ * @brief Gradient checkpointing of a deep network: epoch time against the
+ *        planned activation arena, keeping every activation, then one
+ *        layer in 2, 4 and 8
+ */
+static void _bench_checkpoint(void)
+{
+    size_t every[] = { 0, 2, 4, 8 };
+    size_t L = 16;
+    size_t n = 1024;
+    size_t B = 128;
+    dataset_t* data = _bench_dataset(n);
+    double base = 0.f;
+    double base_arena = 0.f;
+
+    for (size_t i = 0; i < sizeof(every) / sizeof(size_t); i++)
+    {
+        network_t* net = net_init(L, MNIST_INPUT, 256, MNIST_OUTPUT, B,
+                                  0.01f);
+        train_config_t config = net_config_default(1);
+        config.verbose = 0;
+
+        for (size_t l = 0; l + 1 < L; l++)
+            net_set_activation(net, l, ACT_RELU);
+
+        net_set_checkpoint(net, every[i]);
+
+        double start = get_time();
+        size_t epochs = 0;
+
+        while (epochs < 2 || get_time() - start < min_time)
+        {
+            net_fit(net, data, &config);
+            epochs++;
+        }
+
+        double t = (get_time() - start) / epochs;
+        double arena = net->graph->arena_size * sizeof(double) / 1024.f;
+
+        if (i == 0)
+        {
+            base = t;
+            base_arena = arena;
+        }
+
+        char name[64];
+        snprintf(name, sizeof(name), "checkpoint/epoch/layers%zu/every%zu",
+                 L, every[i]);
+
+        bench_result_t* r = _bench_result(name);
+        _bench_metric(r, "time_s", t);
+        _bench_metric(r, "samples_per_s", n / t);
+        _bench_metric(r, "speedup", base / t);
+        _bench_metric(r, "arena_kib", arena);
+        _bench_metric(r, "memory_ratio", arena / base_arena);
+
+        net_free(net);
+    }
+
+    data_free(data);
+}
+
+/**
+ * @brief Training epochs publishing a snapshot to a background validation
+ *        thread every 10 steps, and the cost of a single publication,
+ *        which is all the training thread waits for
+ */
+static void _bench_monitor(void)
+{
+    size_t n = 8192;
+    size_t B = 32;
+    network_t* net = _bench_network(B);
+    dataset_t* data = _bench_dataset(n);
+    dataset_t* val = _bench_dataset(1024);
+    monitor_t* mon = mon_init(net, val, 10, NULL);
+
+    train_config_t config = net_config_default(1);
+    config.verbose = 0;
+    config.monitor = mon;
+
+    double start = get_time();
+    size_t epochs = 0;
+
+    while (epochs < 2 || get_time() - start < min_time)
+    {
+        net_fit(net, data, &config);
+        epochs++;
+    }
+
+    double t = (get_time() - start) / epochs;
+
+    mon_wait(mon);
+
+    bench_result_t* r = _bench_result("monitor/epoch/8192x784/every10");
+    _bench_metric(r, "time_s", t);
+    _bench_metric(r, "samples_per_s", n / t);
+    _bench_metric(r, "published", mon->published);
+    _bench_metric(r, "dropped", mon->dropped);
+
+    size_t calls = 0;
+    start = get_time();
+
+    while (calls < 16 || get_time() - start < min_time / 4)
+    {
+        mon_publish(mon, net, calls);
+        calls++;
+    }
+
+    r = _bench_result("monitor/publish/784x100x10");
+    _bench_metric(r, "time_us", (get_time() - start) / calls * 1e6);
+
+    mon_free(mon);
+    data_free(val);
+    data_free(data);
+    net_free(net);
+}
+
+/**
+ * @brief Serving while training: epochs publishing a version after every
+ *        step while BENCH_LIVE_READERS threads predict one sample at a
+ *        time on the latest version, against epochs without readers.
+ *        Reports the trainer's speedup (below 1 when readers share its
+ *        CPUs), reader latencies, the buffers the versions needed and the
+ *        cost of a publication.
+ */
+static void _bench_live(void)
+{
+    size_t n = 8192;
+    size_t B = 32;
+    network_t* net = _bench_network(B);
+    dataset_t* data = _bench_dataset(n);
+    dataset_t* queries = _bench_dataset(128);
+
+    train_config_t config = net_config_default(1);
+    config.verbose = 0;
+
+    net_args_t args = { .net = net, .data = data, .config = config };
+    double base = _bench_time(_bench_run_fit, &args);
+
+    live_t* live = live_init(net, 1, BENCH_LIVE_READERS, 1);
+    live_args_t readers[BENCH_LIVE_READERS];
+    pthread_t threads[BENCH_LIVE_READERS];
+    int stop = 0;
+
+    for (size_t i = 0; i < BENCH_LIVE_READERS; i++)
+    {
+        readers[i] = (live_args_t) {
+            .live = live, .data = queries, .stop = &stop
+        };
+        pthread_create(&threads[i], NULL, _bench_run_reader, &readers[i]);
+    }
+
+    config.live = live;
+
+    double start = get_time();
+    size_t epochs = 0;
+
+    while (epochs < 2 || get_time() - start < min_time)
+    {
+        net_fit(net, data, &config);
+        epochs++;
+    }
+
+    double elapsed = get_time() - start;
+    double t = elapsed / epochs;
+
+    __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+
+    double lat[BENCH_LIVE_READERS * BENCH_LATENCY_CALLS];
+    size_t n_lat = 0;
+    size_t calls = 0;
+
+    for (size_t i = 0; i < BENCH_LIVE_READERS; i++)
+    {
+        pthread_join(threads[i], NULL);
+
+        size_t kept = readers[i].calls < BENCH_LATENCY_CALLS
+                    ? readers[i].calls : BENCH_LATENCY_CALLS;
+
+        memcpy(lat + n_lat, readers[i].lat, kept * sizeof(double));
+        n_lat += kept;
+        calls += readers[i].calls;
+    }
+
+    bench_result_t* r = _bench_result("live/epoch/8192x784/every1");
+    _bench_metric(r, "time_s", t);
+    _bench_metric(r, "samples_per_s", n / t);
+    _bench_metric(r, "speedup", base / t);
+    _bench_metric(r, "published", live->published);
+    _bench_metric(r, "buffers", live->n_buffers);
+
+    if (n_lat > 0)
+    {
+        qsort(lat, n_lat, sizeof(double), _bench_cmp_double);
+
+        r = _bench_result("live/read/batch1/readers2");
+        _bench_metric(r, "p50_us", lat[n_lat / 2] * 1e6);
+        _bench_metric(r, "p99_us", lat[n_lat * 99 / 100] * 1e6);
+        _bench_metric(r, "reads_per_s", calls / elapsed);
+    }
+
+    calls = 0;
+    start = get_time();
+
+    while (calls < 16 || get_time() - start < min_time / 4)
+    {
+        live_publish(live, net);
+        calls++;
+    }
+
+    r = _bench_result("live/publish/784x100x10");
+    _bench_metric(r, "time_us", (get_time() - start) / calls * 1e6);
+
+    live_free(live);
+    data_free(queries);
+    data_free(data);
+    net_free(net);
+}
+
+/**
+ * @brief Convolutional network on MNIST shapes: 1x28x28 -> conv 8@5x5 ->
+ *        max pool 2 -> conv 16@5x5 -> max pool 2 -> 100 -> 10. Times the
+ *        im2col / col2im of the second convolution, batched inference and
+ *        a training step.
+ */
+static void _bench_conv(void)
+{
+    conv_t conv[] = {
+        conv_2d(8, 5, 1, 2),
+        conv_pool(CONV_MAX_POOL, 2, 2),
+        conv_2d(16, 5, 1, 2),
+        conv_pool(CONV_MAX_POOL, 2, 2),
+    };
+    size_t n_conv = sizeof(conv) / sizeof(conv_t);
+    size_t B = 32;
+
+    conv_shape(conv, n_conv, 1, 28, 28);
+
+    // Windows of the second convolution
+    kernel_args_t k = { .kernel = K_IM2COL, .conv = &conv[2] };
+    k.m1 = m_init(B, conv_in_size(&conv[2]));
+    k.dst = m_init(B * conv_positions(&conv[2]), conv_window(&conv[2]));
+    m_fill(k.m1, normalized_rand);
+
+    double bytes = (k.m1->size + k.dst->size) * sizeof(double);
+    double t = _bench_time(_bench_run_kernel, &k);
+    bench_result_t* r = _bench_result("conv/im2col/batch32/8x14x14k5");
+
+    _bench_metric(r, "time_us", t * 1e6);
+    _bench_metric(r, "gbps", bytes / t * 1e-9);
+
+    k.kernel = K_COL2IM;
+    t = _bench_time(_bench_run_kernel, &k);
+    r = _bench_result("conv/col2im/batch32/8x14x14k5");
+
+    _bench_metric(r, "time_us", t * 1e6);
+    _bench_metric(r, "gbps", bytes / t * 1e-9);
+
+    m_free(k.m1);
+    m_free(k.dst);
+
+    // Forward FLOPs of a sample: one GEMM per convolution, then dense
+    double flops = 2.f * (conv_out_size(&conv[3]) * MNIST_HIDDEN
+                          + MNIST_HIDDEN * MNIST_OUTPUT);
+
+    for (size_t i = 0; i < n_conv; i++)
+    {
+        if (conv[i].type == CONV_2D)
+            flops += 2.f * conv_positions(&conv[i]) * conv_window(&conv[i])
+                   * conv[i].out_c;
+    }
+
+    size_t batches[] = { 128, 32 };
+
+    for (size_t i = 0; i < sizeof(batches) / sizeof(size_t); i++)
+    {
+        size_t n = batches[i];
+        network_t* net = net_init_conv(1, 28, 28, conv, n_conv, 2,
+                                       MNIST_HIDDEN, MNIST_OUTPUT, n, 0.01f);
+        dataset_t* data = _bench_dataset(n);
+        double* out = malloc(n * MNIST_OUTPUT * sizeof(double));
+        char label[64];
+
+        net_set_activation(net, 0, ACT_RELU);
+        net_set_activation(net, 1, ACT_SOFTMAX);
+
+        net_args_t a = { .net = net, .data = data, .out = out, .n = n };
+        a.config = net_config_default(1);
+        a.config.verbose = 0;
+
+        if (i == 0)
+        {
+            snprintf(label, sizeof(label), "conv/forward/batch%zu", n);
+            t = _bench_time(_bench_run_predict, &a);
+        }
+
+        else
+        {
+            // Backward costs about twice the forward pass
+            snprintf(label, sizeof(label), "conv/train_step/batch%zu", n);
+            t = _bench_time(_bench_run_fit, &a);
+        }
+
+        r = _bench_result(label);
+        _bench_metric(r, "time_us", t * 1e6);
+        _bench_metric(r, "samples_per_s", n / t);
+        _bench_metric(r, "gflops", (i == 0 ? 1.f : 3.f) * flops * n / t
+                                   * 1e-9);
+
+        free(out);
+        data_free(data);
+        net_free(net);
+    }
+}
+
+/**
+ * @brief GEMMs of the MNIST network and of the convolution benchmark on
+ *        every compiled in backend. Each shape is first cross-checked
+ *        against the reference backend, a mismatch fails the suite.
+ */
+static void _bench_backends(void)
+{
+    struct
+    {
+        kernel_t    kernel;
+        const char* name;
+        size_t      M, K, N;
+    } shapes[] = {
+        { K_MUL,    "mul",      32, MNIST_INPUT, MNIST_HIDDEN },
+        { K_MUL_TN, "mul_tn",   MNIST_INPUT, 32, MNIST_HIDDEN },
+        { K_MUL_NT, "mul_nt",   32, MNIST_HIDDEN, MNIST_INPUT },
+        { K_MUL,    "mul",      256, 256, 256 },
+        { K_MUL,    "mul",      32 * 14 * 14, 200, 16 },    // conv 2
+    };
+    const char* current = backend_get()->name;
+
+    for (size_t i = 0; i < backend_count(); i++)
+    {
+        const backend_t* backend = backend_at(i);
+
+        backend_set(backend->name);
+
+        for (size_t s = 0; s < sizeof(shapes) / sizeof(shapes[0]); s++)
+        {
+            size_t M = shapes[s].M;
+            size_t K = shapes[s].K;
+            size_t N = shapes[s].N;
+            double error = backend_check(backend, M, K, N);
+
+            if (error > BACKEND_TOLERANCE)
+            {
+                errx(-1, "BENCH::ERROR::BACKEND: %s differs from reference "
+                     "by %g at %zux%zux%zu", backend->name, error, M, K, N);
+            }
+
+            kernel_args_t k = { .kernel = shapes[s].kernel };
+            k.m1 = k.kernel == K_MUL_TN ? m_init(K, M) : m_init(M, K);
+            k.m2 = k.kernel == K_MUL_NT ? m_init(N, K) : m_init(K, N);
+            k.dst = m_init(M, N);
+
+            m_fill(k.m1, normalized_rand);
+            m_fill(k.m2, normalized_rand);
+
+            char label[64];
+            snprintf(label, sizeof(label), "backend/%s/%s/%zux%zux%zu",
+                     backend->name, shapes[s].name, M, K, N);
+
+            double t = _bench_time(_bench_run_kernel, &k);
+            bench_result_t* r = _bench_result(label);
+
+            _bench_metric(r, "time_us", t * 1e6);
+            _bench_metric(r, "gflops", 2.f * M * N * K / t * 1e-9);
+            _bench_metric(r, "max_rel_err", error);
+
+            m_free(k.m1);
+            m_free(k.m2);
+            m_free(k.dst);
+        }
+    }
+
+    backend_set(current);
+}
+
+/**
+ * @brief Online learning on a stream of learnable samples, one step per
+ *        update: 8 new samples with the default config, and 4 new plus 4
+ *        replayed from a reservoir. Update latency percentiles, checked
+ *        against BENCH_ONLINE_P99_US, and test accuracy after the stream.
+ */
+static void _bench_online(void)
+{
+    size_t batches[] = { 8, 4 };
+    size_t replays[] = { 0, 4 };
+    size_t n = 4096;
+    dataset_t* stream = _bench_templates(n);
+    dataset_t* test = _bench_templates(1024);
+
+    for (size_t i = 0; i < sizeof(replays) / sizeof(size_t); i++)
+    {
+        network_t* net = _bench_network(32);
+        online_config_t config = online_config_default();
+        size_t B = batches[i];
+
+        if (replays[i])
+        {
+            config.replay = replays[i];
+            config.capacity = n;
+        }
+
+        online_t* online = online_init(net, &config);
+
+        for (size_t p = 0; p + B <= n; p += B)
+            online_update(online, stream->X + p, stream->y + p, B);
+
+        char label[64];
+        snprintf(label, sizeof(label), "online/update/batch%zu/replay%zu",
+                 B, replays[i]);
+
+        bench_result_t* r = _bench_result(label);
+        _bench_metric(r, "p50_us", online_latency(online, 0.5f) * 1e6);
+        _bench_metric(r, "p99_us", online_latency(online, 0.99f) * 1e6);
+        _bench_metric(r, "samples_per_s", n / online->total_time);
+        _bench_metric(r, "accuracy", net_accuracy(net, test));
+
+        online_free(online);
+        net_free(net);
+    }
+
+    data_free(test);
+    data_free(stream);
+}
+
+/**
+ * @param  values Trial values
+ * @param  n Number of values
+ * @return double Median of values
+ */
+static double _bench_median(const double* values, size_t n)
+{
+    double sorted[BENCH_MAX_TRIALS];
+
+    memcpy(sorted, values, n * sizeof(double));
+    qsort(sorted, n, sizeof(double), _bench_cmp_double);
+
+    return n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+}
+
+/**
+ * @param  values Trial values
+ * @param  n Number of values
+ * @return double Median absolute deviation of values from their median
+ */
+static double _bench_mad(const double* values, size_t n)
+{
+    double median = _bench_median(values, n);
+    double dev[BENCH_MAX_TRIALS];
+
+    for (size_t i = 0; i < n; i++)
+        dev[i] = fabs(values[i] - median);
+
+    return _bench_median(dev, n);
+}
+
+/**
+ * @brief Write all results as JSON: the median of each metric over the
+ *        trials, followed by its MAD as <key>_mad with several trials
+ * 
+ * @param fp Output stream
+ */
+static void _bench_emit_json(FILE* fp)
+{
+    fprintf(fp, "{\n  \"suite\": \"deepsea-bench\",\n");
+    fprintf(fp, "  \"timestamp\": %ld,\n", (long) time(NULL));
+    fprintf(fp, "  \"trials\": %zu,\n", n_trials);
+    fprintf(fp, "  \"results\": [\n");
+
+    for (size_t i = 0; i < n_results; i++)
+    {
+        bench_result_t* r = &results[i];
+
+        fprintf(fp, "    { \"name\": \"%s\"", r->name);
+
+        for (size_t m = 0; m < r->n_metrics; m++)
+        {
+            fprintf(fp, ", \"%s\": %.6g", r->keys[m],
+                    _bench_median(r->values[m], r->n_values[m]));
+
+            if (n_trials > 1)
+                fprintf(fp, ", \"%s_mad\": %.6g", r->keys[m],
+                        _bench_mad(r->values[m], r->n_values[m]));
+        }
+
+        fprintf(fp, " }%s\n", i + 1 < n_results ? "," : "");
+    }
+
+    fprintf(fp, "  ]\n}\n");
+}
+
+/* ==== BASELINES ==== */
+
+
+/**
+ * @brief  Read a JSON string, without escapes
+ * 
+ * @param  p Cursor, on the opening quote, moved past the closing one
+ * @param  dst Destination buffer
+ * @param  size Size of dst
+ * @return int 1 on success, 0 if no string could be read
+ */
+static int _bench_json_string(const char** p, char* dst, size_t size)
+{
+    if (**p != '"')
+        return 0;
+
+    const char* end = strchr(*p + 1, '"');
+
+    if (end == NULL || (size_t) (end - *p - 1) >= size)
+        return 0;
+
+    memcpy(dst, *p + 1, end - *p - 1);
+    dst[end - *p - 1] = '\0';
+    *p = end + 1;
+
+    return 1;
+}
+
+/**
+ * @brief Load the results array of a JSON file written by the suite:
+ *        objects of a "name" string and numeric metrics
+ * 
+ * @param path Baseline file
+ */
+static void _bench_load_baseline(const char* path)
+{
+    FILE* fp = fopen(path, "r");
+
+    if (fp == NULL)
+        err(-1, "BENCH::ERROR::BASELINE: Could not open %s", path);
+
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    rewind(fp);
+
+    char* json = malloc(size + 1);
+    json[fread(json, 1, size, fp)] = '\0';
+    fclose(fp);
+
+    const char* p = strstr(json, "\"results\"");
+    p = p ? strchr(p, '[') : NULL;
+
+    if (p == NULL)
+        errx(-1, "BENCH::ERROR::BASELINE: No results in %s", path);
+
+    p++;
+
+    while ((p = strpbrk(p, "{]")) != NULL && *p == '{')
+    {
+        if (n_baseline == BENCH_MAX_RESULTS)
+            errx(-1, "BENCH::ERROR::BASELINE: Too many results in %s", path);
+
+        bench_baseline_t* b = &baseline[n_baseline++];
+        char key[BENCH_KEY_SIZE];
+
+        b->name[0] = '\0';
+        b->n_metrics = 0;
+        p++;
+
+        // "key": value pairs, up to the closing brace
+        while (*(p += strspn(p, " \t\r\n,")) == '"')
+        {
+            if (!_bench_json_string(&p, key, sizeof(key)))
+                break;
+
+            p += strspn(p, " \t\r\n:");
+
+            if (strcmp(key, "name") == 0)
+            {
+                if (!_bench_json_string(&p, b->name, sizeof(b->name)))
+                    break;
+            }
+
+            else
+            {
+                char* end;
+                double value = strtod(p, &end);
+
+                if (end == p || b->n_metrics == 2 * BENCH_MAX_METRICS)
+                    break;
+
+                snprintf(b->keys[b->n_metrics], BENCH_KEY_SIZE, "%s", key);
+                b->values[b->n_metrics++] = value;
+                p = end;
+            }
+        }
+
+        if (*p != '}')
+        {
+            errx(-1, "BENCH::ERROR::BASELINE: "
+                     "Malformed result %zu in %s", n_baseline, path);
+        }
+    }
+
+    free(json);
+}
+
+/**
+ * @param  name Result name
+ * @param  key Metric name
+ * @return const double* Baseline value of the metric, NULL if absent
+ */
+static const double* _bench_baseline(const char* name, const char* key)
+{
+    for (size_t i = 0; i < n_baseline; i++)
+    {
+        if (strcmp(baseline[i].name, name) != 0)
+            continue;
+
+        for (size_t m = 0; m < baseline[i].n_metrics; m++)
+        {
+            if (strcmp(baseline[i].keys[m], key) == 0)
+                return &baseline[i].values[m];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @param  key Metric name
+ * @return int 1 if higher is better (throughputs, accuracies), -1 if
+ *         lower is better (times, latencies, memory), 0 if not compared
+ */
+static int _bench_direction(const char* key)
+{
+    size_t len = strlen(key);
+    const char* higher[] = { "_per_s", "gflops", "gbps", "speedup",
+                             "accuracy" };
+    const char* lower[] = { "_us", "_s", "_kib" };
+
+    for (size_t i = 0; i < sizeof(higher) / sizeof(char*); i++)
+    {
+        size_t n = strlen(higher[i]);
+
+        if (len >= n && strcmp(key + len - n, higher[i]) == 0)
+            return 1;
+    }
+
+    for (size_t i = 0; i < sizeof(lower) / sizeof(char*); i++)
+    {
+        size_t n = strlen(lower[i]);
+
+        if (len >= n && strcmp(key + len - n, lower[i]) == 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief  Compare the medians of this run with the baseline. A metric
+ *         regresses when it is worse by more than threshold (relative)
+ *         and by more than BENCH_MAD_SCALE times the larger MAD of the
+ *         two runs. Regressions and improvements are reported on stderr.
+ * 
+ * @param  threshold Relative change tolerated, e.g. 0.1 for 10%
+ * @return size_t Number of regressed metrics
+ */
+static size_t _bench_compare(double threshold)
+{
+    size_t compared = 0;
+    size_t regressed = 0;
+    size_t improved = 0;
+
+    for (size_t i = 0; i < n_results; i++)
+    {
+        bench_result_t* r = &results[i];
+
+        for (size_t m = 0; m < r->n_metrics; m++)
+        {
+            int direction = _bench_direction(r->keys[m]);
+            const double* base = _bench_baseline(r->name, r->keys[m]);
+
+            if (direction == 0 || base == NULL || *base == 0.f)
+                continue;
+
+            char mad_key[BENCH_KEY_SIZE + 4];
+            snprintf(mad_key, sizeof(mad_key), "%s_mad", r->keys[m]);
+
+            const double* base_mad = _bench_baseline(r->name, mad_key);
+            double value = _bench_median(r->values[m], r->n_values[m]);
+            double mad = _bench_mad(r->values[m], r->n_values[m]);
+            double change = (value - *base) / *base;
+            double worse = -direction * (value - *base);
+
+            if (base_mad && *base_mad > mad)
+                mad = *base_mad;
+
+            compared++;
+
+            if (worse > threshold * fabs(*base)
+                && worse > BENCH_MAD_SCALE * mad)
+            {
+                fprintf(stderr, "[REGRESSION] %s %s: %.6g -> %.6g "
+                        "(%+.1f%%)\n", r->name, r->keys[m], *base, value,
+                        change * 100);
+                regressed++;
+            }
+
+            else if (-worse > threshold * fabs(*base)
+                     && -worse > BENCH_MAD_SCALE * mad)
+            {
+                fprintf(stderr, "[IMPROVEMENT] %s %s: %.6g -> %.6g "
+                        "(%+.1f%%)\n", r->name, r->keys[m], *base, value,
+                        change * 100);
+                improved++;
+            }
+        }
+    }
+
+    fprintf(stderr, "[BENCH] %zu metrics compared to baseline: "
+            "%zu regressed, %zu improved (threshold %.1f%%)\n",
+            compared, regressed, improved, threshold * 100);
+
+    return regressed;
+}
+
+/**
+ * @brief  Check the absolute budgets, whatever the baseline: the median
+ *         p99 latency of every online benchmark must stay under
+ *         BENCH_ONLINE_P99_US
+ * 
+ * @return size_t Number of metrics over budget
+ */
+static size_t _bench_budgets(void)
+{
+    size_t over = 0;
+
+    for (size_t i = 0; i < n_results; i++)
+    {
+        bench_result_t* r = &results[i];
+
+        if (strncmp(r->name, "online/", 7) != 0)
+            continue;
+
+        for (size_t m = 0; m < r->n_metrics; m++)
+        {
+            if (strcmp(r->keys[m], "p99_us") != 0)
+                continue;
+
+            double value = _bench_median(r->values[m], r->n_values[m]);
+
+            if (value >= BENCH_ONLINE_P99_US)
+            {
+                fprintf(stderr, "[OVER BUDGET] %s p99_us: %.6g >= %.6g\n",
+                        r->name, value, BENCH_ONLINE_P99_US);
+                over++;
+            }
+        }
+    }
+
+    return over;
+}
@@ -0,0 +1,265 @@
+/**
+ * @file    backend.c
+ * @author  Philippe Bouchet (philippe.bouchet@epita.fr)
+ * @brief   Matrix backend registry, selection and cross-checking.
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "backend.h"
+
+#include <err.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Build-time default, make BACKEND=<name>
+#ifndef DEEPSEA_BACKEND
+#ifdef DEEPSEA_CBLAS
+#define DEEPSEA_BACKEND "cblas"
+#else
+#define DEEPSEA_BACKEND "native"
+#endif
+#endif
+
+static const backend_t* backend_current;
+static pthread_once_t   backend_once = PTHREAD_ONCE_INIT;
+
+/* Internal API forward declaration */
+
+static void     _backend_select(void);
+static void     _backend_random(matrix_t* m, unsigned long* state);
+static double   _backend_error(matrix_t* m, matrix_t* ref);
+
+
+/* ==== BACKEND PUBLIC API ==== */
+
+
+/**
+ * @brief  Backend the m_* kernels run on. Chosen on first use from the
+ *         DEEPSEA_BACKEND environment variable, else the build default.
+ *
+ * @return const backend_t* Current backend
+ */
+const backend_t* backend_get(void)
+{
+    pthread_once(&backend_once, _backend_select);
+
+    return backend_current;
+}
+
+/**
+ * @brief Switches every m_* kernel to another backend. Not synchronized
+ *        with running kernels: call it before training or inference.
+ *
+ * @param name Backend name, as listed by backend_at
+ */
+void backend_set(const char* name)
+{
+    const backend_t* backend = backend_find(name);
+
+    if (backend == NULL)
+    {
+        errx(BACKEND_UNKNOWN,
+            "BACKEND::ERROR::SET: "
+            "Unknown or unavailable backend '%s'", name);
+    }
+
+    pthread_once(&backend_once, _backend_select);
+    backend_current = backend;
+}
+
+/**
+ * @param  name Backend name
+ * @return const backend_t* Backend, NULL if unknown or not compiled in
+ */
+const backend_t* backend_find(const char* name)
+{
+    for (size_t i = 0; i < backend_count(); i++)
+    {
+        if (strcmp(backend_at(i)->name, name) == 0)
+            return backend_at(i);
+    }
+
+    return NULL;
+}
+
+/**
+ * @return size_t Number of backends compiled in
+ */
+size_t backend_count(void)
+{
+    return backend_cblas() ? 3 : 2;
+}
+
+/**
+ * @param  i Backend index, reference first
+ * @return const backend_t* i-th compiled in backend
+ */
+const backend_t* backend_at(size_t i)
+{
+    switch (i)
+    {
+        case 0:
+            return backend_reference();
+        case 1:
+            return backend_native();
+        default:
+            return backend_cblas();
+    }
+}
+
+/**
+ * @brief  Cross-checks a backend against the reference on random
+ *         operands: the three GEMMs at M x K x N, and the elementwise
+ *         kernels at M x N.
+ *
+ * @param  backend Backend to check
+ * @param  M Rows of the products
+ * @param  K Inner dimension of the products
+ * @param  N Columns of the products
+ * @return double Largest error, relative to the largest reference value
+ */
+double backend_check(const backend_t* backend, size_t M, size_t K, size_t N)
+{
+    const backend_t* ref = backend_reference();
+    unsigned long state = 42;
+
+    matrix_t* a = m_init(M, K);
+    matrix_t* at = m_init(K, M);
+    matrix_t* b = m_init(K, N);
+    matrix_t* bt = m_init(N, K);
+    matrix_t* c = m_init(M, N);
+    matrix_t* row = m_init(1, N);
+    matrix_t* out = m_init(M, N);
+    matrix_t* expected = m_init(M, N);
+    matrix_t* sum = m_init(1, N);
+    matrix_t* sum_ref = m_init(1, N);
+
+    _backend_random(a, &state);
+    _backend_random(at, &state);
+    _backend_random(b, &state);
+    _backend_random(bt, &state);
+    _backend_random(c, &state);
+    _backend_random(row, &state);
+
+    double error = 0.f;
+
+    backend->mul(a, b, out);
+    ref->mul(a, b, expected);
+    error = fmax(error, _backend_error(out, expected));
+
+    backend->mul_tn(at, b, out);
+    ref->mul_tn(at, b, expected);
+    error = fmax(error, _backend_error(out, expected));
+
+    backend->mul_nt(a, bt, out);
+    ref->mul_nt(a, bt, expected);
+    error = fmax(error, _backend_error(out, expected));
+
+    backend->mul(a, b, out);
+    backend->add(out, c, out);
+    ref->mul(a, b, expected);
+    ref->add(expected, c, expected);
+    error = fmax(error, _backend_error(out, expected));
+
+    backend->sub(out, c, out);
+    ref->sub(expected, c, expected);
+    error = fmax(error, _backend_error(out, expected));
+
+    backend->hadamard(out, c, out);
+    ref->hadamard(expected, c, expected);
+    error = fmax(error, _backend_error(out, expected));
+
+    backend->scalar_mul(out, 0.5, out);
+    ref->scalar_mul(expected, 0.5, expected);
+    backend->scalar_add(out, 1.f, out);
+    ref->scalar_add(expected, 1.f, expected);
+    error = fmax(error, _backend_error(out, expected));
+
+    backend->add_row(out, row, out);
+    ref->add_row(expected, row, expected);
+    error = fmax(error, _backend_error(out, expected));
+
+    backend->sum_rows(out, sum);
+    ref->sum_rows(expected, sum_ref);
+    error = fmax(error, _backend_error(sum, sum_ref));
+
+    m_free(a);
+    m_free(at);
+    m_free(b);
+    m_free(bt);
+    m_free(c);
+    m_free(row);
+    m_free(out);
+    m_free(expected);
+    m_free(sum);
+    m_free(sum_ref);
+
+    return error;
+}
+
+
+/* ==== BACKEND INTERNAL API ==== */
+
+
+/**
+ * @brief Picks the startup backend. An unknown DEEPSEA_BACKEND is an
+ *        error rather than a silent fallback.
+ */
+static void _backend_select(void)
+{
+    const char* name = getenv("DEEPSEA_BACKEND");
+
+    if (name == NULL || *name == '\0')
+        name = DEEPSEA_BACKEND;
+
+    backend_current = backend_find(name);
+
+    if (backend_current == NULL)
+    {
+        errx(BACKEND_UNKNOWN,
+            "BACKEND::ERROR::SELECT: "
+            "Unknown or unavailable backend '%s'", name);
+    }
+}
+
+/**
+ * @brief Fills m with values in [-1, 1), from a xorshift generator so the
+ *        check does not consume rand()
+ *
+ * @param m Matrix to fill
+ * @param state Generator state
+ */
+static void _backend_random(matrix_t* m, unsigned long* state)
+{
+    for (size_t i = 0; i < m->size; i++)
+    {
+        *state ^= *state << 13;
+        *state ^= *state >> 7;
+        *state ^= *state << 17;
+
+        m->array[i] = (double) (*state >> 11) / (double) (1UL << 52) - 1.f;
+    }
+}
+
+/**
+ * @param  m Backend result
+ * @param  ref Reference result
+ * @return double Largest difference, relative to the largest |ref|
+ */
+static double _backend_error(matrix_t* m, matrix_t* ref)
+{
+    double diff = 0.f;
+    double scale = 0.f;
+
+    for (size_t i = 0; i < m->size; i++)
+    {
+        diff = fmax(diff, fabs(m->array[i] - ref->array[i]));
+        scale = fmax(scale, fabs(ref->array[i]));
+    }
+
+    return scale > 0.f ? diff / scale : diff;
+}
@@ -0,0 +1,84 @@
+/**
+ * @file    backend.h
+ * @author  Philippe Bouchet (philippe.bouchet@epita.fr)
+ * @brief   Matrix backends. Every m_* kernel checks its operands, then
+ *          runs through the table of the current backend:
+ *
+ *          - reference: plain loops, the numerical baseline
+ *          - native: cache and register blocked GEMMs, summing in the
+ *            same order as reference (results are identical)
+ *          - cblas: GEMM / GEMV / AXPY from a CBLAS library (OpenBLAS,
+ *            BLIS), compiled in with make BLAS=1
+ *
+ *          The default is cblas when compiled in, else native; make
+ *          BACKEND=<name> changes it, and the DEEPSEA_BACKEND environment
+ *          variable or backend_set override it at runtime.
+ *          Public API functions denoted with "backend" prefix.
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef BACKEND_H
+#define BACKEND_H
+
+#define BACKEND_UNKNOWN         -1
+#define BACKEND_INVALID_BLOCKING -2
+
+#define BACKEND_TOLERANCE       1e-9    // Relative error against reference
+
+#include "matrix.h"
+
+typedef struct
+{
+    const char* name;
+
+    // Operands are checked by the m_* wrappers
+    void    (*mul)(matrix_t* m1, matrix_t* m2, matrix_t* dst);
+    void    (*mul_tn)(matrix_t* m1, matrix_t* m2, matrix_t* dst);
+    void    (*mul_nt)(matrix_t* m1, matrix_t* m2, matrix_t* dst);
+    void    (*add)(matrix_t* m1, matrix_t* m2, matrix_t* dst);
+    void    (*sub)(matrix_t* m1, matrix_t* m2, matrix_t* dst);
+    void    (*hadamard)(matrix_t* m1, matrix_t* m2, matrix_t* dst);
+    void    (*scalar_mul)(matrix_t* m, double lambda, matrix_t* dst);
+    void    (*scalar_add)(matrix_t* m, double lambda, matrix_t* dst);
+    void    (*add_row)(matrix_t* m, matrix_t* row, matrix_t* dst);
+    void    (*sum_rows)(matrix_t* m, matrix_t* dst);
+} backend_t;
+
+typedef struct
+{
+    size_t  mc;              // Rows of a packed lhs block
+    size_t  nc;              // Columns of a packed rhs block
+    size_t  kc;              // Depth of the packed blocks
+} backend_blocking_t;
+
+const backend_t*    backend_get(void);
+void                backend_set(const char* name);
+const backend_t*    backend_find(const char* name);
+size_t              backend_count(void);
+const backend_t*    backend_at(size_t i);
+double              backend_check(const backend_t* backend, size_t M,
+                                  size_t K, size_t N);
+
+const backend_t*    backend_reference(void);
+const backend_t*    backend_native(void);
+const backend_t*    backend_cblas(void);    // NULL unless built with BLAS=1
+
+backend_blocking_t  backend_native_blocking(void);
+void                backend_native_set_blocking(backend_blocking_t blocking);
+int                 backend_native_valid(backend_blocking_t blocking);
+
+// Reference kernels, shared by the backends that do not replace them
+void    backend_ref_mul(matrix_t* m1, matrix_t* m2, matrix_t* dst);
+void    backend_ref_mul_tn(matrix_t* m1, matrix_t* m2, matrix_t* dst);
+void    backend_ref_mul_nt(matrix_t* m1, matrix_t* m2, matrix_t* dst);
+void    backend_ref_add(matrix_t* m1, matrix_t* m2, matrix_t* dst);
+void    backend_ref_sub(matrix_t* m1, matrix_t* m2, matrix_t* dst);
+void    backend_ref_hadamard(matrix_t* m1, matrix_t* m2, matrix_t* dst);
+void    backend_ref_scalar_mul(matrix_t* m, double lambda, matrix_t* dst);
+void    backend_ref_scalar_add(matrix_t* m, double lambda, matrix_t* dst);
+void    backend_ref_add_row(matrix_t* m, matrix_t* row, matrix_t* dst);
+void    backend_ref_sum_rows(matrix_t* m, matrix_t* dst);
+
+#endif // BACKEND_H
@@ -0,0 +1,212 @@
+/**
+ * @file    backend_cblas.c
+ * @author  Philippe Bouchet (philippe.bouchet@epita.fr)
+ * @brief   CBLAS matrix backend, compiled in with make BLAS=1 and linked
+ *          against BLAS_LIBS (-lopenblas by default, -lblis for BLIS).
+ *          Products run on dgemm, or dgemv when one side is a vector;
+ *          additions and scaling run on daxpy and dscal. Results differ
+ *          from the reference by rounding only, BACKEND_TOLERANCE bounds
+ *          the difference. The library's own threads multiply with the
+ *          data-parallel workers: set OPENBLAS_NUM_THREADS=1 when training
+ *          with n_threads > 1.
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "backend.h"
+
+#include <string.h>
+
+#ifdef DEEPSEA_CBLAS
+
+#include <cblas.h>
+
+/* Internal API forward declaration */
+
+static void     _cblas_mul(matrix_t* m1, matrix_t* m2, matrix_t* dst);
+static void     _cblas_mul_tn(matrix_t* m1, matrix_t* m2, matrix_t* dst);
+static void     _cblas_mul_nt(matrix_t* m1, matrix_t* m2, matrix_t* dst);
+static void     _cblas_add(matrix_t* m1, matrix_t* m2, matrix_t* dst);
+static void     _cblas_sub(matrix_t* m1, matrix_t* m2, matrix_t* dst);
+static void     _cblas_scalar_mul(matrix_t* m, double lambda, matrix_t* dst);
+
+
+static const backend_t backend_blas = {
+    .name       = "cblas",
+    .mul        = _cblas_mul,
+    .mul_tn     = _cblas_mul_tn,
+    .mul_nt     = _cblas_mul_nt,
+    .add        = _cblas_add,
+    .sub        = _cblas_sub,
+    .hadamard   = backend_ref_hadamard,
+    .scalar_mul = _cblas_scalar_mul,
+    .scalar_add = backend_ref_scalar_add,
+    .add_row    = backend_ref_add_row,
+    .sum_rows   = backend_ref_sum_rows,
+};
+
+#endif
+
+
+/* ==== BACKEND PUBLIC API ==== */
+
+
+/**
+ * @return const backend_t* CBLAS backend, NULL if not compiled in
+ */
+const backend_t* backend_cblas(void)
+{
+#ifdef DEEPSEA_CBLAS
+    return &backend_blas;
+#else
+    return NULL;
+#endif
+}
+
+
+/* ==== BACKEND INTERNAL API ==== */
+
+#ifdef DEEPSEA_CBLAS
+
+/**
+ * @brief dst = m1 * m2, dgemv for a single row or column
+ *
+ * @param m1 Left hand operation matrix
+ * @param m2 Right hand operation matrix
+ * @param dst Destination matrix to store result in
+ */
+static void _cblas_mul(matrix_t* m1, matrix_t* m2, matrix_t* dst)
+{
+    int M = m1->n_row;
+    int K = m1->n_col;
+    int N = m2->n_col;
+
+    if (M == 1)
+    {
+        // dst^T = m2^T * m1^T
+        cblas_dgemv(CblasColMajor, CblasTrans, K, N, 1.f, m2->array, K,
+                    m1->array, 1, 0.f, dst->array, 1);
+    }
+    else if (N == 1)
+    {
+        cblas_dgemv(CblasColMajor, CblasNoTrans, M, K, 1.f, m1->array, M,
+                    m2->array, 1, 0.f, dst->array, 1);
+    }
+    else
+    {
+        cblas_dgemm(CblasColMajor, CblasNoTrans, CblasNoTrans, M, N, K,
+                    1.f, m1->array, M, m2->array, K, 0.f, dst->array, M);
+    }
+}
+
+/**
+ * @brief dst = transpose(m1) * m2, dgemv for a single output row
+ *
+ * @param m1 Left hand operation matrix, transposed
+ * @param m2 Right hand operation matrix
+ * @param dst Destination matrix to store result in
+ */
+static void _cblas_mul_tn(matrix_t* m1, matrix_t* m2, matrix_t* dst)
+{
+    int M = m1->n_col;
+    int K = m1->n_row;
+    int N = m2->n_col;
+
+    if (M == 1)
+    {
+        cblas_dgemv(CblasColMajor, CblasTrans, K, N, 1.f, m2->array, K,
+                    m1->array, 1, 0.f, dst->array, 1);
+    }
+    else
+    {
+        cblas_dgemm(CblasColMajor, CblasTrans, CblasNoTrans, M, N, K,
+                    1.f, m1->array, K, m2->array, K, 0.f, dst->array, M);
+    }
+}
+
+/**
+ * @brief dst = m1 * transpose(m2), dgemv for a single output row
+ *
+ * @param m1 Left hand operation matrix
+ * @param m2 Right hand operation matrix, transposed
+ * @param dst Destination matrix to store result in
+ */
+static void _cblas_mul_nt(matrix_t* m1, matrix_t* m2, matrix_t* dst)
+{
+    int M = m1->n_row;
+    int K = m1->n_col;
+    int N = m2->n_row;
+
+    if (M == 1)
+    {
+        // dst^T = m2 * m1^T
+        cblas_dgemv(CblasColMajor, CblasNoTrans, N, K, 1.f, m2->array, N,
+                    m1->array, 1, 0.f, dst->array, 1);
+    }
+    else
+    {
+        cblas_dgemm(CblasColMajor, CblasNoTrans, CblasTrans, M, N, K,
+                    1.f, m1->array, M, m2->array, N, 0.f, dst->array, M);
+    }
+}
+
+/**
+ * @brief dst = m1 + m2 with daxpy, either operand may be dst
+ *
+ * @param m1 Left hand operation matrix
+ * @param m2 Right hand operation matrix
+ * @param dst Destination matrix to store result in
+ */
+static void _cblas_add(matrix_t* m1, matrix_t* m2, matrix_t* dst)
+{
+    if (dst->array == m2->array)
+    {
+        cblas_daxpy(m1->size, 1.f, m1->array, 1, dst->array, 1);
+        return;
+    }
+
+    if (dst->array != m1->array)
+        memcpy(dst->array, m1->array, m1->size * sizeof(double));
+
+    cblas_daxpy(m1->size, 1.f, m2->array, 1, dst->array, 1);
+}
+
+/**
+ * @brief dst = m1 - m2 with daxpy, either operand may be dst
+ *
+ * @param m1 Left hand operation matrix
+ * @param m2 Right hand operation matrix
+ * @param dst Destination matrix to store result in
+ */
+static void _cblas_sub(matrix_t* m1, matrix_t* m2, matrix_t* dst)
+{
+    if (dst->array == m2->array)
+    {
+        cblas_dscal(m1->size, -1.f, dst->array, 1);
+        cblas_daxpy(m1->size, 1.f, m1->array, 1, dst->array, 1);
+        return;
+    }
+
+    if (dst->array != m1->array)
+        memcpy(dst->array, m1->array, m1->size * sizeof(double));
+
+    cblas_daxpy(m1->size, -1.f, m2->array, 1, dst->array, 1);
+}
+
+/**
+ * @brief dst = lambda * m with dscal
+ *
+ * @param m Matrix to multiply lambda with
+ * @param lambda Constant value
+ * @param dst Destination matrix to store result in
+ */
+static void _cblas_scalar_mul(matrix_t* m, double lambda, matrix_t* dst)
+{
+    if (dst->array != m->array)
+        memcpy(dst->array, m->array, m->size * sizeof(double));
+
+    cblas_dscal(m->size, lambda, dst->array, 1);
+}
+
+#endif
@@ -0,0 +1,482 @@
+/**
+ * @file    backend_native.c
+ * @author  Philippe Bouchet (philippe.bouchet@epita.fr)
+ * @brief   Native matrix backend. The three GEMMs share one blocked
+ *          kernel: operands are packed into kc deep panels that
+ *          stay in cache, and each NATIVE_MR x NATIVE_NR tile of dst is
+ *          accumulated in registers. Every dst element still sums its
+ *          products in increasing k order, starting from zero, so results
+ *          are bit-identical to the reference backend, whatever the block
+ *          sizes. Those can be changed at runtime (see tune.h); each
+ *          packed block must fit in NATIVE_PACK values.
+ *          Products with few lhs rows (online updates, single sample
+ *          inference) or a shallow depth (their weight gradients) would
+ *          spend more time packing than multiplying: they run the same
+ *          register tiles on the operands in place. Tiny products and the
+ *          elementwise kernels run the reference loops.
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "backend.h"
+
+#include <err.h>
+
+#define NATIVE_MR       4       // Rows of a register tile
+#define NATIVE_NR       4       // Columns of a register tile
+#define NATIVE_MC       64      // Default rows of a packed block of the lhs
+#define NATIVE_NC       64      // Default columns of a packed rhs block
+#define NATIVE_KC       128     // Default depth of the packed blocks
+#define NATIVE_PACK     8192    // Capacity of each packed block, in values
+
+#define NATIVE_SMALL    (16 * 16 * 16)  // Products below run the reference
+#define NATIVE_MIN_K    32      // Shallower ones run unpacked
+#define NATIVE_FEW_ROWS 8       // So do ones with at most as many lhs rows
+
+typedef struct
+{
+    const double*   array;
+    size_t          s_row;   // Stride between rows
+    size_t          s_col;   // Stride between columns
+} native_view_t;
+
+/* Internal API forward declaration */
+
+static void     _native_mul(matrix_t* m1, matrix_t* m2, matrix_t* dst);
+static void     _native_mul_tn(matrix_t* m1, matrix_t* m2, matrix_t* dst);
+static void     _native_mul_nt(matrix_t* m1, matrix_t* m2, matrix_t* dst);
+static void     _native_gemm(size_t M, size_t N, size_t K, native_view_t a,
+                             native_view_t b, double* dst);
+static void     _native_direct(size_t M, size_t N, size_t K,
+                               native_view_t a, native_view_t b,
+                               double* dst);
+static void     _native_pack_a(native_view_t a, size_t i0, size_t mb,
+                               size_t M, size_t k0, size_t kb, double* pack);
+static void     _native_pack_b(native_view_t b, size_t j0, size_t nb,
+                               size_t N, size_t k0, size_t kb, double* pack);
+static void     _native_tile(size_t kb, const double* a, size_t lda,
+                             const double* b, double* dst, size_t ld,
+                             size_t mr, size_t nr, int first);
+
+
+static const backend_t backend_nat = {
+    .name       = "native",
+    .mul        = _native_mul,
+    .mul_tn     = _native_mul_tn,
+    .mul_nt     = _native_mul_nt,
+    .add        = backend_ref_add,
+    .sub        = backend_ref_sub,
+    .hadamard   = backend_ref_hadamard,
+    .scalar_mul = backend_ref_scalar_mul,
+    .scalar_add = backend_ref_scalar_add,
+    .add_row    = backend_ref_add_row,
+    .sum_rows   = backend_ref_sum_rows,
+};
+
+// Read once per product, changed only between runs
+static backend_blocking_t native_blocking = {
+    .mc = NATIVE_MC,
+    .nc = NATIVE_NC,
+    .kc = NATIVE_KC,
+};
+
+
+/* ==== BACKEND PUBLIC API ==== */
+
+
+/**
+ * @return const backend_t* Native backend
+ */
+const backend_t* backend_native(void)
+{
+    return &backend_nat;
+}
+
+/**
+ * @return backend_blocking_t Block sizes of the native GEMMs
+ */
+backend_blocking_t backend_native_blocking(void)
+{
+    return native_blocking;
+}
+
+/**
+ * @brief Changes the block sizes of the native GEMMs. Results do not
+ *        depend on them. Not synchronized with running products.
+ *
+ * @param blocking Block sizes, see backend_native_valid
+ */
+void backend_native_set_blocking(backend_blocking_t blocking)
+{
+    if (!backend_native_valid(blocking))
+    {
+        errx(BACKEND_INVALID_BLOCKING,
+            "BACKEND::ERROR::BLOCKING: "
+            "Invalid native blocking mc %zu, nc %zu, kc %zu",
+            blocking.mc, blocking.nc, blocking.kc);
+    }
+
+    native_blocking = blocking;
+}
+
+/**
+ * @param  blocking Block sizes
+ * @return int 1 if mc and nc are whole register tiles, and each packed
+ *         block fits in NATIVE_PACK values
+ */
+int backend_native_valid(backend_blocking_t blocking)
+{
+    return blocking.mc > 0 && blocking.nc > 0 && blocking.kc > 0
+        && blocking.mc % NATIVE_MR == 0 && blocking.nc % NATIVE_NR == 0
+        && blocking.mc * blocking.kc <= NATIVE_PACK
+        && blocking.kc * blocking.nc <= NATIVE_PACK;
+}
+
+
+/* ==== BACKEND INTERNAL API ==== */
+
+
+/**
+ * @brief dst = m1 * m2
+ *
+ * @param m1 Left hand operation matrix
+ * @param m2 Right hand operation matrix
+ * @param dst Destination matrix to store result in
+ */
+static void _native_mul(matrix_t* m1, matrix_t* m2, matrix_t* dst)
+{
+    size_t M = m1->n_row;
+    size_t K = m1->n_col;
+    size_t N = m2->n_col;
+    native_view_t a = { m1->array, 1, M };
+    native_view_t b = { m2->array, 1, K };
+
+    if (M * N * K < NATIVE_SMALL)
+        backend_ref_mul(m1, m2, dst);
+    else if (M <= NATIVE_FEW_ROWS || K < NATIVE_MIN_K)
+        _native_direct(M, N, K, a, b, dst->array);
+    else
+        _native_gemm(M, N, K, a, b, dst->array);
+}
+
+/**
+ * @brief dst = transpose(m1) * m2
+ *
+ * @param m1 Left hand operation matrix, transposed
+ * @param m2 Right hand operation matrix
+ * @param dst Destination matrix to store result in
+ */
+static void _native_mul_tn(matrix_t* m1, matrix_t* m2, matrix_t* dst)
+{
+    size_t M = m1->n_col;
+    size_t K = m1->n_row;
+    size_t N = m2->n_col;
+    native_view_t a = { m1->array, K, 1 };
+    native_view_t b = { m2->array, 1, K };
+
+    if (M * N * K < NATIVE_SMALL)
+        backend_ref_mul_tn(m1, m2, dst);
+    else if (M <= NATIVE_FEW_ROWS || K < NATIVE_MIN_K)
+        _native_direct(M, N, K, a, b, dst->array);
+    else
+        _native_gemm(M, N, K, a, b, dst->array);
+}
+
+/**
+ * @brief dst = m1 * transpose(m2)
+ *
+ * @param m1 Left hand operation matrix
+ * @param m2 Right hand operation matrix, transposed
+ * @param dst Destination matrix to store result in
+ */
+static void _native_mul_nt(matrix_t* m1, matrix_t* m2, matrix_t* dst)
+{
+    size_t M = m1->n_row;
+    size_t K = m1->n_col;
+    size_t N = m2->n_row;
+    native_view_t a = { m1->array, 1, M };
+    native_view_t b = { m2->array, N, 1 };
+
+    if (M * N * K < NATIVE_SMALL)
+        backend_ref_mul_nt(m1, m2, dst);
+    else if (M <= NATIVE_FEW_ROWS || K < NATIVE_MIN_K)
+        _native_direct(M, N, K, a, b, dst->array);
+    else
+        _native_gemm(M, N, K, a, b, dst->array);
+}
+
+/**
+ * @brief Blocked dst = a * b, dst column-major M x N. The k blocks are
+ *        outermost so every element receives its products in order.
+ *
+ * @param M Rows of a and dst
+ * @param N Columns of b and dst
+ * @param K Columns of a, rows of b
+ * @param a Lhs view, M x K
+ * @param b Rhs view, K x N
+ * @param dst Destination array
+ */
+static void _native_gemm(size_t M, size_t N, size_t K, native_view_t a,
+                         native_view_t b, double* dst)
+{
+    // Packed blocks, 128 KiB together, live on the caller's stack
+    double pack_a[NATIVE_PACK] __attribute__((aligned(64)));
+    double pack_b[NATIVE_PACK] __attribute__((aligned(64)));
+    backend_blocking_t blk = native_blocking;
+
+    // Column-major lhs tiles are read in place, its columns are already
+    // contiguous runs of rows
+    int direct = a.s_row == 1;
+
+    for (size_t k0 = 0; k0 < K; k0 += blk.kc)
+    {
+        size_t kb = K - k0 < blk.kc ? K - k0 : blk.kc;
+
+        for (size_t j0 = 0; j0 < N; j0 += blk.nc)
+        {
+            size_t nb = N - j0 < blk.nc ? N - j0 : blk.nc;
+
+            _native_pack_b(b, j0, nb, N, k0, kb, pack_b);
+
+            for (size_t i0 = 0; i0 < M; i0 += blk.mc)
+            {
+                size_t mb = M - i0 < blk.mc ? M - i0 : blk.mc;
+
+                if (!direct)
+                    _native_pack_a(a, i0, mb, M, k0, kb, pack_a);
+
+                for (size_t j = 0; j < nb; j += NATIVE_NR)
+                {
+                    size_t nr = nb - j < NATIVE_NR ? nb - j : NATIVE_NR;
+
+                    for (size_t i = 0; i < mb; i += NATIVE_MR)
+                    {
+                        size_t mr = mb - i < NATIVE_MR ? mb - i : NATIVE_MR;
+                        const double* panel = pack_a + i * kb;
+                        size_t lda = NATIVE_MR;
+
+                        if (direct && mr == NATIVE_MR)
+                        {
+                            panel = a.array + k0 * a.s_col + i0 + i;
+                            lda = a.s_col;
+                        }
+
+                        else if (direct)
+                        {
+                            // Last rows, padded so the tile stays in bounds
+                            _native_pack_a(a, i0 + i, mr, M, k0, kb,
+                                           pack_a);
+                            panel = pack_a;
+                        }
+
+                        _native_tile(kb, panel, lda, pack_b + j * kb,
+                                     dst + (j0 + j) * M + i0 + i, M, mr, nr,
+                                     k0 == 0);
+                    }
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Unpacked dst = a * b, dst column-major M x N, for products that
+ *        reuse too little of each operand to pay for packing it. Tiles
+ *        of NATIVE_MR x NATIVE_NR are accumulated in registers straight
+ *        from the views; the last rows one at a time, NATIVE_NR columns
+ *        at once. Every element sums its products in increasing k order,
+ *        like _native_gemm.
+ *
+ * @param M Rows of a and dst
+ * @param N Columns of b and dst
+ * @param K Columns of a, rows of b
+ * @param a Lhs view, M x K
+ * @param b Rhs view, K x N
+ * @param dst Destination array
+ */
+static void _native_direct(size_t M, size_t N, size_t K,
+                           native_view_t a, native_view_t b, double* dst)
+{
+    size_t j = 0;
+
+    for (; j + NATIVE_NR <= N; j += NATIVE_NR)
+    {
+        const double* b_j = b.array + j * b.s_col;
+        size_t i = 0;
+
+        for (; i + NATIVE_MR <= M; i += NATIVE_MR)
+        {
+            const double* a_i = a.array + i * a.s_row;
+            double acc[NATIVE_NR][NATIVE_MR] = { 0 };
+
+            for (size_t k = 0; k < K; k++)
+            {
+                double x[NATIVE_MR];
+
+                for (size_t r = 0; r < NATIVE_MR; r++)
+                    x[r] = a_i[r * a.s_row + k * a.s_col];
+
+                for (size_t c = 0; c < NATIVE_NR; c++)
+                {
+                    double bk = b_j[k * b.s_row + c * b.s_col];
+
+                    for (size_t r = 0; r < NATIVE_MR; r++)
+                        acc[c][r] += x[r] * bk;
+                }
+            }
+
+            for (size_t c = 0; c < NATIVE_NR; c++)
+            {
+                for (size_t r = 0; r < NATIVE_MR; r++)
+                    dst[(j + c) * M + i + r] = acc[c][r];
+            }
+        }
+
+        for (; i < M; i++)
+        {
+            const double* a_i = a.array + i * a.s_row;
+            double acc[NATIVE_NR] = { 0 };
+
+            for (size_t k = 0; k < K; k++)
+            {
+                double x = a_i[k * a.s_col];
+
+                for (size_t c = 0; c < NATIVE_NR; c++)
+                    acc[c] += x * b_j[k * b.s_row + c * b.s_col];
+            }
+
+            for (size_t c = 0; c < NATIVE_NR; c++)
+                dst[(j + c) * M + i] = acc[c];
+        }
+    }
+
+    // Last columns, one element at a time
+    for (; j < N; j++)
+    {
+        for (size_t i = 0; i < M; i++)
+        {
+            double acc = 0.f;
+
+            for (size_t k = 0; k < K; k++)
+                acc += a.array[i * a.s_row + k * a.s_col]
+                     * b.array[k * b.s_row + j * b.s_col];
+
+            dst[j * M + i] = acc;
+        }
+    }
+}
+
+/**
+ * @brief Packs a mb x kb block of a as panels of NATIVE_MR rows, each
+ *        stored k-major. Rows past M are zero.
+ *
+ * @param a Lhs view
+ * @param i0 First row of the block
+ * @param mb Rows in the block
+ * @param M Rows of a
+ * @param k0 First column of the block
+ * @param kb Columns in the block
+ * @param pack Destination, NATIVE_PACK values
+ */
+static void _native_pack_a(native_view_t a, size_t i0, size_t mb, size_t M,
+                           size_t k0, size_t kb, double* pack)
+{
+    for (size_t i = 0; i < mb; i += NATIVE_MR)
+    {
+        double* panel = pack + i * kb;
+
+        for (size_t k = 0; k < kb; k++)
+        {
+            const double* src = a.array + (k0 + k) * a.s_col;
+
+            for (size_t r = 0; r < NATIVE_MR; r++)
+            {
+                size_t row = i0 + i + r;
+
+                panel[k * NATIVE_MR + r] =
+                    row < M ? src[row * a.s_row] : 0.f;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Packs a kb x nb block of b as panels of NATIVE_NR columns, each
+ *        stored k-major. Columns past N are zero.
+ *
+ * @param b Rhs view
+ * @param j0 First column of the block
+ * @param nb Columns in the block
+ * @param N Columns of b
+ * @param k0 First row of the block
+ * @param kb Rows in the block
+ * @param pack Destination, NATIVE_PACK values
+ */
+static void _native_pack_b(native_view_t b, size_t j0, size_t nb, size_t N,
+                           size_t k0, size_t kb, double* pack)
+{
+    for (size_t j = 0; j < nb; j += NATIVE_NR)
+    {
+        double* panel = pack + j * kb;
+
+        for (size_t c = 0; c < NATIVE_NR; c++)
+        {
+            size_t col = j0 + j + c;
+
+            for (size_t k = 0; k < kb; k++)
+            {
+                panel[k * NATIVE_NR + c] = col < N
+                    ? b.array[(k0 + k) * b.s_row + col * b.s_col] : 0.f;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Register tile: accumulates kb products into a mr x nr corner of
+ *        a NATIVE_MR x NATIVE_NR tile of dst. Padding lanes are computed
+ *        and dropped.
+ *
+ * @param kb Depth of the panels
+ * @param a Lhs panel, NATIVE_MR rows
+ * @param lda Distance between the columns of the lhs panel
+ * @param b Packed rhs panel
+ * @param dst Top left element of the tile
+ * @param ld Leading dimension of dst
+ * @param mr Valid rows
+ * @param nr Valid columns
+ * @param first Start from zero instead of dst (first k block)
+ */
+static void _native_tile(size_t kb, const double* a, size_t lda,
+                         const double* b, double* dst, size_t ld,
+                         size_t mr, size_t nr, int first)
+{
+    double acc[NATIVE_NR][NATIVE_MR] = { 0 };
+
+    if (!first)
+    {
+        for (size_t j = 0; j < nr; j++)
+        {
+            for (size_t i = 0; i < mr; i++)
+                acc[j][i] = dst[j * ld + i];
+        }
+    }
+
+    for (size_t k = 0; k < kb; k++)
+    {
+        for (size_t j = 0; j < NATIVE_NR; j++)
+        {
+            double bk = b[k * NATIVE_NR + j];
+
+            for (size_t i = 0; i < NATIVE_MR; i++)
+                acc[j][i] += a[k * lda + i] * bk;
+        }
+    }
+
+    for (size_t j = 0; j < nr; j++)
+    {
+        for (size_t i = 0; i < mr; i++)
+            dst[j * ld + i] = acc[j][i];
+    }
+}
@@ -0,0 +1,233 @@
+/**
+ * @file    backend_ref.c
+ * @author  Philippe Bouchet (philippe.bouchet@epita.fr)
+ * @brief   Reference matrix backend: straightforward loops, the baseline
+ *          every other backend is checked against.
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "backend.h"
+
+
+static const backend_t backend_ref = {
+    .name       = "reference",
+    .mul        = backend_ref_mul,
+    .mul_tn     = backend_ref_mul_tn,
+    .mul_nt     = backend_ref_mul_nt,
+    .add        = backend_ref_add,
+    .sub        = backend_ref_sub,
+    .hadamard   = backend_ref_hadamard,
+    .scalar_mul = backend_ref_scalar_mul,
+    .scalar_add = backend_ref_scalar_add,
+    .add_row    = backend_ref_add_row,
+    .sum_rows   = backend_ref_sum_rows,
+};
+
+
+/* ==== BACKEND PUBLIC API ==== */
+
+
+/**
+ * @return const backend_t* Reference backend
+ */
+const backend_t* backend_reference(void)
+{
+    return &backend_ref;
+}
+
+/**
+ * @brief Matrix multiplication, dst = m1 * m2
+ *
+ * @param m1 Left hand operation matrix
+ * @param m2 Right hand operation matrix
+ * @param dst Destination matrix to store result in
+ */
+void backend_ref_mul(matrix_t* m1, matrix_t* m2, matrix_t* dst)
+{
+    size_t R = m1->n_row;
+    size_t K = m1->n_col;
+
+    // Column-major storage: accumulate whole columns of dst so the
+    // innermost loop is contiguous in both m1 and dst.
+    for (size_t j = 0; j < m2->n_col; j++)
+    {
+        double* d = dst->array + j * R;
+
+        for (size_t i = 0; i < R; i++)
+            d[i] = 0.f;
+
+        for (size_t k = 0; k < K; k++)
+        {
+            double b = m2->array[j * K + k];
+            double* a = m1->array + k * R;
+
+            for (size_t i = 0; i < R; i++)
+                d[i] += a[i] * b;
+        }
+    }
+}
+
+/**
+ * @brief Matrix multiplication, dst = transpose(m1) * m2
+ *
+ * @param m1 Left hand operation matrix, transposed
+ * @param m2 Right hand operation matrix
+ * @param dst Destination matrix to store result in
+ */
+void backend_ref_mul_tn(matrix_t* m1, matrix_t* m2, matrix_t* dst)
+{
+    size_t K = m1->n_row;
+
+    for (size_t j = 0; j < m2->n_col; j++)
+    {
+        double* b = m2->array + j * K;
+
+        for (size_t i = 0; i < m1->n_col; i++)
+        {
+            double* a = m1->array + i * K;
+            double val = 0.f;
+
+            for (size_t k = 0; k < K; k++)
+                val += a[k] * b[k];
+
+            dst->array[j * dst->n_row + i] = val;
+        }
+    }
+}
+
+/**
+ * @brief Matrix multiplication, dst = m1 * transpose(m2)
+ *
+ * @param m1 Left hand operation matrix
+ * @param m2 Right hand operation matrix, transposed
+ * @param dst Destination matrix to store result in
+ */
+void backend_ref_mul_nt(matrix_t* m1, matrix_t* m2, matrix_t* dst)
+{
+    size_t R = m1->n_row;
+    size_t C = m2->n_row;
+
+    for (size_t j = 0; j < C; j++)
+    {
+        double* d = dst->array + j * R;
+
+        for (size_t i = 0; i < R; i++)
+            d[i] = 0.f;
+
+        for (size_t k = 0; k < m1->n_col; k++)
+        {
+            double b = m2->array[k * C + j];
+            double* a = m1->array + k * R;
+
+            for (size_t i = 0; i < R; i++)
+                d[i] += a[i] * b;
+        }
+    }
+}
+
+/**
+ * @brief Matrix addition, dst = m1 + m2
+ *
+ * @param m1 Left hand operation matrix
+ * @param m2 Right hand operation matrix
+ * @param dst Destination matrix to store result in
+ */
+void backend_ref_add(matrix_t* m1, matrix_t* m2, matrix_t* dst)
+{
+    for (size_t i = 0; i < m1->size; i++)
+        dst->array[i] = m1->array[i] + m2->array[i];
+}
+
+/**
+ * @brief Matrix substraction, dst = m1 - m2
+ *
+ * @param m1 Left hand operation matrix
+ * @param m2 Right hand operation matrix
+ * @param dst Destination matrix to store result in
+ */
+void backend_ref_sub(matrix_t* m1, matrix_t* m2, matrix_t* dst)
+{
+    for (size_t i = 0; i < m1->size; i++)
+        dst->array[i] = m1->array[i] - m2->array[i];
+}
+
+/**
+ * @brief Matrix hadamard product, dst = m1 .* m2
+ *
+ * @param m1 Left hand operation matrix
+ * @param m2 Right hand operation matrix
+ * @param dst Destination matrix to store result in
+ */
+void backend_ref_hadamard(matrix_t* m1, matrix_t* m2, matrix_t* dst)
+{
+    for (size_t i = 0; i < m1->size; i++)
+        dst->array[i] = m1->array[i] * m2->array[i];
+}
+
+/**
+ * @brief Matrix scalar multiplication, dst = lambda * m
+ *
+ * @param m Matrix to multiply lambda with
+ * @param lambda Constant value
+ * @param dst Destination matrix to store result in
+ */
+void backend_ref_scalar_mul(matrix_t* m, double lambda, matrix_t* dst)
+{
+    for (size_t i = 0; i < m->size; i++)
+        dst->array[i] = m->array[i] * lambda;
+}
+
+/**
+ * @brief Matrix scalar addition, dst = m + lambda
+ *
+ * @param m Matrix to add lambda to
+ * @param lambda Constant value
+ * @param dst Destination matrix to store result in
+ */
+void backend_ref_scalar_add(matrix_t* m, double lambda, matrix_t* dst)
+{
+    for (size_t i = 0; i < m->size; i++)
+        dst->array[i] = m->array[i] + lambda;
+}
+
+/**
+ * @brief Adds a row vector to every row of m
+ *
+ * @param m Matrix to add row to
+ * @param row Row vector (1, m->n_col)
+ * @param dst Destination matrix to store result in
+ */
+void backend_ref_add_row(matrix_t* m, matrix_t* row, matrix_t* dst)
+{
+    for (size_t j = 0; j < m->n_col; j++)
+    {
+        double b = row->array[j];
+        double* s = m->array + j * m->n_row;
+        double* d = dst->array + j * m->n_row;
+
+        for (size_t i = 0; i < m->n_row; i++)
+            d[i] = s[i] + b;
+    }
+}
+
+/**
+ * @brief Sums the rows of m into the row vector dst
+ *
+ * @param m Matrix to reduce
+ * @param dst Destination row vector (1, m->n_col)
+ */
+void backend_ref_sum_rows(matrix_t* m, matrix_t* dst)
+{
+    for (size_t j = 0; j < m->n_col; j++)
+    {
+        double* s = m->array + j * m->n_row;
+        double val = 0.f;
+
+        for (size_t i = 0; i < m->n_row; i++)
+            val += s[i];
+
+        dst->array[j] = val;
+    }
+}
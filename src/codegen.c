@@ -0,0 +1,606 @@
+/**
+ * @file    codegen.c
+ * @author  Philippe Bouchet (philippe.bouchet@epita.fr)
+ * @brief   Ahead-of-time compiler implementation.
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "codegen.h"
+
+#include <ctype.h>
+#include <err.h>
+
+#include "memory.h"
+
+typedef struct
+{
+    FILE*       fp;
+    const char* name;
+    const char* type;        // Scalar type of the generated code
+    const char* exp;         // exp() of that type
+    int         use_double;
+} codegen_t;
+
+/* Internal API forward declaration */
+
+static void     _codegen_check_name(const char* name);
+static void     _codegen_array(codegen_t* cg, const char* type,
+                               const char* label, size_t p, int as_double,
+                               const double* src, size_t n_rows,
+                               size_t n_cols, size_t s_row, size_t s_col);
+static void     _codegen_bounds(codegen_t* cg, size_t p, const conv_t* conv);
+static void     _codegen_dense(codegen_t* cg, size_t p, const model_t* model,
+                               const char* src, const char* dst);
+static void     _codegen_conv(codegen_t* cg, size_t p, const model_t* model,
+                              const conv_t* conv, const char* src,
+                              const char* dst);
+static void     _codegen_pool(codegen_t* cg, const conv_t* conv,
+                              const char* src, const char* dst);
+static void     _codegen_activation(codegen_t* cg, activation_t act,
+                                    const char* lhs, int indent);
+static void     _codegen_softmax(codegen_t* cg, const char* dst, size_t n);
+static void     _codegen_test(codegen_t* cg, network_t* net,
+                              const codegen_config_t* config);
+static size_t   _codegen_width(const model_t* model);
+
+
+/* ==== CODEGEN PUBLIC API ==== */
+
+
+/**
+ * @return codegen_config_t Float code named predict, without tests
+ */
+codegen_config_t codegen_config_default(void)
+{
+    return (codegen_config_t) {
+        .name = "predict",
+        .use_double = 0,
+        .n_tests = 0,
+        .seed = 42,
+    };
+}
+
+/**
+ * @brief Writes the C source of a network: weights, then the predict
+ *        function running every layer in order, then the test harness if
+ *        test vectors were asked for
+ *
+ * @param net Network to compile, its parameters are read from a model
+ * @param fp Output stream
+ * @param config Generation options
+ */
+void codegen_emit(network_t* net, FILE* fp, const codegen_config_t* config)
+{
+    _codegen_check_name(config->name);
+
+    model_t* model = model_init(net);
+
+    codegen_t cg = {
+        .fp = fp,
+        .name = config->name,
+        .type = config->use_double ? "double" : "float",
+        .exp = config->use_double ? "exp" : "expf",
+        .use_double = config->use_double,
+    };
+
+    size_t n_layers = model->n_conv + model->L;
+
+    fprintf(fp, "/*\n * Generated by deepsea-aotc, do not edit.\n *\n");
+    fprintf(fp, " * void %s(const %s* in, %s* out);\n *\n", cg.name, cg.type,
+            cg.type);
+    fprintf(fp, " * in: %zu values, out: %zu values. Layers:\n",
+            model->input_size, model->output_size);
+
+    for (size_t k = 0; k < model->n_conv; k++)
+    {
+        const conv_t* conv = &model->conv[k];
+
+        fprintf(fp, " *   %s %zux%zu, stride %zu, pad %zu: "
+                    "%zux%zux%zu -> %zux%zux%zu\n",
+                conv->type == CONV_2D ? "conv" :
+                conv->type == CONV_MAX_POOL ? "max pool" : "avg pool",
+                conv->kernel, conv->kernel, conv->stride, conv->pad,
+                conv->in_c, conv->in_h, conv->in_w,
+                conv->out_c, conv->out_h, conv->out_w);
+    }
+
+    for (size_t l = 0; l < model->L; l++)
+    {
+        fprintf(fp, " *   dense %zu -> %zu\n", model->w[l]->n_row,
+                model->w[l]->n_col);
+    }
+
+    fprintf(fp, " *\n * Test against the runtime's outputs, when generated "
+                "with test vectors:\n");
+    fprintf(fp, " *   cc -O2 -DDEEPSEA_AOT_TEST file.c -lm && ./a.out\n */"
+                "\n\n#include <math.h>\n\n");
+
+    // Weights: dense layers [in][out], convolutions [filter][window]
+    for (size_t p = 0; p < model->n_params; p++)
+    {
+        matrix_t* w = model->w[p];
+        matrix_t* b = model->b[p];
+
+        if (p < model->L)
+        {
+            _codegen_array(&cg, cg.type, "w", p, cg.use_double, w->array,
+                           w->n_row, w->n_col, 1, w->n_row);
+        }
+
+        else
+        {
+            _codegen_array(&cg, cg.type, "w", p, cg.use_double, w->array,
+                           w->n_col, w->n_row, w->n_row, 1);
+        }
+
+        _codegen_array(&cg, cg.type, "b", p, cg.use_double, b->array, 1,
+                       b->n_col, 0, 1);
+    }
+
+    for (size_t k = 0, p = model->L; k < model->n_conv; k++)
+    {
+        if (model->conv[k].type == CONV_2D)
+            _codegen_bounds(&cg, p++, &model->conv[k]);
+    }
+
+    fprintf(fp, "void %s(const %s* in, %s* out)\n{\n", cg.name, cg.type,
+            cg.type);
+
+    if (n_layers > 1)
+    {
+        fprintf(fp, "    %s buf[2][%zu] __attribute__((aligned(64)));\n\n",
+                cg.type, _codegen_width(model));
+    }
+
+    for (size_t i = 0, p = model->L; i < n_layers; i++)
+    {
+        char src[16];
+        char dst[16];
+
+        if (i == 0)
+            snprintf(src, sizeof(src), "in");
+        else
+            snprintf(src, sizeof(src), "buf[%zu]", (i - 1) % 2);
+
+        if (i == n_layers - 1)
+            snprintf(dst, sizeof(dst), "out");
+        else
+            snprintf(dst, sizeof(dst), "buf[%zu]", i % 2);
+
+        if (i > 0)
+            fprintf(fp, "\n");
+
+        if (i >= model->n_conv)
+            _codegen_dense(&cg, i - model->n_conv, model, src, dst);
+
+        else if (model->conv[i].type == CONV_2D)
+            _codegen_conv(&cg, p++, model, &model->conv[i], src, dst);
+
+        else
+            _codegen_pool(&cg, &model->conv[i], src, dst);
+    }
+
+    fprintf(fp, "}\n");
+
+    if (config->n_tests)
+        _codegen_test(&cg, net, config);
+
+    model_free(model);
+}
+
+
+/* ==== CODEGEN INTERNAL API ==== */
+
+
+/**
+ * @brief Rejects entry point names that are not C identifiers
+ *
+ * @param name Entry point name
+ */
+static void _codegen_check_name(const char* name)
+{
+    int valid = name[0] != '\0' && !isdigit((unsigned char) name[0]);
+
+    for (const char* c = name; *c; c++)
+        valid &= isalnum((unsigned char) *c) || *c == '_';
+
+    if (!valid)
+    {
+        errx(CODEGEN_INVALID_NAME,
+            "CODEGEN::ERROR::NAME: "
+            "'%s' is not a C identifier", name);
+    }
+}
+
+/**
+ * @brief Emits a flat static const array <name>_<label><p>, row-major,
+ *        element (r, c) read from src[r * s_row + c * s_col]. Values are
+ *        written in exponent notation with enough digits to round-trip.
+ *
+ * @param cg Generator state
+ * @param type Element type
+ * @param label Array kind
+ * @param p Parameter index
+ * @param as_double Write double literals, float literals otherwise
+ * @param src Values
+ * @param n_rows Rows
+ * @param n_cols Columns
+ * @param s_row Stride between rows in src
+ * @param s_col Stride between columns in src
+ */
+static void _codegen_array(codegen_t* cg, const char* type,
+                           const char* label, size_t p, int as_double,
+                           const double* src, size_t n_rows, size_t n_cols,
+                           size_t s_row, size_t s_col)
+{
+    size_t n = n_rows * n_cols;
+
+    fprintf(cg->fp, "static const %s %s_%s%zu[%zu] "
+                    "__attribute__((aligned(64))) = {",
+            type, cg->name, label, p, n);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        double v = src[(i / n_cols) * s_row + (i % n_cols) * s_col];
+
+        fprintf(cg->fp, i % 4 ? " " : "\n    ");
+
+        if (as_double)
+            fprintf(cg->fp, "%.17e,", v);
+        else
+            fprintf(cg->fp, "%.9ef,", (float) v);
+    }
+
+    fprintf(cg->fp, "\n};\n\n");
+}
+
+/**
+ * @brief Emits the output rows and columns each kernel row and column
+ *        reaches inside the image, so the convolution loops skip the
+ *        padding instead of testing for it
+ *
+ * @param cg Generator state
+ * @param p Parameter index of the convolution
+ * @param conv Convolution layer
+ */
+static void _codegen_bounds(codegen_t* cg, size_t p, const conv_t* conv)
+{
+    const char* labels[] = { "rows", "cols" };
+    size_t in[] = { conv->in_h, conv->in_w };
+    size_t out[] = { conv->out_h, conv->out_w };
+
+    for (size_t d = 0; d < 2; d++)
+    {
+        fprintf(cg->fp, "static const int %s_%s%zu[%zu][2] = {\n",
+                cg->name, labels[d], p, conv->kernel);
+
+        for (size_t k = 0; k < conv->kernel; k++)
+        {
+            // Outputs o with 0 <= o * stride + k - pad < in
+            long s = conv->stride;
+            long lo = 0;
+            long hi = ((long) in[d] - 1 + (long) conv->pad - (long) k) / s + 1;
+
+            if ((long) k < (long) conv->pad)
+                lo = ((long) conv->pad - (long) k + s - 1) / s;
+
+            if ((long) in[d] - 1 + (long) conv->pad < (long) k)
+                hi = 0;
+
+            if (hi > (long) out[d])
+                hi = out[d];
+
+            if (hi < lo)
+                hi = lo;
+
+            fprintf(cg->fp, "    { %ld, %ld },\n", lo, hi);
+        }
+
+        fprintf(cg->fp, "};\n\n");
+    }
+}
+
+/**
+ * @brief Dense layer: outputs are accumulated one input at a time, so
+ *        the inner loop is a contiguous axpy and each output sums its
+ *        products in input order, as the runtime does
+ *
+ * @param cg Generator state
+ * @param l Dense layer index
+ * @param model Model
+ * @param src Input buffer expression
+ * @param dst Output buffer expression
+ */
+static void _codegen_dense(codegen_t* cg, size_t l, const model_t* model,
+                           const char* src, const char* dst)
+{
+    FILE* fp = cg->fp;
+    size_t n_in = model->w[l]->n_row;
+    size_t n_out = model->w[l]->n_col;
+    char lhs[32];
+
+    fprintf(fp, "    /* Dense %zu -> %zu */\n", n_in, n_out);
+    fprintf(fp, "    for (int j = 0; j < %zu; j++)\n", n_out);
+    fprintf(fp, "        %s[j] = 0;\n\n", dst);
+
+    fprintf(fp, "    for (int k = 0; k < %zu; k++)\n    {\n", n_in);
+    fprintf(fp, "        const %s x = %s[k];\n", cg->type, src);
+    fprintf(fp, "        const %s* w = %s_w%zu + k * %zu;\n\n", cg->type,
+            cg->name, l, n_out);
+    fprintf(fp, "        for (int j = 0; j < %zu; j++)\n", n_out);
+    fprintf(fp, "            %s[j] += x * w[j];\n    }\n\n", dst);
+
+    fprintf(fp, "    for (int j = 0; j < %zu; j++)\n    {\n", n_out);
+    fprintf(fp, "        const %s z = %s[j] + %s_b%zu[j];\n\n", cg->type,
+            dst, cg->name, l);
+    snprintf(lhs, sizeof(lhs), "%s[j]", dst);
+    _codegen_activation(cg, model->act[l], lhs, 8);
+    fprintf(fp, "    }\n");
+
+    if (model->act[l] == ACT_SOFTMAX)
+        _codegen_softmax(cg, dst, n_out);
+}
+
+/**
+ * @brief Convolution layer: for each filter and window element, a
+ *        strided axpy of the input plane into the output plane. Outputs
+ *        sum their products in window order, as the im2col GEMM does.
+ *
+ * @param cg Generator state
+ * @param p Parameter index of the convolution
+ * @param model Model
+ * @param conv Convolution layer
+ * @param src Input buffer expression
+ * @param dst Output buffer expression
+ */
+static void _codegen_conv(codegen_t* cg, size_t p, const model_t* model,
+                          const conv_t* conv, const char* src,
+                          const char* dst)
+{
+    FILE* fp = cg->fp;
+    size_t k = conv->kernel;
+    size_t plane = conv->out_h * conv->out_w;
+    char lhs[32];
+
+    fprintf(fp, "    /* Conv %zu@%zux%zu, stride %zu, pad %zu */\n",
+            conv->out_c, k, k, conv->stride, conv->pad);
+    fprintf(fp, "    for (int i = 0; i < %zu; i++)\n", conv_out_size(conv));
+    fprintf(fp, "        %s[i] = 0;\n\n", dst);
+
+    fprintf(fp, "    for (int o = 0; o < %zu; o++)\n    {\n", conv->out_c);
+    fprintf(fp, "        for (int c = 0; c < %zu; c++)\n        {\n",
+            conv->in_c);
+    fprintf(fp, "            for (int ky = 0; ky < %zu; ky++)\n", k);
+    fprintf(fp, "            {\n");
+    fprintf(fp, "                for (int kx = 0; kx < %zu; kx++)\n", k);
+    fprintf(fp, "                {\n");
+    fprintf(fp, "                    const %s w = %s_w%zu[(o * %zu + c) * "
+                "%zu + ky * %zu + kx];\n\n",
+            cg->type, cg->name, p, conv->in_c, k * k, k);
+    fprintf(fp, "                    for (int y = %s_rows%zu[ky][0]; "
+                "y < %s_rows%zu[ky][1]; y++)\n",
+            cg->name, p, cg->name, p);
+    fprintf(fp, "                    {\n");
+    fprintf(fp, "                        const int s = c * %zu + "
+                "(y * %zu + ky - %zu) * %zu + kx - %zu;\n",
+            conv->in_h * conv->in_w, conv->stride, conv->pad, conv->in_w,
+            conv->pad);
+    fprintf(fp, "                        %s* d = %s + o * %zu + y * %zu;\n\n",
+            cg->type, dst, plane, conv->out_w);
+    fprintf(fp, "                        for (int x = %s_cols%zu[kx][0]; "
+                "x < %s_cols%zu[kx][1]; x++)\n",
+            cg->name, p, cg->name, p);
+    fprintf(fp, "                            d[x] += %s[s + x * %zu] * w;\n",
+            src, conv->stride);
+    fprintf(fp, "                    }\n                }\n            }\n"
+                "        }\n    }\n\n");
+
+    fprintf(fp, "    for (int o = 0; o < %zu; o++)\n    {\n", conv->out_c);
+    fprintf(fp, "        for (int i = o * %zu; i < (o + 1) * %zu; i++)\n",
+            plane, plane);
+    fprintf(fp, "        {\n");
+    fprintf(fp, "            const %s z = %s[i] + %s_b%zu[o];\n\n", cg->type,
+            dst, cg->name, p);
+    snprintf(lhs, sizeof(lhs), "%s[i]", dst);
+    _codegen_activation(cg, model->act[p], lhs, 12);
+    fprintf(fp, "        }\n    }\n");
+
+    if (model->act[p] == ACT_SOFTMAX)
+        _codegen_softmax(cg, dst, conv_out_size(conv));
+}
+
+/**
+ * @brief Pooling layer: each window is reduced from its first element
+ *        on, in window order, as the runtime does
+ *
+ * @param cg Generator state
+ * @param conv Pooling layer
+ * @param src Input buffer expression
+ * @param dst Output buffer expression
+ */
+static void _codegen_pool(codegen_t* cg, const conv_t* conv, const char* src,
+                          const char* dst)
+{
+    FILE* fp = cg->fp;
+    size_t k = conv->kernel;
+    int max = conv->type == CONV_MAX_POOL;
+
+    fprintf(fp, "    /* %s pool %zux%zu, stride %zu */\n", max ? "Max" : "Avg",
+            k, k, conv->stride);
+    fprintf(fp, "    for (int c = 0; c < %zu; c++)\n    {\n", conv->out_c);
+    fprintf(fp, "        for (int y = 0; y < %zu; y++)\n        {\n",
+            conv->out_h);
+    fprintf(fp, "            for (int x = 0; x < %zu; x++)\n            {\n",
+            conv->out_w);
+    fprintf(fp, "                const %s* s = %s + c * %zu + y * %zu + "
+                "x * %zu;\n",
+            cg->type, src, conv->in_h * conv->in_w,
+            conv->stride * conv->in_w, conv->stride);
+    fprintf(fp, "                %s v = s[0];\n\n", cg->type);
+    fprintf(fp, "                for (int q = 1; q < %zu; q++)\n", k * k);
+    fprintf(fp, "                {\n");
+    fprintf(fp, "                    const %s e = s[q / %zu * %zu + q %% %zu];"
+                "\n\n", cg->type, k, conv->in_w, k);
+
+    if (max)
+        fprintf(fp, "                    v = e > v ? e : v;\n");
+    else
+        fprintf(fp, "                    v += e;\n");
+
+    fprintf(fp, "                }\n\n");
+    fprintf(fp, "                %s[(c * %zu + y) * %zu + x] = v",
+            dst, conv->out_h, conv->out_w);
+
+    if (max)
+        fprintf(fp, ";\n");
+    else
+        fprintf(fp, " / %zu;\n", k * k);
+
+    fprintf(fp, "            }\n        }\n    }\n");
+}
+
+/**
+ * @brief Emits lhs = act(z) inside a loop body defining z. Softmax only
+ *        stores z, it is applied to the whole layer afterwards.
+ *
+ * @param cg Generator state
+ * @param act Activation
+ * @param lhs Output element expression
+ * @param indent Indentation of the statement
+ */
+static void _codegen_activation(codegen_t* cg, activation_t act,
+                                const char* lhs, int indent)
+{
+    FILE* fp = cg->fp;
+
+    fprintf(fp, "%*s%s = ", indent, "", lhs);
+
+    switch (act)
+    {
+        case ACT_RELU:
+            fprintf(fp, "z > 0 ? z : 0;\n");
+            break;
+
+        case ACT_SOFTMAX:
+            fprintf(fp, "z;\n");
+            break;
+
+        default:
+            fprintf(fp, "1 / (1 + %s(-z));\n", cg->exp);
+            break;
+    }
+}
+
+/**
+ * @brief Softmax over the n values of dst, shifted by their maximum
+ *
+ * @param cg Generator state
+ * @param dst Buffer expression
+ * @param n Number of values
+ */
+static void _codegen_softmax(codegen_t* cg, const char* dst, size_t n)
+{
+    FILE* fp = cg->fp;
+
+    fprintf(fp, "\n    {\n");
+    fprintf(fp, "        %s max = %s[0];\n", cg->type, dst);
+    fprintf(fp, "        %s sum = 0;\n\n", cg->type);
+    fprintf(fp, "        for (int j = 1; j < %zu; j++)\n", n);
+    fprintf(fp, "            max = %s[j] > max ? %s[j] : max;\n\n", dst, dst);
+    fprintf(fp, "        for (int j = 0; j < %zu; j++)\n        {\n", n);
+    fprintf(fp, "            %s[j] = %s(%s[j] - max);\n", dst, cg->exp, dst);
+    fprintf(fp, "            sum += %s[j];\n        }\n\n", dst);
+    fprintf(fp, "        for (int j = 0; j < %zu; j++)\n", n);
+    fprintf(fp, "            %s[j] /= sum;\n    }\n", dst);
+}
+
+/**
+ * @brief Emits random test inputs, the network's own predictions for
+ *        them, and a main() comparing the generated code against them
+ *
+ * @param cg Generator state
+ * @param net Network, predicts the expected outputs
+ * @param config Generation options
+ */
+static void _codegen_test(codegen_t* cg, network_t* net,
+                          const codegen_config_t* config)
+{
+    FILE* fp = cg->fp;
+    size_t n = config->n_tests;
+    size_t n_in = net->input_size;
+    size_t n_out = net->output_size;
+    unsigned long state = config->seed ? config->seed : 1;
+
+    double* X = mem_malloc(n * n_in * sizeof(double), MEM_DATASET);
+    double** rows = mem_malloc(n * sizeof(double*), MEM_DATASET);
+    double* y = mem_malloc(n * n_out * sizeof(double), MEM_DATASET);
+
+    // Inputs in [0, 1), like normalized pixels
+    for (size_t i = 0; i < n * n_in; i++)
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+
+        X[i] = (double) (state >> 11) / (double) (1UL << 53);
+    }
+
+    for (size_t i = 0; i < n; i++)
+        rows[i] = X + i * n_in;
+
+    // The training runtime's forward pass, not the inference engine
+    net_predict_batch(net, rows, n, y);
+
+    fprintf(fp, "\n#ifdef DEEPSEA_AOT_TEST\n\n#include <stdio.h>\n\n");
+
+    _codegen_array(cg, "double", "test_in", 0, 1, X, n, n_in, n_in, 1);
+    _codegen_array(cg, "double", "test_out", 0, 1, y, n, n_out, n_out, 1);
+
+    fprintf(fp, "int main(void)\n{\n");
+    fprintf(fp, "    %s in[%zu];\n", cg->type, n_in);
+    fprintf(fp, "    %s out[%zu];\n", cg->type, n_out);
+    fprintf(fp, "    double error = 0;\n\n");
+    fprintf(fp, "    for (int t = 0; t < %zu; t++)\n    {\n", n);
+    fprintf(fp, "        for (int i = 0; i < %zu; i++)\n", n_in);
+    fprintf(fp, "            in[i] = %s_test_in0[t * %zu + i];\n\n", cg->name,
+            n_in);
+    fprintf(fp, "        %s(in, out);\n\n", cg->name);
+    fprintf(fp, "        for (int j = 0; j < %zu; j++)\n        {\n", n_out);
+    fprintf(fp, "            double e = fabs(out[j] - %s_test_out0[t * %zu "
+                "+ j]);\n\n", cg->name, n_out);
+    fprintf(fp, "            error = e > error ? e : error;\n        }\n"
+                "    }\n\n");
+    fprintf(fp, "    printf(\"%s: %zu vectors, max error %%g\\n\", error);"
+                "\n\n", cg->name, n);
+    fprintf(fp, "    return error > %g;\n}\n\n#endif\n",
+            cg->use_double ? CODEGEN_TOLERANCE_DOUBLE
+                           : CODEGEN_TOLERANCE_FLOAT);
+
+    mem_free(X);
+    mem_free(rows);
+    mem_free(y);
+}
+
+/**
+ * @return size_t Widest layer output of the model
+ */
+static size_t _codegen_width(const model_t* model)
+{
+    size_t width = 0;
+
+    for (size_t k = 0; k < model->n_conv; k++)
+    {
+        if (conv_out_size(&model->conv[k]) > width)
+            width = conv_out_size(&model->conv[k]);
+    }
+
+    for (size_t l = 0; l < model->L; l++)
+    {
+        if (model->w[l]->n_col > width)
+            width = model->w[l]->n_col;
+    }
+
+    return width;
+}
@@ -0,0 +1,48 @@
+/**
+ * @file    codegen.h
+ * @author  Philippe Bouchet (philippe.bouchet@epita.fr)
+ * @brief   Ahead-of-time compiler: emits a network as a standalone C source
+ *          file, with the weights as aligned static const arrays and one
+ *          loop nest per layer whose bounds are all compile-time
+ *          constants. The generated code only needs <math.h>, and its
+ *          single entry point is
+ *
+ *              void predict(const float* in, float* out);
+ *
+ *          Each output sums its products in the same order as the
+ *          runtime, so double precision code reproduces net_predict_batch
+ *          exactly. With test vectors, the file also carries a main()
+ *          that checks itself against the network's own outputs, compiled
+ *          in with -DDEEPSEA_AOT_TEST (see make aotc-test).
+ *          Public API functions denoted with "codegen" prefix.
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef CODEGEN_H
+#define CODEGEN_H
+
+#define CODEGEN_INVALID_NAME    -1
+
+#define CODEGEN_TOLERANCE_FLOAT     1e-4    // Max output error, float code
+#define CODEGEN_TOLERANCE_DOUBLE    1e-9    // Max output error, double code
+
+#include <stdio.h>
+
+#include "model.h"
+#include "network.h"
+
+typedef struct
+{
+    const char* name;        // Entry point, prefix of every static symbol
+    int         use_double;  // double instead of float arithmetic
+    size_t      n_tests;     // Random test vectors embedded for main()
+    unsigned    seed;        // Seed of the test vectors
+} codegen_config_t;
+
+codegen_config_t    codegen_config_default(void);
+void                codegen_emit(network_t* net, FILE* fp,
+                                 const codegen_config_t* config);
+
+#endif // CODEGEN_H
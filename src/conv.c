@@ -0,0 +1,430 @@
+/**
+ * @file    conv.c
+ * @author  Philippe Bouchet (philippe.bouchet@epita.fr)
+ * @brief   Convolution and pooling kernels implementation.
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "conv.h"
+
+#include <err.h>
+#include <string.h>
+
+/* Internal API forward declaration */
+
+static matrix_t _conv_view(matrix_t* m, size_t n_col);
+
+
+/* ==== CONV PUBLIC API ==== */
+
+
+/**
+ * @brief  Convolution layer description, shaped by conv_shape
+ *
+ * @param  channels Number of filters
+ * @param  kernel Side of the square filters
+ * @param  stride Step between two windows
+ * @param  pad Zero padding on each side of the input
+ * @return conv_t Layer description
+ */
+conv_t conv_2d(size_t channels, size_t kernel, size_t stride, size_t pad)
+{
+    conv_t conv = {
+        .type = CONV_2D,
+        .channels = channels,
+        .kernel = kernel,
+        .stride = stride,
+        .pad = pad,
+    };
+
+    return conv;
+}
+
+/**
+ * @brief  Pooling layer description, shaped by conv_shape
+ *
+ * @param  type CONV_MAX_POOL or CONV_AVG_POOL
+ * @param  kernel Side of the square windows
+ * @param  stride Step between two windows
+ * @return conv_t Layer description
+ */
+conv_t conv_pool(conv_type_t type, size_t kernel, size_t stride)
+{
+    conv_t conv = {
+        .type = type,
+        .kernel = kernel,
+        .stride = stride,
+        .pad = 0,
+    };
+
+    return conv;
+}
+
+/**
+ * @brief Chain the input and output shapes of n layers, from the shape of
+ *        the images fed to the first one
+ *
+ * @param conv Layers
+ * @param n Number of layers
+ * @param channels Channels of the input images
+ * @param height Height of the input images
+ * @param width Width of the input images
+ */
+void conv_shape(conv_t* conv, size_t n, size_t channels, size_t height,
+                size_t width)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        conv_t* c = &conv[i];
+
+        c->in_c = channels;
+        c->in_h = height;
+        c->in_w = width;
+
+        if (c->kernel == 0 || c->stride == 0
+            || c->kernel > height + 2 * c->pad
+            || c->kernel > width + 2 * c->pad
+            || (c->type == CONV_2D && c->channels == 0))
+        {
+            errx(CONV_INVALID_SHAPE,
+                 "CONV::ERROR::SHAPE: "
+                 "Invalid layer %zu (kernel %zu, stride %zu, pad %zu) "
+                 "on %zux%zux%zu inputs", i, c->kernel, c->stride, c->pad,
+                 channels, height, width);
+        }
+
+        c->out_c = c->type == CONV_2D ? c->channels : channels;
+        c->out_h = (height + 2 * c->pad - c->kernel) / c->stride + 1;
+        c->out_w = (width + 2 * c->pad - c->kernel) / c->stride + 1;
+
+        channels = c->out_c;
+        height = c->out_h;
+        width = c->out_w;
+    }
+}
+
+/**
+ * @return size_t Values per input sample of a layer
+ */
+size_t conv_in_size(const conv_t* conv)
+{
+    return conv->in_c * conv->in_h * conv->in_w;
+}
+
+/**
+ * @return size_t Values per output sample of a layer
+ */
+size_t conv_out_size(const conv_t* conv)
+{
+    return conv->out_c * conv->out_h * conv->out_w;
+}
+
+/**
+ * @return size_t Windows per sample, the output positions of a channel
+ */
+size_t conv_positions(const conv_t* conv)
+{
+    return conv->out_h * conv->out_w;
+}
+
+/**
+ * @return size_t Values of a window over every input channel, the
+ *         columns of im2col and the rows of the filters
+ */
+size_t conv_window(const conv_t* conv)
+{
+    return conv->in_c * conv->kernel * conv->kernel;
+}
+
+/**
+ * @brief Lay out every window of a batch as a row of cols. Row p * B + b
+ *        holds the window of sample b at output position p, column
+ *        (c * kernel + ky) * kernel + kx its input value at channel c and
+ *        offset (ky, kx). Samples are the contiguous dimension of the
+ *        input, so each run of B values is a single copy.
+ *
+ * @param conv Layer
+ * @param in Batch of B inputs, B x conv_in_size
+ * @param cols Destination, reshaped to (B * P) x conv_window
+ */
+void conv_im2col(const conv_t* conv, matrix_t* in, matrix_t* cols)
+{
+    if (in->n_col != conv_in_size(conv))
+    {
+        errx(CONV_INVALID_SHAPE,
+             "CONV::ERROR::IM2COL: "
+             "Input of %zu values, layer expects %zu",
+             in->n_col, conv_in_size(conv));
+    }
+
+    size_t B = in->n_row;
+    size_t k = conv->kernel;
+    size_t BP = B * conv_positions(conv);
+
+    m_reshape(cols, BP, conv_window(conv));
+
+    for (size_t c = 0; c < conv->in_c; c++)
+    {
+        for (size_t ky = 0; ky < k; ky++)
+        {
+            for (size_t kx = 0; kx < k; kx++)
+            {
+                double* dst = cols->array + ((c * k + ky) * k + kx) * BP;
+
+                for (size_t oy = 0; oy < conv->out_h; oy++)
+                {
+                    // Unsigned wrap-around puts padding out of range
+                    size_t iy = oy * conv->stride + ky - conv->pad;
+
+                    for (size_t ox = 0; ox < conv->out_w; ox++)
+                    {
+                        size_t ix = ox * conv->stride + kx - conv->pad;
+                        double* d = dst + (oy * conv->out_w + ox) * B;
+
+                        if (iy >= conv->in_h || ix >= conv->in_w)
+                            memset(d, 0, B * sizeof(double));
+                        else
+                            memcpy(d, in->array + ((c * conv->in_h + iy)
+                                                   * conv->in_w + ix) * B,
+                                   B * sizeof(double));
+                    }
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Inverse of conv_im2col: sum every window value of cols back into
+ *        the input position it was read from. Padding is dropped.
+ *
+ * @param conv Layer
+ * @param cols Windows, (B * P) x conv_window
+ * @param in Destination, overwritten and reshaped to B x conv_in_size
+ */
+void conv_col2im(const conv_t* conv, matrix_t* cols, matrix_t* in)
+{
+    size_t BP = cols->n_row;
+    size_t B = BP / conv_positions(conv);
+    size_t k = conv->kernel;
+
+    m_reshape(in, B, conv_in_size(conv));
+    m_reset(in);
+
+    for (size_t c = 0; c < conv->in_c; c++)
+    {
+        for (size_t ky = 0; ky < k; ky++)
+        {
+            for (size_t kx = 0; kx < k; kx++)
+            {
+                double* src = cols->array + ((c * k + ky) * k + kx) * BP;
+
+                for (size_t oy = 0; oy < conv->out_h; oy++)
+                {
+                    size_t iy = oy * conv->stride + ky - conv->pad;
+
+                    if (iy >= conv->in_h)
+                        continue;
+
+                    for (size_t ox = 0; ox < conv->out_w; ox++)
+                    {
+                        size_t ix = ox * conv->stride + kx - conv->pad;
+
+                        if (ix >= conv->in_w)
+                            continue;
+
+                        double* s = src + (oy * conv->out_w + ox) * B;
+                        double* d = in->array + ((c * conv->in_h + iy)
+                                                 * conv->in_w + ix) * B;
+
+                        for (size_t b = 0; b < B; b++)
+                            d[b] += s[b];
+                    }
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Convolution of a batch: out = im2col(in) . w + b, as one GEMM
+ *
+ * @param conv CONV_2D layer
+ * @param in Batch of B inputs, B x conv_in_size
+ * @param w Filters, conv_window x out_c
+ * @param b Biases, 1 x out_c
+ * @param cols Windows of the batch, kept for the backward pass
+ * @param out Output, reshaped to B x conv_out_size
+ */
+void conv_forward(const conv_t* conv, matrix_t* in, matrix_t* w,
+                  matrix_t* b, matrix_t* cols, matrix_t* out)
+{
+    conv_im2col(conv, in, cols);
+    m_reshape(out, in->n_row, conv_out_size(conv));
+
+    matrix_t o = _conv_view(out, conv->out_c);
+
+    m_mul(cols, w, &o);
+    m_add_row(&o, b, &o);
+}
+
+/**
+ * @brief Filter and bias gradients of a batch:
+ *        grad_w = transpose(cols) . delta, grad_b = column sums of delta
+ *
+ * @param conv CONV_2D layer
+ * @param cols Windows written by conv_forward
+ * @param delta Output delta, B x conv_out_size
+ * @param grad_w Filter gradient, conv_window x out_c
+ * @param grad_b Bias gradient, 1 x out_c
+ */
+void conv_grad(const conv_t* conv, matrix_t* cols, matrix_t* delta,
+               matrix_t* grad_w, matrix_t* grad_b)
+{
+    matrix_t d = _conv_view(delta, conv->out_c);
+
+    m_mul_tn(cols, &d, grad_w);
+    m_sum_rows(&d, grad_b);
+}
+
+/**
+ * @brief Input delta of a convolution: col2im(delta . transpose(w))
+ *
+ * @param conv CONV_2D layer
+ * @param delta Output delta, B x conv_out_size
+ * @param w Filters, conv_window x out_c
+ * @param cols Workspace of the window deltas, the windows are overwritten
+ * @param delta_prev Input delta, reshaped to B x conv_in_size
+ */
+void conv_backward(const conv_t* conv, matrix_t* delta, matrix_t* w,
+                   matrix_t* cols, matrix_t* delta_prev)
+{
+    matrix_t d = _conv_view(delta, conv->out_c);
+
+    m_reshape(cols, d.n_row, conv_window(conv));
+    m_mul_nt(&d, w, cols);
+    conv_col2im(conv, cols, delta_prev);
+}
+
+/**
+ * @brief Pooling of a batch. Columns c * kernel^2 to (c + 1) * kernel^2
+ *        of the windows are channel c, reduced into column c of the
+ *        (B * P) x out_c output.
+ *
+ * @param conv Pooling layer
+ * @param in Batch of B inputs, B x conv_in_size
+ * @param cols Windows of the batch, kept for the backward pass
+ * @param out Output, reshaped to B x conv_out_size
+ */
+void conv_pool_forward(const conv_t* conv, matrix_t* in, matrix_t* cols,
+                       matrix_t* out)
+{
+    conv_im2col(conv, in, cols);
+    m_reshape(out, in->n_row, conv_out_size(conv));
+
+    size_t BP = cols->n_row;
+    size_t kk = conv->kernel * conv->kernel;
+
+    for (size_t c = 0; c < conv->out_c; c++)
+    {
+        double* o = out->array + c * BP;
+        double* src = cols->array + c * kk * BP;
+
+        memcpy(o, src, BP * sizeof(double));
+
+        for (size_t j = 1; j < kk; j++)
+        {
+            double* s = src + j * BP;
+
+            if (conv->type == CONV_MAX_POOL)
+            {
+                for (size_t r = 0; r < BP; r++)
+                    o[r] = s[r] > o[r] ? s[r] : o[r];
+            }
+
+            else
+            {
+                for (size_t r = 0; r < BP; r++)
+                    o[r] += s[r];
+            }
+        }
+
+        if (conv->type == CONV_AVG_POOL)
+        {
+            for (size_t r = 0; r < BP; r++)
+                o[r] /= kk;
+        }
+    }
+}
+
+/**
+ * @brief Input delta of a pooling layer. The delta of a max window goes
+ *        to its first maximum, the delta of a mean window is spread
+ *        evenly; the window deltas then go through col2im.
+ *
+ * @param conv Pooling layer
+ * @param cols Windows written by conv_pool_forward, overwritten by the
+ *             window deltas
+ * @param delta Output delta, B x conv_out_size
+ * @param delta_prev Input delta, reshaped to B x conv_in_size
+ */
+void conv_pool_backward(const conv_t* conv, matrix_t* cols,
+                        matrix_t* delta, matrix_t* delta_prev)
+{
+    size_t BP = cols->n_row;
+    size_t kk = conv->kernel * conv->kernel;
+
+    for (size_t c = 0; c < conv->out_c; c++)
+    {
+        double* d = delta->array + c * BP;
+        double* win = cols->array + c * kk * BP;
+
+        for (size_t r = 0; r < BP; r++)
+        {
+            size_t best = 0;
+
+            for (size_t j = 1; j < kk && conv->type == CONV_MAX_POOL; j++)
+            {
+                if (win[j * BP + r] > win[best * BP + r])
+                    best = j;
+            }
+
+            for (size_t j = 0; j < kk; j++)
+            {
+                if (conv->type == CONV_AVG_POOL)
+                    win[j * BP + r] = d[r] / kk;
+                else
+                    win[j * BP + r] = j == best ? d[r] : 0.f;
+            }
+        }
+    }
+
+    conv_col2im(conv, cols, delta_prev);
+}
+
+
+/* ==== CONV INTERNAL API ==== */
+
+
+/**
+ * @brief  View of a B x (n_col * P) batch as the (B * P) x n_col matrix
+ *         of a GEMM. Both share the same column-major array.
+ *
+ * @param  m Batched tensor
+ * @param  n_col Channels
+ * @return matrix_t View, not to be freed
+ */
+static matrix_t _conv_view(matrix_t* m, size_t n_col)
+{
+    matrix_t view = {
+        .array = m->array,
+        .size = m->size,
+        .n_row = m->size / n_col,
+        .n_col = n_col,
+        .capacity = m->size,
+    };
+
+    return view;
+}
@@ -0,0 +1,72 @@
+/**
+ * @file    conv.h
+ * @author  Philippe Bouchet (philippe.bouchet@epita.fr)
+ * @brief   Convolution and pooling kernels. Images are batched like every
+ *          other network tensor: B rows of in_c * in_h * in_w columns,
+ *          channel-major. im2col lays the windows of the whole batch out
+ *          as rows of a matrix, ordered position-major then sample, so a
+ *          convolution is a single GEMM whose (B * P) x out_c result is
+ *          the B x (out_c * P) output tensor itself.
+ *          Public API functions denoted with "conv" prefix.
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef CONV_H
+#define CONV_H
+
+#define CONV_INVALID_SHAPE      -1
+
+#include "matrix.h"
+
+typedef enum
+{
+    CONV_2D,                 // Convolution, out_c filters + bias
+    CONV_MAX_POOL,           // Channel-wise maximum of each window
+    CONV_AVG_POOL,           // Channel-wise mean of each window
+} conv_type_t;
+
+typedef struct
+{
+    conv_type_t type;
+    size_t      channels;    // Filters of a CONV_2D layer
+    size_t      kernel;      // Square window side
+    size_t      stride;
+    size_t      pad;         // Zero padding on each side
+
+    // Filled in by conv_shape
+    size_t      in_c;
+    size_t      in_h;
+    size_t      in_w;
+    size_t      out_c;
+    size_t      out_h;
+    size_t      out_w;
+} conv_t;
+
+conv_t  conv_2d(size_t channels, size_t kernel, size_t stride, size_t pad);
+conv_t  conv_pool(conv_type_t type, size_t kernel, size_t stride);
+void    conv_shape(conv_t* conv, size_t n, size_t channels, size_t height,
+                   size_t width);
+
+size_t  conv_in_size(const conv_t* conv);
+size_t  conv_out_size(const conv_t* conv);
+size_t  conv_positions(const conv_t* conv);
+size_t  conv_window(const conv_t* conv);
+
+void    conv_im2col(const conv_t* conv, matrix_t* in, matrix_t* cols);
+void    conv_col2im(const conv_t* conv, matrix_t* cols, matrix_t* in);
+
+void    conv_forward(const conv_t* conv, matrix_t* in, matrix_t* w,
+                     matrix_t* b, matrix_t* cols, matrix_t* out);
+void    conv_grad(const conv_t* conv, matrix_t* cols, matrix_t* delta,
+                  matrix_t* grad_w, matrix_t* grad_b);
+void    conv_backward(const conv_t* conv, matrix_t* delta, matrix_t* w,
+                      matrix_t* cols, matrix_t* delta_prev);
+
+void    conv_pool_forward(const conv_t* conv, matrix_t* in, matrix_t* cols,
+                          matrix_t* out);
+void    conv_pool_backward(const conv_t* conv, matrix_t* cols,
+                           matrix_t* delta, matrix_t* delta_prev);
+
+#endif // CONV_H
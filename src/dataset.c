@@ -16,11 +16,13 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "memory.h"
 #include "utils.h"
 
 /* Internal API forward declaration. */
 
 static int _data_reverse_int(int i);
+static unsigned long _data_rand(unsigned long* state);
 
 
 /* ==== DATASET PUBLIC API ==== */
@@ -35,19 +37,22 @@ static int _data_reverse_int(int i);
  */
 dataset_t* data_init(size_t n, size_t input_size, size_t output_size)
 {
-    dataset_t* data = malloc(sizeof(dataset_t));
+    dataset_t* data = mem_malloc(sizeof(dataset_t), MEM_DATASET);
     
     data->n = n;
     data->n_input = input_size;
     data->n_output = output_size;
     
-    data->X = calloc(n, sizeof(double*));
-    data->y = calloc(n, sizeof(double*));
+    data->X = mem_calloc(n, sizeof(double*), MEM_DATASET);
+    data->y = mem_calloc(n, sizeof(double*), MEM_DATASET);
+    data->S = NULL;
+    data->background = 0.f;
+    data->rng = 0;
 
     for (size_t i = 0; i < n; i++)
     {
-        data->X[i] = calloc(input_size, sizeof(double));
-        data->y[i] = calloc(output_size, sizeof(double));
+        data->X[i] = mem_calloc(input_size, sizeof(double), MEM_DATASET);
+        data->y[i] = mem_calloc(output_size, sizeof(double), MEM_DATASET);
     }
 
     return data;
@@ -62,14 +67,33 @@ void data_free(dataset_t* data)
 {
     for (size_t i = 0; i < data->n; i++)
     {
-        free(data->X[i]);
-        free(data->y[i]);
+        mem_free(data->X[i]);
+        mem_free(data->y[i]);
+
+        if (data->S)
+            sp_free(data->S[i]);
     }
 
-    free(data->X);
-    free(data->y);
+    mem_free(data->S);
+    mem_free(data->X);
+    mem_free(data->y);
+
+    mem_free(data);
+}
 
-    free(data);
+/**
+ * @brief  Estimate the bytes data_init allocates, without allocating
+ * 
+ * @param  n Number of elements in dataset
+ * @param  input_size 
+ * @param  output_size 
+ * @return size_t Footprint in bytes
+ */
+size_t data_footprint(size_t n, size_t input_size, size_t output_size)
+{
+    return sizeof(dataset_t)
+         + n * 2 * sizeof(double*)
+         + n * (input_size + output_size) * sizeof(double);
 }
 
 /**
@@ -103,15 +127,20 @@ void data_display(dataset_t* data)
 }
 
 /**
- * @brief Randomly shuffle the dataset
+ * @brief Randomly shuffle the dataset, drawing from data->rng if it is
+ *        set, so that the order does not depend on other rand() users
  * 
  * @param data Dataset to shuffle
  */
 void data_shuffle(dataset_t* data)
 {
+    // dataset_t is packed, its state cannot be passed by address
+    unsigned long rng = data->rng;
+
     for (size_t i = 0; i < data->n; i++)
     {
-        size_t r = i + rand() / (RAND_MAX / (data->n - i) + 1);
+        size_t r = rng ? i + _data_rand(&rng) % (data->n - i)
+                       : i + rand() / (RAND_MAX / (data->n - i) + 1);
 
         double* X_tmp = data->X[r];
         double* y_tmp = data->y[r];
@@ -121,7 +150,181 @@ void data_shuffle(dataset_t* data)
 
         data->X[i] = X_tmp;
         data->y[i] = y_tmp;
+
+        if (data->S)
+        {
+            sparse_t* S_tmp = data->S[r];
+            data->S[r] = data->S[i];
+            data->S[i] = S_tmp;
+        }
+    }
+
+    data->rng = rng;
+}
+
+/**
+ * @brief Build the sparse representation of every input: a background
+ *        constant plus the (index, deviation) pairs of the values that
+ *        differ from it. The dense inputs are kept.
+ *        With normalized MNIST images, the background is -1.
+ * 
+ * @param data Dataset to sparsify
+ * @param background Background constant of the inputs
+ */
+void data_sparsify(dataset_t* data, double background)
+{
+    if (data->S)
+    {
+        for (size_t i = 0; i < data->n; i++)
+            sp_free(data->S[i]);
+
+        mem_free(data->S);
+    }
+
+    data->background = background;
+    data->S = mem_calloc(data->n, sizeof(sparse_t*), MEM_DATASET);
+
+    for (size_t i = 0; i < data->n; i++)
+        data->S[i] = sp_from_dense(data->X[i], data->n_input, background);
+}
+
+/**
+ * @brief  Carve the last n samples out of a dataset into a new dataset.
+ *         The samples are moved, not copied: data shrinks by n.
+ * 
+ * @param  data Dataset to split
+ * @param  n Number of samples to move into the new dataset
+ * @return dataset_t* Dataset holding the last n samples of data
+ */
+dataset_t* data_split(dataset_t* data, size_t n)
+{
+    if (n == 0 || n >= data->n)
+    {
+        errx(DATASET_INVALID_SPLIT,
+             "DATASET::ERROR::SPLIT: "
+             "Cannot split %zu samples out of %zu", n, data->n);
+    }
+
+    dataset_t* split = mem_malloc(sizeof(dataset_t), MEM_DATASET);
+
+    split->n = n;
+    split->n_input = data->n_input;
+    split->n_output = data->n_output;
+
+    split->X = mem_calloc(n, sizeof(double*), MEM_DATASET);
+    split->y = mem_calloc(n, sizeof(double*), MEM_DATASET);
+    split->S = NULL;
+    split->background = data->background;
+    split->rng = 0;
+
+    data->n -= n;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        split->X[i] = data->X[data->n + i];
+        split->y[i] = data->y[data->n + i];
+    }
+
+    if (data->S)
+    {
+        split->S = mem_calloc(n, sizeof(sparse_t*), MEM_DATASET);
+
+        for (size_t i = 0; i < n; i++)
+            split->S[i] = data->S[data->n + i];
+    }
+
+    return split;
+}
+
+/**
+ * @brief  Shallow copy of a dataset: the view has its own sample order,
+ *         so it can be shuffled or split while other threads read data,
+ *         but shares the samples themselves. data must outlive the view.
+ * 
+ * @param  data Dataset to view
+ * @return dataset_t* View, freed with data_view_free
+ */
+dataset_t* data_view(dataset_t* data)
+{
+    dataset_t* view = mem_malloc(sizeof(dataset_t), MEM_DATASET);
+
+    *view = *data;
+    view->X = mem_malloc(data->n * sizeof(double*), MEM_DATASET);
+    view->y = mem_malloc(data->n * sizeof(double*), MEM_DATASET);
+    memcpy(view->X, data->X, data->n * sizeof(double*));
+    memcpy(view->y, data->y, data->n * sizeof(double*));
+
+    if (data->S)
+    {
+        view->S = mem_malloc(data->n * sizeof(sparse_t*), MEM_DATASET);
+        memcpy(view->S, data->S, data->n * sizeof(sparse_t*));
     }
+
+    return view;
+}
+
+/**
+ * @brief Free a view from data_view, leaving its samples alone
+ * 
+ * @param view Dataset view
+ */
+void data_view_free(dataset_t* view)
+{
+    mem_free(view->S);
+    mem_free(view->X);
+    mem_free(view->y);
+    mem_free(view);
+}
+
+/**
+ * @brief Move every sample of other back into data, and free other.
+ *        Reverses data_split.
+ * 
+ * @param data Dataset to append samples to
+ * @param other Dataset to empty and free
+ */
+void data_merge(dataset_t* data, dataset_t* other)
+{
+    if (data->n_input != other->n_input || data->n_output != other->n_output)
+    {
+        errx(DATASET_INPUT_MISMATCH,
+             "DATASET::ERROR::MERGE: "
+             "Incompatible datasets (%zu, %zu) and (%zu, %zu)",
+             data->n_input, data->n_output,
+             other->n_input, other->n_output);
+    }
+
+    if (!data->S != !other->S)
+    {
+        errx(DATASET_INPUT_MISMATCH,
+             "DATASET::ERROR::MERGE: "
+             "Cannot merge a sparse and a dense dataset");
+    }
+
+    data->X = mem_realloc(data->X, (data->n + other->n) * sizeof(double*));
+    data->y = mem_realloc(data->y, (data->n + other->n) * sizeof(double*));
+
+    for (size_t i = 0; i < other->n; i++)
+    {
+        data->X[data->n + i] = other->X[i];
+        data->y[data->n + i] = other->y[i];
+    }
+
+    if (data->S)
+    {
+        data->S = mem_realloc(data->S,
+                              (data->n + other->n) * sizeof(sparse_t*));
+
+        for (size_t i = 0; i < other->n; i++)
+            data->S[data->n + i] = other->S[i];
+    }
+
+    data->n += other->n;
+
+    mem_free(other->S);
+    mem_free(other->X);
+    mem_free(other->y);
+    mem_free(other);
 }
 
 /**
@@ -246,4 +449,17 @@ static int _data_reverse_int(int i)
     c_4 = (i >> 24) & 255;
 
     return ((int) c_1 << 24) + ((int) c_2 << 16) + ((int) c_3 << 8) + c_4;
-}
\ No newline at end of file
+}
+
+/**
+ * @param  state xorshift state, not 0
+ * @return unsigned long Next value of the generator
+ */
+static unsigned long _data_rand(unsigned long* state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+
+    return *state;
+}
@@ -10,11 +10,14 @@
 #ifndef DATASET_H
 #define DATASET_H
 
+#include "sparse.h"
+
 #define LOAD_IMAGES 0
 #define LOAD_LABELS 1
 
 #define DATASET_FAILED_LOAD     -1
 #define DATASET_INPUT_MISMATCH  -2
+#define DATASET_INVALID_SPLIT   -3
 
 typedef unsigned long size_t;
 
@@ -26,13 +29,24 @@ __attribute__((packed, aligned(1)))
     size_t      n_output;    // Output size
     double**    X;
     double**    y;
+
+    sparse_t**  S;           // Sparse copy of X, NULL until data_sparsify
+    double      background;  // Background constant of S
+    unsigned long rng;       // Shuffle generator state, 0 for rand()
 }dataset_t;
 
 dataset_t*  data_init(size_t n, size_t input_size, size_t output_size);
 void        data_free(dataset_t* data);
+size_t      data_footprint(size_t n, size_t input_size, size_t output_size);
 
 void        data_display(dataset_t* data);
 void        data_shuffle(dataset_t* data);
+void        data_sparsify(dataset_t* data, double background);
+
+dataset_t*  data_split(dataset_t* data, size_t n);
+dataset_t*  data_view(dataset_t* data);
+void        data_view_free(dataset_t* view);
+void        data_merge(dataset_t* data, dataset_t* other);
 
 void        data_load_mnist(const char* path, dataset_t* data, int load_type);
 
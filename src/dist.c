@@ -0,0 +1,308 @@
+/**
+ * @file    dist.c
+ * @author  Philippe Bouchet (philippe.bouchet@epita.fr)
+ * @brief   Shared-memory multi-process collectives implementation.
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "dist.h"
+
+#include <err.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* Internal API forward declaration */
+
+static double*  _dist_slot(dist_t* dist, size_t rank);
+static void     _dist_chunk(size_t n, size_t world, size_t c,
+                            size_t* lo, size_t* hi);
+
+
+/* ==== DIST PUBLIC API ==== */
+
+
+/**
+ * @brief  Run fn in world forked processes sharing one segment, and wait
+ *         for all of them. The segment is unlinked as soon as it is
+ *         mapped, so nothing is left in /dev/shm if a rank crashes; if one
+ *         does, the other ranks (which would block in the next barrier)
+ *         are killed.
+ *
+ * @param  world Number of ranks
+ * @param  size Largest buffer, in doubles, any collective will be given
+ * @param  fn Rank entry point, its return value is the exit status
+ * @param  args Arguments of fn
+ * @return int 0 if every rank returned 0, -1 otherwise
+ */
+int dist_launch(size_t world, size_t size, dist_main_t fn, void* args)
+{
+    if (world == 0 || size == 0)
+    {
+        errx(DIST_INVALID_SIZE,
+             "DIST::ERROR::LAUNCH: "
+             "Invalid world %zu or buffer size %zu", world, size);
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "/deepsea-%d", (int) getpid());
+
+    size_t stride = (size + DIST_ALIGN - 1) / DIST_ALIGN * DIST_ALIGN;
+    size_t header = (sizeof(dist_shared_t) + 63) / 64 * 64;
+    size_t map_size = header + world * stride * sizeof(double);
+
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+
+    if (fd == -1 || ftruncate(fd, map_size) == -1)
+    {
+        err(DIST_FAILED_INIT,
+            "DIST::ERROR::LAUNCH: "
+            "Could not create shared memory segment %s", name);
+    }
+
+    void* map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     fd, 0);
+
+    close(fd);
+    shm_unlink(name);
+
+    if (map == MAP_FAILED)
+    {
+        err(DIST_FAILED_INIT,
+            "DIST::ERROR::LAUNCH: "
+            "Could not map shared memory segment %s", name);
+    }
+
+    dist_shared_t* shared = map;
+    pthread_barrierattr_t attr;
+
+    shared->world = world;
+    shared->size = size;
+    shared->stride = stride;
+
+    pthread_barrierattr_init(&attr);
+    pthread_barrierattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_barrier_init(&shared->barrier, &attr, world);
+    pthread_barrierattr_destroy(&attr);
+
+    pid_t* pids = calloc(world, sizeof(pid_t));
+
+    // Buffered output would otherwise be written once per rank
+    fflush(NULL);
+
+    for (size_t r = 0; r < world; r++)
+    {
+        pids[r] = fork();
+
+        if (pids[r] == -1)
+        {
+            err(DIST_FAILED_INIT,
+                "DIST::ERROR::LAUNCH: "
+                "Could not fork rank %zu", r);
+        }
+
+        if (pids[r] == 0)
+        {
+            dist_t dist = {
+                .rank = r,
+                .world = world,
+                .size = size,
+                .shared = shared,
+                .slots = (double*) ((char*) map + header),
+            };
+
+            exit(fn(&dist, args));
+        }
+    }
+
+    int failed = 0;
+
+    for (size_t done = 0; done < world; done++)
+    {
+        int status;
+        pid_t pid = wait(&status);
+
+        if (pid == -1)
+            break;
+
+        if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+            continue;
+
+        if (!failed)
+        {
+            for (size_t r = 0; r < world; r++)
+            {
+                if (pids[r] != pid)
+                    kill(pids[r], SIGKILL);
+            }
+        }
+
+        failed = 1;
+    }
+
+    free(pids);
+
+    // Killed ranks may have died inside the barrier, it cannot be destroyed
+    if (!failed)
+        pthread_barrier_destroy(&shared->barrier);
+
+    munmap(map, map_size);
+
+    return failed ? -1 : 0;
+}
+
+/**
+ * @brief Wait for every rank
+ *
+ * @param dist Rank handle
+ */
+void dist_barrier(dist_t* dist)
+{
+    pthread_barrier_wait(&dist->shared->barrier);
+}
+
+/**
+ * @brief Sum x over every rank, in place. The buffer is split in world
+ *        chunks; a reduce-scatter pass leaves each chunk fully summed on
+ *        one rank, then an all-gather pass copies that chunk verbatim to
+ *        the others, so every rank ends with the same bits. Each of the
+ *        2 * (world - 1) steps only reads the previous rank's slot.
+ *
+ * @param dist Rank handle
+ * @param x Buffer to sum
+ * @param n Number of doubles, at most dist->size
+ */
+void dist_allreduce(dist_t* dist, double* x, size_t n)
+{
+    if (n > dist->size)
+    {
+        errx(DIST_INVALID_SIZE,
+             "DIST::ERROR::ALLREDUCE: "
+             "Buffer of %zu doubles exceeds %zu", n, dist->size);
+    }
+
+    size_t W = dist->world;
+    double* own = _dist_slot(dist, dist->rank);
+    double* prev = _dist_slot(dist, (dist->rank + W - 1) % W);
+    size_t lo, hi;
+
+    memcpy(own, x, n * sizeof(double));
+    dist_barrier(dist);
+
+    // Reduce-scatter: rank r ends with chunk (r + 1) % W summed
+    for (size_t s = 0; s + 1 < W; s++)
+    {
+        _dist_chunk(n, W, (dist->rank + 2 * W - 1 - s) % W, &lo, &hi);
+
+        for (size_t i = lo; i < hi; i++)
+            own[i] += prev[i];
+
+        dist_barrier(dist);
+    }
+
+    // All-gather: rank r copies the chunk its predecessor completed last
+    for (size_t s = 0; s + 1 < W; s++)
+    {
+        _dist_chunk(n, W, (dist->rank + W - s) % W, &lo, &hi);
+        memcpy(own + lo, prev + lo, (hi - lo) * sizeof(double));
+
+        dist_barrier(dist);
+    }
+
+    memcpy(x, own, n * sizeof(double));
+}
+
+/**
+ * @brief Copy x of rank root to every rank
+ *
+ * @param dist Rank handle
+ * @param x Buffer, read on root and written on the other ranks
+ * @param n Number of doubles, at most dist->size
+ * @param root Rank holding the data
+ */
+void dist_broadcast(dist_t* dist, double* x, size_t n, size_t root)
+{
+    if (n > dist->size || root >= dist->world)
+    {
+        errx(DIST_INVALID_SIZE,
+             "DIST::ERROR::BROADCAST: "
+             "Invalid buffer of %zu doubles or root %zu", n, root);
+    }
+
+    double* slot = _dist_slot(dist, root);
+
+    if (dist->rank == root)
+        memcpy(slot, x, n * sizeof(double));
+
+    dist_barrier(dist);
+
+    if (dist->rank != root)
+        memcpy(x, slot, n * sizeof(double));
+
+    dist_barrier(dist);
+}
+
+/**
+ * @brief  Check that x holds the same bits on every rank
+ *
+ * @param  dist Rank handle
+ * @param  x Buffer to compare
+ * @param  n Number of doubles, at most dist->size
+ * @return int 1 on every rank if all buffers are identical, 0 on every
+ *         rank otherwise
+ */
+int dist_identical(dist_t* dist, const double* x, size_t n)
+{
+    if (n > dist->size)
+    {
+        errx(DIST_INVALID_SIZE,
+             "DIST::ERROR::IDENTICAL: "
+             "Buffer of %zu doubles exceeds %zu", n, dist->size);
+    }
+
+    memcpy(_dist_slot(dist, dist->rank), x, n * sizeof(double));
+    dist_barrier(dist);
+
+    double differ = memcmp(_dist_slot(dist, dist->rank), _dist_slot(dist, 0),
+                           n * sizeof(double)) != 0;
+
+    dist_barrier(dist);
+    dist_allreduce(dist, &differ, 1);
+
+    return differ == 0.f;
+}
+
+
+/* ==== DIST INTERNAL API ==== */
+
+
+/**
+ * @return double* Slot of a rank in the shared segment
+ */
+static double* _dist_slot(dist_t* dist, size_t rank)
+{
+    return dist->slots + rank * dist->shared->stride;
+}
+
+/**
+ * @brief Bounds of chunk c when n doubles are split in world chunks
+ *
+ * @param n Number of doubles
+ * @param world Number of chunks
+ * @param c Chunk index
+ * @param lo First index of the chunk
+ * @param hi One past the last index of the chunk
+ */
+static void _dist_chunk(size_t n, size_t world, size_t c,
+                        size_t* lo, size_t* hi)
+{
+    *lo = n * c / world;
+    *hi = n * (c + 1) / world;
+}
@@ -0,0 +1,51 @@
+/**
+ * @file    dist.h
+ * @author  Philippe Bouchet (philippe.bouchet@epita.fr)
+ * @brief   Multi-process collectives over POSIX shared memory: a launcher
+ *          forking one process per rank, a barrier, and a ring all-reduce
+ *          whose result is bit-identical on every rank.
+ *          Public API functions denoted with "dist" prefix.
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef DIST_H
+#define DIST_H
+
+#include <pthread.h>
+
+#define DIST_FAILED_INIT    -1
+#define DIST_INVALID_SIZE   -2
+
+#define DIST_ALIGN          8   // Slot strides, in doubles (64 bytes)
+
+typedef unsigned long size_t;
+
+typedef struct
+{
+    size_t      world;
+    size_t      size;        // Doubles per slot
+    size_t      stride;      // Doubles between two slots
+    pthread_barrier_t barrier;
+} dist_shared_t;
+
+typedef struct
+{
+    size_t      rank;
+    size_t      world;
+    size_t      size;        // Largest buffer a collective accepts
+    dist_shared_t* shared;   // Header of the segment
+    double*     slots;       // One slot per rank, after the header
+} dist_t;
+
+typedef int (*dist_main_t)(dist_t* dist, void* args);
+
+int     dist_launch(size_t world, size_t size, dist_main_t fn, void* args);
+
+void    dist_barrier(dist_t* dist);
+void    dist_allreduce(dist_t* dist, double* x, size_t n);
+void    dist_broadcast(dist_t* dist, double* x, size_t n, size_t root);
+int     dist_identical(dist_t* dist, const double* x, size_t n);
+
+#endif // DIST_H
@@ -0,0 +1,387 @@
+/**
+ * @file    graph.c
+ * @author  Philippe Bouchet (philippe.bouchet@epita.fr)
+ * @brief   Static computation graph and memory planner implementation.
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "graph.h"
+
+#include <err.h>
+#include <stdlib.h>
+
+#include "memory.h"
+
+/* Internal API forward declaration */
+
+static void     _graph_use(graph_t* graph, size_t step, size_t tensor);
+static size_t   _graph_tensor_size(g_tensor_t* t);
+static void     _graph_sort(graph_t* graph, size_t* ids, size_t n,
+                            int by_offset);
+
+
+/* ==== GRAPH PUBLIC API ==== */
+
+
+/**
+ * @return graph_t* Empty graph
+ */
+graph_t* graph_init(void)
+{
+    graph_t* graph = mem_calloc(1, sizeof(graph_t), MEM_NETWORK);
+
+    graph->tensor_cap = GRAPH_INIT_CAPACITY;
+    graph->step_cap = GRAPH_INIT_CAPACITY;
+    graph->tensors = mem_malloc(graph->tensor_cap * sizeof(g_tensor_t),
+                                MEM_NETWORK);
+    graph->steps = mem_malloc(graph->step_cap * sizeof(g_step_t),
+                              MEM_NETWORK);
+
+    return graph;
+}
+
+/**
+ * @brief Free the graph, its arena and its tensor views
+ *
+ * @param graph Graph
+ */
+void graph_free(graph_t* graph)
+{
+    for (size_t i = 0; i < graph->n_tensors; i++)
+    {
+        // Views do not own their array, only the struct is freed
+        if (graph->tensors[i].m)
+            mem_free(graph->tensors[i].m);
+    }
+
+    if (graph->arena)
+        mem_free(graph->arena);
+
+    mem_free(graph->tensors);
+    mem_free(graph->steps);
+    mem_free(graph);
+}
+
+/**
+ * @brief  Declare a tensor, at its largest (full batch) shape
+ *
+ * @param  graph Graph
+ * @param  n_row Number of rows
+ * @param  n_col Number of columns
+ * @return size_t Tensor index
+ */
+size_t graph_tensor(graph_t* graph, size_t n_row, size_t n_col)
+{
+    if (graph->n_tensors == graph->tensor_cap)
+    {
+        graph->tensor_cap *= 2;
+        graph->tensors = mem_realloc(graph->tensors, graph->tensor_cap
+                                                     * sizeof(g_tensor_t));
+    }
+
+    g_tensor_t* t = &graph->tensors[graph->n_tensors];
+
+    t->n_row = n_row;
+    t->n_col = n_col;
+    t->offset = 0;
+    t->first = (size_t) -1;
+    t->last = 0;
+    t->m = NULL;
+
+    graph->planned = 0;
+
+    return graph->n_tensors++;
+}
+
+/**
+ * @brief  Append a step to the schedule
+ *
+ * @param  graph Graph
+ * @param  op Operation of the step
+ * @param  layer Layer the step operates on
+ * @return size_t Step index
+ */
+size_t graph_step(graph_t* graph, g_op_t op, size_t layer)
+{
+    if (graph->n_steps == graph->step_cap)
+    {
+        graph->step_cap *= 2;
+        graph->steps = mem_realloc(graph->steps, graph->step_cap
+                                                 * sizeof(g_step_t));
+    }
+
+    g_step_t* s = &graph->steps[graph->n_steps];
+
+    s->op = op;
+    s->layer = layer;
+    s->n_in = 0;
+    s->n_out = 0;
+
+    graph->planned = 0;
+
+    return graph->n_steps++;
+}
+
+/**
+ * @brief Declare that a step reads a tensor
+ *
+ * @param graph Graph
+ * @param step Step index
+ * @param tensor Tensor index
+ */
+void graph_read(graph_t* graph, size_t step, size_t tensor)
+{
+    _graph_use(graph, step, tensor);
+
+    g_step_t* s = &graph->steps[step];
+    s->in[s->n_in++] = tensor;
+}
+
+/**
+ * @brief Declare that a step writes a tensor
+ *
+ * @param graph Graph
+ * @param step Step index
+ * @param tensor Tensor index
+ */
+void graph_write(graph_t* graph, size_t step, size_t tensor)
+{
+    _graph_use(graph, step, tensor);
+
+    g_step_t* s = &graph->steps[step];
+    s->out[s->n_out++] = tensor;
+}
+
+/**
+ * @brief Mark the steps declared so far as the forward pass
+ *
+ * @param graph Graph
+ */
+void graph_end_forward(graph_t* graph)
+{
+    graph->n_forward = graph->n_steps;
+}
+
+/**
+ * @brief Assign every tensor an arena offset. A tensor lives from the
+ *        first to the last step using it; tensors are placed from the
+ *        largest to the smallest, each at the lowest offset free of any
+ *        placed tensor with an overlapping lifetime.
+ *
+ * @param graph Graph
+ */
+void graph_plan(graph_t* graph)
+{
+    size_t n = graph->n_tensors;
+    size_t* order = malloc(n * sizeof(size_t));
+    size_t* live = malloc(n * sizeof(size_t));
+    size_t n_placed = 0;
+
+    graph->arena_size = 0;
+    graph->naive_size = 0;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        order[i] = i;
+        graph->naive_size += _graph_tensor_size(&graph->tensors[i]);
+    }
+
+    _graph_sort(graph, order, n, 0);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        g_tensor_t* t = &graph->tensors[order[i]];
+        size_t size = _graph_tensor_size(t);
+        size_t n_live = 0;
+
+        if (t->first > t->last)
+        {
+            errx(GRAPH_INVALID_TENSOR,
+                 "GRAPH::ERROR::PLAN: "
+                 "Tensor %zu is not used by any step", order[i]);
+        }
+
+        // Placed tensors alive at the same time as t
+        for (size_t j = 0; j < n_placed; j++)
+        {
+            g_tensor_t* p = &graph->tensors[order[j]];
+
+            if (p->first <= t->last && t->first <= p->last)
+                live[n_live++] = order[j];
+        }
+
+        _graph_sort(graph, live, n_live, 1);
+
+        // First gap large enough, in offset order
+        size_t offset = 0;
+
+        for (size_t j = 0; j < n_live; j++)
+        {
+            g_tensor_t* p = &graph->tensors[live[j]];
+
+            if (p->offset >= offset + size)
+                break;
+
+            size_t end = p->offset + _graph_tensor_size(p);
+
+            if (end > offset)
+                offset = end;
+        }
+
+        t->offset = offset;
+        n_placed++;
+
+        if (offset + size > graph->arena_size)
+            graph->arena_size = offset + size;
+    }
+
+    free(order);
+    free(live);
+
+    graph->planned = 1;
+}
+
+/**
+ * @brief Allocate the arena of a planned graph, and a matrix view of
+ *        every tensor into it
+ *
+ * @param graph Graph
+ */
+void graph_alloc(graph_t* graph)
+{
+    if (!graph->planned)
+    {
+        errx(GRAPH_NOT_PLANNED,
+             "GRAPH::ERROR::ALLOC: "
+             "Graph must be planned before allocation");
+    }
+
+    // Offsets are multiples of GRAPH_ALIGN, so is the base
+    graph->arena = mem_aligned(graph->arena_size * sizeof(double),
+                               GRAPH_ALIGN * sizeof(double),
+                               MEM_ACTIVATIONS);
+
+    for (size_t i = 0; i < graph->n_tensors; i++)
+    {
+        g_tensor_t* t = &graph->tensors[i];
+        matrix_t* m = mem_malloc(sizeof(matrix_t), MEM_ACTIVATIONS);
+
+        m->array = graph->arena + t->offset;
+        m->n_row = t->n_row;
+        m->n_col = t->n_col;
+        m->size = t->n_row * t->n_col;
+        m->capacity = m->size;
+
+        t->m = m;
+    }
+}
+
+/**
+ * @param  graph Allocated graph
+ * @param  tensor Tensor index
+ * @return matrix_t* View of the tensor. It must not be freed with m_free.
+ */
+matrix_t* graph_matrix(graph_t* graph, size_t tensor)
+{
+    if (tensor >= graph->n_tensors || graph->tensors[tensor].m == NULL)
+    {
+        errx(GRAPH_INVALID_TENSOR,
+             "GRAPH::ERROR::MATRIX: "
+             "Tensor %zu is not allocated", tensor);
+    }
+
+    return graph->tensors[tensor].m;
+}
+
+
+/* ==== GRAPH INTERNAL API ==== */
+
+
+/**
+ * @brief Extend the lifetime of a tensor to a step
+ *
+ * @param graph Graph
+ * @param step Step index
+ * @param tensor Tensor index
+ */
+static void _graph_use(graph_t* graph, size_t step, size_t tensor)
+{
+    if (tensor >= graph->n_tensors)
+    {
+        errx(GRAPH_INVALID_TENSOR,
+             "GRAPH::ERROR::USE: "
+             "Invalid tensor %zu", tensor);
+    }
+
+    if (step >= graph->n_steps
+        || graph->steps[step].n_in == GRAPH_MAX_IO
+        || graph->steps[step].n_out == GRAPH_MAX_IO)
+    {
+        errx(GRAPH_INVALID_STEP,
+             "GRAPH::ERROR::USE: "
+             "Invalid step %zu, or too many tensors", step);
+    }
+
+    g_tensor_t* t = &graph->tensors[tensor];
+
+    if (step < t->first)
+        t->first = step;
+
+    if (step > t->last)
+        t->last = step;
+}
+
+/**
+ * @return size_t Size of the tensor in the arena, in doubles, rounded up
+ *         so that every tensor starts on a cache line
+ */
+static size_t _graph_tensor_size(g_tensor_t* t)
+{
+    size_t size = t->n_row * t->n_col;
+
+    return (size + GRAPH_ALIGN - 1) / GRAPH_ALIGN * GRAPH_ALIGN;
+}
+
+/**
+ * @brief Insertion sort of tensor indices: by decreasing size (then
+ *        increasing first step), or by increasing offset. Graphs only
+ *        have a few tensors per layer.
+ *
+ * @param graph Graph
+ * @param ids Tensor indices to sort
+ * @param n Number of indices
+ * @param by_offset Sort by offset instead of size
+ */
+static void _graph_sort(graph_t* graph, size_t* ids, size_t n,
+                        int by_offset)
+{
+    for (size_t i = 1; i < n; i++)
+    {
+        size_t id = ids[i];
+        g_tensor_t* t = &graph->tensors[id];
+        size_t j = i;
+
+        while (j > 0)
+        {
+            g_tensor_t* p = &graph->tensors[ids[j - 1]];
+            int before;
+
+            if (by_offset)
+                before = t->offset < p->offset;
+            else if (_graph_tensor_size(t) != _graph_tensor_size(p))
+                before = _graph_tensor_size(t) > _graph_tensor_size(p);
+            else
+                before = t->first < p->first;
+
+            if (!before)
+                break;
+
+            ids[j] = ids[j - 1];
+            j--;
+        }
+
+        ids[j] = id;
+    }
+}
@@ -0,0 +1,92 @@
+/**
+ * @file    graph.h
+ * @author  Philippe Bouchet (philippe.bouchet@epita.fr)
+ * @brief   Static computation graph: a schedule of steps over batched
+ *          tensors, with an ahead-of-time memory planner placing every
+ *          tensor in a single arena, reusing memory between tensors whose
+ *          lifetimes do not overlap.
+ *          Public API functions denoted with "graph" prefix.
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef GRAPH_H
+#define GRAPH_H
+
+#define GRAPH_INVALID_TENSOR    -1
+#define GRAPH_INVALID_STEP      -2
+#define GRAPH_NOT_PLANNED       -3
+
+#define GRAPH_MAX_IO            3   // Tensors read / written per step
+#define GRAPH_ALIGN             8   // Tensor offsets, in doubles (64 bytes)
+#define GRAPH_INIT_CAPACITY     16
+
+#include "matrix.h"
+
+typedef enum
+{
+    G_LOAD,                  // Batch inputs and targets are written
+    G_DENSE,                 // z = a_prev . w + b
+    G_ACT,                   // a = f(z)
+    G_LOSS,                  // Output delta
+    G_DENSE_GRAD,            // Weight and bias gradients of a layer
+    G_DENSE_BWD,             // delta_prev = delta . transpose(w)
+    G_ACT_BWD,               // delta *= f'(a)
+    G_CONV,                  // a = im2col(a_prev) . w + b
+    G_POOL,                  // a = max or mean of the windows of a_prev
+    G_CONV_GRAD,             // Filter and bias gradients of a convolution
+    G_CONV_BWD,              // delta_prev = col2im(delta . transpose(w))
+    G_POOL_BWD,              // delta_prev = col2im(window deltas)
+} g_op_t;
+
+typedef struct
+{
+    size_t      n_row;
+    size_t      n_col;
+    size_t      offset;      // Position in the arena, in doubles
+    size_t      first;       // First step using the tensor
+    size_t      last;        // Last step using the tensor
+    matrix_t*   m;           // View into the arena, once allocated
+} g_tensor_t;
+
+typedef struct
+{
+    g_op_t      op;
+    size_t      layer;
+    size_t      n_in;
+    size_t      n_out;
+    size_t      in[GRAPH_MAX_IO];
+    size_t      out[GRAPH_MAX_IO];
+} g_step_t;
+
+typedef struct
+{
+    size_t      n_tensors;
+    size_t      n_steps;
+    size_t      n_forward;   // Steps [0, n_forward) are the forward pass
+    size_t      tensor_cap;
+    size_t      step_cap;
+    g_tensor_t* tensors;
+    g_step_t*   steps;
+
+    int         planned;
+    size_t      arena_size;  // Planned arena, in doubles
+    size_t      naive_size;  // Sum of all tensors, in doubles
+    double*     arena;
+} graph_t;
+
+graph_t*    graph_init(void);
+void        graph_free(graph_t* graph);
+
+size_t      graph_tensor(graph_t* graph, size_t n_row, size_t n_col);
+size_t      graph_step(graph_t* graph, g_op_t op, size_t layer);
+void        graph_read(graph_t* graph, size_t step, size_t tensor);
+void        graph_write(graph_t* graph, size_t step, size_t tensor);
+void        graph_end_forward(graph_t* graph);
+
+void        graph_plan(graph_t* graph);
+void        graph_alloc(graph_t* graph);
+matrix_t*   graph_matrix(graph_t* graph, size_t tensor);
+
+#endif // GRAPH_H
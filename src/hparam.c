@@ -0,0 +1,405 @@
+/**
+ * @file    hparam.c
+ * @author  Philippe Bouchet (philippe.bouchet@epita.fr)
+ * @brief   Hyperparameter sweep implementation.
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "hparam.h"
+
+#include <err.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "memory.h"
+#include "topology.h"
+#include "utils.h"
+
+/* Internal API forward declaration */
+
+static unsigned long _hparam_rand(unsigned long* state);
+static void     _hparam_worker(void* args, size_t worker);
+static void     _hparam_trial(hparam_sweep_t* sweep, size_t id);
+static int      _hparam_epoch(network_t* net, size_t epoch, void* args);
+static int      _hparam_report(hparam_sweep_t* sweep,
+                               hparam_trial_t* trial, double acc);
+static int      _hparam_cmp_double(const void* a, const void* b);
+
+
+/* ==== HPARAM PUBLIC API ==== */
+
+
+/**
+ * @return hparam_config_t Two layer networks, 5 epochs on one CPU per
+ *         trial, stopped from the second epoch against 3 other trials
+ */
+hparam_config_t hparam_config_default(void)
+{
+    hparam_config_t config = {
+        .L = 2,
+        .epochs = 5,
+        .cores = 1,
+        .n_parallel = 0,
+        .grace = 1,
+        .min_peers = 3,
+        .seed = 42,
+        .verbose = 1,
+    };
+
+    return config;
+}
+
+/**
+ * @brief  Lay out the trials of a search space: every combination of its
+ *         values, hidden size first, or n_random draws with hidden and
+ *         batch sizes picked from their values and the learning rate
+ *         log-uniform between its smallest and largest value.
+ *
+ * @param  space Search space
+ * @param  config Sweep configuration
+ * @param  train Training set, only read
+ * @param  val Validation set, only read
+ * @return hparam_sweep_t* Sweep, run with hparam_run
+ */
+hparam_sweep_t* hparam_init(const hparam_space_t* space,
+                            const hparam_config_t* config,
+                            dataset_t* train, dataset_t* val)
+{
+    if (space->n_hidden == 0 || space->n_batch == 0 || space->n_lr == 0
+        || space->n_hidden > HPARAM_MAX_VALUES
+        || space->n_batch > HPARAM_MAX_VALUES
+        || space->n_lr > HPARAM_MAX_VALUES
+        || config->epochs == 0 || config->cores == 0)
+    {
+        errx(HPARAM_INVALID_SPACE,
+             "HPARAM::ERROR::INIT: "
+             "Invalid sweep of %zu hidden sizes, %zu batch sizes and %zu "
+             "learning rates", space->n_hidden, space->n_batch,
+             space->n_lr);
+    }
+
+    hparam_sweep_t* sweep = mem_calloc(1, sizeof(hparam_sweep_t), MEM_NETWORK);
+    size_t n_cpus = topo_get()->n_cpus;
+
+    sweep->config = *config;
+    sweep->train = train;
+    sweep->val = val;
+    sweep->n_trials = space->n_random ? space->n_random
+                    : space->n_hidden * space->n_batch * space->n_lr;
+    sweep->trials = mem_calloc(sweep->n_trials, sizeof(hparam_trial_t),
+                               MEM_NETWORK);
+    sweep->peers = mem_calloc(sweep->n_trials, sizeof(double), MEM_NETWORK);
+
+    if (sweep->config.n_parallel == 0)
+    {
+        sweep->config.n_parallel = n_cpus > config->cores
+                                 ? n_cpus / config->cores : 1;
+    }
+
+    if (sweep->config.n_parallel > sweep->n_trials)
+        sweep->config.n_parallel = sweep->n_trials;
+
+    double lr_min = space->lr[0];
+    double lr_max = space->lr[0];
+    unsigned long rng = config->seed ? config->seed : 1;
+
+    for (size_t i = 1; i < space->n_lr; i++)
+    {
+        lr_min = space->lr[i] < lr_min ? space->lr[i] : lr_min;
+        lr_max = space->lr[i] > lr_max ? space->lr[i] : lr_max;
+    }
+
+    for (size_t i = 0; i < sweep->n_trials; i++)
+    {
+        hparam_trial_t* trial = &sweep->trials[i];
+
+        if (space->n_random)
+        {
+            double u = (_hparam_rand(&rng) >> 11) * 0x1.0p-53;
+
+            trial->hidden = space->hidden[_hparam_rand(&rng)
+                                          % space->n_hidden];
+            trial->batch = space->batch[_hparam_rand(&rng) % space->n_batch];
+            trial->lr = lr_min * pow(lr_max / lr_min, u);
+        }
+
+        else
+        {
+            size_t k = i;
+
+            trial->lr = space->lr[k % space->n_lr];
+            k /= space->n_lr;
+            trial->batch = space->batch[k % space->n_batch];
+            k /= space->n_batch;
+            trial->hidden = space->hidden[k];
+        }
+
+        trial->acc_curve = mem_calloc(config->epochs, sizeof(double),
+                                      MEM_NETWORK);
+        trial->time_curve = mem_calloc(config->epochs, sizeof(double),
+                                       MEM_NETWORK);
+    }
+
+    pthread_mutex_init(&sweep->lock, NULL);
+    sweep->pool = pool_init(sweep->config.n_parallel, AFFINITY_NONE);
+
+    return sweep;
+}
+
+/**
+ * @param sweep Sweep to free, its datasets are not
+ */
+void hparam_free(hparam_sweep_t* sweep)
+{
+    pool_free(sweep->pool);
+    pthread_mutex_destroy(&sweep->lock);
+
+    for (size_t i = 0; i < sweep->n_trials; i++)
+    {
+        mem_free(sweep->trials[i].acc_curve);
+        mem_free(sweep->trials[i].time_curve);
+    }
+
+    mem_free(sweep->trials);
+    mem_free(sweep->peers);
+    mem_free(sweep);
+}
+
+/**
+ * @brief Run every trial: each worker takes the next trial not started
+ *        until none is left
+ *
+ * @param sweep Sweep
+ */
+void hparam_run(hparam_sweep_t* sweep)
+{
+    sweep->next = 0;
+    sweep->start = get_time();
+
+    pool_run(sweep->pool, _hparam_worker, sweep);
+}
+
+/**
+ * @param  sweep Sweep, after hparam_run
+ * @return hparam_trial_t* Trial with the best validation accuracy
+ */
+hparam_trial_t* hparam_best(hparam_sweep_t* sweep)
+{
+    hparam_trial_t* best = &sweep->trials[0];
+
+    for (size_t i = 1; i < sweep->n_trials; i++)
+    {
+        if (sweep->trials[i].accuracy > best->accuracy)
+            best = &sweep->trials[i];
+    }
+
+    return best;
+}
+
+/**
+ * @brief Write the results as a tab separated table, one row per epoch
+ *        of each trial: validation accuracy against seconds since the
+ *        sweep started. The last row of a trial has status "done" or
+ *        "stopped".
+ *
+ * @param sweep Sweep, after hparam_run
+ * @param fp Output stream
+ */
+void hparam_write(hparam_sweep_t* sweep, FILE* fp)
+{
+    fprintf(fp, "trial\thidden\tbatch\tlr\tepoch\ttime_s\taccuracy"
+                "\tstatus\n");
+
+    for (size_t i = 0; i < sweep->n_trials; i++)
+    {
+        hparam_trial_t* trial = &sweep->trials[i];
+
+        for (size_t e = 0; e < trial->epochs; e++)
+        {
+            const char* status = e + 1 < trial->epochs ? "running"
+                               : trial->stopped ? "stopped" : "done";
+
+            fprintf(fp, "%zu\t%zu\t%zu\t%g\t%zu\t%.3f\t%.4f\t%s\n", i,
+                    trial->hidden, trial->batch, trial->lr, e + 1,
+                    trial->time_curve[e], trial->acc_curve[e], status);
+        }
+    }
+}
+
+
+/* ==== HPARAM INTERNAL API ==== */
+
+
+typedef struct
+{
+    hparam_sweep_t* sweep;
+    hparam_trial_t* trial;
+} hparam_epoch_t;
+
+/**
+ * @param  state xorshift state
+ * @return unsigned long Next value of the generator
+ */
+static unsigned long _hparam_rand(unsigned long* state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+
+    return *state;
+}
+
+/**
+ * @brief Worker job: confine the worker to its own CPUs, which the
+ *        training threads of its trials inherit, then run trials
+ */
+static void _hparam_worker(void* args, size_t worker)
+{
+    hparam_sweep_t* sweep = args;
+
+    topo_bind_range(worker * sweep->config.cores, sweep->config.cores);
+
+    while (1)
+    {
+        pthread_mutex_lock(&sweep->lock);
+        size_t id = sweep->next++;
+        pthread_mutex_unlock(&sweep->lock);
+
+        if (id >= sweep->n_trials)
+            break;
+
+        _hparam_trial(sweep, id);
+    }
+}
+
+/**
+ * @brief Train the network of a trial on its own view of the training
+ *        set, shuffled by a generator of its own, until its last epoch or
+ *        until it is stopped
+ *
+ * @param sweep Sweep
+ * @param id Index of the trial
+ */
+static void _hparam_trial(hparam_sweep_t* sweep, size_t id)
+{
+    hparam_trial_t* trial = &sweep->trials[id];
+    dataset_t* train = data_view(sweep->train);
+    double start = get_time();
+
+    // Never 0, which would make data_shuffle draw from rand()
+    train->rng = (sweep->config.seed + id) * 0x9E3779B97F4A7C15ul | 1;
+
+    pthread_mutex_lock(&sweep->lock);
+    srand(sweep->config.seed + id);
+
+    network_t* net = net_init(sweep->config.L, train->n_input, trial->hidden,
+                              train->n_output, trial->batch, trial->lr);
+
+    for (size_t l = 0; l + 1 < net->L; l++)
+        net_set_activation(net, l, ACT_RELU);
+
+    net_set_activation(net, net->L - 1, ACT_SOFTMAX);
+    pthread_mutex_unlock(&sweep->lock);
+
+    // Workers are unpinned, and stay on the CPUs of the trial
+    hparam_epoch_t args = { .sweep = sweep, .trial = trial };
+    train_config_t config = net_config_default(sweep->config.epochs);
+    config.verbose = 0;
+    config.n_threads = sweep->config.cores;
+    config.affinity = AFFINITY_NONE;
+    config.on_epoch = _hparam_epoch;
+    config.on_epoch_args = &args;
+
+    net_fit(net, train, &config);
+
+    trial->time = get_time() - start;
+
+    if (sweep->config.verbose)
+    {
+        pthread_mutex_lock(&sweep->lock);
+        printf("Trial %zu: hidden %zu, batch %zu, lr %g - %.2f%% after "
+               "%zu epochs in %.1fs%s\n", id, trial->hidden, trial->batch,
+               trial->lr, trial->accuracy * 100, trial->epochs, trial->time,
+               trial->stopped ? " (stopped)" : "");
+        pthread_mutex_unlock(&sweep->lock);
+    }
+
+    net_free(net);
+    data_view_free(train);
+}
+
+/**
+ * @brief net_fit epoch hook: report the validation accuracy of the epoch,
+ *        and stop training if the trial is stopped
+ */
+static int _hparam_epoch(network_t* net, size_t epoch, void* args)
+{
+    hparam_epoch_t* e = args;
+
+    (void) epoch;
+
+    return _hparam_report(e->sweep, e->trial,
+                          net_accuracy(net, e->sweep->val));
+}
+
+/**
+ * @brief  Record the validation accuracy of a trial's latest epoch, and
+ *         apply the median stopping rule to it
+ *
+ * @param  sweep Sweep
+ * @param  trial Trial
+ * @param  acc Validation accuracy after the epoch
+ * @return int Whether the trial is stopped
+ */
+static int _hparam_report(hparam_sweep_t* sweep, hparam_trial_t* trial,
+                          double acc)
+{
+    pthread_mutex_lock(&sweep->lock);
+
+    size_t e = trial->epochs++;
+    double* peers = sweep->peers;
+    size_t n_peers = 0;
+
+    trial->acc_curve[e] = acc;
+    trial->time_curve[e] = get_time() - sweep->start;
+
+    if (acc > trial->accuracy)
+        trial->accuracy = acc;
+
+    for (size_t i = 0; i < sweep->n_trials; i++)
+    {
+        hparam_trial_t* other = &sweep->trials[i];
+
+        if (other != trial && other->epochs > e)
+            peers[n_peers++] = other->acc_curve[e];
+    }
+
+    if (e + 1 > sweep->config.grace && e + 1 < sweep->config.epochs
+        && n_peers >= sweep->config.min_peers && n_peers > 0)
+    {
+        qsort(peers, n_peers, sizeof(double), _hparam_cmp_double);
+
+        double median = n_peers % 2 ? peers[n_peers / 2]
+                      : (peers[n_peers / 2 - 1] + peers[n_peers / 2]) / 2;
+
+        trial->stopped = trial->accuracy < median;
+    }
+
+    pthread_mutex_unlock(&sweep->lock);
+
+    return trial->stopped;
+}
+
+/**
+ * @brief qsort comparator of doubles, in increasing order
+ */
+static int _hparam_cmp_double(const void* a, const void* b)
+{
+    double x = *(const double*) a;
+    double y = *(const double*) b;
+
+    return (x > y) - (x < y);
+}
@@ -0,0 +1,106 @@
+/**
+ * @file    hparam.h
+ * @author  Philippe Bouchet (philippe.bouchet@epita.fr)
+ * @brief   Hyperparameter sweeps. Trains one network per point of a grid,
+ *          or per random draw, over hidden sizes, batch sizes and learning
+ *          rates. The datasets are loaded once and only read: each trial
+ *          shuffles a view of its own (see data_view).
+ *
+ *          Trials run concurrently, each on its own budget of CPUs, which
+ *          its data parallel workers stay within. After every epoch a
+ *          trial reports its validation accuracy; past the grace epochs, a
+ *          trial whose best accuracy is below the median reported by the
+ *          other trials at the same epoch is stopped (median stopping
+ *          rule), and its CPUs go to the next trial.
+ *
+ *          Trial networks are initialized from rand() seeded with
+ *          seed + trial index, under the sweep lock, and each trial
+ *          shuffles its view with a generator of its own seeded the same
+ *          way (see dataset_t.rng). A trial thus starts from the same
+ *          weights and sees the same sample order in every run, whatever
+ *          the other trials do, as long as nothing else draws from rand()
+ *          during the sweep. It is trained by a single net_fit, with the
+ *          stopping rule applied from its epoch hook.
+ *          Public API functions denoted with "hparam" prefix.
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef HPARAM_H
+#define HPARAM_H
+
+#define HPARAM_INVALID_SPACE     -1
+
+#define HPARAM_MAX_VALUES        16      // Values per hyperparameter
+
+#include <pthread.h>
+#include <stdio.h>
+
+#include "network.h"
+#include "pool.h"
+
+typedef struct
+{
+    size_t      hidden[HPARAM_MAX_VALUES];
+    size_t      n_hidden;
+    size_t      batch[HPARAM_MAX_VALUES];
+    size_t      n_batch;
+    double      lr[HPARAM_MAX_VALUES];
+    size_t      n_lr;
+    size_t      n_random;    // Random trials, 0 for the full grid
+} hparam_space_t;
+
+typedef struct
+{
+    size_t      L;           // Dense layers of every network
+    size_t      epochs;      // Epochs of a trial that is not stopped
+    size_t      cores;       // CPUs, and training threads, per trial
+    size_t      n_parallel;  // Concurrent trials, 0 for CPUs / cores
+    size_t      grace;       // Epochs before a trial can be stopped
+    size_t      min_peers;   // Reports at an epoch needed to stop a trial
+    unsigned    seed;
+    int         verbose;     // Print every finished trial
+} hparam_config_t;
+
+typedef struct
+{
+    size_t      hidden;
+    size_t      batch;
+    double      lr;
+
+    size_t      epochs;      // Epochs run so far
+    int         stopped;     // Stopped early by the median rule
+    double      accuracy;    // Best validation accuracy
+    double      time;        // Wall-clock seconds of the trial
+    double*     acc_curve;   // Validation accuracy after each epoch
+    double*     time_curve;  // Seconds since the sweep started, each epoch
+} hparam_trial_t;
+
+typedef struct
+{
+    hparam_config_t config;
+    dataset_t*  train;       // Shared, read only
+    dataset_t*  val;
+
+    hparam_trial_t* trials;
+    size_t      n_trials;
+    size_t      next;        // Next trial to start
+    double*     peers;       // Accuracies compared by the stopping rule
+
+    pool_t*     pool;        // One worker per concurrent trial
+    pthread_mutex_t lock;    // Guards next, reports and srand() + init
+    double      start;
+} hparam_sweep_t;
+
+hparam_config_t hparam_config_default(void);
+hparam_sweep_t* hparam_init(const hparam_space_t* space,
+                            const hparam_config_t* config,
+                            dataset_t* train, dataset_t* val);
+void            hparam_free(hparam_sweep_t* sweep);
+
+void            hparam_run(hparam_sweep_t* sweep);
+hparam_trial_t* hparam_best(hparam_sweep_t* sweep);
+void            hparam_write(hparam_sweep_t* sweep, FILE* fp);
+
+#endif // HPARAM_H
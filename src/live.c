@@ -0,0 +1,289 @@
+/**
+ * @file    live.c
+ * @author  Philippe Bouchet (philippe.bouchet@epita.fr)
+ * @brief   Serving while training implementation.
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "live.h"
+
+#include <err.h>
+
+#include "memory.h"
+
+/* Internal API forward declaration */
+
+static live_version_t*  _live_back(live_t* live, network_t* net);
+static void             _live_reclaim(live_t* live);
+
+
+/* ==== LIVE PUBLIC API ==== */
+
+
+/**
+ * @brief  Publish the network as version 1, for readers to predict on
+ *
+ * @param  net Network being trained, every version has its shape
+ * @param  every Steps between two versions published by live_step
+ * @param  max_readers Reader threads that may call live_reader
+ * @param  max_batch Samples per inference pass of a reader
+ * @return live_t* Published network
+ */
+live_t* live_init(network_t* net, size_t every, size_t max_readers,
+                  size_t max_batch)
+{
+    if (every == 0 || max_readers == 0 || max_batch == 0)
+    {
+        errx(LIVE_INVALID_CONFIG,
+             "LIVE::ERROR::INIT: "
+             "Publication interval, readers and batch must not be 0");
+    }
+
+    // Line aligned, so that readers and the trainer never share a line
+    live_t* live = mem_aligned(sizeof(live_t), LIVE_LINE, MEM_NETWORK);
+
+    live->every = every;
+    live->epoch = 1;
+    live->max_readers = max_readers;
+    live->max_batch = max_batch;
+    live->readers = mem_aligned(max_readers * sizeof(live_reader_t),
+                                LIVE_LINE, MEM_NETWORK);
+
+    live_publish(live, net);
+
+    return live;
+}
+
+/**
+ * @brief Free the published network, its versions and its readers. No
+ *        reader may be between live_enter and live_exit.
+ *
+ * @param live Published network
+ */
+void live_free(live_t* live)
+{
+    live_version_t* lists[] = { live->current, live->retired, live->free };
+
+    for (size_t i = 0; i < 3; i++)
+    {
+        live_version_t* v = lists[i];
+
+        while (v)
+        {
+            live_version_t* next = v->next;
+
+            model_free(v->model);
+            mem_free(v);
+            v = next;
+        }
+    }
+
+    for (size_t i = 0; i < live->n_readers; i++)
+        model_ctx_free(live->readers[i].ctx);
+
+    mem_free(live->readers);
+    mem_free(live);
+}
+
+/**
+ * @brief Count an optimizer step, and publish a version every
+ *        live->every steps
+ *
+ * @param live Published network
+ * @param net Network being trained
+ */
+void live_step(live_t* live, network_t* net)
+{
+    if (++live->step % live->every == 0)
+        live_publish(live, net);
+}
+
+/**
+ * @brief  Publish the network's parameters as a new version. The copy goes
+ *         to a back buffer, which is then swapped in atomically; readers
+ *         already inside keep the version they loaded. Only one thread,
+ *         the trainer, may publish.
+ *
+ * @param  live Published network
+ * @param  net Network being trained
+ * @return size_t Number of the new version
+ */
+size_t live_publish(live_t* live, network_t* net)
+{
+    live_version_t* back = _live_back(live, net);
+
+    model_copy(back->model, net);
+    back->version = ++live->published;
+
+    // The exchange publishes the copy, readers load it with acquire
+    live_version_t* old = __atomic_exchange_n(&live->current, back,
+                                              __ATOMIC_SEQ_CST);
+
+    if (old)
+    {
+        // Readers entering from now on cannot load old
+        old->retired = __atomic_fetch_add(&live->epoch, 1,
+                                          __ATOMIC_SEQ_CST);
+        old->next = live->retired;
+        live->retired = old;
+
+        _live_reclaim(live);
+    }
+
+    return back->version;
+}
+
+/**
+ * @brief  Claim a reader slot and its inference context. Safe to call
+ *         from several threads at once; a slot is used by one thread.
+ *
+ * @param  live Published network
+ * @return live_reader_t* Reader
+ */
+live_reader_t* live_reader(live_t* live)
+{
+    size_t slot = __atomic_fetch_add(&live->n_readers, 1, __ATOMIC_SEQ_CST);
+
+    if (slot >= live->max_readers)
+    {
+        errx(LIVE_TOO_MANY_READERS,
+             "LIVE::ERROR::READER: "
+             "More than %zu readers", live->max_readers);
+    }
+
+    live_reader_t* reader = &live->readers[slot];
+    live_version_t* v = __atomic_load_n(&live->current, __ATOMIC_SEQ_CST);
+
+    // Versions share one shape, and buffers are only freed by live_free
+    reader->ctx = model_ctx_init(v->model, live->max_batch);
+    reader->live = live;
+
+    return reader;
+}
+
+/**
+ * @brief  Enter a read-side critical section. The returned version is not
+ *         written, nor reused, until the reader calls live_exit. Never
+ *         waits.
+ *
+ * @param  reader Reader
+ * @return const model_t* Latest version of the parameters
+ */
+const model_t* live_enter(live_reader_t* reader)
+{
+    live_t* live = reader->live;
+    size_t epoch = __atomic_load_n(&live->epoch, __ATOMIC_SEQ_CST);
+
+    // Announced before loading current, so the trainer sees the reader
+    // before it can retire what the reader loads
+    __atomic_store_n(&reader->epoch, epoch, __ATOMIC_SEQ_CST);
+
+    live_version_t* v = __atomic_load_n(&live->current, __ATOMIC_SEQ_CST);
+    reader->version = v->version;
+
+    return v->model;
+}
+
+/**
+ * @brief Leave a read-side critical section: the version loaded by
+ *        live_enter may be reclaimed
+ *
+ * @param reader Reader
+ */
+void live_exit(live_reader_t* reader)
+{
+    __atomic_store_n(&reader->epoch, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief  Predict the outputs of n samples on the latest version. Every
+ *         sample is predicted by the same version.
+ *
+ * @param  reader Reader
+ * @param  X Array of n inputs of input_size values
+ * @param  n Number of samples
+ * @param  y Output, n rows of output_size values (row-major)
+ * @return size_t Number of the version that predicted
+ */
+size_t live_predict_batch(live_reader_t* reader, double** X, size_t n,
+                          double* y)
+{
+    reader->ctx->model = live_enter(reader);
+    model_predict_batch(reader->ctx, X, n, y);
+    live_exit(reader);
+
+    return reader->version;
+}
+
+
+/* ==== LIVE INTERNAL API ==== */
+
+
+/**
+ * @brief  Buffer to write the next version into: a reclaimed one if any,
+ *         else a new one, so that the trainer never waits for readers
+ *
+ * @param  live Published network
+ * @param  net Network being trained
+ * @return live_version_t* Buffer no reader can hold
+ */
+static live_version_t* _live_back(live_t* live, network_t* net)
+{
+    live_version_t* back = live->free;
+
+    if (back)
+    {
+        live->free = back->next;
+        back->next = NULL;
+
+        return back;
+    }
+
+    back = mem_calloc(1, sizeof(live_version_t), MEM_NETWORK);
+    back->model = model_init(net);
+    live->n_buffers++;
+
+    return back;
+}
+
+/**
+ * @brief Move the retired versions no reader can hold to the free list.
+ *        A reader that entered in an epoch after a version was retired
+ *        loaded a later version; a quiescent reader holds none.
+ *
+ * @param live Published network
+ */
+static void _live_reclaim(live_t* live)
+{
+    size_t oldest = (size_t) -1;
+
+    for (size_t i = 0; i < live->max_readers; i++)
+    {
+        size_t epoch = __atomic_load_n(&live->readers[i].epoch,
+                                       __ATOMIC_SEQ_CST);
+
+        if (epoch != 0 && epoch < oldest)
+            oldest = epoch;
+    }
+
+    live_version_t** link = &live->retired;
+
+    while (*link)
+    {
+        live_version_t* v = *link;
+
+        if (v->retired < oldest)
+        {
+            *link = v->next;
+            v->next = live->free;
+            live->free = v;
+            live->reclaimed++;
+        }
+        else
+        {
+            link = &v->next;
+        }
+    }
+}
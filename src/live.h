@@ -0,0 +1,90 @@
+/**
+ * @file    live.h
+ * @author  Philippe Bouchet (philippe.bouchet@epita.fr)
+ * @brief   Serving while training. A trainer publishes versions of a
+ *          network's parameters, and any number of reader threads predict
+ *          on the latest version concurrently, RCU style:
+ *
+ *          - The trainer copies the network into a back buffer that no
+ *            reader can see, then swaps it in with one atomic exchange of
+ *            the current version pointer.
+ *          - A reader announces the global epoch it entered in, loads the
+ *            current pointer once, and predicts on that version only, so
+ *            it never sees a half written one.
+ *          - A replaced version is tagged with the epoch it was retired
+ *            in. Once every reader is quiescent or has entered in a later
+ *            epoch, nobody can still hold it (epoch-based reclamation),
+ *            and it becomes a back buffer again.
+ *
+ *          Neither side ever waits for the other: readers only load and
+ *          store their own epoch, and a trainer that finds no reclaimable
+ *          buffer allocates one more. With readers that do not stall, two
+ *          or three buffers are in use.
+ *          Public API functions denoted with "live" prefix.
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef LIVE_H
+#define LIVE_H
+
+#define LIVE_INVALID_CONFIG     -1
+#define LIVE_TOO_MANY_READERS   -2
+
+#define LIVE_LINE               64      // Bytes of a cache line
+
+#include "model.h"
+#include "network.h"
+
+typedef struct live_version
+{
+    model_t*    model;
+    size_t      version;     // Publication number, 1 for the first
+    size_t      retired;     // Epoch it was replaced in
+    struct live_version* next;  // Next retired, or free, buffer
+} live_version_t;
+
+typedef struct
+{
+    size_t      epoch;       // Epoch entered in, 0 while quiescent
+    size_t      version;     // Version read by the last live_enter
+    model_ctx_t* ctx;        // Inference context of the reader
+    struct live* live;
+    char        pad[LIVE_LINE - 2 * sizeof(size_t) - 2 * sizeof(void*)];
+} live_reader_t;
+
+typedef struct live
+{
+    live_version_t* current; // Swapped by the trainer, loaded by readers
+    size_t      epoch;       // Global epoch, starts at 1
+    char        pad0[LIVE_LINE - sizeof(void*) - sizeof(size_t)];
+
+    size_t      every;       // Steps between two publications (live_step)
+    size_t      step;        // Steps seen by live_step
+    size_t      published;   // Versions published
+    size_t      n_buffers;   // Versions allocated
+    size_t      reclaimed;   // Retired versions reused as back buffers
+    live_version_t* retired; // Replaced, possibly still read
+    live_version_t* free;    // Reclaimed, next back buffers
+
+    live_reader_t* readers;  // max_readers slots, each on its own line
+    size_t      max_readers;
+    size_t      n_readers;   // Slots claimed by live_reader
+    size_t      max_batch;   // Batch of the reader contexts
+} live_t;
+
+live_t*         live_init(network_t* net, size_t every, size_t max_readers,
+                          size_t max_batch);
+void            live_free(live_t* live);
+
+void            live_step(live_t* live, network_t* net);
+size_t          live_publish(live_t* live, network_t* net);
+
+live_reader_t*  live_reader(live_t* live);
+const model_t*  live_enter(live_reader_t* reader);
+void            live_exit(live_reader_t* reader);
+size_t          live_predict_batch(live_reader_t* reader, double** X,
+                                   size_t n, double* y);
+
+#endif // LIVE_H
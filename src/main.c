@@ -15,7 +15,10 @@
 #include <stdlib.h>
 #include <time.h>
 
+#include "memory.h"
 #include "network.h"
+#include "profile.h"
+#include "utils.h"
 
 #define TRAIN_IMAGE_DATA "data/train-images-idx3-ubyte"
 #define TRAIN_LABEL_DATA "data/train-labels-idx1-ubyte"
@@ -89,6 +92,7 @@ static void evaluate_network(char* network_path)
 	
 	data_load_mnist(TEST_IMAGE_DATA, test_dataset, LOAD_IMAGES);
 	data_load_mnist(TEST_LABEL_DATA, test_dataset, LOAD_LABELS);
+	data_sparsify(test_dataset, normalize(0.f));
 
 	net_evaluate(net, test_dataset);
 
@@ -129,6 +133,7 @@ static void train_network()
 	scanf("%zu", &n_train_data);
 
 	network_t* net = _configure_network();
+	net_summary(net);
 
 	if (net->batch_size > n_train_data)
 	{
@@ -142,9 +147,12 @@ static void train_network()
 	
 	data_load_mnist(TRAIN_IMAGE_DATA, train_dataset, LOAD_IMAGES);
 	data_load_mnist(TRAIN_LABEL_DATA, train_dataset, LOAD_LABELS);
+	data_sparsify(train_dataset, normalize(0.f));
 
 	net_train(net, train_dataset, epochs);
 	net_save(net, "network.save");
+	PROF_DUMP_TRACE("trace.json");
+	mem_report();
 
 	net_free(net);
 	data_free(train_dataset);
@@ -9,12 +9,21 @@
 
 #include "matrix.h"
 
+#include "backend.h"
+#include "memory.h"
+
 #include <err.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+/* Internal API forward declaration */
+
+static void     _m_expr_check(const m_expr_t* expr, matrix_t* dst);
+static const double* _m_expr_chunk(const m_expr_t* expr, size_t offset,
+                                   size_t len, double* out);
+
 
 /* ==== MATRIX PUBLIC API ==== */
 
@@ -28,7 +37,8 @@
  */
 matrix_t* m_init(size_t n_row, size_t n_col)
 {
-    matrix_t* m = malloc(sizeof(matrix_t));
+    mem_category_t category = mem_current_scope();
+    matrix_t* m = mem_malloc(sizeof(matrix_t), category);
 
     if (m == NULL)
     {
@@ -37,7 +47,7 @@ matrix_t* m_init(size_t n_row, size_t n_col)
             "Not enough memory to initialize matrix!");
     }
 
-    m->array = calloc(n_row * n_col, sizeof(double));
+    m->array = mem_calloc(n_row * n_col, sizeof(double), category);
 
     if (m->array == NULL)
     {
@@ -49,6 +59,7 @@ matrix_t* m_init(size_t n_row, size_t n_col)
     m->n_row = n_row;
     m->n_col = n_col;
     m->size = n_row * n_col;
+    m->capacity = m->size;
 
     return m;
 }
@@ -56,12 +67,15 @@ matrix_t* m_init(size_t n_row, size_t n_col)
 /**
  * @brief Frees the matrix
  * 
- * @param m Matrix struct
+ * @param m Matrix struct, or NULL
  */
 void m_free(matrix_t* m)
 {   
-    free(m->array);
-    free(m);
+    if (m == NULL)
+        return;
+
+    mem_free(m->array);
+    mem_free(m);
 }
 
 /**
@@ -85,6 +99,29 @@ void m_display(matrix_t* m)
     }
 }
 
+/**
+ * @brief Changes the shape of a matrix without reallocating it.
+ *        Used to run batched buffers on partial batches.
+ * 
+ * @param m Matrix to reshape
+ * @param n_row New number of rows
+ * @param n_col New number of columns
+ */
+void m_reshape(matrix_t* m, size_t n_row, size_t n_col)
+{
+    if (n_row * n_col > m->capacity)
+    {
+        errx(MATRIX_FAILED_RESHAPE,
+            "MATRIX::ERROR::RESHAPE: "
+            "Shape (%zu, %zu) exceeds matrix capacity (%zu)",
+            n_row, n_col, m->capacity);
+    }
+
+    m->n_row = n_row;
+    m->n_col = n_col;
+    m->size = n_row * n_col;
+}
+
 /**
  * @brief Allocates a new matrix, and copies the content of
  *        given matrix into the newly allocated one. 
@@ -102,6 +139,25 @@ matrix_t* m_copy(matrix_t* m)
     return m_;
 }
 
+/**
+ * @brief Copies the content of m into dst
+ * 
+ * @param m Matrix to copy
+ * @param dst Destination matrix, of the same shape as m
+ */
+void m_copy_dst(matrix_t* m, matrix_t* dst)
+{
+    if (m->n_row != dst->n_row || m->n_col != dst->n_col)
+    {
+        errx(MATRIX_FAILED_COPY,
+            "MATRIX::ERROR::COPY: "
+            "Incompatible dst. Got (%zu, %zu), expected (%zu, %zu)",
+            dst->n_row, dst->n_col, m->n_row, m->n_col);
+    }
+
+    memcpy(dst->array, m->array, m->size * sizeof(double));
+}
+
 /**
  * @brief Resets matrix values to 0
  * 
@@ -193,22 +249,65 @@ void m_mul(matrix_t* m1, matrix_t* m2, matrix_t* dst)
             m1->n_row, m2->n_col, dst->n_row, dst->n_col);
     }
 
-    for (size_t i = 0; i < m1->n_row; i++)
+    backend_get()->mul(m1, m2, dst);
+}
+
+/**
+ * @brief Matrix multiplication with transpose(m1) and m2,
+ *        stored in matrix dst. Avoids allocating the transpose.
+ * 
+ * @param m1 Left hand operation matrix, transposed
+ * @param m2 Right hand operation matrix
+ * @param dst Destination matrix to store result in
+ */
+void m_mul_tn(matrix_t* m1, matrix_t* m2, matrix_t* dst)
+{
+    if (m1->n_row != m2->n_row)
     {
-        for (size_t j = 0; j < m2->n_col; j++)
-        {
-            double val = 0.f;
-            
-            for (size_t k = 0; k < m1->n_col; k++)
-            {
-                double m1_val = m_get(m1, i, k);
-                double m2_val = m_get(m2, k, j);
-                val += m1_val * m2_val;
-            }
-
-            m_set(dst, i, j, val);
-        }
+        errx(MATRIX_FAILED_MULTIPLICATION,
+            "MATRIX::ERROR::MULTIPLICATION: "
+            "Incompatible shapes (%zu, %zu)^T and (%zu, %zu)",
+            m1->n_row, m1->n_col, m2->n_row, m2->n_col);
+    }
+
+    if (m1->n_col != dst->n_row || m2->n_col != dst->n_col)
+    {
+        errx(MATRIX_FAILED_MULTIPLICATION,
+            "MATRIX::ERROR::MULTIPLICATION: "
+            "Incompatible dst. Got (%zu, %zu), expected (%zu, %zu)",
+            dst->n_row, dst->n_col, m1->n_col, m2->n_col);
+    }
+
+    backend_get()->mul_tn(m1, m2, dst);
+}
+
+/**
+ * @brief Matrix multiplication with m1 and transpose(m2),
+ *        stored in matrix dst. Avoids allocating the transpose.
+ * 
+ * @param m1 Left hand operation matrix
+ * @param m2 Right hand operation matrix, transposed
+ * @param dst Destination matrix to store result in
+ */
+void m_mul_nt(matrix_t* m1, matrix_t* m2, matrix_t* dst)
+{
+    if (m1->n_col != m2->n_col)
+    {
+        errx(MATRIX_FAILED_MULTIPLICATION,
+            "MATRIX::ERROR::MULTIPLICATION: "
+            "Incompatible shapes (%zu, %zu) and (%zu, %zu)^T",
+            m1->n_row, m1->n_col, m2->n_row, m2->n_col);
     }
+
+    if (m1->n_row != dst->n_row || m2->n_row != dst->n_col)
+    {
+        errx(MATRIX_FAILED_MULTIPLICATION,
+            "MATRIX::ERROR::MULTIPLICATION: "
+            "Incompatible dst. Got (%zu, %zu), expected (%zu, %zu)",
+            dst->n_row, dst->n_col, m1->n_row, m2->n_row);
+    }
+
+    backend_get()->mul_nt(m1, m2, dst);
 }
 
 /**
@@ -236,8 +335,7 @@ void m_add(matrix_t* m1, matrix_t* m2, matrix_t* dst)
             m1->n_row, m1->n_col, dst->n_row, dst->n_col);
     }
 
-    for (size_t i = 0; i < m1->size; i++)
-        dst->array[i] = m1->array[i] + m2->array[i];
+    backend_get()->add(m1, m2, dst);
 }
 
 /**
@@ -265,8 +363,7 @@ void m_sub(matrix_t* m1, matrix_t* m2, matrix_t* dst)
             m1->n_row, m1->n_col, dst->n_row, dst->n_col);
     }
 
-    for (size_t i = 0; i < m1->size; i++)
-        dst->array[i] = m1->array[i] - m2->array[i];
+    backend_get()->sub(m1, m2, dst);
 }
 
 /**
@@ -278,8 +375,7 @@ void m_sub(matrix_t* m1, matrix_t* m2, matrix_t* dst)
  */
 void m_scalar_mul(matrix_t* m, double lambda, matrix_t* dst)
 {
-    for (size_t i = 0; i < m->size; i++)
-        dst->array[i] = m->array[i] * lambda;
+    backend_get()->scalar_mul(m, lambda, dst);
 }
 
 /**
@@ -291,8 +387,54 @@ void m_scalar_mul(matrix_t* m, double lambda, matrix_t* dst)
  */
 void m_scalar_add(matrix_t* m, double lambda, matrix_t* dst)
 {
-    for (size_t i = 0; i < m->size; i++)
-        dst->array[i] = m->array[i] + lambda;
+    backend_get()->scalar_add(m, lambda, dst);
+}
+
+/**
+ * @brief Adds a row vector to every row of m
+ * 
+ * @param m Matrix to add row to
+ * @param row Row vector (1, m->n_col)
+ * @param dst Destination matrix to store result in
+ */
+void m_add_row(matrix_t* m, matrix_t* row, matrix_t* dst)
+{
+    if (row->n_row != 1 || row->n_col != m->n_col)
+    {
+        errx(MATRIX_FAILED_ADDITION,
+            "MATRIX::ERROR::ADD: "
+            "Incompatible row (%zu, %zu) for matrix (%zu, %zu)",
+            row->n_row, row->n_col, m->n_row, m->n_col);
+    }
+
+    if (m->n_col != dst->n_col || m->n_row != dst->n_row)
+    {
+        errx(MATRIX_FAILED_ADDITION,
+            "MATRIX::ERROR::ADD: "
+            "Incompatible dst. Got (%zu, %zu), expected (%zu, %zu)",
+            dst->n_row, dst->n_col, m->n_row, m->n_col);
+    }
+
+    backend_get()->add_row(m, row, dst);
+}
+
+/**
+ * @brief Sums the rows of m into the row vector dst
+ * 
+ * @param m Matrix to reduce
+ * @param dst Destination row vector (1, m->n_col)
+ */
+void m_sum_rows(matrix_t* m, matrix_t* dst)
+{
+    if (dst->n_row != 1 || dst->n_col != m->n_col)
+    {
+        errx(MATRIX_FAILED_ADDITION,
+            "MATRIX::ERROR::ADD: "
+            "Incompatible dst. Got (%zu, %zu), expected (1, %zu)",
+            dst->n_row, dst->n_col, m->n_col);
+    }
+
+    backend_get()->sum_rows(m, dst);
 }
 
 /**
@@ -320,9 +462,8 @@ void m_hadamard(matrix_t* m1, matrix_t* m2, matrix_t* dst)
             "Incompatible dst. Got (%zu, %zu), expected (%zu, %zu)",
             m1->n_row, m1->n_col, dst->n_row, dst->n_col);
     }
-    
-    for (size_t i = 0; i < m1->size; i++)
-        dst->array[i] = m1->array[i] * m2->array[i];
+
+    backend_get()->hadamard(m1, m2, dst);
 }
 
 /**
@@ -386,3 +527,147 @@ matrix_t* m_apply(matrix_t* m, double (*fun)(double))
 
     return dst;
 }
+
+/**
+ * @brief Evaluate a deferred elementwise expression into dst, in one fused
+ *        pass. Every matrix of the expression must have the shape of dst,
+ *        and dst may itself appear in the expression.
+ * 
+ * @param expr Expression built with the M_* macros
+ * @param dst Destination matrix to store result in
+ */
+void m_eval(const m_expr_t* expr, matrix_t* dst)
+{
+    _m_expr_check(expr, dst);
+
+    for (size_t i = 0; i < dst->size; i += MATRIX_EXPR_CHUNK)
+    {
+        size_t len = dst->size - i < MATRIX_EXPR_CHUNK
+                   ? dst->size - i : MATRIX_EXPR_CHUNK;
+
+        double* out = dst->array + i;
+        const double* res = _m_expr_chunk(expr, i, len, out);
+
+        if (res != out)
+            memcpy(out, res, len * sizeof(double));
+    }
+}
+
+
+/* ==== MATRIX INTERNAL API ==== */
+
+
+/**
+ * @brief Check that every matrix of an expression has the shape of dst
+ * 
+ * @param expr Expression
+ * @param dst Destination matrix
+ */
+static void _m_expr_check(const m_expr_t* expr, matrix_t* dst)
+{
+    if (expr == NULL)
+        return;
+
+    if (expr->op == M_EXPR_LEAF
+        && (expr->m->n_row != dst->n_row || expr->m->n_col != dst->n_col))
+    {
+        errx(MATRIX_FAILED_EVAL,
+            "MATRIX::ERROR::EVAL: "
+            "Incompatible operand. Got (%zu, %zu), expected (%zu, %zu)",
+            expr->m->n_row, expr->m->n_col, dst->n_row, dst->n_col);
+    }
+
+    _m_expr_check(expr->lhs, dst);
+    _m_expr_check(expr->rhs, dst);
+}
+
+/**
+ * @brief  Evaluate elements [offset, offset + len) of an expression.
+ *         Each node works on a chunk small enough to stay in cache, with
+ *         plain loops the compiler vectorizes.
+ * 
+ * @param  expr Expression
+ * @param  offset First element
+ * @param  len Number of elements, at most MATRIX_EXPR_CHUNK
+ * @param  out Chunk the result may be written to, possibly the chunk of
+ *         dst being evaluated
+ * @return const double* Result chunk: out, or the elements of a leaf
+ */
+static const double* _m_expr_chunk(const m_expr_t* expr, size_t offset,
+                                   size_t len, double* out)
+{
+    if (expr->op == M_EXPR_LEAF)
+        return expr->m->array + offset;
+
+    // Read once: out may alias any double, the compiler would reload it
+    double s = expr->s;
+
+    if (expr->op == M_EXPR_CONST)
+    {
+        for (size_t i = 0; i < len; i++)
+            out[i] = s;
+
+        return out;
+    }
+
+    // The right operand is computed first, into a scratch chunk: out is
+    // only written once every operand that may read dst has been read
+    if (expr->rhs != NULL)
+    {
+        double tmp[MATRIX_EXPR_CHUNK];
+        const double* y = _m_expr_chunk(expr->rhs, offset, len, tmp);
+
+        // A dst leaf must be saved before the left operand writes out
+        if (y == out)
+            y = memcpy(tmp, y, len * sizeof(double));
+
+        const double* x = _m_expr_chunk(expr->lhs, offset, len, out);
+
+        switch (expr->op)
+        {
+            case M_EXPR_ADD:
+                for (size_t i = 0; i < len; i++)
+                    out[i] = x[i] + y[i];
+                break;
+
+            case M_EXPR_SUB:
+                for (size_t i = 0; i < len; i++)
+                    out[i] = x[i] - y[i];
+                break;
+
+            default:
+                for (size_t i = 0; i < len; i++)
+                    out[i] = x[i] * y[i];
+                break;
+        }
+
+        return out;
+    }
+
+    const double* x = _m_expr_chunk(expr->lhs, offset, len, out);
+
+    switch (expr->op)
+    {
+        case M_EXPR_SCALE:
+            for (size_t i = 0; i < len; i++)
+                out[i] = s * x[i];
+            break;
+
+        case M_EXPR_APPLY:
+            for (size_t i = 0; i < len; i++)
+                out[i] = expr->fun(x[i]);
+            break;
+
+        case M_EXPR_DSIGMOID:
+            for (size_t i = 0; i < len; i++)
+                out[i] = x[i] * (1.f - x[i]);
+            break;
+
+        default:
+            for (size_t i = 0; i < len; i++)
+                out[i] = x[i] > 0.f ? 1.f : 0.f;
+            break;
+    }
+
+    return out;
+}
@@ -17,6 +17,11 @@
 #define MATRIX_FAILED_SUBSTRACTION      -5
 #define MATRIX_FAILED_HADAMARD          -6
 #define MATRIX_FAILED_APPLY             -7
+#define MATRIX_FAILED_RESHAPE           -8
+#define MATRIX_FAILED_COPY              -9
+#define MATRIX_FAILED_EVAL              -10
+
+#define MATRIX_EXPR_CHUNK               1024 // Elements evaluated per pass
 
 typedef unsigned long size_t;
 
@@ -28,30 +33,88 @@ __attribute__((packed, aligned(1)))
     size_t  size;
     size_t  n_row;
     size_t  n_col;
+    size_t  capacity;   // Allocated elements, size <= capacity
 } matrix_t;
 
+typedef enum
+{
+    M_EXPR_LEAF,             // Elements of a matrix
+    M_EXPR_CONST,            // Constant s
+    M_EXPR_ADD,              // lhs + rhs
+    M_EXPR_SUB,              // lhs - rhs
+    M_EXPR_MUL,              // lhs * rhs, elementwise
+    M_EXPR_SCALE,            // s * lhs
+    M_EXPR_APPLY,            // fun(lhs)
+    M_EXPR_DSIGMOID,         // lhs * (1 - lhs), sigmoid' from sigmoid
+    M_EXPR_DRELU,            // lhs > 0 ? 1 : 0, relu' from relu
+} m_expr_op_t;
+
+/*
+ * Deferred elementwise expression. Nodes are built with the M_* macros
+ * below as compound literals, so a whole expression lives on the stack of
+ * the enclosing block and needs no allocation:
+ *
+ *   m_eval(M_SUB(M_LEAF(w), M_SCALE(lr, M_LEAF(grad))), w);
+ *
+ * m_eval then computes it in a single pass over the operands, one cache
+ * sized chunk at a time, instead of one pass and one temporary per op.
+ */
+typedef struct m_expr
+{
+    m_expr_op_t op;
+    matrix_t*   m;
+    double      s;
+    double      (*fun)(double);
+    const struct m_expr* lhs;
+    const struct m_expr* rhs;
+} m_expr_t;
+
+#define M_LEAF(M)       (&(const m_expr_t){ .op = M_EXPR_LEAF, .m = (M) })
+#define M_CONST(S)      (&(const m_expr_t){ .op = M_EXPR_CONST, .s = (S) })
+#define M_ADD(A, B)     (&(const m_expr_t){ .op = M_EXPR_ADD, \
+                                            .lhs = (A), .rhs = (B) })
+#define M_SUB(A, B)     (&(const m_expr_t){ .op = M_EXPR_SUB, \
+                                            .lhs = (A), .rhs = (B) })
+#define M_MUL(A, B)     (&(const m_expr_t){ .op = M_EXPR_MUL, \
+                                            .lhs = (A), .rhs = (B) })
+#define M_SCALE(S, A)   (&(const m_expr_t){ .op = M_EXPR_SCALE, \
+                                            .s = (S), .lhs = (A) })
+#define M_APPLY(F, A)   (&(const m_expr_t){ .op = M_EXPR_APPLY, \
+                                            .fun = (F), .lhs = (A) })
+#define M_DSIGMOID(A)   (&(const m_expr_t){ .op = M_EXPR_DSIGMOID, \
+                                            .lhs = (A) })
+#define M_DRELU(A)      (&(const m_expr_t){ .op = M_EXPR_DRELU, .lhs = (A) })
+
 matrix_t*   m_init(size_t n_row, size_t n_col);
 void        m_free(matrix_t* m);
 
 void        m_set(matrix_t* m, size_t row, size_t col, double val);
 double      m_get(matrix_t* m, size_t row, size_t col);
 void        m_display(matrix_t* m);
+void        m_reshape(matrix_t* m, size_t n_row, size_t n_col);
 
 matrix_t*   m_copy(matrix_t* m);
+void        m_copy_dst(matrix_t* m, matrix_t* dst);
 void        m_reset(matrix_t* m);
 void        m_fill(matrix_t* m, double (*fun)(void));
 
 void        m_mul(matrix_t* m1, matrix_t* m2, matrix_t* dst);
+void        m_mul_tn(matrix_t* m1, matrix_t* m2, matrix_t* dst);
+void        m_mul_nt(matrix_t* m1, matrix_t* m2, matrix_t* dst);
 void        m_add(matrix_t* m1, matrix_t* m2, matrix_t* dst);
 void        m_sub(matrix_t* m1, matrix_t* m2, matrix_t* dst);
 void        m_hadamard(matrix_t* m1, matrix_t* m2, matrix_t* dst);
 void        m_scalar_mul(matrix_t* m, double lambda, matrix_t* dst);
 void        m_scalar_add(matrix_t* m, double lambda, matrix_t* dst);
+void        m_add_row(matrix_t* m, matrix_t* row, matrix_t* dst);
+void        m_sum_rows(matrix_t* m, matrix_t* dst);
 
 matrix_t*   m_transpose(matrix_t* m);
 
 void        m_apply_dst(matrix_t* m, double (*fun) (double), matrix_t* dst);
 matrix_t*   m_apply(matrix_t* m, double (*fun)(double));
 
+void        m_eval(const m_expr_t* expr, matrix_t* dst);
+
 
 #endif // MATRIX_H
\ No newline at end of file
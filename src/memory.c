@@ -0,0 +1,294 @@
+/**
+ * @file    memory.c
+ * @author  Philippe Bouchet (philippe.bouchet@epita.fr)
+ * @brief   Allocation tracking implementation. Each block is prefixed
+ *          with a header holding its size and category.
+ * 
+ * @copyright Copyright (c) 2022
+ * 
+ */
+
+#include "memory.h"
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct
+{
+    size_t      size;
+    unsigned    category;
+    unsigned    offset;      // Bytes from the malloc'd block to the header
+} mem_header_t;  // 16 bytes, keeps the malloc alignment of the block
+
+static const char* category_names[MEM_N_CATEGORIES] = {
+    "matrix", "params", "activations", "gradients", "network", "dataset",
+};
+
+static mem_stats_t  stats[MEM_N_CATEGORIES];
+static size_t       total_live = 0;
+static size_t       total_peak = 0;
+
+static __thread mem_category_t scope = MEM_MATRIX;
+
+static void _mem_account(size_t category, size_t size, int alloc);
+
+
+/* ==== MEMORY PUBLIC API ==== */
+
+
+/**
+ * @brief  Tracked malloc
+ * 
+ * @param  size Size in bytes
+ * @param  category Category the block is accounted in
+ * @return void* Allocated block
+ */
+void* mem_malloc(size_t size, mem_category_t category)
+{
+    mem_header_t* h = malloc(sizeof(mem_header_t) + size);
+
+    if (h == NULL)
+    {
+        errx(MEMORY_FAILED_ALLOC,
+             "MEMORY::ERROR::ALLOC: "
+             "Not enough memory to allocate %zu bytes (%s, %zu live)",
+             size, category_names[category], total_live);
+    }
+
+    h->size = size;
+    h->category = category;
+    h->offset = 0;
+    _mem_account(category, size, 1);
+
+    return h + 1;
+}
+
+/**
+ * @brief  Tracked calloc
+ * 
+ * @param  n Number of elements
+ * @param  size Size of an element in bytes
+ * @param  category Category the block is accounted in
+ * @return void* Zeroed allocated block
+ */
+void* mem_calloc(size_t n, size_t size, mem_category_t category)
+{
+    void* ptr = mem_malloc(n * size, category);
+    memset(ptr, 0, n * size);
+
+    return ptr;
+}
+
+/**
+ * @brief  Tracked, zeroed allocation starting on an align bytes boundary,
+ *         for blocks that must own whole cache lines or pages. Freed with
+ *         mem_free, and cannot be reallocated.
+ *
+ * @param  size Size in bytes
+ * @param  align Alignment in bytes, a power of two of at least 16
+ * @param  category Category the block is accounted in
+ * @return void* Zeroed allocated block
+ */
+void* mem_aligned(size_t size, size_t align, mem_category_t category)
+{
+    if (align < sizeof(mem_header_t) || (align & (align - 1)) != 0)
+    {
+        errx(MEMORY_INVALID_ALIGN,
+             "MEMORY::ERROR::ALIGN: "
+             "Alignment %zu is not a power of two of at least %zu", align,
+             sizeof(mem_header_t));
+    }
+
+    char* block = malloc(sizeof(mem_header_t) + align - 1 + size);
+
+    if (block == NULL)
+    {
+        errx(MEMORY_FAILED_ALLOC,
+             "MEMORY::ERROR::ALLOC: "
+             "Not enough memory to allocate %zu bytes (%s, %zu live)",
+             size, category_names[category], total_live);
+    }
+
+    size_t start = (size_t) (block + sizeof(mem_header_t));
+    char* ptr = (char*) ((start + align - 1) & ~(align - 1));
+    mem_header_t* h = (mem_header_t*) ptr - 1;
+
+    h->size = size;
+    h->category = category;
+    h->offset = (char*) h - block;
+    _mem_account(category, size, 1);
+
+    memset(ptr, 0, size);
+
+    return ptr;
+}
+
+/**
+ * @brief  Tracked realloc, the block keeps its category
+ * 
+ * @param  ptr Block allocated by mem_malloc / mem_calloc
+ * @param  size New size in bytes
+ * @return void* Reallocated block
+ */
+void* mem_realloc(void* ptr, size_t size)
+{
+    mem_header_t* h = (mem_header_t*) ptr - 1;
+    size_t category = h->category;
+
+    if (h->offset != 0)
+    {
+        errx(MEMORY_INVALID_ALIGN,
+             "MEMORY::ERROR::REALLOC: "
+             "Aligned blocks cannot be reallocated");
+    }
+
+    _mem_account(category, h->size, 0);
+    h = realloc(h, sizeof(mem_header_t) + size);
+
+    if (h == NULL)
+    {
+        errx(MEMORY_FAILED_ALLOC,
+             "MEMORY::ERROR::ALLOC: "
+             "Not enough memory to reallocate %zu bytes (%s)",
+             size, category_names[category]);
+    }
+
+    h->size = size;
+    h->offset = 0;
+    _mem_account(category, size, 1);
+
+    return h + 1;
+}
+
+/**
+ * @brief Tracked free
+ * 
+ * @param ptr Block allocated by mem_malloc / mem_calloc / mem_aligned,
+ *            or NULL
+ */
+void mem_free(void* ptr)
+{
+    if (ptr == NULL)
+        return;
+
+    mem_header_t* h = (mem_header_t*) ptr - 1;
+
+    _mem_account(h->category, h->size, 0);
+    free((char*) h - h->offset);
+}
+
+/**
+ * @brief  Set the category matrices allocated by the calling thread
+ *         are accounted in
+ * 
+ * @param  category New category
+ * @return mem_category_t Previous category, to restore the scope
+ */
+mem_category_t mem_scope(mem_category_t category)
+{
+    mem_category_t prev = scope;
+    scope = category;
+
+    return prev;
+}
+
+/**
+ * @return mem_category_t Category of the calling thread's scope
+ */
+mem_category_t mem_current_scope(void)
+{
+    return scope;
+}
+
+/**
+ * @param  category Category
+ * @return mem_stats_t Snapshot of the category's counters
+ */
+mem_stats_t mem_stats(mem_category_t category)
+{
+    mem_stats_t s;
+
+    s.live = __atomic_load_n(&stats[category].live, __ATOMIC_RELAXED);
+    s.peak = __atomic_load_n(&stats[category].peak, __ATOMIC_RELAXED);
+    s.n_alloc = __atomic_load_n(&stats[category].n_alloc, __ATOMIC_RELAXED);
+    s.n_free = __atomic_load_n(&stats[category].n_free, __ATOMIC_RELAXED);
+
+    return s;
+}
+
+/**
+ * @return size_t Bytes currently allocated, all categories
+ */
+size_t mem_live(void)
+{
+    return __atomic_load_n(&total_live, __ATOMIC_RELAXED);
+}
+
+/**
+ * @return size_t Highest number of bytes allocated at once
+ */
+size_t mem_peak(void)
+{
+    return __atomic_load_n(&total_peak, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Print the counters of every category
+ */
+void mem_report(void)
+{
+    printf("\n[MEMORY]\n\n");
+    printf("%-14s %12s %12s %10s %10s\n",
+           "category", "live (KiB)", "peak (KiB)", "allocs", "frees");
+
+    for (int c = 0; c < MEM_N_CATEGORIES; c++)
+    {
+        mem_stats_t s = mem_stats(c);
+
+        printf("%-14s %12.1f %12.1f %10zu %10zu\n", category_names[c],
+               s.live / 1024.f, s.peak / 1024.f, s.n_alloc, s.n_free);
+    }
+
+    printf("%-14s %12.1f %12.1f\n\n", "total",
+           mem_live() / 1024.f, mem_peak() / 1024.f);
+}
+
+
+/* ==== MEMORY INTERNAL API ==== */
+
+
+/**
+ * @brief Update the counters of a category and the totals
+ * 
+ * @param category Category of the block
+ * @param size Size of the block
+ * @param alloc 1 for an allocation, 0 for a free
+ */
+static void _mem_account(size_t category, size_t size, int alloc)
+{
+    mem_stats_t* s = &stats[category];
+
+    if (!alloc)
+    {
+        __atomic_sub_fetch(&s->live, size, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&total_live, size, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&s->n_free, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    size_t live = __atomic_add_fetch(&s->live, size, __ATOMIC_RELAXED);
+    size_t total = __atomic_add_fetch(&total_live, size, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&s->n_alloc, 1, __ATOMIC_RELAXED);
+
+    size_t peak = __atomic_load_n(&s->peak, __ATOMIC_RELAXED);
+    while (live > peak && !__atomic_compare_exchange_n(&s->peak, &peak, live,
+                          1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+
+    peak = __atomic_load_n(&total_peak, __ATOMIC_RELAXED);
+    while (total > peak && !__atomic_compare_exchange_n(&total_peak, &peak,
+                           total, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
@@ -0,0 +1,53 @@
+/**
+ * @file    memory.h
+ * @author  Philippe Bouchet (philippe.bouchet@epita.fr)
+ * @brief   Allocation tracking: live bytes, peak bytes and allocation
+ *          counts per category, for footprint reporting.
+ * 
+ * @copyright Copyright (c) 2022
+ * 
+ */
+
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#define MEMORY_FAILED_ALLOC -1
+#define MEMORY_INVALID_ALIGN -2
+
+typedef unsigned long size_t;
+
+typedef enum
+{
+    MEM_MATRIX,              // Matrices outside of any scope (temporaries)
+    MEM_PARAMS,              // Weights and biases
+    MEM_ACTIVATIONS,         // Batched inputs, activations and deltas
+    MEM_GRADIENTS,           // Cumulative gradients
+    MEM_NETWORK,             // Network structs and layer tables
+    MEM_DATASET,             // Dataset samples
+    MEM_N_CATEGORIES,
+} mem_category_t;
+
+typedef struct
+{
+    size_t      live;        // Bytes currently allocated
+    size_t      peak;        // Highest value of live
+    size_t      n_alloc;     // Number of allocations
+    size_t      n_free;      // Number of frees
+} mem_stats_t;
+
+void*           mem_malloc(size_t size, mem_category_t category);
+void*           mem_calloc(size_t n, size_t size, mem_category_t category);
+void*           mem_aligned(size_t size, size_t align,
+                            mem_category_t category);
+void*           mem_realloc(void* ptr, size_t size);
+void            mem_free(void* ptr);
+
+mem_category_t  mem_scope(mem_category_t category);
+mem_category_t  mem_current_scope(void);
+
+mem_stats_t     mem_stats(mem_category_t category);
+size_t          mem_live(void);
+size_t          mem_peak(void);
+void            mem_report(void);
+
+#endif // MEMORY_H
@@ -0,0 +1,410 @@
+/**
+ * @file    model.c
+ * @author  Philippe Bouchet (philippe.bouchet@epita.fr)
+ * @brief   Shared model and inference context implementation.
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "model.h"
+
+#include <err.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "memory.h"
+
+/* Internal API forward declaration */
+
+static matrix_t*    _model_forward(model_ctx_t* ctx, size_t len);
+static size_t       _model_width(const model_t* model);
+static size_t       _model_windows(const model_t* model);
+static size_t       _model_argmax(matrix_t* m, size_t row);
+
+
+/* ==== MODEL PUBLIC API ==== */
+
+
+/**
+ * @brief  Copy the activations and parameters of a network into a new
+ *         model. The network may then be freed or trained further.
+ *
+ * @param  net Trained network
+ * @return model_t* Model
+ */
+model_t* model_init(network_t* net)
+{
+    model_t* model = mem_malloc(sizeof(model_t), MEM_NETWORK);
+
+    model->L = net->L;
+    model->input_size = net->input_size;
+    model->hidden_size = net->hidden_size;
+    model->output_size = net->output_size;
+    model->n_conv = net->n_conv;
+    model->conv = NULL;
+    model->n_params = net->n_params;
+    model->act = mem_malloc(net->n_params * sizeof(activation_t),
+                            MEM_NETWORK);
+    model->w = mem_malloc(net->n_params * sizeof(matrix_t*), MEM_NETWORK);
+    model->b = mem_malloc(net->n_params * sizeof(matrix_t*), MEM_NETWORK);
+
+    if (net->n_conv)
+    {
+        model->conv = mem_malloc(net->n_conv * sizeof(conv_t), MEM_NETWORK);
+        memcpy(model->conv, net->conv, net->n_conv * sizeof(conv_t));
+    }
+
+    mem_category_t scope = mem_scope(MEM_PARAMS);
+
+    for (size_t l = 0; l < net->n_params; l++)
+    {
+        model->act[l] = net->act[l];
+        model->w[l] = m_copy(net->w[l]);
+        model->b[l] = m_copy(net->b[l]);
+    }
+
+    mem_scope(scope);
+
+    return model;
+}
+
+/**
+ * @brief  Load a model from a network file written by net_save
+ *
+ * @param  path Path to network parameters file
+ * @return model_t* Model
+ */
+model_t* model_load(const char* path)
+{
+    network_t* net = net_load(path);
+    model_t* model = model_init(net);
+
+    net_free(net);
+
+    return model;
+}
+
+/**
+ * @brief Free a model. Every context using it must be freed first.
+ *
+ * @param model Model
+ */
+void model_free(model_t* model)
+{
+    for (size_t l = 0; l < model->n_params; l++)
+    {
+        m_free(model->w[l]);
+        m_free(model->b[l]);
+    }
+
+    if (model->conv)
+        mem_free(model->conv);
+
+    mem_free(model->act);
+    mem_free(model->w);
+    mem_free(model->b);
+    mem_free(model);
+}
+
+/**
+ * @brief Overwrite the parameters of a model with the ones of a network
+ *        of the same shape. No context may be running on the model.
+ *
+ * @param model Model
+ * @param net Network
+ */
+void model_copy(model_t* model, network_t* net)
+{
+    for (size_t l = 0; l < model->n_params; l++)
+    {
+        model->act[l] = net->act[l];
+        memcpy(model->w[l]->array, net->w[l]->array,
+               net->w[l]->size * sizeof(double));
+        memcpy(model->b[l]->array, net->b[l]->array,
+               net->b[l]->size * sizeof(double));
+    }
+}
+
+/**
+ * @param  model Model
+ * @return size_t Bytes of parameters held by the model
+ */
+size_t model_size(const model_t* model)
+{
+    size_t size = 0;
+
+    for (size_t l = 0; l < model->n_params; l++)
+        size += model->w[l]->size + model->b[l]->size;
+
+    return size * sizeof(double);
+}
+
+/**
+ * @brief  Create an inference context: the input batch and two layer
+ *         output buffers, reused by every layer in turn
+ *
+ * @param  model Model the context runs, shared with other contexts
+ * @param  max_batch Largest batch of a single forward pass
+ * @return model_ctx_t* Context, to be used by one thread at a time
+ */
+model_ctx_t* model_ctx_init(const model_t* model, size_t max_batch)
+{
+    if (max_batch == 0)
+    {
+        errx(MODEL_INVALID_BATCH,
+             "MODEL::ERROR::CONTEXT: "
+             "Invalid batch size %zu", max_batch);
+    }
+
+    model_ctx_t* ctx = mem_malloc(sizeof(model_ctx_t), MEM_NETWORK);
+    mem_category_t scope = mem_scope(MEM_ACTIVATIONS);
+
+    ctx->model = model;
+    ctx->max_batch = max_batch;
+    ctx->X = m_init(max_batch, model->input_size);
+    ctx->a[0] = m_init(max_batch, _model_width(model));
+    ctx->a[1] = m_init(max_batch, _model_width(model));
+    ctx->cols = model->n_conv ? m_init(max_batch, _model_windows(model))
+                              : NULL;
+
+    mem_scope(scope);
+
+    return ctx;
+}
+
+/**
+ * @brief Free an inference context, leaving its model untouched
+ *
+ * @param ctx Context
+ */
+void model_ctx_free(model_ctx_t* ctx)
+{
+    m_free(ctx->X);
+    m_free(ctx->a[0]);
+    m_free(ctx->a[1]);
+
+    if (ctx->cols)
+        m_free(ctx->cols);
+
+    mem_free(ctx);
+}
+
+/**
+ * @param  ctx Context
+ * @return size_t Bytes of buffers held by the context
+ */
+size_t model_ctx_size(const model_ctx_t* ctx)
+{
+    size_t size = ctx->X->capacity + ctx->a[0]->capacity
+                + ctx->a[1]->capacity;
+
+    if (ctx->cols)
+        size += ctx->cols->capacity;
+
+    return size * sizeof(double);
+}
+
+/**
+ * @brief Predict the output of a single input
+ *
+ * @param ctx Context
+ * @param X Input of input_size values
+ * @param y Output of output_size values
+ */
+void model_predict(model_ctx_t* ctx, double* X, double* y)
+{
+    model_predict_batch(ctx, &X, 1, y);
+}
+
+/**
+ * @brief Batched inference: predict the outputs of n samples, in passes
+ *        of at most max_batch samples
+ *
+ * @param ctx Context
+ * @param X Array of n inputs of input_size values
+ * @param n Number of samples
+ * @param y Output, n rows of output_size values (row-major)
+ */
+void model_predict_batch(model_ctx_t* ctx, double** X, size_t n, double* y)
+{
+    const model_t* model = ctx->model;
+
+    for (size_t p = 0; p < n; p += ctx->max_batch)
+    {
+        size_t len = n - p;
+
+        if (len > ctx->max_batch)
+            len = ctx->max_batch;
+
+        m_reshape(ctx->X, len, model->input_size);
+
+        for (size_t i = 0; i < len; i++)
+        {
+            for (size_t j = 0; j < model->input_size; j++)
+                ctx->X->array[j * len + i] = X[p + i][j];
+        }
+
+        matrix_t* a = _model_forward(ctx, len);
+
+        for (size_t i = 0; i < len; i++)
+        {
+            for (size_t j = 0; j < model->output_size; j++)
+                y[(p + i) * model->output_size + j] = a->array[j * len + i];
+        }
+    }
+}
+
+/**
+ * @brief  Share of samples whose highest output is their label
+ *
+ * @param  ctx Context
+ * @param  dataset Test dataset
+ * @return double Accuracy in [0, 1]
+ */
+double model_accuracy(model_ctx_t* ctx, dataset_t* dataset)
+{
+    const model_t* model = ctx->model;
+    size_t correct = 0;
+
+    for (size_t p = 0; p < dataset->n; p += ctx->max_batch)
+    {
+        size_t len = dataset->n - p;
+
+        if (len > ctx->max_batch)
+            len = ctx->max_batch;
+
+        m_reshape(ctx->X, len, model->input_size);
+
+        for (size_t i = 0; i < len; i++)
+        {
+            for (size_t j = 0; j < model->input_size; j++)
+                ctx->X->array[j * len + i] = dataset->X[p + i][j];
+        }
+
+        matrix_t* a = _model_forward(ctx, len);
+
+        for (size_t i = 0; i < len; i++)
+        {
+            double* y = dataset->y[p + i];
+            size_t label = 0;
+
+            for (size_t j = 1; j < model->output_size; j++)
+            {
+                if (y[j] > y[label])
+                    label = j;
+            }
+
+            if (_model_argmax(a, i) == label)
+                correct++;
+        }
+    }
+
+    return (double) correct / dataset->n;
+}
+
+
+/* ==== MODEL INTERNAL API ==== */
+
+
+/**
+ * @brief  Forward pass of the batch loaded in ctx->X. Each layer reads
+ *         the output of the previous one and overwrites the one before
+ *         it; activations are applied in place. Convolution and pooling
+ *         layers run first, sharing the window buffer.
+ *
+ * @param  ctx Context
+ * @param  len Number of samples in the batch
+ * @return matrix_t* Output of the last layer
+ */
+static matrix_t* _model_forward(model_ctx_t* ctx, size_t len)
+{
+    const model_t* model = ctx->model;
+    matrix_t* in = ctx->X;
+    size_t p = model->L;
+
+    for (size_t k = 0; k < model->n_conv; k++)
+    {
+        const conv_t* conv = &model->conv[k];
+        matrix_t* out = ctx->a[k % 2];
+
+        if (conv->type == CONV_2D)
+        {
+            conv_forward(conv, in, model->w[p], model->b[p], ctx->cols, out);
+            net_activate(model->act[p], out, out);
+            p++;
+        }
+
+        else
+            conv_pool_forward(conv, in, ctx->cols, out);
+
+        in = out;
+    }
+
+    for (size_t l = 0; l < model->L; l++)
+    {
+        matrix_t* out = ctx->a[(model->n_conv + l) % 2];
+
+        m_reshape(out, len, model->w[l]->n_col);
+        m_mul(in, model->w[l], out);
+        m_add_row(out, model->b[l], out);
+        net_activate(model->act[l], out, out);
+
+        in = out;
+    }
+
+    return in;
+}
+
+/**
+ * @return size_t Widest layer output of the model
+ */
+static size_t _model_width(const model_t* model)
+{
+    size_t width = model->hidden_size > model->output_size
+                 ? model->hidden_size : model->output_size;
+
+    for (size_t k = 0; k < model->n_conv; k++)
+    {
+        if (conv_out_size(&model->conv[k]) > width)
+            width = conv_out_size(&model->conv[k]);
+    }
+
+    return width;
+}
+
+/**
+ * @return size_t Largest im2col windows of a sample, over every
+ *         convolution and pooling layer
+ */
+static size_t _model_windows(const model_t* model)
+{
+    size_t size = 0;
+
+    for (size_t k = 0; k < model->n_conv; k++)
+    {
+        const conv_t* conv = &model->conv[k];
+        size_t s = conv_positions(conv) * conv_window(conv);
+
+        if (s > size)
+            size = s;
+    }
+
+    return size;
+}
+
+/**
+ * @return size_t Column of the highest value of a row
+ */
+static size_t _model_argmax(matrix_t* m, size_t row)
+{
+    size_t best = 0;
+
+    for (size_t i = 1; i < m->n_col; i++)
+    {
+        if (m->array[i * m->n_row + row] > m->array[best * m->n_row + row])
+            best = i;
+    }
+
+    return best;
+}
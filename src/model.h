@@ -0,0 +1,60 @@
+/**
+ * @file    model.h
+ * @author  Philippe Bouchet (philippe.bouchet@epita.fr)
+ * @brief   Inference API: an immutable model holding the weights of a
+ *          trained network, and lightweight inference contexts holding
+ *          only the activation buffers of one thread. Any number of
+ *          contexts may run predictions concurrently on a shared model.
+ *          Public API functions denoted with "model" prefix.
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef MODEL_H
+#define MODEL_H
+
+#define MODEL_INVALID_BATCH     -1
+
+#include "matrix.h"
+#include "network.h"
+
+typedef struct
+{
+    size_t          L;
+    size_t          input_size;
+    size_t          hidden_size;
+    size_t          output_size;
+    size_t          n_conv;  // Convolution and pooling layers, before L
+    conv_t*         conv;
+    size_t          n_params;// Entries of act, w and b
+    activation_t*   act;
+    matrix_t**      w;
+    matrix_t**      b;
+} model_t;
+
+typedef struct
+{
+    const model_t*  model;   // Shared, never written by a context
+    size_t          max_batch;
+    matrix_t*       X;       // Batch inputs
+    matrix_t*       a[2];    // Layer outputs, alternating between layers
+    matrix_t*       cols;    // im2col windows, NULL without convolutions
+} model_ctx_t;
+
+model_t*        model_init(network_t* net);
+model_t*        model_load(const char* path);
+void            model_free(model_t* model);
+void            model_copy(model_t* model, network_t* net);
+size_t          model_size(const model_t* model);
+
+model_ctx_t*    model_ctx_init(const model_t* model, size_t max_batch);
+void            model_ctx_free(model_ctx_t* ctx);
+size_t          model_ctx_size(const model_ctx_t* ctx);
+
+void            model_predict(model_ctx_t* ctx, double* X, double* y);
+void            model_predict_batch(model_ctx_t* ctx, double** X, size_t n,
+                                    double* y);
+double          model_accuracy(model_ctx_t* ctx, dataset_t* dataset);
+
+#endif // MODEL_H
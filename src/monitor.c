@@ -0,0 +1,292 @@
+/**
+ * @file    monitor.c
+ * @author  Philippe Bouchet (philippe.bouchet@epita.fr)
+ * @brief   Background validation implementation.
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "monitor.h"
+
+#include <err.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include "memory.h"
+#include "utils.h"
+
+/* Internal API forward declaration */
+
+static void*    _mon_thread(void* args);
+static void     _mon_evaluate(monitor_t* mon, model_t* model,
+                              mon_record_t* record);
+
+
+/* ==== MONITOR PUBLIC API ==== */
+
+
+/**
+ * @brief  Start a monitor thread evaluating snapshots of a network
+ *
+ * @param  net Network whose shape the snapshots have
+ * @param  data Held-out set, not used for training
+ * @param  every Steps between two snapshots taken by mon_step
+ * @param  log Stream records are printed to as they complete, or NULL
+ * @return monitor_t* Monitor
+ */
+monitor_t* mon_init(network_t* net, dataset_t* data, size_t every,
+                    FILE* log)
+{
+    if (every == 0 || data->n == 0)
+    {
+        errx(MONITOR_INVALID_CONFIG,
+             "MONITOR::ERROR::INIT: "
+             "Snapshot interval and held-out set must not be empty");
+    }
+
+    monitor_t* mon = mem_calloc(1, sizeof(monitor_t), MEM_NETWORK);
+
+    mon->data = data;
+    mon->every = every;
+    mon->log = log;
+    mon->start = get_time();
+
+    mon->slots[0] = model_init(net);
+    mon->slots[1] = model_init(net);
+    mon->ctx = model_ctx_init(mon->slots[0], MONITOR_EVAL_BATCH);
+
+    mon->busy = -1;
+    mon->pending = -1;
+
+    mon->capacity = MONITOR_INIT_CAPACITY;
+    mon->records = mem_malloc(mon->capacity * sizeof(mon_record_t),
+                              MEM_NETWORK);
+
+    pthread_mutex_init(&mon->lock, NULL);
+    pthread_cond_init(&mon->cond, NULL);
+    pthread_create(&mon->thread, NULL, _mon_thread, mon);
+
+    return mon;
+}
+
+/**
+ * @brief Evaluate the last pending snapshot, stop the monitor thread and
+ *        free the monitor, records included
+ *
+ * @param mon Monitor
+ */
+void mon_free(monitor_t* mon)
+{
+    pthread_mutex_lock(&mon->lock);
+    mon->stop = 1;
+    pthread_cond_broadcast(&mon->cond);
+    pthread_mutex_unlock(&mon->lock);
+
+    pthread_join(mon->thread, NULL);
+
+    pthread_mutex_destroy(&mon->lock);
+    pthread_cond_destroy(&mon->cond);
+
+    model_ctx_free(mon->ctx);
+    model_free(mon->slots[0]);
+    model_free(mon->slots[1]);
+    mem_free(mon->records);
+    mem_free(mon);
+}
+
+/**
+ * @brief Count an optimizer step, and publish a snapshot every
+ *        mon->every steps
+ *
+ * @param mon Monitor
+ * @param net Network being trained
+ */
+void mon_step(monitor_t* mon, network_t* net)
+{
+    if (++mon->step % mon->every == 0)
+        mon_publish(mon, net, mon->step);
+}
+
+/**
+ * @brief Publish a snapshot of the network's parameters. The copy goes to
+ *        the slot the monitor thread is not evaluating, replacing any
+ *        snapshot still waiting there, so the caller only waits for a
+ *        parameter copy, never for an evaluation.
+ *
+ * @param mon Monitor
+ * @param net Network being trained
+ * @param step Step number recorded with the snapshot
+ */
+void mon_publish(monitor_t* mon, network_t* net, size_t step)
+{
+    pthread_mutex_lock(&mon->lock);
+
+    int slot = mon->busy == 0 ? 1 : 0;
+
+    if (mon->pending != -1)
+        mon->dropped++;
+
+    // The slot cannot be picked up while it is being written
+    mon->pending = -1;
+
+    pthread_mutex_unlock(&mon->lock);
+
+    model_copy(mon->slots[slot], net);
+
+    pthread_mutex_lock(&mon->lock);
+
+    mon->pending = slot;
+    mon->pending_step = step;
+    mon->pending_time = get_time() - mon->start;
+    mon->published++;
+
+    pthread_cond_broadcast(&mon->cond);
+    pthread_mutex_unlock(&mon->lock);
+}
+
+/**
+ * @brief Wait until every published snapshot that was not replaced has
+ *        been evaluated
+ *
+ * @param mon Monitor
+ */
+void mon_wait(monitor_t* mon)
+{
+    pthread_mutex_lock(&mon->lock);
+
+    while (mon->pending != -1 || mon->busy != -1)
+        pthread_cond_wait(&mon->cond, &mon->lock);
+
+    pthread_mutex_unlock(&mon->lock);
+}
+
+
+/* ==== MONITOR INTERNAL API ==== */
+
+
+/**
+ * @brief Monitor thread: evaluate pending snapshots until stopped, then
+ *        evaluate the last one
+ *
+ * @param args Monitor
+ */
+static void* _mon_thread(void* args)
+{
+    monitor_t* mon = args;
+
+    pthread_mutex_lock(&mon->lock);
+
+    for (;;)
+    {
+        while (!mon->stop && mon->pending == -1)
+            pthread_cond_wait(&mon->cond, &mon->lock);
+
+        if (mon->pending == -1)
+            break;
+
+        mon_record_t record = {
+            .step = mon->pending_step,
+            .time = mon->pending_time,
+        };
+
+        mon->busy = mon->pending;
+        mon->pending = -1;
+
+        model_t* model = mon->slots[mon->busy];
+
+        pthread_mutex_unlock(&mon->lock);
+
+        _mon_evaluate(mon, model, &record);
+
+        if (mon->log)
+        {
+            fprintf(mon->log, "[MONITOR] step %zu (%.1fs) - val accuracy "
+                    "%.2f%%, loss %.4f [%.1f ms]\n", record.step,
+                    record.time, record.accuracy * 100, record.loss,
+                    record.eval_time * 1e3);
+            fflush(mon->log);
+        }
+
+        pthread_mutex_lock(&mon->lock);
+
+        if (mon->n_records == mon->capacity)
+        {
+            mon->capacity *= 2;
+            mon->records = mem_realloc(mon->records, mon->capacity
+                                                     * sizeof(mon_record_t));
+        }
+
+        mon->records[mon->n_records++] = record;
+        mon->busy = -1;
+
+        // Wake mon_wait
+        pthread_cond_broadcast(&mon->cond);
+    }
+
+    pthread_mutex_unlock(&mon->lock);
+
+    return NULL;
+}
+
+/**
+ * @brief Accuracy and mean loss of a snapshot on the held-out set
+ *
+ * @param mon Monitor
+ * @param model Snapshot
+ * @param record Record to fill
+ */
+static void _mon_evaluate(monitor_t* mon, model_t* model,
+                          mon_record_t* record)
+{
+    double start = get_time();
+    dataset_t* data = mon->data;
+    size_t n_out = model->output_size;
+    int softmax = model->act[model->L - 1] == ACT_SOFTMAX;
+    double* y = malloc(MONITOR_EVAL_BATCH * n_out * sizeof(double));
+    size_t correct = 0;
+    double loss = 0.f;
+
+    mon->ctx->model = model;
+
+    for (size_t p = 0; p < data->n; p += MONITOR_EVAL_BATCH)
+    {
+        size_t len = data->n - p;
+
+        if (len > MONITOR_EVAL_BATCH)
+            len = MONITOR_EVAL_BATCH;
+
+        model_predict_batch(mon->ctx, data->X + p, len, y);
+
+        for (size_t i = 0; i < len; i++)
+        {
+            double* out = y + i * n_out;
+            double* target = data->y[p + i];
+            size_t best = 0, label = 0;
+
+            for (size_t j = 0; j < n_out; j++)
+            {
+                double err = out[j] - target[j];
+
+                if (out[j] > out[best])
+                    best = j;
+
+                if (target[j] > target[label])
+                    label = j;
+
+                if (softmax)
+                    loss -= target[j] * log(out[j] + 1e-12);
+                else
+                    loss += 0.5f * err * err;
+            }
+
+            correct += best == label;
+        }
+    }
+
+    free(y);
+
+    record->accuracy = (double) correct / data->n;
+    record->loss = loss / data->n;
+    record->eval_time = get_time() - start;
+}
@@ -0,0 +1,72 @@
+/**
+ * @file    monitor.h
+ * @author  Philippe Bouchet (philippe.bouchet@epita.fr)
+ * @brief   Background validation. Training publishes snapshots of its
+ *          parameters into one of two model buffers; a monitor thread
+ *          evaluates the latest snapshot on a held-out set and records
+ *          accuracy and loss against the training step.
+ *          Public API functions denoted with "mon" prefix.
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef MONITOR_H
+#define MONITOR_H
+
+#include <pthread.h>
+#include <stdio.h>
+
+#include "model.h"
+#include "network.h"
+
+#define MONITOR_INVALID_CONFIG  -1
+
+#define MONITOR_EVAL_BATCH      256
+#define MONITOR_INIT_CAPACITY   16
+
+typedef struct
+{
+    size_t      step;        // Optimizer step of the snapshot
+    double      accuracy;
+    double      loss;        // Cross-entropy for softmax outputs, else MSE
+    double      time;        // Seconds since mon_init, at publication
+    double      eval_time;   // Seconds spent evaluating
+} mon_record_t;
+
+typedef struct monitor
+{
+    dataset_t*  data;        // Held-out set
+    size_t      every;       // Steps between two snapshots
+    FILE*       log;         // One line per record, or NULL
+    double      start;
+
+    model_t*    slots[2];    // Snapshot buffers
+    model_ctx_t* ctx;        // Inference context of the monitor thread
+    size_t      step;        // Steps seen by mon_step
+    size_t      published;   // Snapshots published
+    size_t      dropped;     // Snapshots replaced before being evaluated
+
+    pthread_t   thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    int         busy;        // Slot being evaluated, -1 if idle
+    int         pending;     // Slot waiting for evaluation, -1 if none
+    size_t      pending_step;
+    double      pending_time;
+    int         stop;
+
+    mon_record_t* records;
+    size_t      n_records;
+    size_t      capacity;
+} monitor_t;
+
+monitor_t*  mon_init(network_t* net, dataset_t* data, size_t every,
+                     FILE* log);
+void        mon_free(monitor_t* mon);
+
+void        mon_step(monitor_t* mon, network_t* net);
+void        mon_publish(monitor_t* mon, network_t* net, size_t step);
+void        mon_wait(monitor_t* mon);
+
+#endif // MONITOR_H
@@ -11,26 +11,160 @@
 
 #include <err.h>
 #include <fcntl.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include "live.h"
+#include "memory.h"
+#include "monitor.h"
+#include "pool.h"
+#include "profile.h"
+#include "queue.h"
+#include "scheduler.h"
 #include "utils.h"
 
+// Tensor indices of the network graph, in _net_build_graph order
+#define NET_TENSOR_X            0
+#define NET_TENSOR_Y            1
+#define NET_TENSOR_Z(l)         (2 + 3 * (l))
+#define NET_TENSOR_A(l)         (3 + 3 * (l))
+#define NET_TENSOR_DELTA(l)     (4 + 3 * (l))
+#define NET_TENSOR_GRAD_W(L, l) (2 + 3 * (L) + 2 * (l))
+#define NET_TENSOR_GRAD_B(L, l) (3 + 3 * (L) + 2 * (l))
+
+// Tensors of a convolution / pooling layer, from _net_conv_tensor
+#define NET_CONV_A              0
+#define NET_CONV_DELTA          1
+#define NET_CONV_COLS           2
+#define NET_CONV_GRAD_W         3   // Convolutions only
+#define NET_CONV_GRAD_B         4
+
+typedef struct
+{
+    network_t*  net;         // Master network, updated by the main thread
+    pool_t*     pool;        // NULL without worker threads
+    network_t** replicas;    // Network of each worker
+    int*        borrowed;    // Replicas reading the weights of another
+                             // network, their own ones freed
+    size_t*     leader;      // First worker on the node of each worker
+    matrix_t**  scratch;     // Reduction operands, n_workers per worker
+    weights_placement_t weights;
+
+    dist_t*     dist;        // Rank of a multi-process run, or NULL
+    double*     flat;        // Gradients or parameters exchanged by ranks
+
+    dataset_t*  data;        // Current micro-batch
+    size_t      start;
+    size_t      len;
+} net_parallel_t;
+
+typedef struct
+{
+    network_t*  net;         // Network owning the weights and gradients
+    pool_t*     pool;        // One worker per stage
+    size_t      n_stages;
+    size_t*     stage;       // Stage of each layer
+    size_t*     fwd_first;   // Forward steps [fwd_first, fwd_last) of
+    size_t*     fwd_last;    // each stage
+    size_t*     bwd_first;   // Backward steps of each stage
+    size_t*     bwd_last;
+    queue_t**   fwd;         // Activations from stage s to s + 1
+    queue_t**   bwd;         // Deltas from stage s + 1 to s
+
+    network_t** replicas;    // Activations of each micro-batch in flight
+    size_t      n_replicas;  // Micro-batches per step
+    dataset_t*  data;        // Micro-batches of the current step
+    size_t*     start;
+    size_t*     len;
+    size_t      n_micro;
+} net_pipeline_t;
+
 /* Internal API forward declaration */
 
+static void     _net_set_conv(network_t* net, const conv_t* conv,
+                              size_t n_conv);
 static void     _net_alloc_layers(network_t* net);
+static void     _net_alloc_graph(network_t* net);
+static void     _net_layer_shape(size_t L, size_t input_size,
+                                 size_t hidden_size, size_t output_size,
+                                 size_t l, size_t* n_in, size_t* n_out);
 static void     _net_free_layers(network_t* net);
 static void     _net_init_layers(network_t* net);
+static void     _net_init_layer(network_t* net, size_t l);
+static graph_t* _net_build_graph(size_t L, size_t input_size,
+                                 size_t hidden_size, size_t output_size,
+                                 const conv_t* conv, size_t n_conv,
+                                 size_t batch_size, size_t checkpoint);
+static int      _net_checkpointed(size_t L, size_t checkpoint, size_t l);
+static size_t   _net_footprint(size_t L, size_t input_size,
+                               size_t hidden_size, size_t output_size,
+                               const conv_t* conv, size_t n_conv,
+                               size_t batch_size, size_t checkpoint);
+static size_t   _net_feature_size(size_t input_size, const conv_t* conv,
+                                  size_t n_conv);
+static size_t   _net_conv_param(size_t L, const conv_t* conv, size_t k);
+static size_t   _net_conv_tensor(size_t L, const conv_t* conv, size_t k,
+                                 size_t which);
+static void     _net_softmax(matrix_t* z, matrix_t* a);
 static void     _net_feed_forward(network_t* net);
 static void     _net_backprop(network_t* net);
-static void     _net_mini_batch_gradient_descent(network_t* net);
-static void     _net_update(network_t* net);
-static void     _net_init_X(network_t* net, double* X);
-static void     _net_init_y(network_t* net, double* y);
-static double   _net_evaluate_prediction(network_t* net);
+static void     _net_run(network_t* net, size_t first, size_t last);
+static void     _net_dense(network_t* net, g_step_t* s);
+static void     _net_sparse_forward(network_t* net, matrix_t* z);
+static void     _net_act(network_t* net, g_step_t* s);
+static void     _net_loss(network_t* net, g_step_t* s);
+static void     _net_dense_grad(network_t* net, g_step_t* s);
+static void     _net_dense_bwd(network_t* net, g_step_t* s);
+static void     _net_act_bwd(network_t* net, g_step_t* s);
+static void     _net_conv(network_t* net, g_step_t* s);
+static void     _net_pool(network_t* net, g_step_t* s);
+static void     _net_conv_grad(network_t* net, g_step_t* s);
+static void     _net_conv_bwd(network_t* net, g_step_t* s);
+static void     _net_pool_bwd(network_t* net, g_step_t* s);
+static void     _net_update(network_t* net, double lr, size_t n_samples);
+static void     _net_accumulate(network_t* net, net_parallel_t* par,
+                                dataset_t* data, size_t start, size_t len);
+static void     _net_step(network_t* net, net_parallel_t* par, double lr,
+                          size_t n_samples);
+static net_parallel_t* _net_par_init(network_t* net, train_config_t* config);
+static void     _net_par_free(net_parallel_t* par);
+static void     _net_par_interleave(matrix_t* m);
+static void     _net_par_clone(void* args, size_t worker);
+static void     _net_par_batch(void* args, size_t worker);
+static void     _net_par_reduce(void* args, size_t worker);
+static void     _net_par_sum(matrix_t* dst, matrix_t** src, size_t n_src,
+                             size_t worker, size_t n_workers);
+static void     _net_par_sync(void* args, size_t worker);
+static void     _net_par_allreduce(net_parallel_t* par);
+static void     _net_par_pack(matrix_t** m, size_t n, double* flat,
+                              size_t* pos, int unpack);
+static size_t   _net_par_params(network_t* net, double* flat, int unpack);
+static net_pipeline_t* _net_pipe_init(network_t* net,
+                                       train_config_t* config);
+static void     _net_pipe_free(net_pipeline_t* pipe);
+static void     _net_pipe_partition(net_pipeline_t* pipe);
+static size_t   _net_pipe_stage_of(net_pipeline_t* pipe, size_t i);
+static network_t* _net_pipe_replica(network_t* net);
+static void     _net_pipe_add(net_pipeline_t* pipe, dataset_t* data,
+                              size_t start, size_t len);
+static void     _net_pipe_run(net_pipeline_t* pipe);
+static void     _net_pipe_stage(void* args, size_t stage);
+static double   _net_schedule_lr(network_t* net, train_config_t* config,
+                                 double epoch, double step);
+static void     _net_copy_params(matrix_t** w_src, matrix_t** b_src,
+                                 matrix_t** w_dst, matrix_t** b_dst,
+                                 size_t L);
+static void     _net_set_batch(network_t* net, size_t rows);
+static void     _net_load_batch(network_t* net, dataset_t* data,
+                                size_t start, size_t len);
+static void     _net_init_X(network_t* net, double* X, size_t row);
+static void     _net_init_y(network_t* net, double* y, size_t row);
+static double   _net_evaluate_prediction(network_t* net, size_t row);
 static void     _net_binarize_output(network_t* net, double threshold);
+static size_t   _net_argmax(matrix_t* m, size_t row);
 
 
 /* ==== NETWORK PUBLIC API ==== */
@@ -43,7 +177,8 @@ static void     _net_binarize_output(network_t* net, double threshold);
  * @param  input_size Number of neurons in the input layer
  * @param  hidden_size Number of neurons in the hidden layer
  * @param  output_size Number of neurons in the output layer
- * @param  batch_size Amount of data to be used per epoch
+ * @param  batch_size Amount of samples per mini-batch
+ * @param  lr Learning rate
  * @return network_t* Pointer to the initialized neural network struct
  */
 network_t* net_init(size_t L, size_t input_size,
@@ -51,14 +186,47 @@ network_t* net_init(size_t L, size_t input_size,
                               size_t output_size,
                               size_t batch_size, double lr)
 {
-    network_t* net = malloc(sizeof(network_t));
+    return net_init_conv(1, 1, input_size, NULL, 0, L, hidden_size,
+                         output_size, batch_size, lr);
+}
+
+/**
+ * @brief  Initialize a network whose dense layers are preceded by
+ *         convolution and pooling layers. Inputs are images of
+ *         channels x height x width values, channel-major; convolutions
+ *         use ReLU activations.
+ * 
+ * @param  channels Channels of the input images
+ * @param  height Height of the input images
+ * @param  width Width of the input images
+ * @param  conv Convolution and pooling layers, from conv_2d and conv_pool
+ * @param  n_conv Number of convolution and pooling layers
+ * @param  L Number of dense layers
+ * @param  hidden_size Number of neurons in the hidden layer
+ * @param  output_size Number of neurons in the output layer
+ * @param  batch_size Amount of samples per mini-batch
+ * @param  lr Learning rate
+ * @return network_t* Pointer to the initialized neural network struct
+ */
+network_t* net_init_conv(size_t channels, size_t height, size_t width,
+                         const conv_t* conv, size_t n_conv,
+                         size_t L, size_t hidden_size, size_t output_size,
+                         size_t batch_size, double lr)
+{
+    network_t* net = mem_malloc(sizeof(network_t), MEM_NETWORK);
 
     net->L = L;
-    net->input_size = input_size;
+    net->input_size = channels * height * width;
     net->hidden_size = hidden_size;
     net->output_size = output_size;
     net->batch_size = batch_size;
+    net->max_batch = batch_size > NETWORK_EVAL_BATCH ? batch_size
+                                                     : NETWORK_EVAL_BATCH;
     net->lr = lr;
+    net->checkpoint = 0;
+
+    _net_set_conv(net, conv, n_conv);
+    conv_shape(net->conv, n_conv, channels, height, width);
 
     _net_alloc_layers(net);
     _net_init_layers(net);
@@ -74,11 +242,53 @@ network_t* net_init(size_t L, size_t input_size,
 void net_free(network_t* net)
 {
     _net_free_layers(net);
-    free(net);
+    mem_free(net);
 
     net = NULL;
 }
 
+/**
+ * @brief Set the activation function of layer l, and re-initialize its
+ *        weights with a range suited to that activation.
+ *        Softmax is only valid on the output layer, where it is trained
+ *        with a cross-entropy loss.
+ * 
+ * @param net Neural network struct
+ * @param l Layer index, 0 being the first hidden layer
+ * @param act Activation function
+ */
+void net_set_activation(network_t* net, size_t l, activation_t act)
+{
+    if (l >= net->L || (act == ACT_SOFTMAX && l != net->L - 1))
+    {
+        errx(NETWORK_INVALID_LAYER,
+             "NETWORK::ERROR::ACTIVATION: "
+             "Invalid activation %d for layer %zu", act, l);
+    }
+
+    net->act[l] = act;
+    _net_init_layer(net, l);
+}
+
+/**
+ * @brief Gradient checkpointing: keep the activations of every k-th dense
+ *        layer (and of the output layer) through the forward pass, and
+ *        recompute the others one segment at a time during the backward
+ *        pass. Activation memory drops from L to about L / k + k layers,
+ *        for up to one more forward pass per batch. Results are unchanged.
+ *        The graph is planned again; the current batch is lost.
+ *
+ * @param net Neural network struct
+ * @param every Layers per checkpoint, 0 or 1 keeps every activation
+ */
+void net_set_checkpoint(network_t* net, size_t every)
+{
+    net->checkpoint = every;
+
+    graph_free(net->graph);
+    _net_alloc_graph(net);
+}
+
 /**
  * @brief  Load network from file and create network struct
  * 
@@ -99,7 +309,8 @@ network_t* net_load(const char* path)
     unsigned int signature;
     read(fd, &signature, sizeof(int));
 
-    if (signature != 0xDEADBEEF)
+    if (signature != NETWORK_SIGNATURE && signature != NETWORK_SIGNATURE_ACT
+        && signature != NETWORK_SIGNATURE_CONV)
     {
         errx(NETWORK_FAILED_LOAD,
              "NETWORK::ERROR::LOAD: "
@@ -109,24 +320,59 @@ network_t* net_load(const char* path)
     size_t arr[4];
     read(fd, &arr, sizeof(size_t) * 4);
 
-    network_t* net = net_init(arr[0], arr[1], arr[2], arr[3], 0, 0.f);
+    network_t* net;
 
-    for (size_t l = 0; l < net->L; l++)
+    if (signature == NETWORK_SIGNATURE_CONV)
     {
-        size_t w_size = net->hidden_size * net->hidden_size;
-        size_t b_size = net->hidden_size;
-        
-        if (l == 0)
-            w_size = net->input_size*net->hidden_size;
-        
-        else if (l == net->L - 1)
+        // Layer count and input image shape, then each layer
+        size_t shape[4];
+        read(fd, &shape, sizeof(size_t) * 4);
+
+        conv_t* conv = mem_calloc(shape[0], sizeof(conv_t), MEM_NETWORK);
+
+        for (size_t k = 0; k < shape[0]; k++)
         {
-            w_size = net->output_size * net->hidden_size;
-            b_size = net->output_size;
+            size_t spec[5];
+            read(fd, &spec, sizeof(size_t) * 5);
+
+            conv[k].type = spec[0];
+            conv[k].channels = spec[1];
+            conv[k].kernel = spec[2];
+            conv[k].stride = spec[3];
+            conv[k].pad = spec[4];
+        }
+
+        net = net_init_conv(shape[1], shape[2], shape[3], conv, shape[0],
+                            arr[0], arr[2], arr[3], 0, 0.f);
+        mem_free(conv);
+    }
+
+    else
+        net = net_init(arr[0], arr[1], arr[2], arr[3], 0, 0.f);
+
+    if (signature != NETWORK_SIGNATURE)
+    {
+        for (size_t l = 0; l < net->n_params; l++)
+        {
+            unsigned int act;
+            read(fd, &act, sizeof(int));
+
+            // Softmax is only dispatched on the output layer
+            if (act > ACT_SOFTMAX || (act == ACT_SOFTMAX && l != net->L - 1))
+            {
+                errx(NETWORK_FAILED_LOAD,
+                     "NETWORK::ERROR::LOAD: "
+                     "Invalid activation %u for layer %zu", act, l);
+            }
+
+            net->act[l] = act;
         }
-        
-        read(fd, net->b[l]->array, sizeof(double) * b_size);
-        read(fd, net->w[l]->array, sizeof(double) * w_size);
+    }
+
+    for (size_t l = 0; l < net->n_params; l++)
+    {
+        read(fd, net->b[l]->array, sizeof(double) * net->b[l]->size);
+        read(fd, net->w[l]->array, sizeof(double) * net->w[l]->size);
     }
 
     close(fd);
@@ -134,6 +380,42 @@ network_t* net_load(const char* path)
     return net;
 }
 
+/**
+ * @brief  Copy the parameters and activations of a network into a new
+ *         network with its own buffers, so that both can run passes
+ *         concurrently
+ * 
+ * @param  net Network to copy
+ * @param  batch_size Mini-batch size of the copy
+ * @return network_t* Copy of the network
+ */
+network_t* net_clone(network_t* net, size_t batch_size)
+{
+    network_t* copy = mem_malloc(sizeof(network_t), MEM_NETWORK);
+
+    copy->L = net->L;
+    copy->input_size = net->input_size;
+    copy->hidden_size = net->hidden_size;
+    copy->output_size = net->output_size;
+    copy->batch_size = batch_size;
+    copy->max_batch = batch_size > NETWORK_EVAL_BATCH ? batch_size
+                                                      : NETWORK_EVAL_BATCH;
+    copy->lr = net->lr;
+    copy->checkpoint = net->checkpoint;
+
+    _net_set_conv(copy, net->conv, net->n_conv);
+
+    // Parameters are copied, not randomized: rand() is left untouched
+    _net_alloc_layers(copy);
+
+    for (size_t l = 0; l < net->n_params; l++)
+        copy->act[l] = net->act[l];
+
+    _net_copy_params(net->w, net->b, copy->w, copy->b, net->n_params);
+
+    return copy;
+}
+
 /**
  * @brief Save network's weights and biases in a file
  * 
@@ -144,7 +426,9 @@ void net_save(network_t* net, const char* dst)
 {
     FILE* fp = fopen(dst, "w+");
 
-    unsigned int signature = 0xDEADBEEF;
+    // Dense networks keep the format older readers understand
+    unsigned int signature = net->n_conv ? NETWORK_SIGNATURE_CONV
+                                         : NETWORK_SIGNATURE_ACT;
     fwrite(&signature, sizeof(int), 1, fp);
 
     size_t arr[4] = { net->L, net->input_size,
@@ -152,22 +436,33 @@ void net_save(network_t* net, const char* dst)
 
     fwrite(&arr, sizeof(size_t), 4, fp);
 
-    for (size_t l = 0; l < net->L; l++)
+    if (net->n_conv)
     {
-        size_t w_size = net->hidden_size * net->hidden_size;
-        size_t b_size = net->hidden_size;
-        
-        if (l == 0)
-            w_size = net->input_size*net->hidden_size;
-        
-        else if (l == net->L - 1)
+        size_t shape[4] = { net->n_conv, net->conv[0].in_c,
+                            net->conv[0].in_h, net->conv[0].in_w };
+
+        fwrite(&shape, sizeof(size_t), 4, fp);
+
+        for (size_t k = 0; k < net->n_conv; k++)
         {
-            w_size = net->output_size * net->hidden_size;
-            b_size = net->output_size;
+            conv_t* c = &net->conv[k];
+            size_t spec[5] = { c->type, c->channels, c->kernel,
+                               c->stride, c->pad };
+
+            fwrite(&spec, sizeof(size_t), 5, fp);
         }
-        
-        fwrite(net->b[l]->array, sizeof(double), b_size, fp);
-        fwrite(net->w[l]->array, sizeof(double), w_size, fp);
+    }
+
+    for (size_t l = 0; l < net->n_params; l++)
+    {
+        unsigned int act = net->act[l];
+        fwrite(&act, sizeof(int), 1, fp);
+    }
+
+    for (size_t l = 0; l < net->n_params; l++)
+    {
+        fwrite(net->b[l]->array, sizeof(double), net->b[l]->size, fp);
+        fwrite(net->w[l]->array, sizeof(double), net->w[l]->size, fp);
     }
 
     fclose(fp);
@@ -180,346 +475,2568 @@ void net_save(network_t* net, const char* dst)
  */
 void net_summary(network_t* net)
 {
+    static const char* act_names[] = { "sigmoid", "relu", "softmax" };
+    static const char* pool_names[] = { "conv", "max", "avg" };
+
     printf("Layers (Hidden):\t%zu\n", net->L);
     printf("Input size:\t\t%zu\n", net->input_size);
     printf("Hidden size:\t\t%zu\n", net->hidden_size);
-    printf("Output size:\t\t%zu\n\n", net->output_size);
+    printf("Output size:\t\t%zu\n", net->output_size);
+    printf("Batch capacity:\t\t%zu\n\n", net->max_batch);
+
+    printf("%-6s %-8s %-12s %10s %12s %12s %12s\n", "layer", "act",
+           "shape", "params", "params KiB", "grads KiB", "activ. KiB");
+
+    size_t params = 0;
+    size_t B = net->max_batch;
+
+    for (size_t k = 0; k < net->n_conv; k++)
+    {
+        conv_t* c = &net->conv[k];
+        size_t l = _net_conv_param(net->L, net->conv, k);
+        size_t p = c->type == CONV_2D ? net->w[l]->size + net->b[l]->size
+                                      : 0;
+        char name[32], shape[32];
+
+        snprintf(name, sizeof(name), "c%zu", k);
+        snprintf(shape, sizeof(shape), "%zux%zux%zu", c->out_c, c->out_h,
+                 c->out_w);
+        params += p;
+
+        // a and delta hold max_batch rows each, plus the im2col windows
+        printf("%-6s %-8s %-12s %10zu %12.1f %12.1f %12.1f\n", name,
+               c->type == CONV_2D ? act_names[net->act[l]]
+                                  : pool_names[c->type],
+               shape, p, p * sizeof(double) / 1024.f,
+               p * sizeof(double) / 1024.f,
+               (2.f * conv_out_size(c) + conv_positions(c) * conv_window(c))
+               * B * sizeof(double) / 1024.f);
+    }
+
+    for (size_t l = 0; l < net->L; l++)
+    {
+        size_t n_in = net->w[l]->n_row;
+        size_t n_out = net->w[l]->n_col;
+        size_t p = n_in * n_out + n_out;
+        char shape[32];
+
+        snprintf(shape, sizeof(shape), "%zux%zu", n_in, n_out);
+        params += p;
+
+        // a, z and delta hold max_batch rows each
+        printf("%-6zu %-8s %-12s %10zu %12.1f %12.1f %12.1f\n", l,
+               act_names[net->act[l]], shape, p,
+               p * sizeof(double) / 1024.f, p * sizeof(double) / 1024.f,
+               3.f * B * n_out * sizeof(double) / 1024.f);
+    }
+
+    printf("\nParameters:\t\t%zu\n", params);
+    printf("Activation arena:\t%.1f KiB planned, %.1f KiB without reuse "
+           "(%zu tensors, %zu steps)\n",
+           net->graph->arena_size * sizeof(double) / 1024.f,
+           net->graph->naive_size * sizeof(double) / 1024.f,
+           net->graph->n_tensors, net->graph->n_steps);
+
+    if (net->checkpoint > 1)
+        printf("Checkpoints:\t\tevery %zu layers, others recomputed\n",
+               net->checkpoint);
+
+    printf("Footprint:\t\t%.1f KiB (inputs, parameters, gradients "
+           "and activations)\n\n",
+           _net_footprint(net->L, net->input_size, net->hidden_size,
+                          net->output_size, net->conv, net->n_conv,
+                          net->batch_size, net->checkpoint) / 1024.f);
 }
 
 /**
- * @brief Train the network
+ * @brief  Estimate the bytes a network configuration allocates, without
+ *         allocating it. Workspace temporaries of training are included.
  * 
- * @param net Neural network struct
- * @param epochs Amount of times the network should iterate on training
+ * @param  L Number of layers in the network, excluding the input layer
+ * @param  input_size Number of neurons in the input layer
+ * @param  hidden_size Number of neurons in the hidden layer
+ * @param  output_size Number of neurons in the output layer
+ * @param  batch_size Amount of samples per mini-batch
+ * @return size_t Footprint in bytes
  */
-void net_train(network_t* net, dataset_t* data, size_t epochs)
+size_t net_footprint(size_t L, size_t input_size, size_t hidden_size,
+                     size_t output_size, size_t batch_size)
 {
-    printf("\n[TRAINING]\n\n");
+    return _net_footprint(L, input_size, hidden_size, output_size,
+                          NULL, 0, batch_size, 0);
+}
 
-    for (size_t e = 0; e < epochs; e++)
-    {
-        printf("Epoch %zu / %zu\n", e+1, epochs);
-        
-        data_shuffle(data);
-        
-        // Todo: Parallelize batch training
-        for (size_t b = 0; b < data->n - net->batch_size + 1; b++)
-        {
-            for (size_t i = b; i < net->batch_size + b; i++)
-            {
-                _net_init_X(net, data->X[i]);
-                _net_init_y(net, data->y[i]);
+/**
+ * @param  net Neural network struct
+ * @return size_t Doubles exchanged per step by multi-process training, the
+ *         buffer size to give dist_launch
+ */
+size_t net_dist_size(network_t* net)
+{
+    size_t size = net->grad_bg->size;
 
-                _net_feed_forward(net);
-                _net_backprop(net);
-                _net_mini_batch_gradient_descent(net);
-            }
+    for (size_t l = 0; l < net->n_params; l++)
+        size += net->grad_w[l]->size + net->grad_b[l]->size;
 
-            _net_update(net);
-        } 
-    }
-    
-    printf("\nCompleted %zu epochs!\n\n", epochs);
+    return size;
 }
 
 /**
- * @brief Calculate network accuracy on test dataset.
- *        Output is thresholded at 0.8.
+ * @brief Train the network with the default training configuration
  * 
  * @param net Neural network struct
- * @param dataset Test dataset
+ * @param epochs Amount of times the network should iterate on training
  */
-void net_evaluate(network_t* net, dataset_t* dataset)
+void net_train(network_t* net, dataset_t* data, size_t epochs)
 {
-    double accuracy = 0.f;
-    printf("\n[EVALUATING]\n");
-    
-    for (size_t p = 0; p < dataset->n; p++)
-    {
-        _net_init_X(net, dataset->X[p]);
-        _net_init_y(net, dataset->y[p]);
-        
-        _net_feed_forward(net);
-        _net_binarize_output(net, 0.8f);
-
-        accuracy += _net_evaluate_prediction(net);
-    }
-
-    accuracy /= dataset->n;
+    train_config_t config = net_config_default(epochs);
+    net_fit(net, data, &config);
+}
 
-    printf("\nNetwork accuracy: [%f%%]\n\n", accuracy * 100);
+/**
+ * @brief  Default training configuration: every micro-batch of the epoch
+ *         is its own optimizer step, and the last partial batch is kept.
+ * 
+ * @param  epochs Amount of times the network should iterate on training
+ * @return train_config_t Training configuration
+ */
+train_config_t net_config_default(size_t epochs)
+{
+    train_config_t config = {
+        .epochs = epochs,
+        .steps_per_epoch = 0,
+        .accum_steps = 1,
+        .drop_last = 0,
+        .lr_schedule = LR_CONSTANT,
+        .lr_step = 1,
+        .lr_gamma = 1.f,
+        .lr_min = 0.f,
+        .warmup_epochs = 0,
+        .val_split = 0.f,
+        .patience = 0,
+        .n_threads = 1,
+        .n_stages = 1,
+        .affinity = AFFINITY_SCATTER,
+        .weights = WEIGHTS_REPLICATED,
+        .dist = NULL,
+        .monitor = NULL,
+        .live = NULL,
+        .on_epoch = NULL,
+        .on_epoch_args = NULL,
+        .verbose = 1,
+    };
+
+    return config;
 }
 
 /**
- * @brief Predict output on network with single input
+ * @brief Train the network. Each shuffled epoch is split into disjoint
+ *        micro-batches of net->batch_size samples, and gradients of
+ *        config->accum_steps micro-batches are accumulated per update.
+ *
+ *        If config->val_split is set, that fraction of data is held out
+ *        for validation (at least one sample, and at most n - 1).
+ *        Training then stops once validation accuracy has not improved
+ *        for config->patience epochs, and the best weights are restored.
+ *        The held out samples are returned to data on exit.
+ *
+ *        With config->n_threads > 1, each micro-batch is split across a
+ *        pool of pinned workers (see _net_par_init). With config->dist,
+ *        every rank of a dist_launch run calls net_fit on the same data
+ *        and trains on its share of each micro-batch; gradients are
+ *        all-reduced before every step, so weights stay identical.
+ *        With config->n_stages > 1, layers are split into a pipeline of
+ *        stages instead, and the micro-batches of a step stream through
+ *        them (see _net_pipe_init).
+ *        With config->monitor, a snapshot of the parameters is handed to
+ *        its background thread every monitor->every steps.
+ *        With config->live, a new version of the parameters is published
+ *        to its readers every live->every steps.
+ *        With config->on_epoch, it is called after every epoch with the
+ *        index of that epoch, and training stops early if it returns non
+ *        zero, as with patience.
  * 
- * @param net Network to perform the prediction
- * @param X Input to predict with
+ * @param net Neural network struct
+ * @param data Training dataset
+ * @param config Training configuration
  */
-void net_predict(network_t* net, double* X, double* y)
+void net_fit(network_t* net, dataset_t* data, train_config_t* config)
 {
-    _net_init_X(net, X);
-    _net_init_y(net, y);
-    _net_feed_forward(net);
+    if (net->batch_size == 0 || net->batch_size > net->max_batch)
+    {
+        errx(NETWORK_INVALID_BATCH,
+             "NETWORK::ERROR::TRAIN: "
+             "Invalid batch size %zu", net->batch_size);
+    }
 
-    double threshold = 0.8f;
+    if (!(config->val_split >= 0.f && config->val_split < 1.f))
+    {
+        errx(NETWORK_INVALID_CONFIG,
+             "NETWORK::ERROR::TRAIN: "
+             "val_split %g is not in [0, 1)", config->val_split);
+    }
 
-    printf("\n[PREDICTION]:\n\n");
-    for (size_t i = 0; i < net->output_size; i++)
+    if (config->val_split > 0.f && data->n < 2)
     {
-        double predicted_val = net->a[net->L-1]->array[i];
-        double expected_val = y[i];
+        errx(NETWORK_INVALID_CONFIG,
+             "NETWORK::ERROR::TRAIN: "
+             "val_split needs at least 2 samples, got %zu", data->n);
+    }
 
-        printf("[");
-        if (expected_val == 1.0f)
-            printf("\033[0;32m");
+    dataset_t* val = NULL;
+    matrix_t** best_w = NULL;
+    matrix_t** best_b = NULL;
+    double best_acc = -1.f;
+    size_t best_epoch = 0;
 
-        printf("%zu", i);
-        printf("\033[0m] - ");
+    if (config->val_split > 0.f)
+    {
+        // At least one sample on each side of the split
+        size_t n_val = (size_t) (data->n * config->val_split);
 
-        if (predicted_val > threshold)
-            printf("\033[0;32m");
+        if (n_val < 1)
+            n_val = 1;
 
-        printf("Predicted: %f ", net->a[net->L-1]->array[i]);
-        printf("\033[0m - ");
+        if (n_val > data->n - 1)
+            n_val = data->n - 1;
 
-        if (expected_val > threshold)
-            printf("\033[0;32m");
+        data_shuffle(data);
+        val = data_split(data, n_val);
 
-        printf("Expected: %f\n", y[i]);
-        printf("\033[0m");
-    }
+        best_w = mem_calloc(net->n_params, sizeof(matrix_t*), MEM_NETWORK);
+        best_b = mem_calloc(net->n_params, sizeof(matrix_t*), MEM_NETWORK);
 
-    printf("\n");
-}
+        mem_category_t scope = mem_scope(MEM_PARAMS);
 
+        for (size_t l = 0; l < net->n_params; l++)
+        {
+            best_w[l] = m_copy(net->w[l]);
+            best_b[l] = m_copy(net->b[l]);
+        }
 
+        mem_scope(scope);
+    }
 
-/* ==== NETWORK INTERNAL API ==== */
+    net_parallel_t* par = config->n_threads > 1 || config->dist
+                        ? _net_par_init(net, config) : NULL;
+    net_pipeline_t* pipe = config->n_stages > 1
+                         ? _net_pipe_init(net, config) : NULL;
 
+    size_t accum_steps = config->accum_steps ? config->accum_steps : 1;
+    scheduler_t* sched = sched_init(data->n, net->batch_size,
+                                    config->drop_last);
 
+    size_t steps_in_epoch = (sched->n_batches + accum_steps - 1)
+                          / accum_steps;
 
-/**
- * @brief Dynamic allocation of network layers
- * 
- * @param net Neural network struct
- */
-static void _net_alloc_layers(network_t* net)
-{
-    net->a = calloc(net->L, sizeof(matrix_t*));
-    net->z = calloc(net->L, sizeof(matrix_t*));
-    net->w = calloc(net->L, sizeof(matrix_t*));
-    net->b = calloc(net->L, sizeof(matrix_t*));
-    net->delta = calloc(net->L, sizeof(matrix_t*));
-    net->grad_w = calloc(net->L, sizeof(matrix_t*));
-    net->grad_b = calloc(net->L, sizeof(matrix_t*));
+    if (config->steps_per_epoch && config->steps_per_epoch < steps_in_epoch)
+        steps_in_epoch = config->steps_per_epoch;
+
+    if (config->verbose)
+        printf("\n[TRAINING]\n\n");
 
-    net->X = m_init(1, net->input_size);
-    net->y = m_init(1, net->output_size);
+    size_t e = 0;
 
-    for (size_t l = 0; l < net->L - 1; l++)
+    for (; e < config->epochs; e++)
     {
-        net->a[l] = m_init(1, net->hidden_size);
-        net->z[l] = m_init(1, net->hidden_size);
-        net->b[l] = m_init(1, net->hidden_size);
-        net->delta[l] = m_init(1, net->hidden_size);
-        net->grad_b[l] = m_init(1, net->hidden_size);
+        double start_time = get_time();
+        size_t steps = 0;
+        size_t samples = 0;
+        size_t accumulated = 0;
+        size_t n_micro = 0;
+        size_t b_start, b_len;
+        double lr = net->lr;
+
+        PROF_START(t_shuffle);
+        data_shuffle(data);
+        PROF_STOP(t_shuffle, PROF_SHUFFLE, PROF_NO_LAYER, 0.f,
+                  32.f * data->n);
+
+        sched_reset(sched);
+
+        while (sched_next(sched, &b_start, &b_len))
+        {
+            if (pipe)
+                _net_pipe_add(pipe, data, b_start, b_len);
+            else
+                _net_accumulate(net, par, data, b_start, b_len);
+
+            accumulated += b_len;
+            samples += b_len;
+
+            if (++n_micro < accum_steps)
+                continue;
+
+            if (pipe)
+                _net_pipe_run(pipe);
+
+            lr = _net_schedule_lr(net, config,
+                                  e + (double) steps / steps_in_epoch,
+                                  1.f / steps_in_epoch);
+            _net_step(net, par, lr, accumulated);
+
+            if (config->monitor)
+                mon_step(config->monitor, net);
+
+            if (config->live)
+                live_step(config->live, net);
+
+            accumulated = 0;
+            n_micro = 0;
+
+            if (++steps == config->steps_per_epoch)
+                break;
+        }
+
+        // Flush gradients of a trailing incomplete accumulation
+        if (accumulated > 0)
+        {
+            if (pipe)
+                _net_pipe_run(pipe);
+
+            lr = _net_schedule_lr(net, config,
+                                  e + (double) steps / steps_in_epoch,
+                                  1.f / steps_in_epoch);
+            _net_step(net, par, lr, accumulated);
+
+            if (config->monitor)
+                mon_step(config->monitor, net);
+
+            if (config->live)
+                live_step(config->live, net);
+
+            steps++;
+        }
+
+        double elapsed = get_time() - start_time;
+        double acc = val ? net_accuracy(net, val) : 0.f;
+
+        if (config->verbose)
+        {
+            printf("Epoch %zu / %zu - %zu steps, %zu samples, lr %g "
+                   "[%.1f samples/s, %.1f steps/s]",
+                   e+1, config->epochs, steps, samples, lr,
+                   samples / elapsed, steps / elapsed);
+
+            if (val)
+                printf(" - val accuracy %.2f%%", acc * 100);
+
+            printf("\n");
+        }
+
+        PROF_EPOCH_SUMMARY(samples, elapsed, config->verbose);
+
+        if (val != NULL && acc > best_acc)
+        {
+            best_acc = acc;
+            best_epoch = e;
+            _net_copy_params(net->w, net->b, best_w, best_b,
+                             net->n_params);
+        }
+
+        else if (val != NULL && config->patience
+                 && e - best_epoch >= config->patience)
+        {
+            if (config->verbose)
+                printf("\nEarly stopping: no improvement for %zu epochs\n",
+                       config->patience);
+            e++;
+            break;
+        }
+
+        if (config->on_epoch
+            && config->on_epoch(net, e, config->on_epoch_args))
+        {
+            e++;
+            break;
+        }
     }
 
-    net->w[0] = m_init(net->input_size, net->hidden_size);
-    net->grad_w[0] = m_init(net->input_size, net->hidden_size);
-    
-    for (size_t l = 1; l < net->L - 1; l++)
+    sched_free(sched);
+
+    if (config->dist)
     {
-        net->grad_w[l] = m_init(net->hidden_size, net->hidden_size);
-        net->w[l] = m_init(net->hidden_size, net->hidden_size);
+        // Every rank applied the same all-reduced gradients
+        size_t n_params = _net_par_params(net, par->flat, 0);
+
+        if (!dist_identical(config->dist, par->flat, n_params))
+        {
+            errx(NETWORK_DIVERGED,
+                 "NETWORK::ERROR::TRAIN: "
+                 "Weights of rank %zu diverged", config->dist->rank);
+        }
     }
 
-    net->a[net->L - 1] = m_init(1, net->output_size);
-    net->z[net->L - 1] = m_init(1, net->output_size);
-    net->b[net->L - 1] = m_init(1, net->output_size);
-    net->delta[net->L - 1] = m_init(1, net->output_size);
-    net->grad_w[net->L - 1] = m_init(net->hidden_size, net->output_size);
-    net->grad_b[net->L - 1] = m_init(1, net->output_size);
-    net->w[net->L - 1] = m_init(net->hidden_size, net->output_size);
-}
+    if (par != NULL)
+        _net_par_free(par);
 
-/**
- * @brief Free network layers
- * 
- * @param net Neural network struct
- */
-static void _net_free_layers(network_t* net)
-{
-    m_free(net->X);
-    m_free(net->y);
-    
-    for (size_t l = 0; l < net->L; l++)
+    if (pipe != NULL)
+        _net_pipe_free(pipe);
+
+    if (val != NULL)
     {
-        m_free(net->a[l]);
-        m_free(net->z[l]);
-        m_free(net->b[l]);
-        m_free(net->delta[l]);
-        m_free(net->w[l]);
-        m_free(net->grad_b[l]);
-        m_free(net->grad_w[l]);
+        if (config->verbose)
+            printf("Restoring weights of epoch %zu (val accuracy %.2f%%)\n",
+                   best_epoch + 1, best_acc * 100);
+        _net_copy_params(best_w, best_b, net->w, net->b, net->n_params);
+        net->w_sum_valid = 0;
+
+        for (size_t l = 0; l < net->n_params; l++)
+        {
+            m_free(best_w[l]);
+            m_free(best_b[l]);
+        }
+
+        mem_free(best_w);
+        mem_free(best_b);
+        data_merge(data, val);
     }
-    
-    free(net->a);
-    free(net->z);
-    free(net->w);
-    free(net->b);
-    free(net->delta);
-    free(net->grad_b);
-    free(net->grad_w);
+
+    if (config->verbose)
+        printf("\nCompleted %zu epochs!\n\n", e);
 }
 
 /**
- * @brief Randomizes network weights and biases
+ * @brief In place optimizer step on n new samples, for online learning:
+ *        no shuffling, no epoch, nothing allocated. Gradients are
+ *        accumulated in micro-batches of at most max_batch rows, then
+ *        applied once, averaged over the n samples.
  * 
  * @param net Neural network struct
+ * @param X Array of n inputs of input_size values
+ * @param y Array of n expected outputs of output_size values
+ * @param n Number of samples, 0 does nothing
+ * @param lr Learning rate of the step
  */
-static void _net_init_layers(network_t* net)
+void net_update_online(network_t* net, double** X, double** y, size_t n,
+                       double lr)
 {
-    for (size_t l = 0; l < net->L; l++)
+    dataset_t batch = {
+        .n = n,
+        .n_input = net->input_size,
+        .n_output = net->output_size,
+        .X = X,
+        .y = y,
+        .S = NULL,
+    };
+
+    if (n == 0)
+        return;
+
+    for (size_t p = 0; p < n; p += net->max_batch)
     {
-        m_fill(net->w[l], normalized_rand);
-        m_fill(net->b[l], normalized_rand);
+        size_t len = n - p < net->max_batch ? n - p : net->max_batch;
+        _net_accumulate(net, NULL, &batch, p, len);
     }
+
+    _net_update(net, lr, n);
 }
 
 /**
- * @brief Feed forward algorithm
+ * @brief Calculate network accuracy on test dataset.
+ *        Output is thresholded at 0.8.
  * 
  * @param net Neural network struct
+ * @param dataset Test dataset
  */
-static void _net_feed_forward(network_t* net)
+void net_evaluate(network_t* net, dataset_t* dataset)
 {
-    m_mul(net->X, net->w[0], net->z[0]);
-    m_add(net->z[0], net->b[0], net->z[0]);
-    m_apply_dst(net->z[0], sigmoid, net->a[0]);
-
-    for (size_t l = 1; l < net->L; l++)
+    double accuracy = 0.f;
+    printf("\n[EVALUATING]\n");
+    
+    for (size_t p = 0; p < dataset->n; p += net->max_batch)
     {
-        m_mul(net->a[l-1], net->w[l], net->z[l]);
-        m_add(net->z[l], net->b[l], net->z[l]);
-        m_apply_dst(net->z[l], sigmoid, net->a[l]);
-    }
+        size_t len = dataset->n - p;
+
+        if (len > net->max_batch)
+            len = net->max_batch;
+
+        _net_load_batch(net, dataset, p, len);
+        
+        _net_feed_forward(net);
+        _net_binarize_output(net, 0.8f);
+
+        for (size_t i = 0; i < len; i++)
+            accuracy += _net_evaluate_prediction(net, i);
+    }
+
+    accuracy /= dataset->n;
+
+    printf("\nNetwork accuracy: [%f%%]\n\n", accuracy * 100);
+}
+
+/**
+ * @brief  Fraction of samples of a dataset whose strongest output matches
+ *         the expected class. Runs batched inference.
+ * 
+ * @param  net Neural network struct
+ * @param  dataset Dataset to evaluate
+ * @return double Accuracy in [0, 1]
+ */
+double net_accuracy(network_t* net, dataset_t* dataset)
+{
+    PROF_START(t);
+
+    size_t correct = 0;
+
+    for (size_t p = 0; p < dataset->n; p += net->max_batch)
+    {
+        size_t len = dataset->n - p;
+
+        if (len > net->max_batch)
+            len = net->max_batch;
+
+        _net_load_batch(net, dataset, p, len);
+        _net_feed_forward(net);
+
+        for (size_t i = 0; i < len; i++)
+        {
+            if (_net_argmax(net->a[net->L - 1], i)
+                == _net_argmax(net->y, i))
+                correct++;
+        }
+    }
+
+    PROF_STOP(t, PROF_EVALUATE, PROF_NO_LAYER, 0.f, 0.f);
+
+    return (double) correct / dataset->n;
+}
+
+/**
+ * @brief Batched inference: predict the outputs of n samples
+ * 
+ * @param net Neural network struct
+ * @param X Array of n inputs of input_size values
+ * @param n Number of samples
+ * @param y Output, n rows of output_size values (row-major)
+ */
+void net_predict_batch(network_t* net, double** X, size_t n, double* y)
+{
+    for (size_t p = 0; p < n; p += net->max_batch)
+    {
+        size_t len = n - p;
+
+        if (len > net->max_batch)
+            len = net->max_batch;
+
+        _net_set_batch(net, len);
+
+        for (size_t i = 0; i < len; i++)
+            _net_init_X(net, X[p + i], i);
+
+        _net_feed_forward(net);
+
+        matrix_t* a = net->a[net->L - 1];
+
+        for (size_t i = 0; i < len; i++)
+        {
+            for (size_t j = 0; j < net->output_size; j++)
+                y[(p + i) * net->output_size + j] = a->array[j * len + i];
+        }
+    }
+}
+
+/**
+ * @brief Apply an activation function on a batch
+ * 
+ * @param act Activation function
+ * @param z Pre activated batch
+ * @param a Activated batch, same shape as z
+ */
+void net_activate(activation_t act, matrix_t* z, matrix_t* a)
+{
+    switch (act)
+    {
+        case ACT_RELU:
+            m_apply_dst(z, relu, a);
+            break;
+
+        case ACT_SOFTMAX:
+            _net_softmax(z, a);
+            break;
+
+        default:
+            m_apply_dst(z, sigmoid, a);
+            break;
+    }
+}
+
+/**
+ * @brief Predict output on network with single input
+ * 
+ * @param net Network to perform the prediction
+ * @param X Input to predict with
+ */
+void net_predict(network_t* net, double* X, double* y)
+{
+    _net_set_batch(net, 1);
+    _net_init_X(net, X, 0);
+    _net_init_y(net, y, 0);
+    _net_feed_forward(net);
+
+    double threshold = 0.8f;
+
+    printf("\n[PREDICTION]:\n\n");
+    for (size_t i = 0; i < net->output_size; i++)
+    {
+        double predicted_val = net->a[net->L-1]->array[i];
+        double expected_val = y[i];
+
+        printf("[");
+        if (expected_val == 1.0f)
+            printf("\033[0;32m");
+
+        printf("%zu", i);
+        printf("\033[0m] - ");
+
+        if (predicted_val > threshold)
+            printf("\033[0;32m");
+
+        printf("Predicted: %f ", net->a[net->L-1]->array[i]);
+        printf("\033[0m - ");
+
+        if (expected_val > threshold)
+            printf("\033[0;32m");
+
+        printf("Expected: %f\n", y[i]);
+        printf("\033[0m");
+    }
+
+    printf("\n");
+}
+
+
+
+/* ==== NETWORK INTERNAL API ==== */
+
+
+
+/**
+ * @brief Copy the convolution and pooling layers of a network, and count
+ *        its parameter layers. The layers are shaped by the caller.
+ * 
+ * @param net Neural network struct
+ * @param conv Convolution and pooling layers
+ * @param n_conv Number of layers
+ */
+static void _net_set_conv(network_t* net, const conv_t* conv, size_t n_conv)
+{
+    net->n_conv = n_conv;
+    net->conv = NULL;
+    net->n_params = net->L;
+
+    if (n_conv == 0)
+        return;
+
+    net->conv = mem_malloc(n_conv * sizeof(conv_t), MEM_NETWORK);
+    memcpy(net->conv, conv, n_conv * sizeof(conv_t));
+
+    for (size_t k = 0; k < n_conv; k++)
+        net->n_params += conv[k].type == CONV_2D;
+}
+
+/**
+ * @brief Dynamic allocation of network layers
+ * 
+ * @param net Neural network struct
+ */
+static void _net_alloc_layers(network_t* net)
+{
+    size_t P = net->n_params;
+
+    net->a = mem_calloc(net->L, sizeof(matrix_t*), MEM_NETWORK);
+    net->z = mem_calloc(net->L, sizeof(matrix_t*), MEM_NETWORK);
+    net->w = mem_calloc(P, sizeof(matrix_t*), MEM_NETWORK);
+    net->b = mem_calloc(P, sizeof(matrix_t*), MEM_NETWORK);
+    net->delta = mem_calloc(net->L, sizeof(matrix_t*), MEM_NETWORK);
+    net->grad_w = mem_calloc(P, sizeof(matrix_t*), MEM_NETWORK);
+    net->grad_b = mem_calloc(P, sizeof(matrix_t*), MEM_NETWORK);
+    net->act = mem_calloc(P, sizeof(activation_t), MEM_NETWORK);
+    net->conv_a = mem_calloc(net->n_conv, sizeof(matrix_t*), MEM_NETWORK);
+    net->conv_delta = mem_calloc(net->n_conv, sizeof(matrix_t*),
+                                 MEM_NETWORK);
+    net->conv_cols = mem_calloc(net->n_conv, sizeof(matrix_t*),
+                                MEM_NETWORK);
+
+    for (size_t l = 0; l < P; l++)
+        net->act[l] = l < net->L ? ACT_SIGMOID : ACT_RELU;
+
+    size_t B = net->max_batch;
+
+    _net_alloc_graph(net);
+
+    net->X_sparse = mem_calloc(B, sizeof(sparse_t*), MEM_NETWORK);
+    net->mask = NULL;
+    net->sparse_batch = 0;
+    net->batch_nnz = 0;
+    net->background = 0.f;
+    net->w_sum_valid = 0;
+
+    size_t features = _net_feature_size(net->input_size, net->conv,
+                                        net->n_conv);
+    mem_category_t scope = mem_scope(MEM_PARAMS);
+
+    for (size_t l = 0; l < net->L; l++)
+    {
+        size_t n_in, n_out;
+        _net_layer_shape(net->L, features, net->hidden_size,
+                         net->output_size, l, &n_in, &n_out);
+
+        mem_scope(MEM_PARAMS);
+        net->w[l] = m_init(n_in, n_out);
+        net->b[l] = m_init(1, n_out);
+
+        mem_scope(MEM_GRADIENTS);
+        net->grad_w[l] = m_init(n_in, n_out);
+        net->grad_b[l] = m_init(1, n_out);
+    }
+
+    for (size_t k = 0; k < net->n_conv; k++)
+    {
+        conv_t* c = &net->conv[k];
+
+        if (c->type != CONV_2D)
+            continue;
+
+        size_t l = _net_conv_param(net->L, net->conv, k);
+
+        mem_scope(MEM_PARAMS);
+        net->w[l] = m_init(conv_window(c), c->out_c);
+        net->b[l] = m_init(1, c->out_c);
+
+        mem_scope(MEM_GRADIENTS);
+        net->grad_w[l] = m_init(conv_window(c), c->out_c);
+        net->grad_b[l] = m_init(1, c->out_c);
+    }
+
+    mem_scope(MEM_PARAMS);
+    net->w_sum = m_init(1, net->w[0]->n_col);
+
+    mem_scope(MEM_GRADIENTS);
+    net->grad_bg = m_init(1, net->w[0]->n_col);
+
+    mem_scope(scope);
+}
+
+/**
+ * @brief Plan and allocate the graph of the network, then point the
+ *        batched tensors of the network at its arena
+ *
+ * @param net Neural network struct
+ */
+static void _net_alloc_graph(network_t* net)
+{
+    mem_category_t scope = mem_scope(MEM_ACTIVATIONS);
+
+    net->graph = _net_build_graph(net->L, net->input_size, net->hidden_size,
+                                  net->output_size, net->conv, net->n_conv,
+                                  net->max_batch, net->checkpoint);
+    graph_alloc(net->graph);
+
+    net->X = graph_matrix(net->graph, NET_TENSOR_X);
+    net->y = graph_matrix(net->graph, NET_TENSOR_Y);
+
+    for (size_t l = 0; l < net->L; l++)
+    {
+        net->a[l] = graph_matrix(net->graph, NET_TENSOR_A(l));
+        net->z[l] = graph_matrix(net->graph, NET_TENSOR_Z(l));
+        net->delta[l] = graph_matrix(net->graph, NET_TENSOR_DELTA(l));
+    }
+
+    for (size_t k = 0; k < net->n_conv; k++)
+    {
+        size_t t = _net_conv_tensor(net->L, net->conv, k, 0);
+
+        net->conv_a[k] = graph_matrix(net->graph, t + NET_CONV_A);
+        net->conv_delta[k] = graph_matrix(net->graph, t + NET_CONV_DELTA);
+        net->conv_cols[k] = graph_matrix(net->graph, t + NET_CONV_COLS);
+    }
+
+    mem_scope(scope);
+}
+
+/**
+ * @brief Input and output sizes of layer l
+ * 
+ * @param L Number of layers
+ * @param input_size Number of neurons in the input layer
+ * @param hidden_size Number of neurons in the hidden layers
+ * @param output_size Number of neurons in the output layer
+ * @param l Layer index
+ * @param n_in Number of inputs of the layer
+ * @param n_out Number of neurons of the layer
+ */
+static void _net_layer_shape(size_t L, size_t input_size,
+                             size_t hidden_size, size_t output_size,
+                             size_t l, size_t* n_in, size_t* n_out)
+{
+    *n_in = l == 0 ? input_size : hidden_size;
+    *n_out = l == L - 1 ? output_size : hidden_size;
+}
+
+/**
+ * @brief Free network layers
+ * 
+ * @param net Neural network struct
+ */
+static void _net_free_layers(network_t* net)
+{
+    graph_free(net->graph);
+    m_free(net->w_sum);
+    m_free(net->grad_bg);
+    mem_free(net->X_sparse);
+
+    if (net->mask)
+    {
+        for (size_t l = 0; l < net->L; l++)
+            m_free(net->mask[l]);
+
+        mem_free(net->mask);
+    }
+    
+    for (size_t l = 0; l < net->n_params; l++)
+    {
+        m_free(net->b[l]);
+        m_free(net->w[l]);
+        m_free(net->grad_b[l]);
+        m_free(net->grad_w[l]);
+    }
+    
+    mem_free(net->a);
+    mem_free(net->z);
+    mem_free(net->w);
+    mem_free(net->b);
+    mem_free(net->delta);
+    mem_free(net->grad_b);
+    mem_free(net->grad_w);
+    mem_free(net->act);
+    mem_free(net->conv_a);
+    mem_free(net->conv_delta);
+    mem_free(net->conv_cols);
+
+    if (net->conv)
+        mem_free(net->conv);
+}
+
+/**
+ * @brief Randomizes network weights and biases
+ * 
+ * @param net Neural network struct
+ */
+static void _net_init_layers(network_t* net)
+{
+    for (size_t l = 0; l < net->n_params; l++)
+        _net_init_layer(net, l);
+}
+
+/**
+ * @brief Randomizes the weights and biases of layer l. Sigmoid layers keep
+ *        the [-1, 1] range, ReLU and softmax layers use a fan-in scaled
+ *        range (He / Glorot uniform) with zero biases.
+ * 
+ * @param net Neural network struct
+ * @param l Parameter layer index, convolutions following the L dense ones
+ */
+static void _net_init_layer(network_t* net, size_t l)
+{
+    matrix_t* w = net->w[l];
+
+    if (l == 0)
+        net->w_sum_valid = 0;
+
+    m_fill(w, normalized_rand);
+    m_fill(net->b[l], normalized_rand);
+
+    if (net->act[l] == ACT_SIGMOID)
+        return;
+
+    double range = net->act[l] == ACT_RELU
+                 ? sqrt(6.f / w->n_row)
+                 : sqrt(6.f / (w->n_row + w->n_col));
+
+    m_scalar_mul(w, range, w);
+    m_reset(net->b[l]);
+}
+
+/**
+ * @brief  Build the graph of a network configuration, and plan its memory.
+ *         The forward pass is followed by a backward pass interleaving
+ *         the gradient of each layer with the delta of the previous one,
+ *         so a delta dies as soon as both consumed it. Convolution and
+ *         pooling layers run before the dense ones; their im2col windows
+ *         live until the backward pass, which reuses them for the window
+ *         deltas.
+ *
+ *         Layers that are not checkpointed write their forward pass to
+ *         short-lived tensors appended after all the others, read only by
+ *         the next layer. Their activations proper are recomputed from the
+ *         last checkpoint when the backward pass enters their segment.
+ * 
+ * @param  L Number of layers
+ * @param  input_size Number of neurons in the input layer
+ * @param  hidden_size Number of neurons in the hidden layers
+ * @param  output_size Number of neurons in the output layer
+ * @param  conv Shaped convolution and pooling layers, or NULL
+ * @param  n_conv Number of convolution and pooling layers
+ * @param  batch_size Row capacity of the batched tensors
+ * @param  checkpoint Activations kept every checkpoint layers, see
+ *         net_set_checkpoint
+ * @return graph_t* Planned graph, not allocated
+ */
+static graph_t* _net_build_graph(size_t L, size_t input_size,
+                                 size_t hidden_size, size_t output_size,
+                                 const conv_t* conv, size_t n_conv,
+                                 size_t batch_size, size_t checkpoint)
+{
+    graph_t* g = graph_init();
+    size_t features = _net_feature_size(input_size, conv, n_conv);
+    size_t n_in, n_out, s, t;
+
+    graph_tensor(g, batch_size, input_size);
+    graph_tensor(g, batch_size, output_size);
+
+    for (size_t l = 0; l < L; l++)
+    {
+        _net_layer_shape(L, features, hidden_size, output_size,
+                         l, &n_in, &n_out);
+
+        graph_tensor(g, batch_size, n_out);
+        graph_tensor(g, batch_size, n_out);
+        graph_tensor(g, batch_size, n_out);
+    }
+
+    // Workspace of the gradient of each layer
+    for (size_t l = 0; l < L; l++)
+    {
+        _net_layer_shape(L, features, hidden_size, output_size,
+                         l, &n_in, &n_out);
+
+        graph_tensor(g, n_in, n_out);
+        graph_tensor(g, 1, n_out);
+    }
+
+    // Output, delta and windows of each convolution / pooling layer
+    for (size_t k = 0; k < n_conv; k++)
+    {
+        const conv_t* c = &conv[k];
+
+        graph_tensor(g, batch_size, conv_out_size(c));
+        graph_tensor(g, batch_size, conv_out_size(c));
+        graph_tensor(g, batch_size * conv_positions(c), conv_window(c));
+
+        if (c->type != CONV_2D)
+            continue;
+
+        graph_tensor(g, conv_window(c), c->out_c);
+        graph_tensor(g, 1, c->out_c);
+    }
+
+    s = graph_step(g, G_LOAD, 0);
+    graph_write(g, s, NET_TENSOR_X);
+    graph_write(g, s, NET_TENSOR_Y);
+
+    size_t in = NET_TENSOR_X;
+
+    for (size_t k = 0; k < n_conv; k++)
+    {
+        t = _net_conv_tensor(L, conv, k, 0);
+
+        s = graph_step(g, conv[k].type == CONV_2D ? G_CONV : G_POOL, k);
+        graph_read(g, s, in);
+        graph_write(g, s, t + NET_CONV_COLS);
+        graph_write(g, s, t + NET_CONV_A);
+
+        if (conv[k].type == CONV_2D)
+        {
+            // Activated in place
+            s = graph_step(g, G_ACT, _net_conv_param(L, conv, k));
+            graph_read(g, s, t + NET_CONV_A);
+            graph_write(g, s, t + NET_CONV_A);
+        }
+
+        in = t + NET_CONV_A;
+    }
+
+    size_t prev = in;
+
+    for (size_t l = 0; l < L; l++)
+    {
+        size_t z = NET_TENSOR_Z(l);
+        size_t a = NET_TENSOR_A(l);
+
+        // Hidden layer recomputed later, never the output layer
+        if (!_net_checkpointed(L, checkpoint, l))
+        {
+            z = graph_tensor(g, batch_size, hidden_size);
+            a = graph_tensor(g, batch_size, hidden_size);
+        }
+
+        s = graph_step(g, G_DENSE, l);
+        graph_read(g, s, prev);
+        graph_write(g, s, z);
+
+        s = graph_step(g, G_ACT, l);
+        graph_read(g, s, z);
+        graph_write(g, s, a);
+
+        prev = a;
+    }
+
+    graph_end_forward(g);
+
+    s = graph_step(g, G_LOSS, L - 1);
+    graph_read(g, s, NET_TENSOR_A(L - 1));
+    graph_read(g, s, NET_TENSOR_Y);
+    graph_write(g, s, NET_TENSOR_DELTA(L - 1));
+
+    for (size_t l = L; l-- > 0;)
+    {
+        // Entering a segment: recompute it from the previous checkpoint
+        if (l > 0 && _net_checkpointed(L, checkpoint, l)
+            && !_net_checkpointed(L, checkpoint, l - 1))
+        {
+            size_t j = l - 1;
+
+            while (j > 0 && !_net_checkpointed(L, checkpoint, j - 1))
+                j--;
+
+            for (; j < l; j++)
+            {
+                s = graph_step(g, G_DENSE, j);
+                graph_read(g, s, j == 0 ? in : NET_TENSOR_A(j - 1));
+                graph_write(g, s, NET_TENSOR_Z(j));
+
+                s = graph_step(g, G_ACT, j);
+                graph_read(g, s, NET_TENSOR_Z(j));
+                graph_write(g, s, NET_TENSOR_A(j));
+            }
+        }
+
+        s = graph_step(g, G_DENSE_GRAD, l);
+        graph_read(g, s, l == 0 ? in : NET_TENSOR_A(l - 1));
+        graph_read(g, s, NET_TENSOR_DELTA(l));
+        graph_write(g, s, NET_TENSOR_GRAD_W(L, l));
+        graph_write(g, s, NET_TENSOR_GRAD_B(L, l));
+
+        if (l == 0)
+            break;
+
+        s = graph_step(g, G_DENSE_BWD, l);
+        graph_read(g, s, NET_TENSOR_DELTA(l));
+        graph_write(g, s, NET_TENSOR_DELTA(l - 1));
+
+        s = graph_step(g, G_ACT_BWD, l - 1);
+        graph_read(g, s, NET_TENSOR_A(l - 1));
+        graph_read(g, s, NET_TENSOR_DELTA(l - 1));
+        graph_write(g, s, NET_TENSOR_DELTA(l - 1));
+    }
+
+    if (n_conv)
+    {
+        s = graph_step(g, G_DENSE_BWD, 0);
+        graph_read(g, s, NET_TENSOR_DELTA(0));
+        graph_write(g, s, _net_conv_tensor(L, conv, n_conv - 1,
+                                           NET_CONV_DELTA));
+    }
+
+    for (size_t k = n_conv; k-- > 0;)
+    {
+        t = _net_conv_tensor(L, conv, k, 0);
+
+        if (conv[k].type == CONV_2D)
+        {
+            s = graph_step(g, G_ACT_BWD, _net_conv_param(L, conv, k));
+            graph_read(g, s, t + NET_CONV_A);
+            graph_read(g, s, t + NET_CONV_DELTA);
+            graph_write(g, s, t + NET_CONV_DELTA);
+
+            s = graph_step(g, G_CONV_GRAD, k);
+            graph_read(g, s, t + NET_CONV_COLS);
+            graph_read(g, s, t + NET_CONV_DELTA);
+            graph_write(g, s, t + NET_CONV_GRAD_W);
+            graph_write(g, s, t + NET_CONV_GRAD_B);
+        }
+
+        // The input delta of the first layer is never needed
+        if (k == 0)
+            break;
+
+        size_t prev = _net_conv_tensor(L, conv, k - 1, NET_CONV_DELTA);
+
+        if (conv[k].type == CONV_2D)
+        {
+            s = graph_step(g, G_CONV_BWD, k);
+            graph_read(g, s, t + NET_CONV_DELTA);
+            graph_write(g, s, t + NET_CONV_COLS);
+            graph_write(g, s, prev);
+        }
+
+        else
+        {
+            s = graph_step(g, G_POOL_BWD, k);
+            graph_read(g, s, t + NET_CONV_DELTA);
+            graph_read(g, s, t + NET_CONV_COLS);
+            graph_write(g, s, t + NET_CONV_COLS);
+            graph_write(g, s, prev);
+        }
+    }
+
+    graph_plan(g);
+
+    return g;
+}
+
+/**
+ * @return int Whether the activations of layer l are kept through the
+ *         forward pass, with a checkpoint every checkpoint layers
+ */
+static int _net_checkpointed(size_t L, size_t checkpoint, size_t l)
+{
+    return checkpoint < 2 || l == L - 1 || (l + 1) % checkpoint == 0;
+}
+
+/**
+ * @brief  Bytes a network configuration allocates, see net_footprint
+ * 
+ * @param  L Number of layers in the network, excluding the input layer
+ * @param  input_size Number of neurons in the input layer
+ * @param  hidden_size Number of neurons in the hidden layer
+ * @param  output_size Number of neurons in the output layer
+ * @param  conv Shaped convolution and pooling layers, or NULL
+ * @param  n_conv Number of convolution and pooling layers
+ * @param  batch_size Amount of samples per mini-batch
+ * @param  checkpoint Activations kept every checkpoint layers, see
+ *         net_set_checkpoint
+ * @return size_t Footprint in bytes
+ */
+static size_t _net_footprint(size_t L, size_t input_size,
+                             size_t hidden_size, size_t output_size,
+                             const conv_t* conv, size_t n_conv,
+                             size_t batch_size, size_t checkpoint)
+{
+    size_t B = batch_size > NETWORK_EVAL_BATCH ? batch_size
+                                               : NETWORK_EVAL_BATCH;
+    size_t features = _net_feature_size(input_size, conv, n_conv);
+    size_t doubles = 0;
+
+    for (size_t l = 0; l < L; l++)
+    {
+        size_t n_in, n_out;
+        _net_layer_shape(L, features, hidden_size, output_size,
+                         l, &n_in, &n_out);
+
+        doubles += 2 * (n_in * n_out + n_out);
+    }
+
+    for (size_t k = 0; k < n_conv; k++)
+    {
+        if (conv[k].type == CONV_2D)
+            doubles += 2 * (conv_window(&conv[k]) + 1) * conv[k].out_c;
+    }
+
+    // Batched tensors and workspaces share the planned arena
+    graph_t* g = _net_build_graph(L, input_size, hidden_size,
+                                  output_size, conv, n_conv, B, checkpoint);
+
+    doubles += g->arena_size;
+    size_t views = g->n_tensors * sizeof(matrix_t);
+
+    graph_free(g);
+
+    return doubles * sizeof(double) + views
+         + sizeof(network_t) + 8 * L * sizeof(matrix_t*)
+         + n_conv * (sizeof(conv_t) + 7 * sizeof(matrix_t*));
+}
+
+/**
+ * @return size_t Inputs of the first dense layer: the output of the last
+ *         convolution / pooling layer, or the network input
+ */
+static size_t _net_feature_size(size_t input_size, const conv_t* conv,
+                                size_t n_conv)
+{
+    return n_conv ? conv_out_size(&conv[n_conv - 1]) : input_size;
+}
+
+/**
+ * @return size_t Index in w, b, grad_w, grad_b and act of convolution
+ *         layer k: the L dense layers come first, then one entry per
+ *         convolution, pooling layers having none
+ */
+static size_t _net_conv_param(size_t L, const conv_t* conv, size_t k)
+{
+    size_t l = L;
+
+    for (size_t i = 0; i < k; i++)
+        l += conv[i].type == CONV_2D;
+
+    return l;
+}
+
+/**
+ * @return size_t Graph index of tensor which (NET_CONV_*) of convolution /
+ *         pooling layer k. Their tensors follow the dense ones, five per
+ *         convolution and three per pooling layer.
+ */
+static size_t _net_conv_tensor(size_t L, const conv_t* conv, size_t k,
+                               size_t which)
+{
+    size_t t = NET_TENSOR_GRAD_W(L, L);
+
+    for (size_t i = 0; i < k; i++)
+        t += conv[i].type == CONV_2D ? 5 : 3;
+
+    return t + which;
+}
+
+/**
+ * @brief Feed forward algorithm, on the current batch
+ * 
+ * @param net Neural network struct
+ */
+static void _net_feed_forward(network_t* net)
+{
+    _net_run(net, 0, net->graph->n_forward);
+}
+
+/**
+ * @brief Backpropagation algorithm, on the current batch: computes the
+ *        deltas, and accumulates the gradients of every layer into the
+ *        cumulative batch gradients
+ * 
+ * @param net Neural network struct
+ */
+static void _net_backprop(network_t* net)
+{
+    _net_run(net, net->graph->n_forward, net->graph->n_steps);
+}
+
+/**
+ * @brief Run steps [first, last) of the network graph
+ * 
+ * @param net Neural network struct
+ * @param first First step
+ * @param last End of the steps to run
+ */
+static void _net_run(network_t* net, size_t first, size_t last)
+{
+    for (size_t i = first; i < last; i++)
+    {
+        g_step_t* s = &net->graph->steps[i];
+
+        switch (s->op)
+        {
+            case G_LOAD:        break;
+            case G_DENSE:       _net_dense(net, s); break;
+            case G_ACT:         _net_act(net, s); break;
+            case G_LOSS:        _net_loss(net, s); break;
+            case G_DENSE_GRAD:  _net_dense_grad(net, s); break;
+            case G_DENSE_BWD:   _net_dense_bwd(net, s); break;
+            case G_ACT_BWD:     _net_act_bwd(net, s); break;
+            case G_CONV:        _net_conv(net, s); break;
+            case G_POOL:        _net_pool(net, s); break;
+            case G_CONV_GRAD:   _net_conv_grad(net, s); break;
+            case G_CONV_BWD:    _net_conv_bwd(net, s); break;
+            case G_POOL_BWD:    _net_pool_bwd(net, s); break;
+        }
+    }
+}
+
+/**
+ * @brief Dense layer: z = a_prev . w + b
+ * 
+ * @param net Neural network struct
+ * @param s Step: reads a_prev, writes z
+ */
+static void _net_dense(network_t* net, g_step_t* s)
+{
+    PROF_START(t);
+
+    size_t l = s->layer;
+    matrix_t* a = net->graph->tensors[s->in[0]].m;
+    matrix_t* z = net->graph->tensors[s->out[0]].m;
+    int sparse = l == 0 && net->sparse_batch;
+
+    if (sparse)
+        _net_sparse_forward(net, z);
+    else
+        m_mul(a, net->w[l], z);
+
+    m_add_row(z, net->b[l], z);
+
+    PROF_STOP(t, PROF_FEED_FORWARD, l,
+              (sparse ? 2.f * net->batch_nnz * net->w[l]->n_col
+                      : 2.f * net->w[l]->size * a->n_row) + z->size,
+              8.f * (a->size + net->w[l]->size + z->size));
+}
+
+/**
+ * @brief First layer product of a sparse batch: z[0] = X . w[0], computed
+ *        as background * column sums of w[0] plus a gather over the rows
+ *        of w[0] hit by a deviation
+ * 
+ * @param net Neural network struct
+ * @param z Destination of the product
+ */
+static void _net_sparse_forward(network_t* net, matrix_t* z)
+{
+    if (!net->w_sum_valid)
+    {
+        m_sum_rows(net->w[0], net->w_sum);
+        net->w_sum_valid = 1;
+    }
+
+    sp_mul(net->X_sparse, net->background, net->w[0], net->w_sum, z);
+}
+
+/**
+ * @brief Activation of a layer: a = f(z)
+ * 
+ * @param net Neural network struct
+ * @param s Step: reads z, writes a
+ */
+static void _net_act(network_t* net, g_step_t* s)
+{
+    PROF_START(t);
+
+    matrix_t* z = net->graph->tensors[s->in[0]].m;
+    matrix_t* a = net->graph->tensors[s->out[0]].m;
+
+    net_activate(net->act[s->layer], z, a);
+
+    PROF_STOP(t, PROF_FEED_FORWARD, s->layer, z->size,
+              16.f * z->size);
+}
+
+/**
+ * @brief Output delta. A softmax output layer uses the cross-entropy
+ *        delta (a - y), other output layers the squared error delta
+ *        (a - y) * f'(z).
+ * 
+ * @param net Neural network struct
+ * @param s Step: reads a and y, writes delta
+ */
+static void _net_loss(network_t* net, g_step_t* s)
+{
+    PROF_START(t);
+
+    matrix_t* a = net->graph->tensors[s->in[0]].m;
+    matrix_t* y = net->graph->tensors[s->in[1]].m;
+    matrix_t* delta = net->graph->tensors[s->out[0]].m;
+    const m_expr_t* err = M_SUB(M_LEAF(a), M_LEAF(y));
+
+    if (net->act[s->layer] == ACT_SIGMOID)
+        m_eval(M_MUL(err, M_DSIGMOID(M_LEAF(a))), delta);
+    else if (net->act[s->layer] == ACT_RELU)
+        m_eval(M_MUL(err, M_DRELU(M_LEAF(a))), delta);
+    else
+        m_eval(err, delta);
+
+    PROF_STOP(t, PROF_BACKPROP, s->layer, 2.f * delta->size,
+              24.f * delta->size);
+}
+
+/**
+ * @brief Accumulate the gradients of a layer over the current batch into
+ *        the cumulative batch gradients
+ * 
+ * @param net Neural network struct
+ * @param s Step: reads a_prev and delta, writes the gradient workspaces
+ */
+static void _net_dense_grad(network_t* net, g_step_t* s)
+{
+    PROF_START(t);
+
+    size_t l = s->layer;
+    matrix_t* a = net->graph->tensors[s->in[0]].m;
+    matrix_t* delta = net->graph->tensors[s->in[1]].m;
+    matrix_t* grad_w = net->graph->tensors[s->out[0]].m;
+    matrix_t* grad_b = net->graph->tensors[s->out[1]].m;
+
+    m_sum_rows(delta, grad_b);
+    m_add(grad_b, net->grad_b[l], net->grad_b[l]);
+
+    if (l == 0 && net->sparse_batch)
+    {
+        // grad_w[0] += transpose(background + S) . delta
+        sp_mul_tn_add(net->X_sparse, delta, net->grad_w[0]);
+        m_eval(M_ADD(M_LEAF(net->grad_bg),
+                     M_SCALE(net->background, M_LEAF(grad_b))),
+               net->grad_bg);
+    }
+
+    else
+    {
+        m_mul_tn(a, delta, grad_w);
+        m_add(grad_w, net->grad_w[l], net->grad_w[l]);
+    }
+
+    PROF_STOP(t, PROF_GRADIENT, l,
+              2.f * grad_w->size * a->n_row
+              + grad_w->size + 2.f * delta->size,
+              8.f * (a->size + delta->size + 3 * grad_w->size));
+}
+
+/**
+ * @brief Propagate a delta to the previous layer:
+ *        delta_prev = delta . transpose(w)
+ * 
+ * @param net Neural network struct
+ * @param s Step: reads delta, writes delta_prev
+ */
+static void _net_dense_bwd(network_t* net, g_step_t* s)
+{
+    PROF_START(t);
+
+    matrix_t* w = net->w[s->layer];
+    matrix_t* delta = net->graph->tensors[s->in[0]].m;
+    matrix_t* delta_prev = net->graph->tensors[s->out[0]].m;
+
+    m_mul_nt(delta, w, delta_prev);
+
+    PROF_STOP(t, PROF_BACKPROP, s->layer - 1,
+              2.f * w->size * delta->n_row,
+              8.f * (delta->size + w->size + delta_prev->size));
+}
+
+/**
+ * @brief Multiply a delta by the derivative of the layer's activation.
+ *        The derivative is taken from the activated values, so no
+ *        exponential is recomputed.
+ * 
+ * @param net Neural network struct
+ * @param s Step: reads a and delta, writes delta
+ */
+static void _net_act_bwd(network_t* net, g_step_t* s)
+{
+    PROF_START(t);
+
+    matrix_t* a = net->graph->tensors[s->in[0]].m;
+    matrix_t* delta = net->graph->tensors[s->out[0]].m;
+
+    if (net->act[s->layer] == ACT_RELU)
+        m_eval(M_MUL(M_LEAF(delta), M_DRELU(M_LEAF(a))), delta);
+    else
+        m_eval(M_MUL(M_LEAF(delta), M_DSIGMOID(M_LEAF(a))), delta);
+
+    PROF_STOP(t, PROF_BACKPROP, s->layer, 3.f * delta->size,
+              24.f * delta->size);
+}
+
+/**
+ * @brief Convolution layer: a = im2col(a_prev) . w + b, activated by the
+ *        following G_ACT step
+ * 
+ * @param net Neural network struct
+ * @param s Step: reads a_prev, writes the windows and a
+ */
+static void _net_conv(network_t* net, g_step_t* s)
+{
+    PROF_START(t);
+
+    size_t l = _net_conv_param(net->L, net->conv, s->layer);
+    matrix_t* in = net->graph->tensors[s->in[0]].m;
+    matrix_t* cols = net->graph->tensors[s->out[0]].m;
+    matrix_t* a = net->graph->tensors[s->out[1]].m;
+
+    conv_forward(&net->conv[s->layer], in, net->w[l], net->b[l], cols, a);
+
+    PROF_STOP(t, PROF_FEED_FORWARD, l,
+              2.f * cols->size * net->w[l]->n_col + a->size,
+              8.f * (in->size + 2 * cols->size + net->w[l]->size
+                     + a->size));
+}
+
+/**
+ * @brief Pooling layer: a = max or mean of each window of a_prev
+ * 
+ * @param net Neural network struct
+ * @param s Step: reads a_prev, writes the windows and a
+ */
+static void _net_pool(network_t* net, g_step_t* s)
+{
+    PROF_START(t);
+
+    matrix_t* in = net->graph->tensors[s->in[0]].m;
+    matrix_t* cols = net->graph->tensors[s->out[0]].m;
+    matrix_t* a = net->graph->tensors[s->out[1]].m;
+
+    conv_pool_forward(&net->conv[s->layer], in, cols, a);
+
+    PROF_STOP(t, PROF_FEED_FORWARD, PROF_NO_LAYER, cols->size,
+              8.f * (in->size + 2 * cols->size + a->size));
+}
+
+/**
+ * @brief Accumulate the filter and bias gradients of a convolution over
+ *        the current batch into the cumulative batch gradients
+ * 
+ * @param net Neural network struct
+ * @param s Step: reads the windows and delta, writes the gradient
+ *          workspaces
+ */
+static void _net_conv_grad(network_t* net, g_step_t* s)
+{
+    PROF_START(t);
+
+    size_t l = _net_conv_param(net->L, net->conv, s->layer);
+    matrix_t* cols = net->graph->tensors[s->in[0]].m;
+    matrix_t* delta = net->graph->tensors[s->in[1]].m;
+    matrix_t* grad_w = net->graph->tensors[s->out[0]].m;
+    matrix_t* grad_b = net->graph->tensors[s->out[1]].m;
+
+    conv_grad(&net->conv[s->layer], cols, delta, grad_w, grad_b);
+    m_add(grad_w, net->grad_w[l], net->grad_w[l]);
+    m_add(grad_b, net->grad_b[l], net->grad_b[l]);
+
+    PROF_STOP(t, PROF_GRADIENT, l,
+              2.f * cols->size * grad_w->n_col + grad_w->size
+              + 2.f * delta->size,
+              8.f * (cols->size + delta->size + 3 * grad_w->size));
+}
+
+/**
+ * @brief Propagate a delta through a convolution:
+ *        delta_prev = col2im(delta . transpose(w))
+ * 
+ * @param net Neural network struct
+ * @param s Step: reads delta, writes the window deltas and delta_prev
+ */
+static void _net_conv_bwd(network_t* net, g_step_t* s)
+{
+    PROF_START(t);
+
+    size_t l = _net_conv_param(net->L, net->conv, s->layer);
+    matrix_t* delta = net->graph->tensors[s->in[0]].m;
+    matrix_t* cols = net->graph->tensors[s->out[0]].m;
+    matrix_t* delta_prev = net->graph->tensors[s->out[1]].m;
+
+    conv_backward(&net->conv[s->layer], delta, net->w[l], cols, delta_prev);
+
+    PROF_STOP(t, PROF_BACKPROP, l,
+              2.f * cols->size * net->w[l]->n_col + cols->size,
+              8.f * (delta->size + 2 * cols->size + net->w[l]->size
+                     + delta_prev->size));
+}
+
+/**
+ * @brief Propagate a delta through a pooling layer
+ * 
+ * @param net Neural network struct
+ * @param s Step: reads delta and the windows, writes the window deltas
+ *          and delta_prev
+ */
+static void _net_pool_bwd(network_t* net, g_step_t* s)
+{
+    PROF_START(t);
+
+    matrix_t* delta = net->graph->tensors[s->in[0]].m;
+    matrix_t* cols = net->graph->tensors[s->in[1]].m;
+    matrix_t* delta_prev = net->graph->tensors[s->out[1]].m;
+
+    conv_pool_backward(&net->conv[s->layer], cols, delta, delta_prev);
+
+    PROF_STOP(t, PROF_BACKPROP, PROF_NO_LAYER, 2.f * cols->size,
+              8.f * (delta->size + 2 * cols->size + delta_prev->size));
+}
+
+/**
+ * @brief Row-wise softmax of z into a, shifted by the row maximum
+ *        for numerical stability
+ * 
+ * @param z Pre activated batch
+ * @param a Activated batch
+ */
+static void _net_softmax(matrix_t* z, matrix_t* a)
+{
+    size_t rows = z->n_row;
+
+    for (size_t i = 0; i < rows; i++)
+    {
+        double max = z->array[i];
+
+        for (size_t j = 1; j < z->n_col; j++)
+        {
+            if (z->array[j * rows + i] > max)
+                max = z->array[j * rows + i];
+        }
+
+        double sum = 0.f;
+
+        for (size_t j = 0; j < z->n_col; j++)
+        {
+            a->array[j * rows + i] = exp(z->array[j * rows + i] - max);
+            sum += a->array[j * rows + i];
+        }
+
+        for (size_t j = 0; j < z->n_col; j++)
+            a->array[j * rows + i] /= sum;
+    }
+}
+
+/**
+ * @brief Update network weights and biases with the accumulated
+ *        gradients, then reset the gradients for the next step
+ * 
+ * @param net Neural network struct
+ * @param lr Learning rate of this step
+ * @param n_samples Number of samples the gradients were accumulated over
+ */
+static void _net_update(network_t* net, double lr, size_t n_samples)
+{
+    lr /= n_samples;
+
+    // Fold the background gradient of sparse batches into every row
+    for (size_t j = 0; j < net->grad_bg->n_col; j++)
+    {
+        double g = net->grad_bg->array[j];
+        double* g_j = net->grad_w[0]->array + j * net->grad_w[0]->n_row;
+
+        if (g == 0.f)
+            continue;
+
+        for (size_t k = 0; k < net->grad_w[0]->n_row; k++)
+            g_j[k] += g;
+    }
+
+    m_reset(net->grad_bg);
+    net->w_sum_valid = 0;
+
+    for (int l = net->n_params - 1; l >= 0; l--)
+    {
+        PROF_START(t);
+
+        // Weight update, pruned weights stay at zero
+        const m_expr_t* w = M_SUB(M_LEAF(net->w[l]),
+                                  M_SCALE(lr, M_LEAF(net->grad_w[l])));
+        int masked = net->mask && (size_t) l < net->L;
+
+        m_eval(masked ? M_MUL(w, M_LEAF(net->mask[l])) : w, net->w[l]);
+        m_reset(net->grad_w[l]);
+
+        // Bias update
+        m_eval(M_SUB(M_LEAF(net->b[l]), M_SCALE(lr, M_LEAF(net->grad_b[l]))),
+               net->b[l]);
+        m_reset(net->grad_b[l]);
+
+        PROF_STOP(t, PROF_UPDATE, l,
+                  2.f * (net->w[l]->size + net->b[l]->size),
+                  32.f * (net->w[l]->size + net->b[l]->size));
+    }
+}
+
+/**
+ * @brief Accumulate the gradients of a micro-batch, on the calling thread
+ *        or split over the workers of a data parallel run
+ * 
+ * @param net Neural network struct
+ * @param par Data parallel context, NULL to run on the calling thread
+ * @param data Dataset
+ * @param start First sample of the micro-batch
+ * @param len Number of samples in the micro-batch
+ */
+static void _net_accumulate(network_t* net, net_parallel_t* par,
+                            dataset_t* data, size_t start, size_t len)
+{
+    if (par && par->dist)
+    {
+        size_t share = (len + par->dist->world - 1) / par->dist->world;
+        size_t first = par->dist->rank * share;
+
+        if (first >= len)
+            return;
+
+        start += first;
+        len = len - first < share ? len - first : share;
+    }
+
+    if (par == NULL || par->pool == NULL)
+    {
+        _net_load_batch(net, data, start, len);
+        _net_feed_forward(net);
+        _net_backprop(net);
+        return;
+    }
+
+    par->data = data;
+    par->start = start;
+    par->len = len;
+
+    pool_run(par->pool, _net_par_batch, par);
+}
+
+/**
+ * @brief Optimizer step. A data parallel run first sums the gradients of
+ *        the workers into the network, and afterwards brings the weights
+ *        the workers read up to date.
+ * 
+ * @param net Neural network struct
+ * @param par Data parallel context, or NULL
+ * @param lr Learning rate of this step
+ * @param n_samples Number of samples the gradients were accumulated over
+ */
+static void _net_step(network_t* net, net_parallel_t* par, double lr,
+                      size_t n_samples)
+{
+    if (par && par->pool)
+        pool_run(par->pool, _net_par_reduce, par);
+
+    if (par && par->dist)
+        _net_par_allreduce(par);
+
+    _net_update(net, lr, n_samples);
+
+    if (par && par->pool)
+        pool_run(par->pool, _net_par_sync, par);
+}
+
+/**
+ * @brief  Set up a data parallel run. Ranks of a multi-process run start
+ *         from the weights of rank 0.
+ *
+ *         With worker threads, every worker builds its own network
+ *         (activations, deltas and gradients) from its pinned thread, so
+ *         its pages are first touched on its node. Workers then read the
+ *         weights of their node's first worker (WEIGHTS_REPLICATED) or of
+ *         the network itself.
+ * 
+ * @param  net Neural network struct
+ * @param  config Training configuration
+ * @return net_parallel_t* Data parallel context
+ */
+static net_parallel_t* _net_par_init(network_t* net, train_config_t* config)
+{
+    size_t n = config->n_threads;
+    net_parallel_t* par = mem_calloc(1, sizeof(net_parallel_t), MEM_NETWORK);
+
+    par->net = net;
+    par->weights = config->weights;
+    par->dist = config->dist;
+
+    if (par->dist)
+    {
+        par->flat = mem_malloc(net_dist_size(net) * sizeof(double),
+                               MEM_GRADIENTS);
+
+        size_t n_params = _net_par_params(net, par->flat, 0);
+        dist_broadcast(par->dist, par->flat, n_params, 0);
+        _net_par_params(net, par->flat, 1);
+
+        net->w_sum_valid = 0;
+    }
+
+    if (n < 2)
+        return par;
+
+    par->pool = pool_init(n, config->affinity);
+    par->replicas = mem_calloc(n, sizeof(network_t*), MEM_NETWORK);
+    par->borrowed = mem_calloc(n, sizeof(int), MEM_NETWORK);
+    par->leader = mem_calloc(n, sizeof(size_t), MEM_NETWORK);
+    par->scratch = mem_calloc(n * n, sizeof(matrix_t*), MEM_NETWORK);
+
+    if (par->weights == WEIGHTS_INTERLEAVED)
+    {
+        for (size_t l = 0; l < net->n_params; l++)
+        {
+            _net_par_interleave(net->w[l]);
+            _net_par_interleave(net->b[l]);
+        }
+    }
+
+    pool_run(par->pool, _net_par_clone, par);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        size_t leader = 0;
+
+        while (par->pool->nodes[leader] != par->pool->nodes[i])
+            leader++;
+
+        par->leader[i] = leader;
+
+        network_t* src = par->weights == WEIGHTS_REPLICATED
+                       ? par->replicas[leader] : net;
+
+        if (src == par->replicas[i])
+            continue;
+
+        network_t* rep = par->replicas[i];
+
+        // The copy from net_clone is never read, keep only one per source
+        par->borrowed[i] = 1;
+
+        for (size_t l = 0; l < net->n_params; l++)
+        {
+            m_free(rep->w[l]);
+            m_free(rep->b[l]);
+            rep->w[l] = src->w[l];
+            rep->b[l] = src->b[l];
+        }
+    }
+
+    return par;
+}
+
+/**
+ * @brief Stop the workers and free their networks, then the context
+ * 
+ * @param par Data parallel context
+ */
+static void _net_par_free(net_parallel_t* par)
+{
+    if (par->flat)
+        mem_free(par->flat);
+
+    if (par->pool == NULL)
+    {
+        mem_free(par);
+        return;
+    }
+
+    size_t n = par->pool->n_workers;
+
+    pool_free(par->pool);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        // Borrowed weights are freed by their own network
+        if (par->borrowed[i])
+        {
+            for (size_t l = 0; l < par->net->n_params; l++)
+            {
+                par->replicas[i]->w[l] = NULL;
+                par->replicas[i]->b[l] = NULL;
+            }
+        }
+
+        net_free(par->replicas[i]);
+    }
+
+    mem_free(par->replicas);
+    mem_free(par->borrowed);
+    mem_free(par->leader);
+    mem_free(par->scratch);
+    mem_free(par);
 }
 
 /**
- * @brief Backpropagation algorithm
+ * @brief Move the values of a weight matrix to a block of whole pages, and
+ *        spread those pages over the NUMA nodes. The block owns its pages,
+ *        so no other allocation is moved along.
+ *
+ * @param m Weight or bias matrix of the shared network
+ */
+static void _net_par_interleave(matrix_t* m)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t size = (m->capacity * sizeof(double) + page - 1) & ~(page - 1);
+    double* array = mem_aligned(size, page, MEM_PARAMS);
+
+    memcpy(array, m->array, m->size * sizeof(double));
+    mem_free(m->array);
+    m->array = array;
+
+    topo_interleave(m->array, size);
+}
+
+/**
+ * @brief Worker job: build the network of the worker, sized for its share
+ *        of a micro-batch
+ */
+static void _net_par_clone(void* args, size_t worker)
+{
+    net_parallel_t* par = args;
+    size_t n = par->pool->n_workers;
+
+    par->replicas[worker] = net_clone(par->net,
+                                      (par->net->batch_size + n - 1) / n);
+}
+
+/**
+ * @brief Worker job: forward and backward pass over the worker's share of
+ *        the current micro-batch, into the worker's gradients
+ */
+static void _net_par_batch(void* args, size_t worker)
+{
+    net_parallel_t* par = args;
+    network_t* rep = par->replicas[worker];
+    size_t n = par->pool->n_workers;
+    size_t share = (par->len + n - 1) / n;
+    size_t first = worker * share;
+
+    if (first >= par->len)
+        return;
+
+    size_t len = par->len - first < share ? par->len - first : share;
+
+    _net_load_batch(rep, par->data, par->start + first, len);
+    _net_feed_forward(rep);
+    _net_backprop(rep);
+}
+
+/**
+ * @brief Worker job: add a slice of every worker's gradients to the
+ *        network's gradients, and reset that slice
+ */
+static void _net_par_reduce(void* args, size_t worker)
+{
+    net_parallel_t* par = args;
+    network_t* net = par->net;
+    size_t n = par->pool->n_workers;
+    matrix_t** src = par->scratch + worker * n;
+
+    for (size_t l = 0; l < net->n_params; l++)
+    {
+        for (size_t i = 0; i < n; i++)
+            src[i] = par->replicas[i]->grad_w[l];
+
+        _net_par_sum(net->grad_w[l], src, n, worker, n);
+
+        for (size_t i = 0; i < n; i++)
+            src[i] = par->replicas[i]->grad_b[l];
+
+        _net_par_sum(net->grad_b[l], src, n, worker, n);
+    }
+
+    for (size_t i = 0; i < n; i++)
+        src[i] = par->replicas[i]->grad_bg;
+
+    _net_par_sum(net->grad_bg, src, n, worker, n);
+}
+
+/**
+ * @brief dst += sum of src, then src = 0, over the worker's slice of the
+ *        elements
  * 
- * @param net Neural network struct
+ * @param dst Destination matrix
+ * @param src Matrices to add
+ * @param n_src Number of matrices to add
+ * @param worker Worker index
+ * @param n_workers Number of workers
  */
-static void _net_backprop(network_t* net)
+static void _net_par_sum(matrix_t* dst, matrix_t** src, size_t n_src,
+                         size_t worker, size_t n_workers)
+{
+    size_t lo = dst->size * worker / n_workers;
+    size_t hi = dst->size * (worker + 1) / n_workers;
+
+    for (size_t r = 0; r < n_src; r++)
+    {
+        double* s = src[r]->array;
+
+        for (size_t i = lo; i < hi; i++)
+        {
+            dst->array[i] += s[i];
+            s[i] = 0.f;
+        }
+    }
+}
+
+/**
+ * @brief Worker job: once the network is updated, the first worker of
+ *        each node refreshes the node's copy of the weights
+ */
+static void _net_par_sync(void* args, size_t worker)
+{
+    net_parallel_t* par = args;
+    network_t* rep = par->replicas[worker];
+
+    if (par->weights == WEIGHTS_REPLICATED && par->leader[worker] == worker)
+        _net_copy_params(par->net->w, par->net->b, rep->w, rep->b,
+                         par->net->n_params);
+
+    // Column sums of the sparse path follow the weights
+    rep->w_sum_valid = 0;
+}
+
+/**
+ * @brief Sum the gradients of the network over every rank
+ * 
+ * @param par Data parallel context of a multi-process run
+ */
+static void _net_par_allreduce(net_parallel_t* par)
 {
-    m_sub(net->a[net->L-1], net->y, net->delta[net->L-1]);
-    matrix_t* d_zL = m_apply(net->z[net->L-1], d_sigmoid);
-    m_hadamard(net->delta[net->L-1], d_zL, net->delta[net->L-1]);
-    m_free(d_zL);
+    network_t* net = par->net;
+    matrix_t* grad_bg = net->grad_bg;   // network_t is packed
+    size_t pos = 0;
+
+    _net_par_pack(net->grad_w, net->n_params, par->flat, &pos, 0);
+    _net_par_pack(net->grad_b, net->n_params, par->flat, &pos, 0);
+    _net_par_pack(&grad_bg, 1, par->flat, &pos, 0);
 
-    for (int l = net->L-2; l >= 0; l--)
+    dist_allreduce(par->dist, par->flat, pos);
+
+    pos = 0;
+    _net_par_pack(net->grad_w, net->n_params, par->flat, &pos, 1);
+    _net_par_pack(net->grad_b, net->n_params, par->flat, &pos, 1);
+    _net_par_pack(&grad_bg, 1, par->flat, &pos, 1);
+}
+
+/**
+ * @brief Copy matrices to or from a flat buffer
+ * 
+ * @param m Matrices
+ * @param n Number of matrices
+ * @param flat Flat buffer, NULL to only count
+ * @param pos Position in the buffer, advanced past the matrices
+ * @param unpack Copy from the buffer into the matrices
+ */
+static void _net_par_pack(matrix_t** m, size_t n, double* flat,
+                          size_t* pos, int unpack)
+{
+    for (size_t i = 0; i < n; i++)
     {
-        matrix_t* weights_trans = m_transpose(net->w[l+1]);
-        m_mul(net->delta[l+1], weights_trans, net->delta[l]);
+        size_t bytes = m[i]->size * sizeof(double);
 
-        matrix_t* d_zl = m_apply(net->z[l], d_sigmoid);
-        m_hadamard(net->delta[l], d_zl, net->delta[l]);
+        if (flat && unpack)
+            memcpy(m[i]->array, flat + *pos, bytes);
+        else if (flat)
+            memcpy(flat + *pos, m[i]->array, bytes);
 
-        m_free(d_zl);
-        m_free(weights_trans);
+        *pos += m[i]->size;
     }
 }
 
 /**
- * @brief     Computes gradient descent
- *            on training examples on determined batch size 
+ * @brief  Copy the weights and biases of the network to or from a flat
+ *         buffer
  * 
- * @param net Neural network struct
+ * @param  net Neural network struct
+ * @param  flat Flat buffer, NULL to only count
+ * @param  unpack Copy from the buffer into the network
+ * @return size_t Number of parameters
  */
-static void _net_mini_batch_gradient_descent(network_t* net)
+static size_t _net_par_params(network_t* net, double* flat, int unpack)
 {
-    matrix_t* grad_w;
-    matrix_t* a_T;
-    
-    for (int l = net->L - 1; l >= 0; l--)
+    size_t pos = 0;
+
+    _net_par_pack(net->w, net->n_params, flat, &pos, unpack);
+    _net_par_pack(net->b, net->n_params, flat, &pos, unpack);
+
+    return pos;
+}
+
+/**
+ * @brief  Set up a pipeline parallel run. Layers are split into
+ *         config->n_stages contiguous groups of about the same weight
+ *         count, each run by its own pinned worker. Stages share the
+ *         network's weights and gradients; every micro-batch of a step
+ *         gets its own activations, kept until its backward pass.
+ *
+ * @param  net Neural network struct
+ * @param  config Training configuration
+ * @return net_pipeline_t* Pipeline context
+ */
+static net_pipeline_t* _net_pipe_init(network_t* net, train_config_t* config)
+{
+    size_t S = config->n_stages;
+
+    if (S > net->L || net->n_conv > 0 || config->n_threads > 1
+        || config->dist)
     {
-        if (l == 0)
-            a_T = m_transpose(net->X);
+        errx(NETWORK_INVALID_PIPELINE,
+             "NETWORK::ERROR::PIPELINE: "
+             "Invalid pipeline of %zu stages: needs at most %zu dense "
+             "layers, and no other parallelism", S, net->L);
+    }
+
+    net_pipeline_t* pipe = mem_calloc(1, sizeof(net_pipeline_t),
+                                      MEM_NETWORK);
+
+    pipe->net = net;
+    pipe->n_stages = S;
+    pipe->n_replicas = config->accum_steps ? config->accum_steps : 1;
+
+    pipe->stage = mem_calloc(net->L, sizeof(size_t), MEM_NETWORK);
+    pipe->fwd_first = mem_calloc(S, sizeof(size_t), MEM_NETWORK);
+    pipe->fwd_last = mem_calloc(S, sizeof(size_t), MEM_NETWORK);
+    pipe->bwd_first = mem_calloc(S, sizeof(size_t), MEM_NETWORK);
+    pipe->bwd_last = mem_calloc(S, sizeof(size_t), MEM_NETWORK);
+
+    _net_pipe_partition(pipe);
+
+    // A queue holds every micro-batch of a step, so pushes never wait
+    size_t capacity = 1;
+
+    while (capacity < pipe->n_replicas)
+        capacity <<= 1;
+
+    pipe->fwd = mem_calloc(S - 1, sizeof(queue_t*), MEM_NETWORK);
+    pipe->bwd = mem_calloc(S - 1, sizeof(queue_t*), MEM_NETWORK);
+
+    for (size_t s = 0; s + 1 < S; s++)
+    {
+        pipe->fwd[s] = queue_init(capacity);
+        pipe->bwd[s] = queue_init(capacity);
+    }
+
+    pipe->replicas = mem_calloc(pipe->n_replicas, sizeof(network_t*),
+                                MEM_NETWORK);
+    pipe->start = mem_calloc(pipe->n_replicas, sizeof(size_t), MEM_NETWORK);
+    pipe->len = mem_calloc(pipe->n_replicas, sizeof(size_t), MEM_NETWORK);
+
+    for (size_t m = 0; m < pipe->n_replicas; m++)
+        pipe->replicas[m] = _net_pipe_replica(net);
+
+    pipe->pool = pool_init(S, config->affinity);
+
+    return pipe;
+}
+
+/**
+ * @brief Stop the stages and free the activations of the micro-batches,
+ *        then the context
+ *
+ * @param pipe Pipeline context
+ */
+static void _net_pipe_free(net_pipeline_t* pipe)
+{
+    pool_free(pipe->pool);
+
+    for (size_t s = 0; s + 1 < pipe->n_stages; s++)
+    {
+        queue_free(pipe->fwd[s]);
+        queue_free(pipe->bwd[s]);
+    }
+
+    // Everything else of a replica belongs to the network
+    for (size_t m = 0; m < pipe->n_replicas; m++)
+    {
+        network_t* rep = pipe->replicas[m];
+
+        graph_free(rep->graph);
+        mem_free(rep->X_sparse);
+        mem_free(rep->a);
+        mem_free(rep->z);
+        mem_free(rep->delta);
+        mem_free(rep);
+    }
+
+    mem_free(pipe->replicas);
+    mem_free(pipe->start);
+    mem_free(pipe->len);
+    mem_free(pipe->fwd);
+    mem_free(pipe->bwd);
+    mem_free(pipe->stage);
+    mem_free(pipe->fwd_first);
+    mem_free(pipe->fwd_last);
+    mem_free(pipe->bwd_first);
+    mem_free(pipe->bwd_last);
+    mem_free(pipe);
+}
+
+/**
+ * @brief Assign contiguous layers to the stages, balancing their weight
+ *        counts, with at least one layer per stage. Then split the graph:
+ *        the forward steps of a stage, and its backward steps, are
+ *        contiguous ranges.
+ *
+ * @param pipe Pipeline context
+ */
+static void _net_pipe_partition(net_pipeline_t* pipe)
+{
+    network_t* net = pipe->net;
+    size_t S = pipe->n_stages;
+    double total = 0.f;
+    double done = 0.f;
+    size_t s = 0;
+    size_t in_stage = 0;
+
+    for (size_t l = 0; l < net->L; l++)
+        total += net->w[l]->size;
+
+    for (size_t l = 0; l < net->L; l++)
+    {
+        double mid = done + net->w[l]->size / 2.f;
+
+        // Move on past the stage's share, or when every layer left is
+        // needed by the following stages
+        if (s + 1 < S && in_stage > 0
+            && (mid > (s + 1) * total / S || net->L - l == S - 1 - s))
+        {
+            s++;
+            in_stage = 0;
+        }
+
+        pipe->stage[l] = s;
+        in_stage++;
+        done += net->w[l]->size;
+    }
+
+    graph_t* g = net->graph;
+
+    for (size_t i = 0; i < g->n_steps; i++)
+    {
+        s = _net_pipe_stage_of(pipe, i);
+
+        size_t* first = i < g->n_forward ? pipe->fwd_first : pipe->bwd_first;
+        size_t* last = i < g->n_forward ? pipe->fwd_last : pipe->bwd_last;
+
+        if (last[s] == 0)
+            first[s] = i;
+
+        last[s] = i + 1;
+    }
+}
+
+/**
+ * @brief  Stage of a graph step. The output delta is computed by the last
+ *         stage, and the activation derivative of a layer by the stage
+ *         of the next layer, which hands the finished delta over.
+ *         Activations recomputed by the backward pass are computed by the
+ *         stage about to read them.
+ *
+ * @param  pipe Pipeline context
+ * @param  i Index of the step in the network graph
+ * @return size_t Stage running the step
+ */
+static size_t _net_pipe_stage_of(net_pipeline_t* pipe, size_t i)
+{
+    graph_t* g = pipe->net->graph;
+    g_step_t* s = &g->steps[i];
+
+    if (i >= g->n_forward)
+    {
+        while (s->op == G_DENSE || s->op == G_ACT)
+            s++;
+    }
+
+    switch (s->op)
+    {
+        case G_LOAD:    return 0;
+        case G_LOSS:    return pipe->n_stages - 1;
+        case G_ACT_BWD: return pipe->stage[s->layer + 1];
+        default:        return pipe->stage[s->layer];
+    }
+}
+
+/**
+ * @brief  Network reading and accumulating into the weights and gradients
+ *         of net, with its own batch, activations and deltas
+ *
+ * @param  net Neural network struct
+ * @return network_t* Replica, freed by _net_pipe_free
+ */
+static network_t* _net_pipe_replica(network_t* net)
+{
+    network_t* rep = mem_malloc(sizeof(network_t), MEM_NETWORK);
+
+    *rep = *net;
+    rep->max_batch = net->batch_size;
+    rep->a = mem_calloc(net->L, sizeof(matrix_t*), MEM_NETWORK);
+    rep->z = mem_calloc(net->L, sizeof(matrix_t*), MEM_NETWORK);
+    rep->delta = mem_calloc(net->L, sizeof(matrix_t*), MEM_NETWORK);
+    rep->X_sparse = mem_calloc(net->batch_size, sizeof(sparse_t*),
+                               MEM_NETWORK);
+
+    mem_category_t scope = mem_scope(MEM_ACTIVATIONS);
+
+    rep->graph = _net_build_graph(net->L, net->input_size, net->hidden_size,
+                                  net->output_size, NULL, 0,
+                                  net->batch_size, net->checkpoint);
+    graph_alloc(rep->graph);
+
+    mem_scope(scope);
+
+    rep->X = graph_matrix(rep->graph, NET_TENSOR_X);
+    rep->y = graph_matrix(rep->graph, NET_TENSOR_Y);
+
+    for (size_t l = 0; l < net->L; l++)
+    {
+        rep->a[l] = graph_matrix(rep->graph, NET_TENSOR_A(l));
+        rep->z[l] = graph_matrix(rep->graph, NET_TENSOR_Z(l));
+        rep->delta[l] = graph_matrix(rep->graph, NET_TENSOR_DELTA(l));
+    }
+
+    return rep;
+}
+
+/**
+ * @brief Record a micro-batch of the current step, run by _net_pipe_run
+ *
+ * @param pipe Pipeline context
+ * @param data Dataset
+ * @param start First sample of the micro-batch
+ * @param len Number of samples in the micro-batch
+ */
+static void _net_pipe_add(net_pipeline_t* pipe, dataset_t* data,
+                          size_t start, size_t len)
+{
+    pipe->data = data;
+    pipe->start[pipe->n_micro] = start;
+    pipe->len[pipe->n_micro] = len;
+    pipe->n_micro++;
+}
+
+/**
+ * @brief Stream the recorded micro-batches through the stages, which
+ *        accumulate their gradients into the network
+ *
+ * @param pipe Pipeline context
+ */
+static void _net_pipe_run(net_pipeline_t* pipe)
+{
+    network_t* net = pipe->net;
+
+    if (pipe->n_micro == 0)
+        return;
+
+    // Replicas share w_sum: bring it up to date once per step
+    if (pipe->data->S && !net->w_sum_valid)
+    {
+        m_sum_rows(net->w[0], net->w_sum);
+        net->w_sum_valid = 1;
+    }
+
+    for (size_t m = 0; m < pipe->n_micro; m++)
+        pipe->replicas[m]->w_sum_valid = net->w_sum_valid;
+
+    pool_run(pipe->pool, _net_pipe_stage, pipe);
+
+    pipe->n_micro = 0;
+}
+
+/**
+ * @brief Worker job: GPipe schedule of a stage. The forward pass of every
+ *        micro-batch runs first, then the backward passes in the same
+ *        order, so each layer accumulates its gradients in the order of a
+ *        serial run. Micro-batches enter the first stage and the
+ *        backward pass of the last stage from replicas, and reach the
+ *        others through the queues.
+ */
+static void _net_pipe_stage(void* args, size_t stage)
+{
+    net_pipeline_t* pipe = args;
+    size_t last = pipe->n_stages - 1;
+    network_t* rep;
+
+    for (size_t m = 0; m < pipe->n_micro; m++)
+    {
+        if (stage == 0)
+        {
+            rep = pipe->replicas[m];
+            _net_load_batch(rep, pipe->data, pipe->start[m], pipe->len[m]);
+        }
+
         else
-            a_T = m_transpose(net->a[l - 1]);
+            rep = queue_take(pipe->fwd[stage - 1]);
 
-        grad_w = m_copy(net->grad_w[l]);
-        
-        m_mul(a_T, net->delta[l], grad_w);
-        m_add(grad_w, net->grad_w[l], net->grad_w[l]);
-        m_add(net->delta[l], net->grad_b[l], net->grad_b[l]);
+        _net_run(rep, pipe->fwd_first[stage], pipe->fwd_last[stage]);
+
+        if (stage < last)
+            queue_put(pipe->fwd[stage], rep);
+    }
+
+    for (size_t m = 0; m < pipe->n_micro; m++)
+    {
+        rep = stage == last ? pipe->replicas[m]
+                            : queue_take(pipe->bwd[stage]);
+
+        _net_run(rep, pipe->bwd_first[stage], pipe->bwd_last[stage]);
+
+        if (stage > 0)
+            queue_put(pipe->bwd[stage - 1], rep);
+    }
+}
+
+/**
+ * @brief  Learning rate of the configured schedule for a step, from the
+ *         training progress at its start. Warm-up ramps up to the end of
+ *         the step, so the first one does not run at a zero rate.
+ * 
+ * @param  net Neural network struct, holding the base learning rate
+ * @param  config Training configuration
+ * @param  epoch Training progress, in (fractional) epochs
+ * @param  step Progress made by the step, in epochs
+ * @return double Learning rate
+ */
+static double _net_schedule_lr(network_t* net, train_config_t* config,
+                               double epoch, double step)
+{
+    double lr = net->lr;
+    double warmup = config->warmup_epochs;
+
+    switch (config->lr_schedule)
+    {
+        case LR_STEP:
+            if (config->lr_step)
+                lr *= pow(config->lr_gamma,
+                          floor(epoch / config->lr_step));
+            break;
+
+        case LR_COSINE:
+            if (config->epochs > warmup)
+            {
+                double t = (epoch - warmup) / (config->epochs - warmup);
+                t = t < 0.f ? 0.f : (t > 1.f ? 1.f : t);
+                lr = config->lr_min
+                   + (net->lr - config->lr_min) * 0.5f * (1.f + cos(M_PI * t));
+            }
+            break;
+
+        default:
+            break;
+    }
 
-        m_free(a_T);
-        m_free(grad_w);
+    if (epoch + step < warmup)
+        lr *= (epoch + step) / warmup;
+
+    return lr;
+}
+
+/**
+ * @brief Copy weights and biases of L layers from src to dst
+ * 
+ * @param w_src Source weights
+ * @param b_src Source biases
+ * @param w_dst Destination weights
+ * @param b_dst Destination biases
+ * @param L Number of parameter layers
+ */
+static void _net_copy_params(matrix_t** w_src, matrix_t** b_src,
+                             matrix_t** w_dst, matrix_t** b_dst,
+                             size_t L)
+{
+    for (size_t l = 0; l < L; l++)
+    {
+        m_copy_dst(w_src[l], w_dst[l]);
+        m_copy_dst(b_src[l], b_dst[l]);
     }
 }
 
 /**
- * @brief Update network weights and biases with delta layer
+ * @brief Resize the batched buffers of the network to hold rows samples
  * 
  * @param net Neural network struct
+ * @param rows Number of samples in the batch
  */
-static void _net_update(network_t* net)
+static void _net_set_batch(network_t* net, size_t rows)
 {
-    double lr = net->lr / net->batch_size;
+    if (rows == 0 || rows > net->max_batch)
+    {
+        errx(NETWORK_INVALID_BATCH,
+             "NETWORK::ERROR::BATCH: "
+             "Batch of %zu samples exceeds capacity %zu",
+             rows, net->max_batch);
+    }
+
+    m_reshape(net->X, rows, net->X->n_col);
+    m_reshape(net->y, rows, net->y->n_col);
+    net->sparse_batch = 0;
+
+    for (size_t l = 0; l < net->L; l++)
+    {
+        m_reshape(net->a[l], rows, net->a[l]->n_col);
+        m_reshape(net->z[l], rows, net->z[l]->n_col);
+        m_reshape(net->delta[l], rows, net->delta[l]->n_col);
+    }
 
-    for (int l = net->L - 1; l >= 0; l--)
+    for (size_t k = 0; k < net->n_conv; k++)
     {
-        // Weight update
-        m_scalar_mul(net->grad_w[l], lr, net->grad_w[l]);
-        m_sub(net->w[l], net->grad_w[l], net->w[l]);
-        
-        // Bias update
-        m_scalar_mul(net->grad_b[l], lr, net->grad_b[l]);
-        m_sub(net->b[l], net->grad_b[l], net->b[l]);
+        m_reshape(net->conv_a[k], rows, net->conv_a[k]->n_col);
+        m_reshape(net->conv_delta[k], rows, net->conv_delta[k]->n_col);
+        m_reshape(net->conv_cols[k], rows * conv_positions(&net->conv[k]),
+                  net->conv_cols[k]->n_col);
+    }
+
+    // Forward tensors of recomputed layers follow all the others
+    graph_t* g = net->graph;
+
+    for (size_t t = _net_conv_tensor(net->L, net->conv, net->n_conv, 0);
+         t < g->n_tensors; t++)
+        m_reshape(g->tensors[t].m, rows, g->tensors[t].n_col);
+}
+
+/**
+ * @brief Load samples [start, start + len) of a dataset as the
+ *        network's current batch
+ * 
+ * @param net Neural network struct
+ * @param data Dataset to load samples from
+ * @param start Index of the first sample
+ * @param len Number of samples
+ */
+static void _net_load_batch(network_t* net, dataset_t* data,
+                            size_t start, size_t len)
+{
+    PROF_START(t);
+
+    _net_set_batch(net, len);
+
+    for (size_t i = 0; i < len; i++)
+        _net_init_y(net, data->y[start + i], i);
+
+    // Convolutions read dense images
+    if (data->S && net->n_conv == 0)
+    {
+        net->sparse_batch = 1;
+        net->background = data->background;
+        net->batch_nnz = 0;
+
+        for (size_t i = 0; i < len; i++)
+        {
+            net->X_sparse[i] = data->S[start + i];
+            net->batch_nnz += data->S[start + i]->nnz;
+        }
+    }
+
+    else
+    {
+        for (size_t i = 0; i < len; i++)
+            _net_init_X(net, data->X[start + i], i);
     }
+
+    PROF_STOP(t, PROF_LOAD_BATCH, PROF_NO_LAYER, 0.f,
+              16.f * (net->X->size + net->y->size));
 }
 
 /**
- * @brief Initialize the network's input layer with data in X
+ * @brief Initialize a row of the network's input layer with data in X
  * 
  * @param net Neural network struct
  * @param X Array containing input_size amount of data
+ * @param row Row of the batch to initialize
  */
-static void _net_init_X(network_t* net, double* X)
+static void _net_init_X(network_t* net, double* X, size_t row)
 {
+    size_t rows = net->X->n_row;
+
     for(size_t i = 0; i < net->input_size; i++)
-        net->X->array[i] = X[i];
+        net->X->array[i * rows + row] = X[i];
 }    
 
 /**
- * @brief Initilaize the network's expected output with data in y
+ * @brief Initilaize a row of the network's expected output with data in y
  * 
  * @param net Neural network struct
  * @param y Array containing output_size amount of data
+ * @param row Row of the batch to initialize
  */
-static void _net_init_y(network_t* net, double* y)
+static void _net_init_y(network_t* net, double* y, size_t row)
 {
+    size_t rows = net->y->n_row;
+
     for(size_t i = 0; i < net->output_size; i++)
-        net->y->array[i] = y[i];
+        net->y->array[i * rows + row] = y[i];
 }
 
 /**
  * @brief  Checks for equality between
- *         network prediction, and expected output
+ *         network prediction, and expected output of a batch row
  * 
  * @param  net Neural network struct
+ * @param  row Row of the batch to check
  * @return int 1. if equal, 0. if not.
  */
-static double _net_evaluate_prediction(network_t* net)
+static double _net_evaluate_prediction(network_t* net, size_t row)
 {
     double pred = 1.f;
+    size_t rows = net->y->n_row;
     
     for(size_t i = 0; i < net->output_size; i++)
     {
-        if (net->a[net->L - 1]->array[i] != net->y->array[i])
+        if (net->a[net->L - 1]->array[i * rows + row]
+            != net->y->array[i * rows + row])
         {
             pred = 0.f;
             break;
@@ -539,11 +3056,33 @@ static double _net_evaluate_prediction(network_t* net)
  */
 static void _net_binarize_output(network_t* net, double threshold)
 {
-    for(size_t i = 0; i < net->output_size; i++)
+    matrix_t* a = net->a[net->L - 1];
+
+    for(size_t i = 0; i < a->size; i++)
     {
-        if (net->a[net->L - 1]->array[i] > threshold)
-            net->a[net->L - 1]->array[i] = 1.f;
+        if (a->array[i] > threshold)
+            a->array[i] = 1.f;
         else
-            net->a[net->L - 1]->array[i] = 0.f;
+            a->array[i] = 0.f;
+    }
+}
+
+/**
+ * @brief  Index of the largest value in a row of a batched matrix
+ * 
+ * @param  m Batched matrix
+ * @param  row Row of the batch
+ * @return size_t Column of the largest value
+ */
+static size_t _net_argmax(matrix_t* m, size_t row)
+{
+    size_t best = 0;
+    
+    for (size_t i = 1; i < m->n_col; i++)
+    {
+        if (m->array[i * m->n_row + row] > m->array[best * m->n_row + row])
+            best = i;
     }
+
+    return best;
 }
@@ -11,10 +11,32 @@
 #ifndef NETWORK_H
 #define NETWORK_H
 
-#define NETWORK_FAILED_LOAD -1
+#define NETWORK_FAILED_LOAD     -1
+#define NETWORK_INVALID_BATCH   -2
+#define NETWORK_INVALID_LAYER   -3
+#define NETWORK_DIVERGED        -4
+#define NETWORK_INVALID_PIPELINE -5
+#define NETWORK_INVALID_CONFIG  -6
+
+#define NETWORK_SIGNATURE       0xDEADBEEF  // Sigmoid only network file
+#define NETWORK_SIGNATURE_ACT   0xDEADBEF1  // Network file with activations
+#define NETWORK_SIGNATURE_CONV  0xDEADBEF3  // Network file with conv layers
+
+#define NETWORK_EVAL_BATCH      64  // Minimum rows of the batched buffers
 
 #include "matrix.h"
+#include "conv.h"
 #include "dataset.h"
+#include "dist.h"
+#include "graph.h"
+#include "topology.h"
+
+typedef enum
+{
+    ACT_SIGMOID,
+    ACT_RELU,
+    ACT_SOFTMAX,             // Output layer only, trained with cross-entropy
+} activation_t;
 
 typedef struct
 __attribute__((packed, aligned(1)))
@@ -24,11 +46,17 @@ __attribute__((packed, aligned(1)))
     size_t      hidden_size;
     size_t      output_size;
 
+    size_t      n_conv;      // Convolution and pooling layers, before L
+    conv_t*     conv;        // Shapes of those layers, NULL if none
+    size_t      n_params;    // L, then one per convolution: entries of
+                             // w, b, grad_w, grad_b and act
+
     size_t      batch_size;
+    size_t      max_batch;   // Row capacity of the batched buffers
     double      lr;          // Network learning rate
 
-    matrix_t*   X;           // Input data
-    matrix_t*   y;           // Expected output
+    matrix_t*   X;           // Input data, one sample per row
+    matrix_t*   y;           // Expected output, one sample per row
     
     matrix_t**  a;           // Activated neurons layer
     matrix_t**  z;           // Pre activated neurons layer
@@ -37,22 +65,106 @@ __attribute__((packed, aligned(1)))
     matrix_t**  delta;       // Error delta layer
     matrix_t**  grad_w;      // Cumulative batch gradient for weights
     matrix_t**  grad_b;      // Cumulative batch gradient for biases
+
+    activation_t* act;       // Activation function of each layer
+
+    matrix_t**  conv_a;      // Output of each convolution / pooling layer
+    matrix_t**  conv_delta;  // Error delta of each of those layers
+    matrix_t**  conv_cols;   // im2col windows of each of those layers
+
+    sparse_t**  X_sparse;    // Sparse inputs of the current batch
+    int         sparse_batch;// Current batch is read from X_sparse
+    size_t      batch_nnz;   // Deviations in the current sparse batch
+    double      background;  // Background constant of X_sparse
+    matrix_t*   w_sum;       // Column sums of w[0], sparse bias correction
+    int         w_sum_valid; // w_sum matches w[0]
+    matrix_t*   grad_bg;     // Background part of grad_w[0], per column
+
+    matrix_t**  mask;        // Pruning masks of w, NULL if not pruned
+
+    size_t      checkpoint;  // Activations kept every k layers, 0 for all
+    graph_t*    graph;       // Schedule and memory plan of X, y, a, z, delta
 } network_t;
 
+typedef enum
+{
+    LR_CONSTANT,                  // lr
+    LR_STEP,                      // lr * gamma^(epoch / lr_step)
+    LR_COSINE,                    // Cosine annealing from lr to lr_min
+} lr_schedule_t;
+
+typedef enum
+{
+    WEIGHTS_REPLICATED,           // One copy per NUMA node, synced per step
+    WEIGHTS_INTERLEAVED,          // Shared, pages spread over the nodes
+    WEIGHTS_SHARED,               // Shared, left where first touched
+} weights_placement_t;
+
+typedef struct
+{
+    size_t      epochs;
+    size_t      steps_per_epoch;  // Optimizer steps per epoch, 0 for all
+    size_t      accum_steps;      // Micro-batches accumulated per step
+    int         drop_last;        // Drop the trailing partial micro-batch
+
+    lr_schedule_t lr_schedule;
+    size_t      lr_step;          // LR_STEP: epochs between two decays
+    double      lr_gamma;         // LR_STEP: decay factor
+    double      lr_min;           // LR_COSINE: final learning rate
+    size_t      warmup_epochs;    // Linear warm-up, applied to any schedule
+
+    double      val_split;        // Fraction of data held out, 0 disables
+    size_t      patience;         // Epochs without improvement, 0 disables
+
+    size_t      n_threads;        // Data parallel workers, 1 for none
+    size_t      n_stages;         // Pipeline stages, 1 for none
+    affinity_t  affinity;         // Placement of the workers
+    weights_placement_t weights;  // Placement of the weights workers read
+    dist_t*     dist;             // Rank of a multi-process run, or NULL
+    struct monitor* monitor;      // Background validation, or NULL
+    struct live* live;            // Versions published to readers, or NULL
+
+    // Called after every epoch, training stops if it returns non zero
+    int       (*on_epoch)(network_t* net, size_t epoch, void* args);
+    void*       on_epoch_args;
+
+    int         verbose;          // Print training progress
+} train_config_t;
+
 network_t*  net_init(size_t L, size_t input_size,
                                size_t hidden_size,
                                size_t output_size,
                                size_t batch_size, double lr);
+network_t*  net_init_conv(size_t channels, size_t height, size_t width,
+                          const conv_t* conv, size_t n_conv,
+                          size_t L, size_t hidden_size, size_t output_size,
+                          size_t batch_size, double lr);
 
 void        net_free(network_t* net);
+void        net_set_activation(network_t* net, size_t l, activation_t act);
+void        net_set_checkpoint(network_t* net, size_t every);
 
 network_t*  net_load(const char* path);
+network_t*  net_clone(network_t* net, size_t batch_size);
 void        net_save(network_t* net, const char* dst);
 
 void        net_summary(network_t* net);
+size_t      net_footprint(size_t L, size_t input_size, size_t hidden_size,
+                          size_t output_size, size_t batch_size);
+size_t      net_dist_size(network_t* net);
 void        net_train(network_t* net, dataset_t* dataset, size_t epochs);
 
+train_config_t  net_config_default(size_t epochs);
+void            net_fit(network_t* net, dataset_t* dataset,
+                        train_config_t* config);
+void            net_update_online(network_t* net, double** X, double** y,
+                                  size_t n, double lr);
+
 void        net_evaluate(network_t* net, dataset_t* dataset);
+double      net_accuracy(network_t* net, dataset_t* dataset);
 void        net_predict(network_t* net, double* X, double* y);
+void        net_activate(activation_t act, matrix_t* z, matrix_t* a);
+void        net_predict_batch(network_t* net, double** X, size_t n,
+                              double* y);
 
 #endif // NETWORK_H
\ No newline at end of file
@@ -0,0 +1,252 @@
+/**
+ * @file    online.c
+ * @author  Philippe Bouchet (philippe.bouchet@epita.fr)
+ * @brief   Online learning implementation.
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "online.h"
+
+#include <err.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "memory.h"
+#include "utils.h"
+
+/* Internal API forward declaration */
+
+static unsigned long _online_rand(online_t* online);
+static void     _online_reserve(online_t* online, size_t n);
+static void     _online_store(online_t* online, double* X, double* y);
+static int      _online_cmp_double(const void* a, const void* b);
+
+
+/* ==== ONLINE PUBLIC API ==== */
+
+
+/**
+ * @return online_config_t One step per update on the new samples only.
+ *         Replay is off: set replay and capacity, e.g. 4 of 4096, to
+ *         trade latency for retention.
+ */
+online_config_t online_config_default(void)
+{
+    online_config_t config = {
+        .steps = 1,
+        .replay = 0,
+        .capacity = 0,
+        .lr = 0.f,
+        .seed = 42,
+    };
+
+    return config;
+}
+
+/**
+ * @brief  Online learner of a network. The reservoir is allocated
+ *         upfront, so updates allocate nothing once their batch size has
+ *         been seen.
+ *
+ * @param  net Network trained in place
+ * @param  config Online configuration
+ * @return online_t* Online learner
+ */
+online_t* online_init(network_t* net, const online_config_t* config)
+{
+    if (config->steps == 0 || (config->replay && config->capacity == 0))
+    {
+        errx(ONLINE_INVALID_CONFIG,
+             "ONLINE::ERROR::CONFIG: "
+             "Invalid config: %zu steps, %zu replayed of %zu",
+             config->steps, config->replay, config->capacity);
+    }
+
+    online_t* online = mem_calloc(1, sizeof(online_t), MEM_NETWORK);
+
+    online->net = net;
+    online->config = *config;
+    online->rng = config->seed ? config->seed : 1;
+
+    if (config->capacity)
+    {
+        online->store_X = mem_malloc(config->capacity * net->input_size
+                                     * sizeof(double), MEM_DATASET);
+        online->store_y = mem_malloc(config->capacity * net->output_size
+                                     * sizeof(double), MEM_DATASET);
+    }
+
+    _online_reserve(online, net->max_batch);
+
+    return online;
+}
+
+/**
+ * @param online Online learner to free, its network is not
+ */
+void online_free(online_t* online)
+{
+    if (online->config.capacity)
+    {
+        mem_free(online->store_X);
+        mem_free(online->store_y);
+    }
+
+    mem_free(online->step_X);
+    mem_free(online->step_y);
+    mem_free(online);
+}
+
+/**
+ * @brief  Train on a batch of new samples: config.steps optimizer steps,
+ *         each on the new samples plus config.replay samples drawn from
+ *         the reservoir. The new samples are then offered to the
+ *         reservoir (Algorithm R), so each sample of the stream is kept
+ *         with the same probability. X and y are copied, not retained.
+ *
+ * @param  online Online learner
+ * @param  X Array of n inputs of input_size values
+ * @param  y Array of n expected outputs of output_size values
+ * @param  n Number of new samples
+ * @return double Seconds spent in the update
+ */
+double online_update(online_t* online, double** X, double** y, size_t n)
+{
+    double start = get_time();
+    network_t* net = online->net;
+    size_t replay = online->n_stored ? online->config.replay : 0;
+    double lr = online->config.lr > 0.f ? online->config.lr : net->lr;
+
+    _online_reserve(online, n + replay);
+
+    memcpy(online->step_X, X, n * sizeof(double*));
+    memcpy(online->step_y, y, n * sizeof(double*));
+
+    for (size_t s = 0; s < online->config.steps; s++)
+    {
+        for (size_t i = 0; i < replay; i++)
+        {
+            size_t j = _online_rand(online) % online->n_stored;
+
+            online->step_X[n + i] = online->store_X + j * net->input_size;
+            online->step_y[n + i] = online->store_y + j * net->output_size;
+        }
+
+        net_update_online(net, online->step_X, online->step_y, n + replay,
+                          lr);
+    }
+
+    for (size_t i = 0; i < n; i++)
+        _online_store(online, X[i], y[i]);
+
+    double elapsed = get_time() - start;
+
+    online->latencies[online->n_updates % ONLINE_LATENCIES] = elapsed;
+    online->n_updates++;
+    online->total_time += elapsed;
+
+    return elapsed;
+}
+
+/**
+ * @param  online Online learner
+ * @param  quantile In [0, 1], 0.5 for the median
+ * @return double Update latency at quantile over the last
+ *         ONLINE_LATENCIES updates, in seconds, 0 before any update
+ */
+double online_latency(const online_t* online, double quantile)
+{
+    size_t n = online->n_updates < ONLINE_LATENCIES ? online->n_updates
+                                                    : ONLINE_LATENCIES;
+    double sorted[ONLINE_LATENCIES];
+
+    if (n == 0)
+        return 0.f;
+
+    memcpy(sorted, online->latencies, n * sizeof(double));
+    qsort(sorted, n, sizeof(double), _online_cmp_double);
+
+    size_t i = (size_t) (quantile * n);
+
+    return sorted[i < n ? i : n - 1];
+}
+
+
+/* ==== ONLINE INTERNAL API ==== */
+
+
+/**
+ * @param  online Online learner
+ * @return unsigned long Next value of the reservoir's xorshift generator
+ */
+static unsigned long _online_rand(online_t* online)
+{
+    online->rng ^= online->rng << 13;
+    online->rng ^= online->rng >> 7;
+    online->rng ^= online->rng << 17;
+
+    return online->rng;
+}
+
+/**
+ * @brief Grow the sample arrays of a step to at least n entries
+ *
+ * @param online Online learner
+ * @param n Samples in a step
+ */
+static void _online_reserve(online_t* online, size_t n)
+{
+    if (n <= online->step_size)
+        return;
+
+    if (online->step_X == NULL)
+    {
+        online->step_X = mem_malloc(n * sizeof(double*), MEM_NETWORK);
+        online->step_y = mem_malloc(n * sizeof(double*), MEM_NETWORK);
+    }
+
+    else
+    {
+        online->step_X = mem_realloc(online->step_X, n * sizeof(double*));
+        online->step_y = mem_realloc(online->step_y, n * sizeof(double*));
+    }
+
+    online->step_size = n;
+}
+
+/**
+ * @brief Offer a sample to the reservoir: kept while it is not full, then
+ *        replaces a random slot with probability capacity / n_seen
+ *
+ * @param online Online learner
+ * @param X Input of input_size values
+ * @param y Expected output of output_size values
+ */
+static void _online_store(online_t* online, double* X, double* y)
+{
+    size_t capacity = online->config.capacity;
+    size_t slot = online->n_seen++;
+
+    if (capacity == 0)
+        return;
+
+    if (online->n_stored < capacity)
+        online->n_stored++;
+    else if ((slot = _online_rand(online) % online->n_seen) >= capacity)
+        return;
+
+    memcpy(online->store_X + slot * online->net->input_size, X,
+           online->net->input_size * sizeof(double));
+    memcpy(online->store_y + slot * online->net->output_size, y,
+           online->net->output_size * sizeof(double));
+}
+
+static int _online_cmp_double(const void* a, const void* b)
+{
+    double x = *(const double*) a;
+    double y = *(const double*) b;
+
+    return (x > y) - (x < y);
+}
@@ -0,0 +1,73 @@
+/**
+ * @file    online.h
+ * @author  Philippe Bouchet (philippe.bouchet@epita.fr)
+ * @brief   Online learning: labeled samples arriving one small batch at a
+ *          time are trained on in place, with a bounded number of
+ *          optimizer steps per update (see net_update_online). Each step
+ *          may mix in samples replayed from a reservoir of the samples
+ *          seen so far, a uniform sample of the whole stream, so that
+ *          older data is not forgotten. Update latencies are recorded.
+ *
+ *          A step costs a forward and a backward pass over n + replay
+ *          samples, which run the native backend's unpacked kernels up
+ *          to 8 rows, plus one update of every weight. The default, one
+ *          step on the new samples only, keeps batches of 8 under a
+ *          millisecond on MNIST-sized networks (deepsea-bench fails
+ *          otherwise); replay adds its samples to that budget.
+ *
+ *          An online learner owns its network between updates; publish
+ *          it to inference threads with model_copy, or with live_publish
+ *          to serve while it learns (see live.h).
+ *          Public API functions denoted with "online" prefix.
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef ONLINE_H
+#define ONLINE_H
+
+#define ONLINE_INVALID_CONFIG   -1
+
+#define ONLINE_LATENCIES        1024    // Latencies kept for percentiles
+
+#include "network.h"
+
+typedef struct
+{
+    size_t      steps;       // Optimizer steps per update
+    size_t      replay;      // Reservoir samples mixed into each step
+    size_t      capacity;    // Reservoir samples, 0 disables replay
+    double      lr;          // Learning rate, 0 for the network's
+    unsigned    seed;        // Seed of the reservoir, rand() is not used
+} online_config_t;
+
+typedef struct
+{
+    network_t*  net;
+    online_config_t config;
+
+    double*     store_X;     // capacity inputs, one after the other
+    double*     store_y;     // capacity expected outputs
+    size_t      n_stored;    // Samples in the reservoir
+    size_t      n_seen;      // Samples offered to the reservoir
+    unsigned long rng;       // xorshift state
+
+    double**    step_X;      // Samples of the current step
+    double**    step_y;
+    size_t      step_size;   // Capacity of step_X and step_y
+
+    size_t      n_updates;
+    double      total_time;  // Seconds spent in online_update
+    double      latencies[ONLINE_LATENCIES];  // Ring of the last updates
+} online_t;
+
+online_config_t online_config_default(void);
+online_t*       online_init(network_t* net, const online_config_t* config);
+void            online_free(online_t* online);
+
+double          online_update(online_t* online, double** X, double** y,
+                              size_t n);
+double          online_latency(const online_t* online, double quantile);
+
+#endif // ONLINE_H
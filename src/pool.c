@@ -0,0 +1,166 @@
+/**
+ * @file    pool.c
+ * @author  Philippe Bouchet (philippe.bouchet@epita.fr)
+ * @brief   Thread pool implementation.
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "pool.h"
+
+#include <err.h>
+#include <stdlib.h>
+
+#include "memory.h"
+
+typedef struct
+{
+    pool_t*     pool;
+    size_t      id;
+} pool_worker_t;
+
+/* Internal API forward declaration */
+
+static void*    _pool_worker(void* args);
+
+
+/* ==== POOL PUBLIC API ==== */
+
+
+/**
+ * @brief  Start n_workers threads. Each worker pins itself before running
+ *         any job, so memory it first touches lands on its own node.
+ *
+ * @param  n_workers Number of worker threads
+ * @param  affinity Placement policy of the workers
+ * @return pool_t* Pool
+ */
+pool_t* pool_init(size_t n_workers, affinity_t affinity)
+{
+    if (n_workers == 0)
+    {
+        errx(POOL_INVALID_SIZE,
+             "POOL::ERROR::INIT: "
+             "A pool needs at least one worker");
+    }
+
+    pool_t* pool = mem_calloc(1, sizeof(pool_t), MEM_NETWORK);
+
+    pool->n_workers = n_workers;
+    pool->threads = mem_calloc(n_workers, sizeof(pthread_t), MEM_NETWORK);
+    pool->cpus = mem_calloc(n_workers, sizeof(int), MEM_NETWORK);
+    pool->nodes = mem_calloc(n_workers, sizeof(int), MEM_NETWORK);
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start_cond, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+
+    for (size_t i = 0; i < n_workers; i++)
+    {
+        pool->cpus[i] = topo_cpu(affinity, i);
+        pool->nodes[i] = topo_node(pool->cpus[i]);
+
+        pool_worker_t* worker = malloc(sizeof(pool_worker_t));
+        worker->pool = pool;
+        worker->id = i;
+
+        pthread_create(&pool->threads[i], NULL, _pool_worker, worker);
+    }
+
+    return pool;
+}
+
+/**
+ * @brief Stop and join the workers, then free the pool
+ *
+ * @param pool Pool
+ */
+void pool_free(pool_t* pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->start_cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (size_t i = 0; i < pool->n_workers; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start_cond);
+    pthread_cond_destroy(&pool->done_cond);
+
+    mem_free(pool->threads);
+    mem_free(pool->cpus);
+    mem_free(pool->nodes);
+    mem_free(pool);
+}
+
+/**
+ * @brief Run job(args, worker) on every worker, and wait for all of them
+ *
+ * @param pool Pool
+ * @param job Job to run
+ * @param args Arguments shared by every worker
+ */
+void pool_run(pool_t* pool, pool_job_t job, void* args)
+{
+    pthread_mutex_lock(&pool->lock);
+
+    pool->job = job;
+    pool->args = args;
+    pool->running = pool->n_workers;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start_cond);
+
+    while (pool->running > 0)
+        pthread_cond_wait(&pool->done_cond, &pool->lock);
+
+    pthread_mutex_unlock(&pool->lock);
+}
+
+
+/* ==== POOL INTERNAL API ==== */
+
+
+/**
+ * @brief Worker thread: pin, then run every job of the pool
+ *
+ * @param args pool_worker_t, freed by the worker
+ */
+static void* _pool_worker(void* args)
+{
+    pool_worker_t* worker = args;
+    pool_t* pool = worker->pool;
+    size_t id = worker->id;
+    size_t generation = 0;
+
+    free(worker);
+    topo_bind(pool->cpus[id]);
+
+    pthread_mutex_lock(&pool->lock);
+
+    for (;;)
+    {
+        while (!pool->stop && pool->generation == generation)
+            pthread_cond_wait(&pool->start_cond, &pool->lock);
+
+        if (pool->stop)
+            break;
+
+        generation = pool->generation;
+        pool_job_t job = pool->job;
+        void* job_args = pool->args;
+
+        pthread_mutex_unlock(&pool->lock);
+        job(job_args, id);
+        pthread_mutex_lock(&pool->lock);
+
+        if (--pool->running == 0)
+            pthread_cond_signal(&pool->done_cond);
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
@@ -0,0 +1,45 @@
+/**
+ * @file    pool.h
+ * @author  Philippe Bouchet (philippe.bouchet@epita.fr)
+ * @brief   Fixed pool of worker threads, each pinned by an affinity
+ *          policy, running the same job in lockstep.
+ *          Public API functions denoted with "pool" prefix.
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <pthread.h>
+
+#include "topology.h"
+
+#define POOL_INVALID_SIZE   -1
+
+typedef void (*pool_job_t)(void* args, size_t worker);
+
+typedef struct
+{
+    size_t      n_workers;
+    pthread_t*  threads;
+    int*        cpus;        // CPU of each worker, -1 if unpinned
+    int*        nodes;       // NUMA node of each worker
+
+    pthread_mutex_t lock;
+    pthread_cond_t  start_cond;
+    pthread_cond_t  done_cond;
+
+    pool_job_t  job;
+    void*       args;
+    size_t      generation;  // Incremented for every job
+    size_t      running;     // Workers still running the current job
+    int         stop;
+} pool_t;
+
+pool_t* pool_init(size_t n_workers, affinity_t affinity);
+void    pool_free(pool_t* pool);
+void    pool_run(pool_t* pool, pool_job_t job, void* args);
+
+#endif // POOL_H
@@ -0,0 +1,248 @@
+/**
+ * @file    profile.c
+ * @author  Philippe Bouchet (philippe.bouchet@epita.fr)
+ * @brief   Instrumentation implementation. Empty unless DEEPSEA_PROFILE
+ *          is defined.
+ * 
+ * @copyright Copyright (c) 2022
+ * 
+ */
+
+#include "profile.h"
+
+#ifdef DEEPSEA_PROFILE
+
+#include <err.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+typedef struct
+{
+    size_t      calls;
+    double      time;
+    double      flops;
+    double      bytes;
+} prof_stat_t;
+
+typedef struct
+{
+    double      start;
+    double      end;
+    int         phase;
+    int         layer;
+    int         tid;
+} prof_event_t;
+
+static const char* phase_names[PROF_N_PHASES] = {
+    "shuffle", "load_batch", "feed_forward", "backprop",
+    "gradient", "update", "evaluate",
+};
+
+// Slot 0 holds events that are not tied to a layer
+static prof_stat_t      epoch_stats[PROF_N_PHASES][PROF_MAX_LAYERS + 1];
+static prof_stat_t      total_stats[PROF_N_PHASES][PROF_MAX_LAYERS + 1];
+
+static prof_event_t*    events = NULL;
+static size_t           n_events = 0;
+static size_t           dropped_events = 0;
+static double           origin = -1.f;
+
+static pthread_mutex_t  prof_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void _prof_add(prof_stat_t* stat, double time,
+                      double flops, double bytes);
+
+
+/* ==== PROFILE PUBLIC API ==== */
+
+
+/**
+ * @brief Record one timed section
+ * 
+ * @param phase Training phase of the section
+ * @param layer Layer index, or PROF_NO_LAYER
+ * @param start Start time, from get_time()
+ * @param end End time, from get_time()
+ * @param flops Floating point operations performed
+ * @param bytes Bytes read and written
+ */
+void prof_record(prof_phase_t phase, int layer, double start, double end,
+                 double flops, double bytes)
+{
+    int slot = layer < 0 || layer >= PROF_MAX_LAYERS ? 0 : layer + 1;
+
+    pthread_mutex_lock(&prof_lock);
+
+    if (origin < 0.f)
+        origin = start;
+
+    _prof_add(&epoch_stats[phase][slot], end - start, flops, bytes);
+    _prof_add(&total_stats[phase][slot], end - start, flops, bytes);
+
+    if (events == NULL)
+        events = malloc(PROF_MAX_EVENTS * sizeof(prof_event_t));
+
+    if (events != NULL && n_events < PROF_MAX_EVENTS)
+    {
+        prof_event_t* ev = &events[n_events++];
+
+        ev->start = start;
+        ev->end = end;
+        ev->phase = phase;
+        ev->layer = layer;
+        ev->tid = (int) syscall(SYS_gettid);
+    }
+
+    else
+        dropped_events++;
+
+    pthread_mutex_unlock(&prof_lock);
+}
+
+/**
+ * @brief Print the per-phase breakdown of the epoch that just ended, if
+ *        asked to, then reset the epoch counters. Called every epoch, so
+ *        that quiet runs do not carry counters over.
+ * 
+ * @param samples Samples processed during the epoch
+ * @param elapsed Wall time of the epoch in seconds
+ * @param print Whether to print the breakdown
+ */
+void prof_epoch_summary(size_t samples, double elapsed, int print)
+{
+    pthread_mutex_lock(&prof_lock);
+
+    if (!print)
+    {
+        memset(epoch_stats, 0, sizeof(epoch_stats));
+        pthread_mutex_unlock(&prof_lock);
+        return;
+    }
+
+    printf("\n    %-14s %8s %10s %7s %9s %9s\n",
+           "phase", "calls", "time (ms)", "%", "GFLOP/s", "GB/s");
+
+    for (int p = 0; p < PROF_N_PHASES; p++)
+    {
+        prof_stat_t sum = { 0, 0.f, 0.f, 0.f };
+
+        for (int l = 0; l <= PROF_MAX_LAYERS; l++)
+        {
+            prof_stat_t* s = &epoch_stats[p][l];
+            sum.calls += s->calls;
+            sum.time += s->time;
+            sum.flops += s->flops;
+            sum.bytes += s->bytes;
+        }
+
+        if (sum.calls == 0)
+            continue;
+
+        printf("    %-14s %8zu %10.2f %6.1f%% %9.2f %9.2f\n",
+               phase_names[p], sum.calls, sum.time * 1e3,
+               100.f * sum.time / elapsed,
+               sum.time > 0.f ? sum.flops / sum.time * 1e-9 : 0.f,
+               sum.time > 0.f ? sum.bytes / sum.time * 1e-9 : 0.f);
+
+        for (int l = 1; l <= PROF_MAX_LAYERS; l++)
+        {
+            prof_stat_t* s = &epoch_stats[p][l];
+
+            if (s->calls == 0)
+                continue;
+
+            printf("      layer %-6d %8zu %10.2f %6.1f%% %9.2f %9.2f\n",
+                   l - 1, s->calls, s->time * 1e3,
+                   100.f * s->time / elapsed,
+                   s->time > 0.f ? s->flops / s->time * 1e-9 : 0.f,
+                   s->time > 0.f ? s->bytes / s->time * 1e-9 : 0.f);
+        }
+    }
+
+    printf("    %zu samples in %.3f s [%.1f samples/s]\n\n",
+           samples, elapsed, samples / elapsed);
+
+    memset(epoch_stats, 0, sizeof(epoch_stats));
+
+    pthread_mutex_unlock(&prof_lock);
+}
+
+/**
+ * @brief Write every recorded section as a Chrome trace-event JSON file
+ *        (chrome://tracing, Perfetto), with the run totals in its metadata
+ * 
+ * @param path Output file
+ */
+void prof_dump_trace(const char* path)
+{
+    FILE* fp = fopen(path, "w");
+
+    if (fp == NULL)
+    {
+        warn("PROFILE::WARNING::TRACE: Could not open %s", path);
+        return;
+    }
+
+    pthread_mutex_lock(&prof_lock);
+
+    fprintf(fp, "{\"displayTimeUnit\": \"ms\",\n\"traceEvents\": [\n");
+
+    for (size_t i = 0; i < n_events; i++)
+    {
+        prof_event_t* ev = &events[i];
+
+        fprintf(fp, "{\"name\": \"%s\", \"cat\": \"deepsea\", \"ph\": \"X\", "
+                    "\"ts\": %.3f, \"dur\": %.3f, \"pid\": %d, \"tid\": %d, "
+                    "\"args\": {\"layer\": %d}}%s\n",
+                phase_names[ev->phase], (ev->start - origin) * 1e6,
+                (ev->end - ev->start) * 1e6, (int) getpid(), ev->tid,
+                ev->layer, i + 1 < n_events ? "," : "");
+    }
+
+    fprintf(fp, "],\n\"otherData\": {\"dropped_events\": %zu, "
+                "\"phases\": {", dropped_events);
+
+    for (int p = 0; p < PROF_N_PHASES; p++)
+    {
+        prof_stat_t sum = { 0, 0.f, 0.f, 0.f };
+
+        for (int l = 0; l <= PROF_MAX_LAYERS; l++)
+        {
+            prof_stat_t* s = &total_stats[p][l];
+            sum.calls += s->calls;
+            sum.time += s->time;
+            sum.flops += s->flops;
+            sum.bytes += s->bytes;
+        }
+
+        fprintf(fp, "%s\"%s\": {\"calls\": %zu, \"time_s\": %.6f, "
+                    "\"flops\": %.0f, \"bytes\": %.0f}",
+                p ? ", " : "", phase_names[p], sum.calls, sum.time,
+                sum.flops, sum.bytes);
+    }
+
+    fprintf(fp, "}}}\n");
+
+    pthread_mutex_unlock(&prof_lock);
+
+    fclose(fp);
+}
+
+
+/* ==== PROFILE INTERNAL API ==== */
+
+
+static void _prof_add(prof_stat_t* stat, double time,
+                      double flops, double bytes)
+{
+    stat->calls++;
+    stat->time += time;
+    stat->flops += flops;
+    stat->bytes += bytes;
+}
+
+#endif // DEEPSEA_PROFILE
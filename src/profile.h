@@ -0,0 +1,59 @@
+/**
+ * @file    profile.h
+ * @author  Philippe Bouchet (philippe.bouchet@epita.fr)
+ * @brief   Hot-path instrumentation: per-phase and per-layer timers,
+ *          call, FLOP and byte counters, exported as a Chrome trace.
+ *          Compiled in with -DDEEPSEA_PROFILE (make PROFILE=1), every
+ *          macro expands to nothing otherwise.
+ * 
+ * @copyright Copyright (c) 2022
+ * 
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#define PROF_MAX_LAYERS     64
+#define PROF_MAX_EVENTS     (1 << 20)
+#define PROF_NO_LAYER       -1
+
+typedef unsigned long size_t;
+
+typedef enum
+{
+    PROF_SHUFFLE,
+    PROF_LOAD_BATCH,
+    PROF_FEED_FORWARD,
+    PROF_BACKPROP,
+    PROF_GRADIENT,
+    PROF_UPDATE,
+    PROF_EVALUATE,
+    PROF_N_PHASES,
+} prof_phase_t;
+
+#ifdef DEEPSEA_PROFILE
+
+#include "utils.h"
+
+#define PROF_START(t)       double t = get_time()
+#define PROF_STOP(t, phase, layer, flops, bytes) \
+        prof_record(phase, layer, t, get_time(), flops, bytes)
+#define PROF_EPOCH_SUMMARY(samples, elapsed, print) \
+        prof_epoch_summary(samples, elapsed, print)
+#define PROF_DUMP_TRACE(path) prof_dump_trace(path)
+
+void    prof_record(prof_phase_t phase, int layer, double start, double end,
+                    double flops, double bytes);
+void    prof_epoch_summary(size_t samples, double elapsed, int print);
+void    prof_dump_trace(const char* path);
+
+#else
+
+#define PROF_START(t)
+#define PROF_STOP(t, phase, layer, flops, bytes)
+#define PROF_EPOCH_SUMMARY(samples, elapsed, print)
+#define PROF_DUMP_TRACE(path)
+
+#endif // DEEPSEA_PROFILE
+
+#endif // PROFILE_H
@@ -0,0 +1,578 @@
+/**
+ * @file    prune.c
+ * @author  Philippe Bouchet (philippe.bouchet@epita.fr)
+ * @brief   Pruning and CSR inference implementation.
+ * 
+ * @copyright Copyright (c) 2022
+ * 
+ */
+
+#include "prune.h"
+
+#include <err.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "memory.h"
+
+/* Internal API forward declaration */
+
+static int      _prune_cmp_double(const void* a, const void* b);
+static pruned_net_t* _pnet_alloc(size_t L, size_t max_batch);
+static void     _pnet_alloc_layer(pruned_net_t* pnet, size_t l, size_t n_in,
+                                  size_t n_out, size_t nnz);
+static void     _pnet_feed_forward(pruned_net_t* pnet);
+static void     _pnet_set_batch(pruned_net_t* pnet, size_t rows);
+static void     _pnet_read(int fd, void* dst, size_t size, const char* path);
+
+
+/* ==== PRUNE PUBLIC API ==== */
+
+
+/**
+ * @brief Zero the lowest magnitude weights of every dense layer, so that
+ *        each layer reaches the target sparsity. The network keeps a mask of
+ *        the surviving weights: further training (fine-tuning) with
+ *        net_fit leaves pruned weights at zero. Biases are not pruned.
+ * 
+ * @param net Trained network
+ * @param sparsity Fraction of weights to remove, in [0, 1)
+ */
+void net_prune(network_t* net, double sparsity)
+{
+    if (sparsity < 0.f || sparsity >= 1.f)
+    {
+        errx(PRUNE_INVALID_SPARSITY,
+             "PRUNE::ERROR::SPARSITY: "
+             "Invalid sparsity %f, expected [0, 1)", sparsity);
+    }
+
+    if (net->mask == NULL)
+    {
+        mem_category_t scope = mem_scope(MEM_PARAMS);
+        net->mask = mem_calloc(net->L, sizeof(matrix_t*), MEM_NETWORK);
+
+        for (size_t l = 0; l < net->L; l++)
+        {
+            net->mask[l] = m_init(net->w[l]->n_row, net->w[l]->n_col);
+            m_scalar_add(net->mask[l], 1.f, net->mask[l]);
+        }
+
+        mem_scope(scope);
+    }
+
+    for (size_t l = 0; l < net->L; l++)
+    {
+        matrix_t* w = net->w[l];
+        size_t k = (size_t) (sparsity * w->size);
+
+        if (k == 0)
+            continue;
+
+        double* mag = mem_malloc(w->size * sizeof(double), MEM_NETWORK);
+
+        for (size_t i = 0; i < w->size; i++)
+            mag[i] = fabs(w->array[i]);
+
+        qsort(mag, w->size, sizeof(double), _prune_cmp_double);
+        double threshold = mag[k - 1];
+        mem_free(mag);
+
+        for (size_t i = 0; i < w->size; i++)
+        {
+            if (fabs(w->array[i]) <= threshold)
+                net->mask[l]->array[i] = 0.f;
+        }
+
+        m_hadamard(w, net->mask[l], w);
+    }
+
+    net->w_sum_valid = 0;
+}
+
+/**
+ * @brief  Compress a (pruned) network into CSR layers. Only the non zero
+ *         weights are kept, grouped per output neuron.
+ * 
+ * @param  net Network to compress
+ * @param  max_batch Row capacity of the inference buffers
+ * @return pruned_net_t* Compressed network
+ */
+pruned_net_t* pnet_init(network_t* net, size_t max_batch)
+{
+    if (net->n_conv)
+    {
+        errx(PRUNE_UNSUPPORTED,
+             "PRUNE::ERROR::COMPRESS: "
+             "Convolution layers cannot be compressed");
+    }
+
+    pruned_net_t* pnet = _pnet_alloc(net->L, max_batch);
+
+    pnet->input_size = net->input_size;
+    pnet->output_size = net->output_size;
+
+    for (size_t l = 0; l < net->L; l++)
+    {
+        matrix_t* w = net->w[l];
+        size_t nnz = 0;
+
+        for (size_t i = 0; i < w->size; i++)
+            nnz += w->array[i] != 0.f;
+
+        _pnet_alloc_layer(pnet, l, w->n_row, w->n_col, nnz);
+
+        csr_layer_t* layer = &pnet->layers[l];
+        layer->act = net->act[l];
+        m_copy_dst(net->b[l], layer->b);
+
+        // Column j of w (column-major) holds the inputs of neuron j
+        size_t p = 0;
+
+        for (size_t j = 0; j < w->n_col; j++)
+        {
+            layer->row_ptr[j] = p;
+
+            for (size_t k = 0; k < w->n_row; k++)
+            {
+                double val = w->array[j * w->n_row + k];
+
+                if (val == 0.f)
+                    continue;
+
+                layer->col_idx[p] = k;
+                layer->val[p] = val;
+                p++;
+            }
+        }
+
+        layer->row_ptr[w->n_col] = p;
+    }
+
+    return pnet;
+}
+
+/**
+ * @brief Free the compressed network
+ * 
+ * @param pnet Compressed network
+ */
+void pnet_free(pruned_net_t* pnet)
+{
+    m_free(pnet->X);
+
+    for (size_t l = 0; l < pnet->L; l++)
+    {
+        csr_layer_t* layer = &pnet->layers[l];
+
+        mem_free(layer->row_ptr);
+        mem_free(layer->col_idx);
+        mem_free(layer->val);
+        m_free(layer->b);
+        m_free(pnet->z[l]);
+        m_free(pnet->a[l]);
+    }
+
+    mem_free(pnet->layers);
+    mem_free(pnet->z);
+    mem_free(pnet->a);
+    mem_free(pnet);
+}
+
+/**
+ * @brief  Load a compressed network saved by pnet_save
+ * 
+ * @param  path Path to the pruned network file
+ * @param  max_batch Row capacity of the inference buffers
+ * @return pruned_net_t* Compressed network
+ */
+pruned_net_t* pnet_load(const char* path, size_t max_batch)
+{
+    int fd = open(path, O_RDONLY);
+
+    if (fd == -1)
+    {
+        errx(PRUNE_FAILED_LOAD,
+             "PRUNE::ERROR::LOAD: "
+             "Invalid path %s", path);
+    }
+
+    unsigned int signature;
+    _pnet_read(fd, &signature, sizeof(int), path);
+
+    if (signature != PRUNE_SIGNATURE)
+    {
+        errx(PRUNE_FAILED_LOAD,
+             "PRUNE::ERROR::LOAD: "
+             "Invalid file format!");
+    }
+
+    size_t arr[3];
+    _pnet_read(fd, &arr, sizeof(size_t) * 3, path);
+
+    if (arr[0] == 0)
+    {
+        errx(PRUNE_FAILED_LOAD,
+             "PRUNE::ERROR::LOAD: "
+             "No layer in %s", path);
+    }
+
+    pruned_net_t* pnet = _pnet_alloc(arr[0], max_batch);
+
+    pnet->input_size = arr[1];
+    pnet->output_size = arr[2];
+
+    for (size_t l = 0; l < pnet->L; l++)
+    {
+        size_t shape[3];
+        unsigned int act;
+
+        _pnet_read(fd, &shape, sizeof(size_t) * 3, path);
+        _pnet_read(fd, &act, sizeof(int), path);
+
+        // Layers chain from input_size to output_size
+        size_t n_in = l == 0 ? pnet->input_size : pnet->layers[l - 1].n_out;
+
+        if (shape[0] != n_in || shape[1] == 0
+            || (l == pnet->L - 1 && shape[1] != pnet->output_size)
+            || shape[2] > shape[0] * shape[1])
+        {
+            errx(PRUNE_FAILED_LOAD,
+                 "PRUNE::ERROR::LOAD: "
+                 "Invalid shape %zux%zu (%zu non zero) for layer %zu",
+                 shape[0], shape[1], shape[2], l);
+        }
+
+        // Softmax is only dispatched on the output layer
+        if (act > ACT_SOFTMAX || (act == ACT_SOFTMAX && l != pnet->L - 1))
+        {
+            errx(PRUNE_FAILED_LOAD,
+                 "PRUNE::ERROR::LOAD: "
+                 "Invalid activation %u for layer %zu", act, l);
+        }
+
+        _pnet_alloc_layer(pnet, l, shape[0], shape[1], shape[2]);
+
+        csr_layer_t* layer = &pnet->layers[l];
+        layer->act = act;
+
+        _pnet_read(fd, layer->b->array, sizeof(double) * layer->n_out, path);
+        _pnet_read(fd, layer->row_ptr, sizeof(size_t) * (layer->n_out + 1),
+                   path);
+        _pnet_read(fd, layer->col_idx, sizeof(unsigned) * layer->nnz, path);
+        _pnet_read(fd, layer->val, sizeof(double) * layer->nnz, path);
+
+        // The SpMM kernel indexes with these unchecked
+        int valid = layer->row_ptr[0] == 0
+                 && layer->row_ptr[layer->n_out] == layer->nnz;
+
+        for (size_t j = 0; valid && j < layer->n_out; j++)
+            valid = layer->row_ptr[j] <= layer->row_ptr[j + 1];
+
+        for (size_t i = 0; valid && i < layer->nnz; i++)
+            valid = layer->col_idx[i] < layer->n_in;
+
+        if (!valid)
+        {
+            errx(PRUNE_FAILED_LOAD,
+                 "PRUNE::ERROR::LOAD: "
+                 "Invalid sparse indices in layer %zu", l);
+        }
+    }
+
+    close(fd);
+
+    return pnet;
+}
+
+/**
+ * @brief Save the compressed network. Only the non zero weights and
+ *        their indices are written.
+ * 
+ * @param pnet Compressed network
+ * @param dst File to save the network to
+ */
+void pnet_save(pruned_net_t* pnet, const char* dst)
+{
+    FILE* fp = fopen(dst, "w+");
+
+    unsigned int signature = PRUNE_SIGNATURE;
+    fwrite(&signature, sizeof(int), 1, fp);
+
+    size_t arr[3] = { pnet->L, pnet->input_size, pnet->output_size };
+    fwrite(&arr, sizeof(size_t), 3, fp);
+
+    for (size_t l = 0; l < pnet->L; l++)
+    {
+        csr_layer_t* layer = &pnet->layers[l];
+        size_t shape[3] = { layer->n_in, layer->n_out, layer->nnz };
+        unsigned int act = layer->act;
+
+        fwrite(&shape, sizeof(size_t), 3, fp);
+        fwrite(&act, sizeof(int), 1, fp);
+
+        fwrite(layer->b->array, sizeof(double), layer->n_out, fp);
+        fwrite(layer->row_ptr, sizeof(size_t), layer->n_out + 1, fp);
+        fwrite(layer->col_idx, sizeof(unsigned), layer->nnz, fp);
+        fwrite(layer->val, sizeof(double), layer->nnz, fp);
+    }
+
+    fclose(fp);
+}
+
+/**
+ * @param  pnet Compressed network
+ * @return double Fraction of zero weights over the whole network
+ */
+double pnet_sparsity(pruned_net_t* pnet)
+{
+    size_t nnz = 0;
+    size_t total = 0;
+
+    for (size_t l = 0; l < pnet->L; l++)
+    {
+        nnz += pnet->layers[l].nnz;
+        total += pnet->layers[l].n_in * pnet->layers[l].n_out;
+    }
+
+    return 1.f - (double) nnz / total;
+}
+
+/**
+ * @brief Batched inference: predict the outputs of n samples
+ * 
+ * @param pnet Compressed network
+ * @param X Array of n inputs of input_size values
+ * @param n Number of samples
+ * @param y Output, n rows of output_size values (row-major)
+ */
+void pnet_predict_batch(pruned_net_t* pnet, double** X, size_t n, double* y)
+{
+    for (size_t p = 0; p < n; p += pnet->max_batch)
+    {
+        size_t len = n - p;
+
+        if (len > pnet->max_batch)
+            len = pnet->max_batch;
+
+        _pnet_set_batch(pnet, len);
+
+        for (size_t i = 0; i < len; i++)
+        {
+            for (size_t k = 0; k < pnet->input_size; k++)
+                pnet->X->array[k * len + i] = X[p + i][k];
+        }
+
+        _pnet_feed_forward(pnet);
+
+        matrix_t* a = pnet->a[pnet->L - 1];
+
+        for (size_t i = 0; i < len; i++)
+        {
+            for (size_t j = 0; j < pnet->output_size; j++)
+                y[(p + i) * pnet->output_size + j] = a->array[j * len + i];
+        }
+    }
+}
+
+/**
+ * @brief  Fraction of samples whose strongest output matches the
+ *         expected class
+ * 
+ * @param  pnet Compressed network
+ * @param  dataset Dataset to evaluate
+ * @return double Accuracy in [0, 1]
+ */
+double pnet_accuracy(pruned_net_t* pnet, dataset_t* dataset)
+{
+    size_t correct = 0;
+    size_t n_out = pnet->output_size;
+    double* y = mem_malloc(pnet->max_batch * n_out * sizeof(double),
+                           MEM_NETWORK);
+
+    for (size_t p = 0; p < dataset->n; p += pnet->max_batch)
+    {
+        size_t len = dataset->n - p;
+
+        if (len > pnet->max_batch)
+            len = pnet->max_batch;
+
+        pnet_predict_batch(pnet, dataset->X + p, len, y);
+
+        for (size_t i = 0; i < len; i++)
+        {
+            size_t pred = 0;
+            size_t expected = 0;
+
+            for (size_t j = 1; j < n_out; j++)
+            {
+                if (y[i * n_out + j] > y[i * n_out + pred])
+                    pred = j;
+
+                if (dataset->y[p + i][j] > dataset->y[p + i][expected])
+                    expected = j;
+            }
+
+            correct += pred == expected;
+        }
+    }
+
+    mem_free(y);
+
+    return (double) correct / dataset->n;
+}
+
+
+/* ==== PRUNE INTERNAL API ==== */
+
+
+static int _prune_cmp_double(const void* a, const void* b)
+{
+    double x = *(const double*) a;
+    double y = *(const double*) b;
+
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief  Allocate a compressed network of L layers, without its layers
+ * 
+ * @param  L Number of layers
+ * @param  max_batch Row capacity of the inference buffers
+ * @return pruned_net_t* Compressed network
+ */
+static pruned_net_t* _pnet_alloc(size_t L, size_t max_batch)
+{
+    pruned_net_t* pnet = mem_malloc(sizeof(pruned_net_t), MEM_NETWORK);
+
+    pnet->L = L;
+    pnet->max_batch = max_batch ? max_batch : NETWORK_EVAL_BATCH;
+    pnet->X = NULL;
+    pnet->layers = mem_calloc(L, sizeof(csr_layer_t), MEM_NETWORK);
+    pnet->z = mem_calloc(L, sizeof(matrix_t*), MEM_NETWORK);
+    pnet->a = mem_calloc(L, sizeof(matrix_t*), MEM_NETWORK);
+
+    return pnet;
+}
+
+/**
+ * @brief Allocate layer l of a compressed network, and its buffers
+ * 
+ * @param pnet Compressed network
+ * @param l Layer index
+ * @param n_in Number of inputs
+ * @param n_out Number of neurons
+ * @param nnz Number of non zero weights
+ */
+static void _pnet_alloc_layer(pruned_net_t* pnet, size_t l, size_t n_in,
+                              size_t n_out, size_t nnz)
+{
+    csr_layer_t* layer = &pnet->layers[l];
+    mem_category_t scope = mem_scope(MEM_PARAMS);
+
+    layer->n_in = n_in;
+    layer->n_out = n_out;
+    layer->nnz = nnz;
+    layer->row_ptr = mem_calloc(n_out + 1, sizeof(size_t), MEM_PARAMS);
+    layer->col_idx = mem_calloc(nnz, sizeof(unsigned), MEM_PARAMS);
+    layer->val = mem_calloc(nnz, sizeof(double), MEM_PARAMS);
+    layer->b = m_init(1, n_out);
+
+    mem_scope(MEM_ACTIVATIONS);
+
+    if (l == 0)
+        pnet->X = m_init(pnet->max_batch, n_in);
+
+    pnet->z[l] = m_init(pnet->max_batch, n_out);
+    pnet->a[l] = m_init(pnet->max_batch, n_out);
+
+    mem_scope(scope);
+}
+
+/**
+ * @brief Sparse feed forward (SpMM): for each neuron, only the inputs
+ *        with a non zero weight are read. Activations are column-major,
+ *        so each non zero weight scales a contiguous column of the batch.
+ * 
+ * @param pnet Compressed network
+ */
+static void _pnet_feed_forward(pruned_net_t* pnet)
+{
+    size_t R = pnet->X->n_row;
+
+    for (size_t l = 0; l < pnet->L; l++)
+    {
+        csr_layer_t* layer = &pnet->layers[l];
+        matrix_t* a = l == 0 ? pnet->X : pnet->a[l - 1];
+        matrix_t* z = pnet->z[l];
+
+        for (size_t j = 0; j < layer->n_out; j++)
+        {
+            double* z_j = z->array + j * R;
+            double b = layer->b->array[j];
+
+            for (size_t i = 0; i < R; i++)
+                z_j[i] = b;
+
+            for (size_t p = layer->row_ptr[j]; p < layer->row_ptr[j + 1]; p++)
+            {
+                double w = layer->val[p];
+                double* a_k = a->array + layer->col_idx[p] * R;
+
+                for (size_t i = 0; i < R; i++)
+                    z_j[i] += w * a_k[i];
+            }
+        }
+
+        net_activate(layer->act, z, pnet->a[l]);
+    }
+}
+
+/**
+ * @brief Resize the batched buffers to hold rows samples
+ * 
+ * @param pnet Compressed network
+ * @param rows Number of samples in the batch
+ */
+static void _pnet_set_batch(pruned_net_t* pnet, size_t rows)
+{
+    m_reshape(pnet->X, rows, pnet->X->n_col);
+
+    for (size_t l = 0; l < pnet->L; l++)
+    {
+        m_reshape(pnet->z[l], rows, pnet->z[l]->n_col);
+        m_reshape(pnet->a[l], rows, pnet->a[l]->n_col);
+    }
+}
+
+/**
+ * @brief Read exactly size bytes of a pruned network file
+ * 
+ * @param fd File descriptor
+ * @param dst Destination
+ * @param size Amount of bytes
+ * @param path Path of the file, for the error message
+ */
+static void _pnet_read(int fd, void* dst, size_t size, const char* path)
+{
+    char* buf = dst;
+
+    while (size > 0)
+    {
+        ssize_t n = read(fd, buf, size);
+
+        if (n <= 0)
+        {
+            errx(PRUNE_FAILED_LOAD,
+                 "PRUNE::ERROR::LOAD: "
+                 "Truncated file %s", path);
+        }
+
+        buf += n;
+        size -= n;
+    }
+}
@@ -0,0 +1,60 @@
+/**
+ * @file    prune.h
+ * @author  Philippe Bouchet (philippe.bouchet@epita.fr)
+ * @brief   Magnitude pruning of a trained network, and a compressed
+ *          sparse row (CSR) inference engine for the pruned model.
+ * 
+ * @copyright Copyright (c) 2022
+ * 
+ */
+
+#ifndef PRUNE_H
+#define PRUNE_H
+
+#include "network.h"
+
+#define PRUNE_INVALID_SPARSITY  -1
+#define PRUNE_FAILED_LOAD       -2
+#define PRUNE_UNSUPPORTED       -3
+
+#define PRUNE_SIGNATURE         0xDEADBEF2  // Pruned (CSR) network file
+
+typedef struct
+{
+    size_t      n_in;
+    size_t      n_out;
+    size_t      nnz;         // Non zero weights
+    size_t*     row_ptr;     // n_out + 1 offsets into col_idx / val
+    unsigned*   col_idx;     // Input index of each non zero weight
+    double*     val;         // Non zero weights, grouped per output neuron
+    matrix_t*   b;           // Biases (1, n_out)
+    activation_t act;
+} csr_layer_t;
+
+typedef struct
+{
+    size_t      L;
+    size_t      input_size;
+    size_t      output_size;
+    size_t      max_batch;   // Row capacity of the batched buffers
+
+    csr_layer_t* layers;
+    matrix_t*   X;           // Input batch
+    matrix_t**  z;           // Pre activated batch of each layer
+    matrix_t**  a;           // Activated batch of each layer
+} pruned_net_t;
+
+void            net_prune(network_t* net, double sparsity);
+
+pruned_net_t*   pnet_init(network_t* net, size_t max_batch);
+void            pnet_free(pruned_net_t* pnet);
+
+pruned_net_t*   pnet_load(const char* path, size_t max_batch);
+void            pnet_save(pruned_net_t* pnet, const char* dst);
+
+double          pnet_sparsity(pruned_net_t* pnet);
+void            pnet_predict_batch(pruned_net_t* pnet, double** X, size_t n,
+                                   double* y);
+double          pnet_accuracy(pruned_net_t* pnet, dataset_t* dataset);
+
+#endif // PRUNE_H
@@ -0,0 +1,147 @@
+/**
+ * @file    queue.c
+ * @author  Philippe Bouchet (philippe.bouchet@epita.fr)
+ * @brief   Lock-free single-producer / single-consumer queue implementation.
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "queue.h"
+
+#include <err.h>
+#include <sched.h>
+
+#include "memory.h"
+
+/* Internal API forward declaration */
+
+static void     _queue_wait(size_t* spins);
+
+
+/* ==== QUEUE PUBLIC API ==== */
+
+
+/**
+ * @brief  Empty queue of capacity pointers
+ *
+ * @param  capacity Number of slots, a non zero power of two
+ * @return queue_t* Queue
+ */
+queue_t* queue_init(size_t capacity)
+{
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0)
+    {
+        errx(QUEUE_INVALID_CAPACITY,
+             "QUEUE::ERROR::INIT: "
+             "Capacity %zu is not a power of two", capacity);
+    }
+
+    // Line aligned, so that head and tail each own a whole line
+    queue_t* queue = mem_aligned(sizeof(queue_t), QUEUE_LINE, MEM_NETWORK);
+
+    queue->slots = mem_calloc(capacity, sizeof(void*), MEM_NETWORK);
+    queue->mask = capacity - 1;
+
+    return queue;
+}
+
+/**
+ * @param queue Queue to free, its items are not
+ */
+void queue_free(queue_t* queue)
+{
+    mem_free(queue->slots);
+    mem_free(queue);
+}
+
+/**
+ * @brief  Producer side: append an item. The release store of tail
+ *         publishes the item, and everything written before the push,
+ *         to the consumer.
+ *
+ * @param  queue Queue
+ * @param  item Item to append
+ * @return int 1 if appended, 0 if the queue is full
+ */
+int queue_push(queue_t* queue, void* item)
+{
+    size_t tail = queue->tail;
+    size_t head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+
+    if (tail - head > queue->mask)
+        return 0;
+
+    queue->slots[tail & queue->mask] = item;
+    __atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+
+    return 1;
+}
+
+/**
+ * @brief  Consumer side: remove the oldest item
+ *
+ * @param  queue Queue
+ * @return void* Oldest item, NULL if the queue is empty
+ */
+void* queue_pop(queue_t* queue)
+{
+    size_t head = queue->head;
+    size_t tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+
+    if (head == tail)
+        return NULL;
+
+    void* item = queue->slots[head & queue->mask];
+    __atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+
+    return item;
+}
+
+/**
+ * @brief Blocking queue_push: wait while the queue is full
+ *
+ * @param queue Queue
+ * @param item Item to append
+ */
+void queue_put(queue_t* queue, void* item)
+{
+    size_t spins = 0;
+
+    while (!queue_push(queue, item))
+        _queue_wait(&spins);
+}
+
+/**
+ * @brief  Blocking queue_pop: wait while the queue is empty
+ *
+ * @param  queue Queue
+ * @return void* Oldest item, NULL items cannot be told apart from waiting
+ */
+void* queue_take(queue_t* queue)
+{
+    size_t spins = 0;
+    void* item;
+
+    while ((item = queue_pop(queue)) == NULL)
+        _queue_wait(&spins);
+
+    return item;
+}
+
+
+/* ==== QUEUE INTERNAL API ==== */
+
+
+/**
+ * @brief Poll QUEUE_SPINS times, then give the CPU away between polls, so
+ *        that waiting stages do not starve the others of an oversubscribed
+ *        machine
+ *
+ * @param spins Polls so far
+ */
+static void _queue_wait(size_t* spins)
+{
+    if (++*spins >= QUEUE_SPINS)
+        sched_yield();
+}
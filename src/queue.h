@@ -0,0 +1,45 @@
+/**
+ * @file    queue.h
+ * @author  Philippe Bouchet (philippe.bouchet@epita.fr)
+ * @brief   Lock-free single-producer / single-consumer queue of pointers.
+ *          One thread pushes, one other thread pops; neither ever takes a
+ *          lock. The two indices live on their own cache lines, so the
+ *          producer and the consumer only share a line when an item moves.
+ *          Public API functions denoted with "queue" prefix.
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#define QUEUE_INVALID_CAPACITY  -1
+
+#define QUEUE_LINE              64      // Bytes of a cache line
+#define QUEUE_SPINS             1024    // Polls before yielding the CPU
+
+typedef unsigned long size_t;
+
+typedef struct
+{
+    void**      slots;       // capacity entries, capacity a power of two
+    size_t      mask;        // capacity - 1
+    char        pad0[QUEUE_LINE - sizeof(void**) - sizeof(size_t)];
+
+    size_t      head;        // Next slot to pop, written by the consumer
+    char        pad1[QUEUE_LINE - sizeof(size_t)];
+
+    size_t      tail;        // Next slot to push, written by the producer
+    char        pad2[QUEUE_LINE - sizeof(size_t)];
+} queue_t;
+
+queue_t*    queue_init(size_t capacity);
+void        queue_free(queue_t* queue);
+
+int         queue_push(queue_t* queue, void* item);
+void*       queue_pop(queue_t* queue);
+void        queue_put(queue_t* queue, void* item);
+void*       queue_take(queue_t* queue);
+
+#endif // QUEUE_H
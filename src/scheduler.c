@@ -0,0 +1,93 @@
+/**
+ * @file    scheduler.c
+ * @author  Philippe Bouchet (philippe.bouchet@epita.fr)
+ * @brief   Mini-batch scheduler implementation.
+ * 
+ * @copyright Copyright (c) 2022
+ * 
+ */
+
+#include "scheduler.h"
+
+#include <err.h>
+#include <stdlib.h>
+
+
+/* ==== SCHEDULER PUBLIC API ==== */
+
+
+/**
+ * @brief Initialize a scheduler over n samples
+ * 
+ * @param n Number of samples in an epoch
+ * @param batch_size Number of samples per micro-batch
+ * @param drop_last If non zero, the trailing partial batch is dropped,
+ *                  otherwise it is scheduled with fewer samples
+ * @return scheduler_t* Pointer to the initialized scheduler
+ */
+scheduler_t* sched_init(size_t n, size_t batch_size, int drop_last)
+{
+    if (batch_size == 0 || (drop_last && batch_size > n))
+    {
+        errx(SCHEDULER_INVALID_BATCH,
+             "SCHEDULER::ERROR::INIT: "
+             "Invalid batch size %zu for %zu samples",
+             batch_size, n);
+    }
+
+    scheduler_t* sched = malloc(sizeof(scheduler_t));
+
+    sched->n = n;
+    sched->batch_size = batch_size;
+    sched->n_batches = n / batch_size;
+    sched->cursor = 0;
+
+    if (!drop_last && n % batch_size != 0)
+        sched->n_batches++;
+
+    return sched;
+}
+
+/**
+ * @brief Free the scheduler
+ * 
+ * @param sched Scheduler struct
+ */
+void sched_free(scheduler_t* sched)
+{
+    free(sched);
+}
+
+/**
+ * @brief Rewind the scheduler to the start of a new epoch
+ * 
+ * @param sched Scheduler struct
+ */
+void sched_reset(scheduler_t* sched)
+{
+    sched->cursor = 0;
+}
+
+/**
+ * @brief  Get the next micro-batch of the epoch
+ * 
+ * @param  sched Scheduler struct
+ * @param  start Index of the first sample of the batch
+ * @param  len Number of samples in the batch
+ * @return int 1 if a batch was scheduled, 0 once the epoch is exhausted
+ */
+int sched_next(scheduler_t* sched, size_t* start, size_t* len)
+{
+    if (sched->cursor >= sched->n_batches)
+        return 0;
+
+    *start = sched->cursor * sched->batch_size;
+    *len = sched->batch_size;
+
+    if (*start + *len > sched->n)
+        *len = sched->n - *start;
+
+    sched->cursor++;
+
+    return 1;
+}
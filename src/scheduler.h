@@ -0,0 +1,32 @@
+/**
+ * @file    scheduler.h
+ * @author  Philippe Bouchet (philippe.bouchet@epita.fr)
+ * @brief   Mini-batch scheduler. Splits an epoch into disjoint batches.
+ * 
+ * @copyright Copyright (c) 2022
+ * 
+ */
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#define SCHEDULER_INVALID_BATCH -1
+
+typedef unsigned long size_t;
+
+typedef struct
+__attribute__((packed, aligned(1)))
+{
+    size_t      n;           // Number of samples in an epoch
+    size_t      batch_size;  // Samples per micro-batch
+    size_t      n_batches;   // Micro-batches per epoch
+    size_t      cursor;      // Next micro-batch to hand out
+} scheduler_t;
+
+scheduler_t*    sched_init(size_t n, size_t batch_size, int drop_last);
+void            sched_free(scheduler_t* sched);
+
+void            sched_reset(scheduler_t* sched);
+int             sched_next(scheduler_t* sched, size_t* start, size_t* len);
+
+#endif // SCHEDULER_H
@@ -0,0 +1,598 @@
+/**
+ * @file    server.c
+ * @author  Philippe Bouchet (philippe.bouchet@epita.fr)
+ * @brief   Inference server implementation. Each connection is read by
+ *          its own thread, which queues its predictions; worker threads
+ *          drain the queue in batches of up to max_batch requests, waiting
+ *          at most max_wait for a batch to fill.
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "server.h"
+
+#include <err.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "memory.h"
+#include "utils.h"
+
+typedef struct
+{
+    server_t*   srv;
+    size_t      id;
+} srv_worker_t;
+
+typedef struct
+{
+    server_t*   srv;
+    int         fd;
+} srv_conn_t;
+
+/* Internal API forward declaration */
+
+static void*    _srv_worker(void* args);
+static void*    _srv_connection(void* args);
+static int      _srv_read_all(int fd, void* buf, size_t len);
+static int      _srv_write_all(int fd, const void* buf, size_t len);
+static void     _srv_predict(server_t* srv, srv_request_t* req);
+static void     _srv_deadline(double t, struct timespec* ts);
+static void     _srv_add_conn(server_t* srv, int fd);
+static void     _srv_remove_conn(server_t* srv, int fd);
+static int      _srv_cmp_double(const void* a, const void* b);
+
+
+/* ==== SERVER PUBLIC API ==== */
+
+
+/**
+ * @return srv_config_t Batches of up to 32 requests, waiting at most 1ms,
+ *         with one worker per online CPU
+ */
+srv_config_t srv_config_default(void)
+{
+    long n_cpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+    srv_config_t config =
+    {
+        .max_batch = 32,
+        .max_wait = 1e-3,
+        .n_workers = n_cpu > 0 ? n_cpu : 1,
+    };
+
+    return config;
+}
+
+/**
+ * @brief  Bind the server socket and start the worker threads. Each
+ *         worker runs its forward passes through its own inference
+ *         context, on one model copied from net.
+ *
+ * @param  net Network to serve
+ * @param  path Path of the Unix domain socket, replaced if it exists
+ * @param  config Batching and worker configuration
+ * @return server_t* Server, ready for srv_run
+ */
+server_t* srv_init(network_t* net, const char* path, srv_config_t* config)
+{
+    if (config->max_batch == 0 || config->n_workers == 0)
+    {
+        errx(SERVER_INVALID_CONFIG,
+             "SERVER::ERROR::CONFIG: "
+             "max_batch and n_workers must be positive");
+    }
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        errx(SERVER_INVALID_CONFIG,
+             "SERVER::ERROR::CONFIG: "
+             "Socket path too long: %s", path);
+    }
+
+    strcpy(addr.sun_path, path);
+    unlink(path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (fd == -1
+        || bind(fd, (struct sockaddr*) &addr, sizeof(addr)) == -1
+        || listen(fd, SERVER_MAX_CONNECTIONS) == -1)
+    {
+        err(SERVER_FAILED_SOCKET,
+            "SERVER::ERROR::SOCKET: "
+            "Could not listen on %s", path);
+    }
+
+    server_t* srv = mem_calloc(1, sizeof(server_t), MEM_NETWORK);
+
+    srv->model = model_init(net);
+    srv->config = *config;
+    srv->path = path;
+    srv->fd = fd;
+    srv->running = 1;
+    srv->start = get_time();
+
+    pthread_mutex_init(&srv->lock, NULL);
+    pthread_cond_init(&srv->queue_cond, NULL);
+    pthread_cond_init(&srv->conn_cond, NULL);
+
+    srv->ctxs = mem_calloc(config->n_workers, sizeof(model_ctx_t*),
+                           MEM_NETWORK);
+    srv->workers = mem_calloc(config->n_workers, sizeof(pthread_t),
+                              MEM_NETWORK);
+
+    for (size_t i = 0; i < config->n_workers; i++)
+    {
+        srv->ctxs[i] = model_ctx_init(srv->model, config->max_batch);
+
+        srv_worker_t* worker = malloc(sizeof(srv_worker_t));
+        worker->srv = srv;
+        worker->id = i;
+
+        pthread_create(&srv->workers[i], NULL, _srv_worker, worker);
+    }
+
+    return srv;
+}
+
+/**
+ * @brief Free a server stopped by srv_run returning, and remove its socket
+ *
+ * @param srv Server
+ */
+void srv_free(server_t* srv)
+{
+    close(srv->fd);
+    unlink(srv->path);
+
+    for (size_t i = 0; i < srv->config.n_workers; i++)
+        model_ctx_free(srv->ctxs[i]);
+
+    model_free(srv->model);
+
+    pthread_mutex_destroy(&srv->lock);
+    pthread_cond_destroy(&srv->queue_cond);
+    pthread_cond_destroy(&srv->conn_cond);
+
+    mem_free(srv->ctxs);
+    mem_free(srv->workers);
+    mem_free(srv);
+}
+
+/**
+ * @brief Accept connections until srv_stop is called. Open connections are
+ *        then shut down, their pending requests answered, and the workers
+ *        joined before returning.
+ *
+ * @param srv Server
+ */
+void srv_run(server_t* srv)
+{
+    struct pollfd pfd = { .fd = srv->fd, .events = POLLIN };
+
+    while (srv->running)
+    {
+        // Wake up regularly to notice srv_stop
+        if (poll(&pfd, 1, 100) <= 0)
+            continue;
+
+        int fd = accept(srv->fd, NULL, NULL);
+
+        if (fd == -1)
+            continue;
+
+        pthread_mutex_lock(&srv->lock);
+
+        if (srv->n_conns == SERVER_MAX_CONNECTIONS)
+        {
+            pthread_mutex_unlock(&srv->lock);
+            close(fd);
+            continue;
+        }
+
+        _srv_add_conn(srv, fd);
+        srv->connections++;
+        pthread_mutex_unlock(&srv->lock);
+
+        srv_conn_t* conn = malloc(sizeof(srv_conn_t));
+        conn->srv = srv;
+        conn->fd = fd;
+
+        pthread_t thread;
+        pthread_create(&thread, NULL, _srv_connection, conn);
+        pthread_detach(thread);
+    }
+
+    pthread_mutex_lock(&srv->lock);
+
+    for (size_t i = 0; i < srv->n_conns; i++)
+        shutdown(srv->conns[i], SHUT_RDWR);
+
+    while (srv->n_conns > 0)
+        pthread_cond_wait(&srv->conn_cond, &srv->lock);
+
+    srv->stopping = 1;
+    pthread_cond_broadcast(&srv->queue_cond);
+    pthread_mutex_unlock(&srv->lock);
+
+    for (size_t i = 0; i < srv->config.n_workers; i++)
+        pthread_join(srv->workers[i], NULL);
+}
+
+/**
+ * @brief Make srv_run return. Only writes a flag, so it may be called
+ *        from a signal handler.
+ *
+ * @param srv Server
+ */
+void srv_stop(server_t* srv)
+{
+    srv->running = 0;
+}
+
+/**
+ * @param  srv Server
+ * @return srv_stats_t Counters since start, and latency percentiles
+ */
+srv_stats_t srv_stats(server_t* srv)
+{
+    srv_stats_t stats;
+    double lat[SERVER_LATENCY_WINDOW];
+
+    pthread_mutex_lock(&srv->lock);
+
+    size_t n = srv->requests < SERVER_LATENCY_WINDOW
+             ? srv->requests : SERVER_LATENCY_WINDOW;
+
+    memcpy(lat, srv->latency, n * sizeof(double));
+
+    stats.requests = srv->requests;
+    stats.batches = srv->batches;
+    stats.connections = srv->connections;
+
+    pthread_mutex_unlock(&srv->lock);
+
+    qsort(lat, n, sizeof(double), _srv_cmp_double);
+
+    stats.uptime = get_time() - srv->start;
+    stats.throughput = stats.requests / stats.uptime;
+    stats.mean_batch = stats.batches
+                     ? (double) stats.requests / stats.batches : 0.f;
+    stats.p50_us = n ? lat[n / 2] * 1e6 : 0.f;
+    stats.p99_us = n ? lat[n * 99 / 100] * 1e6 : 0.f;
+
+    return stats;
+}
+
+
+/* ==== SERVER INTERNAL API ==== */
+
+
+/**
+ * @brief Worker thread: wait for the oldest pending request to either have
+ *        max_batch - 1 followers or reach max_wait, then run the whole batch
+ *        through one forward pass
+ *
+ * @param args srv_worker_t, freed by the worker
+ */
+static void* _srv_worker(void* args)
+{
+    srv_worker_t* worker = args;
+    server_t* srv = worker->srv;
+    model_ctx_t* ctx = srv->ctxs[worker->id];
+    size_t max_batch = srv->config.max_batch;
+    size_t n_out = srv->model->output_size;
+
+    free(worker);
+
+    double** X = malloc(max_batch * sizeof(double*));
+    double* y = malloc(max_batch * n_out * sizeof(double));
+    srv_request_t** batch = malloc(max_batch * sizeof(srv_request_t*));
+
+    pthread_mutex_lock(&srv->lock);
+
+    for (;;)
+    {
+        while (!srv->stopping && srv->pending == 0)
+            pthread_cond_wait(&srv->queue_cond, &srv->lock);
+
+        if (srv->pending == 0)
+            break;
+
+        struct timespec deadline;
+        _srv_deadline(srv->head->arrival + srv->config.max_wait, &deadline);
+
+        while (!srv->stopping && srv->pending > 0
+               && srv->pending < max_batch)
+        {
+            if (pthread_cond_timedwait(&srv->queue_cond, &srv->lock,
+                                       &deadline) == ETIMEDOUT)
+                break;
+        }
+
+        // Another worker may have taken the batch meanwhile
+        if (srv->pending == 0)
+            continue;
+
+        size_t n = 0;
+
+        while (n < max_batch && srv->head != NULL)
+        {
+            batch[n] = srv->head;
+            X[n] = srv->head->X;
+            srv->head = srv->head->next;
+            n++;
+        }
+
+        if (srv->head == NULL)
+            srv->tail = NULL;
+
+        srv->pending -= n;
+
+        // Leftovers start their own batch in another worker
+        if (srv->pending > 0)
+            pthread_cond_signal(&srv->queue_cond);
+
+        pthread_mutex_unlock(&srv->lock);
+
+        model_predict_batch(ctx, X, n, y);
+
+        double now = get_time();
+
+        pthread_mutex_lock(&srv->lock);
+
+        for (size_t i = 0; i < n; i++)
+        {
+            srv_request_t* req = batch[i];
+            double* out = y + i * n_out;
+
+            req->argmax = 0;
+
+            for (size_t j = 0; j < n_out; j++)
+            {
+                req->y[j] = out[j];
+
+                if (out[j] > out[req->argmax])
+                    req->argmax = j;
+            }
+
+            srv->latency[srv->requests % SERVER_LATENCY_WINDOW]
+                = now - req->arrival;
+            srv->requests++;
+
+            req->done = 1;
+            pthread_cond_signal(&req->cond);
+        }
+
+        srv->batches++;
+    }
+
+    pthread_mutex_unlock(&srv->lock);
+
+    free(X);
+    free(y);
+    free(batch);
+
+    return NULL;
+}
+
+/**
+ * @brief Connection thread: answer requests until the peer disconnects or
+ *        sends a malformed request
+ *
+ * @param args srv_conn_t, freed by the thread
+ */
+static void* _srv_connection(void* args)
+{
+    srv_conn_t* conn = args;
+    server_t* srv = conn->srv;
+    int fd = conn->fd;
+    model_t* model = srv->model;
+
+    free(conn);
+
+    srv_request_t req;
+    req.X = malloc(model->input_size * sizeof(double));
+    req.y = malloc(model->output_size * sizeof(double));
+    pthread_cond_init(&req.cond, NULL);
+
+    srv_header_t header;
+
+    while (_srv_read_all(fd, &header, sizeof(header)) == 0
+           && header.magic == SERVER_MAGIC)
+    {
+        if (header.type == SRV_INFO)
+        {
+            srv_info_t info =
+            {
+                .input_size = model->input_size,
+                .output_size = model->output_size,
+                .max_batch = srv->config.max_batch,
+            };
+
+            if (_srv_write_all(fd, &info, sizeof(info)))
+                break;
+        }
+
+        else if (header.type == SRV_PREDICT)
+        {
+            if (_srv_read_all(fd, req.X, model->input_size * sizeof(double)))
+                break;
+
+            _srv_predict(srv, &req);
+
+            srv_reply_t reply = { .status = 0, .argmax = req.argmax };
+
+            if (_srv_write_all(fd, &reply, sizeof(reply))
+                || _srv_write_all(fd, req.y,
+                                  model->output_size * sizeof(double)))
+                break;
+        }
+
+        else if (header.type == SRV_STATS)
+        {
+            srv_stats_t stats = srv_stats(srv);
+
+            if (_srv_write_all(fd, &stats, sizeof(stats)))
+                break;
+        }
+
+        else
+            break;
+    }
+
+    pthread_cond_destroy(&req.cond);
+    free(req.X);
+    free(req.y);
+
+    pthread_mutex_lock(&srv->lock);
+    _srv_remove_conn(srv, fd);
+    pthread_cond_signal(&srv->conn_cond);
+    pthread_mutex_unlock(&srv->lock);
+
+    close(fd);
+
+    return NULL;
+}
+
+/**
+ * @brief Queue a prediction and wait for a worker to answer it
+ *
+ * @param srv Server
+ * @param req Request with X filled, y is filled on return
+ */
+static void _srv_predict(server_t* srv, srv_request_t* req)
+{
+    req->done = 0;
+    req->next = NULL;
+    req->arrival = get_time();
+
+    pthread_mutex_lock(&srv->lock);
+
+    if (srv->tail)
+        srv->tail->next = req;
+    else
+        srv->head = req;
+
+    srv->tail = req;
+    srv->pending++;
+
+    // The first request arms a batch, the last one completes it
+    if (srv->pending == 1 || srv->pending >= srv->config.max_batch)
+        pthread_cond_signal(&srv->queue_cond);
+
+    while (!req->done)
+        pthread_cond_wait(&req->cond, &srv->lock);
+
+    pthread_mutex_unlock(&srv->lock);
+}
+
+/**
+ * @brief  Read exactly len bytes
+ *
+ * @return int 0 on success, -1 on error or end of stream
+ */
+static int _srv_read_all(int fd, void* buf, size_t len)
+{
+    char* p = buf;
+
+    while (len > 0)
+    {
+        ssize_t r = read(fd, p, len);
+
+        if (r < 0 && errno == EINTR)
+            continue;
+
+        if (r <= 0)
+            return -1;
+
+        p += r;
+        len -= r;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief  Write exactly len bytes, without raising SIGPIPE
+ *
+ * @return int 0 on success, -1 on error
+ */
+static int _srv_write_all(int fd, const void* buf, size_t len)
+{
+    const char* p = buf;
+
+    while (len > 0)
+    {
+        ssize_t w = send(fd, p, len, MSG_NOSIGNAL);
+
+        if (w < 0 && errno == EINTR)
+            continue;
+
+        if (w <= 0)
+            return -1;
+
+        p += w;
+        len -= w;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Convert a get_time timestamp into a pthread_cond_timedwait
+ *        deadline (CLOCK_REALTIME)
+ *
+ * @param t Monotonic timestamp, in seconds
+ * @param ts Deadline
+ */
+static void _srv_deadline(double t, struct timespec* ts)
+{
+    clock_gettime(CLOCK_REALTIME, ts);
+
+    double wait = t - get_time();
+
+    if (wait <= 0.f)
+        return;
+
+    long ns = ts->tv_nsec + (long) (wait * 1e9);
+
+    ts->tv_sec += ns / 1000000000L;
+    ts->tv_nsec = ns % 1000000000L;
+}
+
+static void _srv_add_conn(server_t* srv, int fd)
+{
+    srv->conns[srv->n_conns++] = fd;
+}
+
+static void _srv_remove_conn(server_t* srv, int fd)
+{
+    for (size_t i = 0; i < srv->n_conns; i++)
+    {
+        if (srv->conns[i] == fd)
+        {
+            srv->conns[i] = srv->conns[--srv->n_conns];
+            return;
+        }
+    }
+}
+
+static int _srv_cmp_double(const void* a, const void* b)
+{
+    double x = *(const double*) a;
+    double y = *(const double*) b;
+
+    return (x > y) - (x < y);
+}
@@ -0,0 +1,133 @@
+/**
+ * @file    server.h
+ * @author  Philippe Bouchet (philippe.bouchet@epita.fr)
+ * @brief   Inference server API header. Serves a network over a Unix
+ *          domain socket, coalescing concurrent requests into batches.
+ *          Public API functions denoted with "srv" prefix.
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "model.h"
+#include "network.h"
+
+#define SERVER_FAILED_SOCKET    -1
+#define SERVER_INVALID_CONFIG   -2
+
+#define SERVER_MAGIC            0xDEE95EA0  // First word of every request
+#define SERVER_MAX_CONNECTIONS  256
+#define SERVER_LATENCY_WINDOW   4096        // Latencies kept for percentiles
+
+/*
+ * Wire protocol, native byte order. Every request starts with a
+ * srv_header_t, and gets exactly one reply:
+ *
+ *  SRV_INFO     -> srv_info_t
+ *  SRV_PREDICT  -> followed by input_size doubles,
+ *                  replied with srv_reply_t and output_size doubles
+ *  SRV_STATS    -> srv_stats_t
+ */
+
+typedef enum
+{
+    SRV_INFO,
+    SRV_PREDICT,
+    SRV_STATS,
+} srv_type_t;
+
+typedef struct
+{
+    uint32_t    magic;
+    uint32_t    type;
+} srv_header_t;
+
+typedef struct
+{
+    uint64_t    input_size;
+    uint64_t    output_size;
+    uint64_t    max_batch;
+} srv_info_t;
+
+typedef struct
+{
+    uint32_t    status;      // 0 on success
+    uint32_t    argmax;      // Index of the strongest output
+} srv_reply_t;
+
+typedef struct
+{
+    uint64_t    requests;    // Predictions served
+    uint64_t    batches;     // Batched forward passes
+    uint64_t    connections; // Connections accepted
+    double      uptime;      // Seconds since the server started
+    double      throughput;  // Predictions per second since start
+    double      mean_batch;  // Average predictions per batch
+    double      p50_us;      // Request latency percentiles, in the queue
+    double      p99_us;      // and the forward pass, over recent requests
+} srv_stats_t;
+
+typedef struct srv_request
+{
+    double*     X;
+    double*     y;
+    size_t      argmax;
+    double      arrival;
+    int         done;
+    pthread_cond_t cond;     // Signaled once y is filled
+    struct srv_request* next;
+} srv_request_t;
+
+typedef struct
+{
+    size_t      max_batch;   // Largest coalesced batch
+    double      max_wait;    // Seconds a request may wait for a batch
+    size_t      n_workers;   // Worker threads running forward passes
+} srv_config_t;
+
+typedef struct
+{
+    model_t*    model;       // Weights, shared by every worker
+    model_ctx_t** ctxs;      // Inference context of each worker
+    srv_config_t config;
+
+    const char* path;
+    int         fd;
+    volatile int running;    // Accepting connections
+    int         stopping;    // Workers exit once the queue is drained
+
+    pthread_mutex_t lock;
+    pthread_cond_t  queue_cond;
+    pthread_cond_t  conn_cond;
+    pthread_t*  workers;
+
+    srv_request_t* head;     // Pending requests, oldest first
+    srv_request_t* tail;
+    size_t      pending;
+
+    int         conns[SERVER_MAX_CONNECTIONS];
+    size_t      n_conns;
+
+    double      start;
+    uint64_t    requests;
+    uint64_t    batches;
+    uint64_t    connections;
+    double      latency[SERVER_LATENCY_WINDOW];
+} server_t;
+
+srv_config_t    srv_config_default(void);
+server_t*       srv_init(network_t* net, const char* path,
+                         srv_config_t* config);
+void            srv_free(server_t* srv);
+
+void            srv_run(server_t* srv);
+void            srv_stop(server_t* srv);
+srv_stats_t     srv_stats(server_t* srv);
+
+#endif // SERVER_H
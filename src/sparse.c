@@ -0,0 +1,148 @@
+/**
+ * @file    sparse.c
+ * @author  Philippe Bouchet (philippe.bouchet@epita.fr)
+ * @brief   Sparse sample implementation.
+ * 
+ * @copyright Copyright (c) 2022
+ * 
+ */
+
+#include "sparse.h"
+
+#include <err.h>
+#include <stdlib.h>
+
+#include "memory.h"
+
+
+/* ==== SPARSE PUBLIC API ==== */
+
+
+/**
+ * @brief  Build the sparse representation of a dense sample. The index
+ *         and value lists share the allocation of the struct.
+ * 
+ * @param  x Dense sample
+ * @param  n Number of values in x
+ * @param  background Value that is not stored
+ * @return sparse_t* Sparse sample
+ */
+sparse_t* sp_from_dense(double* x, size_t n, double background)
+{
+    size_t nnz = 0;
+
+    for (size_t i = 0; i < n; i++)
+        nnz += x[i] != background;
+
+    sparse_t* s = mem_malloc(sizeof(sparse_t)
+                             + nnz * (sizeof(double) + sizeof(unsigned)),
+                             MEM_DATASET);
+
+    s->nnz = nnz;
+    s->val = (double*) (s + 1);
+    s->idx = (unsigned*) (s->val + nnz);
+
+    for (size_t i = 0, k = 0; i < n; i++)
+    {
+        if (x[i] == background)
+            continue;
+
+        s->idx[k] = i;
+        s->val[k] = x[i] - background;
+        k++;
+    }
+
+    return s;
+}
+
+/**
+ * @brief Free a sparse sample
+ * 
+ * @param s Sparse sample
+ */
+void sp_free(sparse_t* s)
+{
+    mem_free(s);
+}
+
+/**
+ * @brief Product of a batch of sparse rows with a dense matrix:
+ *        dst = X . w, with X[i] = background + rows[i].
+ *        The background term is background * w_sum, so only the rows of w
+ *        hit by a deviation are read.
+ * 
+ * @param rows dst->n_row sparse samples
+ * @param background Background constant of the samples
+ * @param w Dense (n, dst->n_col) matrix
+ * @param w_sum Column sums of w, (1, dst->n_col)
+ * @param dst Destination matrix to store result in
+ */
+void sp_mul(sparse_t** rows, double background, matrix_t* w,
+            matrix_t* w_sum, matrix_t* dst)
+{
+    if (w->n_col != dst->n_col || w_sum->n_col != dst->n_col)
+    {
+        errx(SPARSE_SHAPE_MISMATCH,
+             "SPARSE::ERROR::MULTIPLICATION: "
+             "Incompatible dst. Got (%zu, %zu), expected (%zu, %zu)",
+             dst->n_row, dst->n_col, dst->n_row, w->n_col);
+    }
+
+    size_t R = dst->n_row;
+    size_t K = w->n_row;
+
+    // Column-major: column j of w is contiguous, gather it per sample
+    for (size_t j = 0; j < dst->n_col; j++)
+    {
+        double* w_j = w->array + j * K;
+        double base = background * w_sum->array[j];
+
+        for (size_t i = 0; i < R; i++)
+        {
+            sparse_t* s = rows[i];
+            double val = base;
+
+            for (size_t k = 0; k < s->nnz; k++)
+                val += s->val[k] * w_j[s->idx[k]];
+
+            dst->array[j * R + i] = val;
+        }
+    }
+}
+
+/**
+ * @brief Accumulate the deviation part of transpose(X) . delta into dst,
+ *        with X a batch of sparse rows. The background part,
+ *        background * column sums of delta, is left to the caller.
+ * 
+ * @param rows delta->n_row sparse samples
+ * @param delta Error delta of the batch, (R, dst->n_col)
+ * @param dst Gradient matrix to accumulate into, (n, dst->n_col)
+ */
+void sp_mul_tn_add(sparse_t** rows, matrix_t* delta, matrix_t* dst)
+{
+    if (delta->n_col != dst->n_col)
+    {
+        errx(SPARSE_SHAPE_MISMATCH,
+             "SPARSE::ERROR::MULTIPLICATION: "
+             "Incompatible shapes (%zu, %zu) and (%zu, %zu)",
+             delta->n_row, delta->n_col, dst->n_row, dst->n_col);
+    }
+
+    size_t R = delta->n_row;
+    size_t K = dst->n_row;
+
+    for (size_t j = 0; j < dst->n_col; j++)
+    {
+        double* g_j = dst->array + j * K;
+
+        for (size_t i = 0; i < R; i++)
+        {
+            sparse_t* s = rows[i];
+            double d = delta->array[j * R + i];
+
+            for (size_t k = 0; k < s->nnz; k++)
+                g_j[s->idx[k]] += s->val[k] * d;
+        }
+    }
+}
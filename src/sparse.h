@@ -0,0 +1,35 @@
+/**
+ * @file    sparse.h
+ * @author  Philippe Bouchet (philippe.bouchet@epita.fr)
+ * @brief   Sparse sample representation: a background constant plus a
+ *          list of (index, deviation) pairs, and the kernels feeding it
+ *          through a dense weight matrix.
+ * 
+ * @copyright Copyright (c) 2022
+ * 
+ */
+
+#ifndef SPARSE_H
+#define SPARSE_H
+
+#include "matrix.h"
+
+#define SPARSE_SHAPE_MISMATCH   -1
+
+typedef unsigned long size_t;
+
+typedef struct
+{
+    size_t      nnz;         // Number of values differing from background
+    unsigned*   idx;         // Indices of those values
+    double*     val;         // Deviation from background: x[idx] - bg
+} sparse_t;
+
+sparse_t*   sp_from_dense(double* x, size_t n, double background);
+void        sp_free(sparse_t* s);
+
+void        sp_mul(sparse_t** rows, double background, matrix_t* w,
+                   matrix_t* w_sum, matrix_t* dst);
+void        sp_mul_tn_add(sparse_t** rows, matrix_t* delta, matrix_t* dst);
+
+#endif // SPARSE_H
@@ -0,0 +1,291 @@
+/**
+ * @file    topology.c
+ * @author  Philippe Bouchet (philippe.bouchet@epita.fr)
+ * @brief   Topology discovery and placement implementation.
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include "topology.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// From <numaif.h>, not installed without libnuma
+#define TOPO_MPOL_INTERLEAVE    3
+#define TOPO_MPOL_MF_MOVE       (1 << 1)
+
+static topology_t       topology;
+static pthread_once_t   topology_once = PTHREAD_ONCE_INIT;
+
+/* Internal API forward declaration */
+
+static void     _topo_discover(void);
+static int      _topo_parse_list(const char* list, int* ids, int max);
+
+
+/* ==== TOPOLOGY PUBLIC API ==== */
+
+
+/**
+ * @return const topology_t* Topology of the host, discovered on first use
+ */
+const topology_t* topo_get(void)
+{
+    pthread_once(&topology_once, _topo_discover);
+
+    return &topology;
+}
+
+/**
+ * @brief  CPU a worker should run on under an affinity policy
+ *
+ * @param  affinity Placement policy
+ * @param  worker Worker index
+ * @return int CPU id, -1 for AFFINITY_NONE
+ */
+int topo_cpu(affinity_t affinity, size_t worker)
+{
+    const topology_t* topo = topo_get();
+
+    if (affinity == AFFINITY_NONE)
+        return -1;
+
+    if (affinity == AFFINITY_COMPACT)
+        return topo->cpus[worker % topo->n_cpus];
+
+    // Scatter: k-th CPU of node (worker % n_nodes)
+    int node = topo->nodes[worker % topo->n_nodes];
+    size_t k = worker / topo->n_nodes;
+    size_t n_node_cpus = 0;
+
+    for (size_t i = 0; i < topo->n_cpus; i++)
+        n_node_cpus += topo->cpu_node[i] == node;
+
+    k %= n_node_cpus;
+
+    for (size_t i = 0; i < topo->n_cpus; i++)
+    {
+        if (topo->cpu_node[i] == node && k-- == 0)
+            return topo->cpus[i];
+    }
+
+    return topo->cpus[0];
+}
+
+/**
+ * @param  cpu CPU id, or -1
+ * @return int NUMA node of the CPU, 0 if unknown
+ */
+int topo_node(int cpu)
+{
+    const topology_t* topo = topo_get();
+
+    for (size_t i = 0; i < topo->n_cpus; i++)
+    {
+        if (topo->cpus[i] == cpu)
+            return topo->cpu_node[i];
+    }
+
+    return 0;
+}
+
+/**
+ * @brief  Pin the calling thread to a CPU
+ *
+ * @param  cpu CPU id, -1 leaves the thread unpinned
+ * @return int 0 on success
+ */
+int topo_bind(int cpu)
+{
+    if (cpu < 0)
+        return 0;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+/**
+ * @brief  Confine the calling thread to n consecutive CPUs of the process,
+ *         in node order (wrapping around). Threads it creates afterwards
+ *         inherit the set, so unpinned workers stay within it.
+ *
+ * @param  first Index of the first CPU, in topology order
+ * @param  n Number of CPUs, 0 leaves the thread as it is
+ * @return int 0 on success
+ */
+int topo_bind_range(size_t first, size_t n)
+{
+    const topology_t* topo = topo_get();
+
+    if (n == 0)
+        return 0;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+
+    for (size_t i = 0; i < n; i++)
+        CPU_SET(topo->cpus[(first + i) % topo->n_cpus], &set);
+
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+/**
+ * @brief  Spread the pages of a block round robin over every node, moving
+ *         pages already touched. Does nothing on a single node host.
+ *         mbind works on whole pages: the block must start on a page and
+ *         own every page up to ptr + size rounded up (see mem_aligned),
+ *         or unrelated objects sharing those pages would move with it.
+ *
+ * @param  ptr Start of the block, page aligned
+ * @param  size Size of the block in bytes
+ * @return int 0 on success or if there is a single node, -1 if ptr is
+ *         not page aligned
+ */
+int topo_interleave(void* ptr, size_t size)
+{
+    const topology_t* topo = topo_get();
+
+    if (topo->n_nodes < 2 || size == 0)
+        return 0;
+
+    unsigned long mask[TOPOLOGY_MAX_NODES / (8 * sizeof(long))] = { 0 };
+
+    for (size_t i = 0; i < topo->n_nodes; i++)
+    {
+        int node = topo->nodes[i];
+        mask[node / (8 * sizeof(long))] |= 1UL << (node % (8 * sizeof(long)));
+    }
+
+    size_t page = sysconf(_SC_PAGESIZE);
+
+    if ((size_t) ptr & (page - 1))
+        return -1;
+
+    size_t len = (size + page - 1) & ~(page - 1);
+
+    return syscall(SYS_mbind, ptr, len, TOPO_MPOL_INTERLEAVE,
+                   mask, TOPOLOGY_MAX_NODES, TOPO_MPOL_MF_MOVE);
+}
+
+
+/* ==== TOPOLOGY INTERNAL API ==== */
+
+
+/**
+ * @brief Build the topology from the CPUs the process may use, and the
+ *        CPU lists of /sys/devices/system/node
+ */
+static void _topo_discover(void)
+{
+    cpu_set_t allowed;
+    int node_of[TOPOLOGY_MAX_CPUS];
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+    {
+        CPU_ZERO(&allowed);
+        CPU_SET(0, &allowed);
+    }
+
+    for (int cpu = 0; cpu < TOPOLOGY_MAX_CPUS; cpu++)
+        node_of[cpu] = -1;
+
+    for (int node = 0; node < TOPOLOGY_MAX_NODES; node++)
+    {
+        char path[64], list[4096];
+        int ids[TOPOLOGY_MAX_CPUS];
+
+        snprintf(path, sizeof(path),
+                 "/sys/devices/system/node/node%d/cpulist", node);
+
+        FILE* fp = fopen(path, "r");
+
+        if (fp == NULL)
+            continue;
+
+        if (fgets(list, sizeof(list), fp))
+        {
+            int n = _topo_parse_list(list, ids, TOPOLOGY_MAX_CPUS);
+
+            for (int i = 0; i < n; i++)
+                node_of[ids[i]] = node;
+        }
+
+        fclose(fp);
+    }
+
+    // Group allowed CPUs by node, CPUs of unknown node count as node 0
+    memset(&topology, 0, sizeof(topology));
+
+    for (int node = 0; node < TOPOLOGY_MAX_NODES; node++)
+    {
+        size_t found = 0;
+
+        for (int cpu = 0; cpu < TOPOLOGY_MAX_CPUS; cpu++)
+        {
+            int cpu_node = node_of[cpu] < 0 ? 0 : node_of[cpu];
+
+            if (!CPU_ISSET(cpu, &allowed) || cpu_node != node)
+                continue;
+
+            topology.cpus[topology.n_cpus] = cpu;
+            topology.cpu_node[topology.n_cpus] = node;
+            topology.n_cpus++;
+            found++;
+        }
+
+        if (found)
+            topology.nodes[topology.n_nodes++] = node;
+    }
+}
+
+/**
+ * @brief  Parse a CPU list such as "0-7,16-23"
+ *
+ * @param  list CPU list
+ * @param  ids Parsed ids
+ * @param  max Capacity of ids
+ * @return int Number of ids
+ */
+static int _topo_parse_list(const char* list, int* ids, int max)
+{
+    int n = 0;
+    const char* p = list;
+
+    while (*p && *p != '\n')
+    {
+        char* end;
+        long first = strtol(p, &end, 10);
+        long last = first;
+
+        if (end == p)
+            break;
+
+        if (*end == '-')
+        {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+        }
+
+        for (long cpu = first; cpu <= last && n < max; cpu++)
+        {
+            if (cpu < TOPOLOGY_MAX_CPUS)
+                ids[n++] = cpu;
+        }
+
+        p = *end == ',' ? end + 1 : end;
+    }
+
+    return n;
+}
@@ -0,0 +1,45 @@
+/**
+ * @file    topology.h
+ * @author  Philippe Bouchet (philippe.bouchet@epita.fr)
+ * @brief   CPU / NUMA node topology, thread placement policies and memory
+ *          interleaving. Read from /sys on Linux; hosts without NUMA
+ *          information are seen as a single node.
+ *          Public API functions denoted with "topo" prefix.
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#define TOPOLOGY_MAX_CPUS   1024
+#define TOPOLOGY_MAX_NODES  64
+
+typedef unsigned long size_t;
+
+typedef enum
+{
+    AFFINITY_NONE,           // Threads are left to the OS scheduler
+    AFFINITY_COMPACT,        // Fill the CPUs of a node before the next one
+    AFFINITY_SCATTER,        // Round robin across nodes
+} affinity_t;
+
+typedef struct
+{
+    size_t      n_cpus;      // CPUs this process may run on
+    size_t      n_nodes;     // NUMA nodes holding at least one of them
+    int         cpus[TOPOLOGY_MAX_CPUS];      // Ordered by node
+    int         cpu_node[TOPOLOGY_MAX_CPUS];  // Node of cpus[i]
+    int         nodes[TOPOLOGY_MAX_NODES];    // Node ids
+} topology_t;
+
+const topology_t*   topo_get(void);
+
+int     topo_cpu(affinity_t affinity, size_t worker);
+int     topo_node(int cpu);
+int     topo_bind(int cpu);
+int     topo_bind_range(size_t first, size_t n);
+int     topo_interleave(void* ptr, size_t size);
+
+#endif // TOPOLOGY_H
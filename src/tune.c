@@ -0,0 +1,822 @@
+/**
+ * @file    tune.c
+ * @author  Philippe Bouchet (philippe.bouchet@epita.fr)
+ * @brief   Autotuner implementation.
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "tune.h"
+
+#include <err.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "memory.h"
+#include "model.h"
+#include "utils.h"
+
+#define TUNE_MARGIN     1.02    // Speedup a later candidate needs to win
+#define TUNE_MIN_MICRO  8       // Smallest micro-batch candidate
+#define TUNE_HOST_SIZE  256
+#define TUNE_LINE_SIZE  512
+
+static const size_t tune_mc[] = { 32, 64, 128 };
+static const size_t tune_nc[] = { 32, 64, 128 };
+static const size_t tune_kc[] = { 64, 128, 256 };
+static const size_t tune_infer_batch[] = { 1, 8, 32, 64, 128, 256 };
+
+#define TUNE_COUNT(a)   (sizeof(a) / sizeof(*(a)))
+
+typedef struct
+{
+    matrix_t*   a;           // M x K, layer input or im2col windows
+    matrix_t*   w;           // K x N, weights
+    matrix_t*   z;           // M x N, layer output and its delta
+    matrix_t*   grad;        // K x N, weight gradient
+    matrix_t*   delta;       // M x K, delta of the layer input
+} tune_gemm_t;
+
+typedef struct
+{
+    model_ctx_t* ctx;
+    double**    X;
+    size_t      n;
+    size_t      batch;
+    double*     y;
+    double      deadline;
+    size_t      done;        // Samples predicted before the deadline
+} tune_worker_t;
+
+/* Internal API forward declaration */
+
+static void     _tune_key(network_t* net, const train_config_t* train,
+                          char* key, size_t size);
+static void     _tune_host(char* host, size_t size);
+static int      _tune_host_line(const char* line);
+static size_t   _tune_threads(size_t i, size_t max_threads);
+
+static void     _tune_blocking(network_t* net, const tune_config_t* config,
+                               tune_params_t* params);
+static tune_gemm_t* _tune_gemm_init(network_t* net, size_t* n);
+static void     _tune_gemm_free(tune_gemm_t* gemm, size_t n);
+static void     _tune_gemm_fill(matrix_t* m);
+
+static void     _tune_train(network_t* net, dataset_t* data,
+                            const train_config_t* train,
+                            const tune_config_t* config, size_t max_threads,
+                            tune_params_t* params);
+static void     _tune_infer(network_t* net, dataset_t* data,
+                            const tune_config_t* config, size_t max_threads,
+                            tune_params_t* params);
+static void*    _tune_infer_worker(void* args);
+
+
+/* ==== TUNE PUBLIC API ==== */
+
+
+/**
+ * @return tune_config_t 50ms per candidate on every CPU of the process,
+ *         cached in tune_cache_path, quiet
+ */
+tune_config_t tune_config_default(void)
+{
+    tune_config_t config = {
+        .min_time = 0.05f,
+        .max_threads = 0,
+        .cache = NULL,
+        .verbose = 0,
+    };
+
+    return config;
+}
+
+/**
+ * @brief Default cache file: $DEEPSEA_TUNE_CACHE if set, else
+ *        $HOME/.deepsea-<hostname>.tune, else in the working directory.
+ *
+ * @param path Destination buffer
+ * @param size Size of path
+ */
+void tune_cache_path(char* path, size_t size)
+{
+    const char* env = getenv("DEEPSEA_TUNE_CACHE");
+    const char* home = getenv("HOME");
+    char host[TUNE_HOST_SIZE];
+
+    _tune_host(host, sizeof(host));
+
+    if (env && *env)
+        snprintf(path, size, "%s", env);
+    else if (home && *home)
+        snprintf(path, size, "%s/.deepsea-%s.tune", home, host);
+    else
+        snprintf(path, size, "deepsea-%s.tune", host);
+}
+
+/**
+ * @brief Time every candidate, in three stages: native GEMM block sizes
+ *        on the layer products of net at its batch size, then training
+ *        micro-batch and worker counts with the winning blocking, then
+ *        inference batch and context counts. net, data and the current
+ *        blocking are left unchanged; see tune_apply.
+ *
+ * @param  net Network to tune for
+ * @param  data Training samples, the first TUNE_SAMPLES are used
+ * @param  train Training configuration, gives the effective batch
+ * @param  config Tuning configuration
+ * @return tune_params_t Fastest parameters
+ */
+tune_params_t tune_run(network_t* net, dataset_t* data,
+                       const train_config_t* train,
+                       const tune_config_t* config)
+{
+    size_t max_threads = config->max_threads ? config->max_threads
+                                             : topo_get()->n_cpus;
+    backend_blocking_t blocking = backend_native_blocking();
+    tune_params_t params = {
+        .blocking = blocking,
+        .batch_size = net->batch_size,
+        .n_threads = train->n_threads,
+        .infer_batch = NETWORK_EVAL_BATCH,
+        .infer_threads = 1,
+    };
+
+    // Same samples, own order: shuffling the view leaves data untouched
+    dataset_t view = *data;
+    view.n = data->n < TUNE_SAMPLES ? data->n : TUNE_SAMPLES;
+    view.X = malloc(view.n * sizeof(double*));
+    view.y = malloc(view.n * sizeof(double*));
+    memcpy(view.X, data->X, view.n * sizeof(double*));
+    memcpy(view.y, data->y, view.n * sizeof(double*));
+
+    if (data->S)
+    {
+        view.S = malloc(view.n * sizeof(sparse_t*));
+        memcpy(view.S, data->S, view.n * sizeof(sparse_t*));
+    }
+
+    _tune_blocking(net, config, &params);
+
+    backend_native_set_blocking(params.blocking);
+    _tune_train(net, &view, train, config, max_threads, &params);
+    _tune_infer(net, &view, config, max_threads, &params);
+    backend_native_set_blocking(blocking);
+
+    free(view.X);
+    free(view.y);
+    if (data->S)
+        free(view.S);
+
+    return params;
+}
+
+/**
+ * @brief Load the parameters of net from the cache, or tune and cache
+ *        them on a miss.
+ *
+ * @param  net Network to tune for
+ * @param  data Training samples
+ * @param  train Training configuration
+ * @param  config Tuning configuration
+ * @return tune_params_t Cached or freshly tuned parameters
+ */
+tune_params_t tune_get(network_t* net, dataset_t* data,
+                       const train_config_t* train,
+                       const tune_config_t* config)
+{
+    char path[TUNE_LINE_SIZE];
+    tune_params_t params;
+
+    if (config->cache)
+        snprintf(path, sizeof(path), "%s", config->cache);
+    else
+        tune_cache_path(path, sizeof(path));
+
+    double start = get_time();
+
+    if (tune_load(path, net, train, &params))
+    {
+        if (config->verbose)
+            printf("[TUNE] Loaded from %s in %.3fms\n", path,
+                   (get_time() - start) * 1000);
+
+        return params;
+    }
+
+    params = tune_run(net, data, train, config);
+    tune_save(path, net, train, &params);
+
+    if (config->verbose)
+        printf("[TUNE] Tuned in %.2fs, saved to %s\n", get_time() - start,
+               path);
+
+    return params;
+}
+
+/**
+ * @brief Use tuned parameters: sets the native blocking, the micro-batch
+ *        of net and the workers of train. accum_steps is scaled so that
+ *        an optimizer step still sees the same effective batch.
+ *
+ * @param params Tuned parameters
+ * @param net Network to train
+ * @param train Training configuration
+ */
+void tune_apply(const tune_params_t* params, network_t* net,
+                train_config_t* train)
+{
+    size_t effective = net->batch_size * train->accum_steps;
+
+    if (params->batch_size == 0 || effective % params->batch_size != 0
+        || params->batch_size > net->max_batch)
+    {
+        errx(TUNE_MISMATCH,
+             "TUNE::ERROR::APPLY: "
+             "Micro-batch %zu does not split a batch of %zu in %zu rows",
+             params->batch_size, effective, net->max_batch);
+    }
+
+    backend_native_set_blocking(params->blocking);
+
+    net->batch_size = params->batch_size;
+    train->accum_steps = effective / params->batch_size;
+    train->n_threads = params->n_threads;
+}
+
+/**
+ * @brief Look the parameters of net up in a cache file. Files written on
+ *        another host, or with another CPU count, are ignored.
+ *
+ * @param  path Cache file
+ * @param  net Network, gives the key with train
+ * @param  train Training configuration
+ * @param  params Destination
+ * @return int 1 if found, else 0
+ */
+int tune_load(const char* path, network_t* net, const train_config_t* train,
+              tune_params_t* params)
+{
+    FILE* fp = fopen(path, "r");
+
+    if (fp == NULL)
+        return 0;
+
+    char key[TUNE_KEY_SIZE];
+    char line[TUNE_LINE_SIZE];
+    char k[TUNE_LINE_SIZE];
+    int host = 0;
+    int found = 0;
+
+    _tune_key(net, train, key, sizeof(key));
+
+    while (!found && fgets(line, sizeof(line), fp))
+    {
+        if (line[0] == '#')
+            continue;
+
+        if (!host)
+        {
+            host = 1;
+
+            if (!_tune_host_line(line))
+                break;
+
+            continue;
+        }
+
+        tune_params_t p;
+
+        if (sscanf(line, "%511s %zu %zu %zu %zu %zu %zu %zu", k,
+                   &p.blocking.mc, &p.blocking.nc, &p.blocking.kc,
+                   &p.batch_size, &p.n_threads, &p.infer_batch,
+                   &p.infer_threads) == 8
+            && strcmp(k, key) == 0 && backend_native_valid(p.blocking))
+        {
+            *params = p;
+            found = 1;
+        }
+    }
+
+    fclose(fp);
+
+    return found;
+}
+
+/**
+ * @brief Store the parameters of net in a cache file, replacing its
+ *        previous entry. Entries of other hosts are dropped. The file is
+ *        written aside and renamed, readers never see it partially.
+ *
+ * @param path Cache file
+ * @param net Network, gives the key with train
+ * @param train Training configuration
+ * @param params Parameters to store
+ */
+void tune_save(const char* path, network_t* net, const train_config_t* train,
+               const tune_params_t* params)
+{
+    char key[TUNE_KEY_SIZE];
+    char host[TUNE_HOST_SIZE];
+    char tmp[TUNE_LINE_SIZE + 32];
+    char line[TUNE_LINE_SIZE];
+
+    _tune_key(net, train, key, sizeof(key));
+    _tune_host(host, sizeof(host));
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, (int) getpid());
+
+    FILE* out = fopen(tmp, "w");
+
+    if (out == NULL)
+    {
+        errx(TUNE_FAILED_SAVE,
+             "TUNE::ERROR::SAVE: "
+             "Failed to open %s", tmp);
+    }
+
+    fprintf(out, "# deepsea autotune cache\n");
+    fprintf(out, "host %s %zu\n", host, topo_get()->n_cpus);
+
+    FILE* in = fopen(path, "r");
+
+    if (in)
+    {
+        int valid = 0;
+        size_t len = strlen(key);
+
+        while (fgets(line, sizeof(line), in))
+        {
+            if (line[0] == '#')
+                continue;
+
+            if (!valid)
+            {
+                if (!_tune_host_line(line))
+                    break;
+
+                valid = 1;
+                continue;
+            }
+
+            if (strncmp(line, key, len) != 0 || line[len] != ' ')
+                fputs(line, out);
+        }
+
+        fclose(in);
+    }
+
+    fprintf(out, "%s %zu %zu %zu %zu %zu %zu %zu\n", key,
+            params->blocking.mc, params->blocking.nc, params->blocking.kc,
+            params->batch_size, params->n_threads, params->infer_batch,
+            params->infer_threads);
+
+    if (fclose(out) != 0 || rename(tmp, path) != 0)
+    {
+        unlink(tmp);
+        errx(TUNE_FAILED_SAVE,
+             "TUNE::ERROR::SAVE: "
+             "Failed to write %s", path);
+    }
+}
+
+
+/* ==== TUNE INTERNAL API ==== */
+
+
+/**
+ * @brief Cache key of a network: input size, convolution shapes, dense
+ *        layer widths, then the effective batch. Free of spaces.
+ *
+ * @param net Network
+ * @param train Training configuration
+ * @param key Destination buffer
+ * @param size Size of key
+ */
+static void _tune_key(network_t* net, const train_config_t* train,
+                      char* key, size_t size)
+{
+    size_t len = snprintf(key, size, "%zu", net->input_size);
+
+    for (size_t k = 0; k < net->n_conv && len < size; k++)
+    {
+        const conv_t* c = &net->conv[k];
+
+        if (c->type == CONV_2D)
+            len += snprintf(key + len, size - len, "-c%zuk%zus%zup%zu",
+                            c->channels, c->kernel, c->stride, c->pad);
+        else
+            len += snprintf(key + len, size - len, "-%c%zus%zu",
+                            c->type == CONV_MAX_POOL ? 'm' : 'a',
+                            c->kernel, c->stride);
+    }
+
+    for (size_t l = 0; l < net->L && len < size; l++)
+        len += snprintf(key + len, size - len, "-%zu", net->w[l]->n_col);
+
+    if (len < size)
+        snprintf(key + len, size - len, "@%zu",
+                 net->batch_size * train->accum_steps);
+}
+
+/**
+ * @param host Destination buffer, the host name or "localhost"
+ * @param size Size of host
+ */
+static void _tune_host(char* host, size_t size)
+{
+    if (gethostname(host, size) != 0 || host[0] == '\0')
+        snprintf(host, size, "localhost");
+
+    host[size - 1] = '\0';
+
+    for (char* c = host; *c; c++)
+    {
+        if (*c == ' ' || *c == '/')
+            *c = '_';
+    }
+}
+
+/**
+ * @param  line Host line of a cache file
+ * @return int 1 if it names this host and CPU count
+ */
+static int _tune_host_line(const char* line)
+{
+    char host[TUNE_HOST_SIZE];
+    char name[TUNE_LINE_SIZE];
+    size_t n_cpus;
+
+    _tune_host(host, sizeof(host));
+
+    return sscanf(line, "host %511s %zu", name, &n_cpus) == 2
+        && strcmp(name, host) == 0 && n_cpus == topo_get()->n_cpus;
+}
+
+/**
+ * @param  i Candidate index
+ * @param  max_threads Highest thread count
+ * @return size_t i-th thread count candidate: powers of two, then
+ *         max_threads, then 0 once past it
+ */
+static size_t _tune_threads(size_t i, size_t max_threads)
+{
+    size_t t = (size_t) 1 << i;
+
+    if (t < max_threads)
+        return t;
+
+    return t < 2 * max_threads ? max_threads : 0;
+}
+
+/**
+ * @brief Time the forward, gradient and backward GEMMs of every layer of
+ *        net on the native backend, for each valid blocking candidate.
+ *        The current blocking is timed first and kept on ties.
+ *
+ * @param net Network
+ * @param config Tuning configuration
+ * @param params Destination of the fastest blocking
+ */
+static void _tune_blocking(network_t* net, const tune_config_t* config,
+                           tune_params_t* params)
+{
+    const backend_t* native = backend_native();
+    size_t n;
+    tune_gemm_t* gemm = _tune_gemm_init(net, &n);
+    size_t n_cand = TUNE_COUNT(tune_mc) * TUNE_COUNT(tune_nc)
+                  * TUNE_COUNT(tune_kc);
+    double best = 0.f;
+
+    for (size_t c = 0; c <= n_cand; c++)
+    {
+        backend_blocking_t blk = params->blocking;
+
+        if (c > 0)
+        {
+            size_t i = c - 1;
+
+            blk.mc = tune_mc[i % TUNE_COUNT(tune_mc)];
+            i /= TUNE_COUNT(tune_mc);
+            blk.nc = tune_nc[i % TUNE_COUNT(tune_nc)];
+            i /= TUNE_COUNT(tune_nc);
+            blk.kc = tune_kc[i];
+        }
+
+        if (!backend_native_valid(blk))
+            continue;
+
+        backend_native_set_blocking(blk);
+
+        size_t rounds = 0;
+        double start = get_time();
+        double elapsed = 0.f;
+
+        while (elapsed < config->min_time)
+        {
+            for (size_t l = 0; l < n; l++)
+            {
+                native->mul(gemm[l].a, gemm[l].w, gemm[l].z);
+                native->mul_tn(gemm[l].a, gemm[l].z, gemm[l].grad);
+                native->mul_nt(gemm[l].z, gemm[l].w, gemm[l].delta);
+            }
+
+            rounds++;
+            elapsed = get_time() - start;
+        }
+
+        double rate = rounds / elapsed;
+
+        if (config->verbose)
+            printf("[TUNE] gemm mc %3zu nc %3zu kc %3zu: %10.1f passes/s\n",
+                   blk.mc, blk.nc, blk.kc, rate);
+
+        if (rate > best * TUNE_MARGIN)
+        {
+            best = rate;
+            params->blocking = blk;
+        }
+    }
+
+    _tune_gemm_free(gemm, n);
+}
+
+/**
+ * @brief Operands of the layer products of net at its batch size: one
+ *        per dense layer, and one per convolution with its im2col shape.
+ *
+ * @param  net Network
+ * @param  n Destination of the number of products
+ * @return tune_gemm_t* Operands, filled with a fixed pattern
+ */
+static tune_gemm_t* _tune_gemm_init(network_t* net, size_t* n)
+{
+    tune_gemm_t* gemm = mem_calloc(net->L + net->n_conv, sizeof(tune_gemm_t),
+                                   MEM_NETWORK);
+    size_t B = net->batch_size;
+
+    *n = 0;
+
+    for (size_t k = 0; k < net->n_conv; k++)
+    {
+        const conv_t* c = &net->conv[k];
+
+        if (c->type != CONV_2D)
+            continue;
+
+        size_t M = B * conv_positions(c);
+        size_t K = conv_window(c);
+        size_t N = c->out_c;
+
+        gemm[*n] = (tune_gemm_t) {
+            .a = m_init(M, K), .w = m_init(K, N), .z = m_init(M, N),
+            .grad = m_init(K, N), .delta = m_init(M, K),
+        };
+        (*n)++;
+    }
+
+    for (size_t l = 0; l < net->L; l++)
+    {
+        size_t K = net->w[l]->n_row;
+        size_t N = net->w[l]->n_col;
+
+        gemm[*n] = (tune_gemm_t) {
+            .a = m_init(B, K), .w = m_init(K, N), .z = m_init(B, N),
+            .grad = m_init(K, N), .delta = m_init(B, K),
+        };
+        (*n)++;
+    }
+
+    for (size_t l = 0; l < *n; l++)
+    {
+        _tune_gemm_fill(gemm[l].a);
+        _tune_gemm_fill(gemm[l].w);
+        _tune_gemm_fill(gemm[l].z);
+    }
+
+    return gemm;
+}
+
+/**
+ * @param gemm Operands to free
+ * @param n Number of products
+ */
+static void _tune_gemm_free(tune_gemm_t* gemm, size_t n)
+{
+    for (size_t l = 0; l < n; l++)
+    {
+        m_free(gemm[l].a);
+        m_free(gemm[l].w);
+        m_free(gemm[l].z);
+        m_free(gemm[l].grad);
+        m_free(gemm[l].delta);
+    }
+
+    mem_free(gemm);
+}
+
+/**
+ * @brief Fill with values in [-0.5, 0.5), without touching rand()
+ *
+ * @param m Matrix to fill
+ */
+static void _tune_gemm_fill(matrix_t* m)
+{
+    for (size_t i = 0; i < m->size; i++)
+        m->array[i] = (double) ((i * 7919) % 1000) / 1000 - 0.5f;
+}
+
+/**
+ * @brief Time epochs of net_fit on copies of net, for each micro-batch
+ *        dividing the effective batch and each worker count. Samples per
+ *        second are compared; the current micro-batch is timed first, and
+ *        fewer workers are kept on ties.
+ *
+ * @param net Network, copied per candidate
+ * @param data Samples
+ * @param train Training configuration, gives the effective batch
+ * @param config Tuning configuration
+ * @param max_threads Highest worker count
+ * @param params Destination of the fastest micro-batch and workers
+ */
+static void _tune_train(network_t* net, dataset_t* data,
+                        const train_config_t* train,
+                        const tune_config_t* config, size_t max_threads,
+                        tune_params_t* params)
+{
+    size_t effective = net->batch_size * train->accum_steps;
+    double best = 0.f;
+
+    for (size_t c = 0; c <= effective; c++)
+    {
+        // Candidate 0 is the current micro-batch, then every divisor
+        size_t micro = c == 0 ? net->batch_size : c;
+
+        if (c > 0 && (micro == net->batch_size || effective % micro != 0
+                      || (micro < TUNE_MIN_MICRO && micro != effective)))
+            continue;
+
+        if (micro > net->max_batch)
+            continue;
+
+        network_t* copy = net_clone(net, micro);
+
+        for (size_t i = 0; _tune_threads(i, max_threads) != 0; i++)
+        {
+            size_t threads = _tune_threads(i, max_threads);
+
+            if (threads > micro)
+                break;
+
+            train_config_t fit = *train;
+            fit.epochs = 1;
+            fit.steps_per_epoch = 0;
+            fit.accum_steps = effective / micro;
+            fit.lr_schedule = LR_CONSTANT;
+            fit.warmup_epochs = 0;
+            fit.val_split = 0.f;
+            fit.patience = 0;
+            fit.n_threads = threads;
+            fit.dist = NULL;
+            fit.monitor = NULL;
+            fit.verbose = 0;
+
+            // Warm-up epoch, then whole epochs until min_time
+            net_fit(copy, data, &fit);
+
+            size_t samples = 0;
+            double start = get_time();
+            double elapsed = 0.f;
+
+            while (elapsed < config->min_time)
+            {
+                net_fit(copy, data, &fit);
+                samples += data->n;
+                elapsed = get_time() - start;
+            }
+
+            double rate = samples / elapsed;
+
+            if (config->verbose)
+                printf("[TUNE] train batch %4zu threads %3zu: "
+                       "%10.1f samples/s\n", micro, threads, rate);
+
+            if (rate > best * TUNE_MARGIN)
+            {
+                best = rate;
+                params->batch_size = micro;
+                params->n_threads = threads;
+            }
+        }
+
+        net_free(copy);
+    }
+}
+
+/**
+ * @brief Time concurrent inference contexts on a shared model of net,
+ *        for each batch size and context count. Samples per second over
+ *        all contexts are compared.
+ *
+ * @param net Network
+ * @param data Samples
+ * @param config Tuning configuration
+ * @param max_threads Highest context count
+ * @param params Destination of the fastest batch and contexts
+ */
+static void _tune_infer(network_t* net, dataset_t* data,
+                        const tune_config_t* config, size_t max_threads,
+                        tune_params_t* params)
+{
+    model_t* model = model_init(net);
+    tune_worker_t* workers = mem_calloc(max_threads, sizeof(tune_worker_t),
+                                        MEM_NETWORK);
+    pthread_t* tids = mem_calloc(max_threads, sizeof(pthread_t), MEM_NETWORK);
+    double best = 0.f;
+
+    for (size_t c = 0; c < TUNE_COUNT(tune_infer_batch); c++)
+    {
+        size_t batch = tune_infer_batch[c];
+
+        for (size_t i = 0; _tune_threads(i, max_threads) != 0; i++)
+        {
+            size_t threads = _tune_threads(i, max_threads);
+
+            for (size_t t = 0; t < threads; t++)
+            {
+                workers[t] = (tune_worker_t) {
+                    .ctx = model_ctx_init(model, batch),
+                    .X = data->X,
+                    .n = data->n,
+                    .batch = batch,
+                    .y = mem_malloc(batch * net->output_size * sizeof(double),
+                                    MEM_ACTIVATIONS),
+                };
+            }
+
+            double start = get_time();
+
+            for (size_t t = 0; t < threads; t++)
+            {
+                workers[t].deadline = start + config->min_time;
+                pthread_create(&tids[t], NULL, _tune_infer_worker,
+                               &workers[t]);
+            }
+
+            size_t samples = 0;
+
+            for (size_t t = 0; t < threads; t++)
+            {
+                pthread_join(tids[t], NULL);
+                samples += workers[t].done;
+                model_ctx_free(workers[t].ctx);
+                mem_free(workers[t].y);
+            }
+
+            double rate = samples / (get_time() - start);
+
+            if (config->verbose)
+                printf("[TUNE] infer batch %4zu contexts %3zu: "
+                       "%10.1f samples/s\n", batch, threads, rate);
+
+            if (rate > best * TUNE_MARGIN)
+            {
+                best = rate;
+                params->infer_batch = batch;
+                params->infer_threads = threads;
+            }
+        }
+    }
+
+    mem_free(tids);
+    mem_free(workers);
+    model_free(model);
+}
+
+/**
+ * @brief Inference worker: predicts the samples batch by batch, over and
+ *        over, until the deadline
+ *
+ * @param  args tune_worker_t of the worker
+ * @return void* NULL
+ */
+static void* _tune_infer_worker(void* args)
+{
+    tune_worker_t* w = args;
+    size_t i = 0;
+
+    while (get_time() < w->deadline)
+    {
+        size_t rows = w->n - i < w->batch ? w->n - i : w->batch;
+
+        model_predict_batch(w->ctx, w->X + i, rows, w->y);
+
+        w->done += rows;
+        i = i + rows < w->n ? i + rows : 0;
+    }
+
+    return NULL;
+}
@@ -0,0 +1,75 @@
+/**
+ * @file    tune.h
+ * @author  Philippe Bouchet (philippe.bouchet@epita.fr)
+ * @brief   Autotuner. Times candidate native GEMM block sizes on the
+ *          network's own layer shapes, then candidate micro-batch sizes
+ *          and worker counts for training, and batch sizes and context
+ *          counts for inference. Micro-batch candidates divide the
+ *          effective batch (batch_size x accum_steps), which tune_apply
+ *          keeps, so tuning never changes what is being optimized.
+ *
+ *          Winners are kept in a per-host text cache file, one line per
+ *          network shape, so later runs only read a few lines:
+ *
+ *              host <hostname> <cpus>
+ *              <shape>@<batch> <mc> <nc> <kc> <batch> <threads>
+ *                              <infer batch> <infer threads>
+ *
+ *          tune_apply uses the training half; deepsea-serve -a sets its
+ *          max_batch and workers from the inference half.
+ *          Tuning trains throwaway copies of the network on a copy of
+ *          the sample order, but draws from rand().
+ *          Public API functions denoted with "tune" prefix.
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef TUNE_H
+#define TUNE_H
+
+#define TUNE_MISMATCH           -1
+#define TUNE_FAILED_SAVE        -2
+
+#define TUNE_SAMPLES            1024    // Samples of the training runs
+#define TUNE_KEY_SIZE           256
+
+#include "backend.h"
+#include "network.h"
+
+typedef struct
+{
+    backend_blocking_t blocking;    // Native GEMM block sizes
+    size_t      batch_size;         // Training micro-batch
+    size_t      n_threads;          // Training workers
+    size_t      infer_batch;        // Server max_batch
+    size_t      infer_threads;      // Server workers
+} tune_params_t;
+
+typedef struct
+{
+    double      min_time;           // Seconds timed per candidate
+    size_t      max_threads;        // 0 for the CPUs of the process
+    const char* cache;              // Cache file, NULL for tune_cache_path
+    int         verbose;            // Print every candidate
+} tune_config_t;
+
+tune_config_t   tune_config_default(void);
+void            tune_cache_path(char* path, size_t size);
+
+tune_params_t   tune_run(network_t* net, dataset_t* data,
+                         const train_config_t* train,
+                         const tune_config_t* config);
+tune_params_t   tune_get(network_t* net, dataset_t* data,
+                         const train_config_t* train,
+                         const tune_config_t* config);
+void            tune_apply(const tune_params_t* params, network_t* net,
+                           train_config_t* train);
+
+int             tune_load(const char* path, network_t* net,
+                          const train_config_t* train, tune_params_t* params);
+void            tune_save(const char* path, network_t* net,
+                          const train_config_t* train,
+                          const tune_params_t* params);
+
+#endif // TUNE_H
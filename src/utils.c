@@ -11,6 +11,7 @@
 
 #include <math.h>
 #include <stdlib.h>
+#include <time.h>
 
 /**
  * @brief Returns a randomly generated normalized float between -1 and 1
@@ -75,4 +76,17 @@ double relu(double x)
 double d_relu(double x)
 {
     return x > 0.f ? 1.f : 0.f;
+}
+
+/**
+ * @brief Monotonic wall clock time
+ * 
+ * @return double Time in seconds
+ */
+double get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
 }
\ No newline at end of file
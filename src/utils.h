@@ -17,4 +17,6 @@ double d_sigmoid(double x);
 double relu(double x);
 double d_relu(double x);
 
+double get_time(void);
+
 #endif // UTILS_H
\ No newline at end of file
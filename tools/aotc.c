@@ -0,0 +1,77 @@
+/**
+ * @file    aotc.c
+ * @author  Philippe Bouchet (philippe.bouchet@epita.fr)
+ * @brief   DeepSea ahead-of-time compiler. Turns a saved network into a
+ *          standalone C source file with a single predict entry point.
+ *
+ *          Usage: ./bin/deepsea-aotc [-n name] [-d] [-t n_tests]
+ *                                    [-o output.c] network.save
+ *
+ *          -n  Entry point name, prefix of every generated symbol
+ *          -d  Double precision code (float by default)
+ *          -t  Embed n random test vectors and a self-checking main()
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "codegen.h"
+#include "network.h"
+
+#define AOTC_USAGE "Usage: %s [-n name] [-d] [-t n_tests] [-o output.c] " \
+                   "network.save"
+
+int main(int argc, char* argv[])
+{
+    codegen_config_t config = codegen_config_default();
+    const char* output = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:dt:o:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n':
+                config.name = optarg;
+                break;
+
+            case 'd':
+                config.use_double = 1;
+                break;
+
+            case 't':
+                config.n_tests = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'o':
+                output = optarg;
+                break;
+
+            default:
+                errx(-1, AOTC_USAGE, argv[0]);
+        }
+    }
+
+    if (optind != argc - 1)
+        errx(-1, AOTC_USAGE, argv[0]);
+
+    network_t* net = net_load(argv[optind]);
+    FILE* fp = output ? fopen(output, "w") : stdout;
+
+    if (fp == NULL)
+        err(-1, "AOTC::ERROR::OUTPUT: Could not open %s", output);
+
+    codegen_emit(net, fp, &config);
+
+    if (output)
+        fclose(fp);
+
+    net_free(net);
+
+    return 0;
+}
@@ -0,0 +1,169 @@
+/**
+ * @file    dtrain.c
+ * @author  Philippe Bouchet (philippe.bouchet@epita.fr)
+ * @brief   DeepSea multi-process trainer. Loads MNIST once, then forks
+ *          one training process per rank; ranks all-reduce their
+ *          gradients through shared memory every step, and rank 0 saves
+ *          the trained network. With -a, the micro-batch, threads and
+ *          GEMM blocking are autotuned first, or loaded from the cache of
+ *          a previous run (see tune.h).
+ *
+ *          Usage: ./bin/deepsea-dtrain [-p processes] [-t threads]
+ *                                      [-e epochs] [-n samples]
+ *                                      [-b batch] [-l lr] [-a]
+ *                                      [-o network.save]
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "dist.h"
+#include "network.h"
+#include "tune.h"
+#include "utils.h"
+
+#define TRAIN_IMAGE_DATA "data/train-images-idx3-ubyte"
+#define TRAIN_LABEL_DATA "data/train-labels-idx1-ubyte"
+
+#define MNIST_INPUT     784
+#define MNIST_HIDDEN    100
+#define MNIST_OUTPUT    10
+
+typedef struct
+{
+    network_t*      net;
+    dataset_t*      data;
+    train_config_t  config;
+    const char*     output;
+} dtrain_args_t;
+
+static int _dtrain_rank(dist_t* dist, void* args)
+{
+    dtrain_args_t* a = args;
+    train_config_t config = a->config;
+
+    config.dist = dist;
+    config.verbose = dist->rank == 0;
+
+    net_fit(a->net, a->data, &config);
+
+    if (dist->rank == 0)
+    {
+        printf("Accuracy on training set: %.2f%%\n",
+               net_accuracy(a->net, a->data) * 100);
+        net_save(a->net, a->output);
+    }
+
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    size_t world = 2;
+    size_t n = 8192;
+    size_t batch_size = 64;
+    double lr = 0.05f;
+    int autotune = 0;
+    dtrain_args_t args = {
+        .config = net_config_default(5),
+        .output = "network.save",
+    };
+    int opt;
+
+    while ((opt = getopt(argc, argv, "p:t:e:n:b:l:ao:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'p':
+                world = strtoul(optarg, NULL, 10);
+                break;
+
+            case 't':
+                args.config.n_threads = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'e':
+                args.config.epochs = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'n':
+                n = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'b':
+                batch_size = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'l':
+                lr = strtod(optarg, NULL);
+                break;
+
+            case 'a':
+                autotune = 1;
+                break;
+
+            case 'o':
+                args.output = optarg;
+                break;
+
+            default:
+                errx(-1, "Usage: %s [-p processes] [-t threads] [-e epochs] "
+                         "[-n samples] [-b batch] [-l lr] [-a] "
+                         "[-o network.save]",
+                     argv[0]);
+        }
+    }
+
+    srand(0);
+
+    args.net = net_init(2, MNIST_INPUT, MNIST_HIDDEN, MNIST_OUTPUT,
+                        batch_size, lr);
+    net_set_activation(args.net, 0, ACT_RELU);
+    net_set_activation(args.net, 1, ACT_SOFTMAX);
+
+    args.data = data_init(n, MNIST_INPUT, MNIST_OUTPUT);
+    data_load_mnist(TRAIN_IMAGE_DATA, args.data, LOAD_IMAGES);
+    data_load_mnist(TRAIN_LABEL_DATA, args.data, LOAD_LABELS);
+
+    if (autotune)
+    {
+        // Ranks share the CPUs, each tunes for its part of them
+        tune_config_t tune = tune_config_default();
+        size_t n_cpus = topo_get()->n_cpus;
+
+        tune.max_threads = n_cpus > world ? n_cpus / world : 1;
+        tune.verbose = 1;
+
+        tune_params_t params = tune_get(args.net, args.data, &args.config,
+                                        &tune);
+        tune_apply(&params, args.net, &args.config);
+
+        printf("Autotuned: micro-batch %zu x %zu steps, blocking "
+               "%zu/%zu/%zu\n", args.net->batch_size,
+               args.config.accum_steps, params.blocking.mc,
+               params.blocking.nc, params.blocking.kc);
+    }
+
+    printf("Training on %zu samples with %zu processes x %zu threads\n",
+           n, world, args.config.n_threads);
+
+    double start = get_time();
+    int status = dist_launch(world, net_dist_size(args.net),
+                             _dtrain_rank, &args);
+
+    if (status != 0)
+        errx(-1, "DTRAIN::ERROR: A training process failed");
+
+    printf("Trained in %.2fs, network saved to %s\n",
+           get_time() - start, args.output);
+
+    data_free(args.data);
+    net_free(args.net);
+
+    return 0;
+}
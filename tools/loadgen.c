@@ -0,0 +1,256 @@
+/**
+ * @file    loadgen.c
+ * @author  Philippe Bouchet (philippe.bouchet@epita.fr)
+ * @brief   Load generator for deepsea-serve. Opens concurrent connections
+ *          that each send predictions back to back with random inputs,
+ *          then reports client side throughput and latency, and the
+ *          server statistics. Requests answered with an error, or lost
+ *          with their connection, are counted as failed.
+ *
+ *          Usage: ./bin/deepsea-loadgen [-s socket] [-c connections]
+ *                                       [-n requests]
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include <err.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "server.h"
+#include "utils.h"
+
+#define LOADGEN_DEFAULT_SOCKET "/tmp/deepsea.sock"
+
+typedef struct
+{
+    const char* path;
+    size_t      n;           // Requests to send
+    double*     latency;     // Latency of each answered request, in seconds
+    size_t      done;        // Requests answered
+    size_t      failed;      // Requests answered with an error, or lost
+} loadgen_client_t;
+
+static int      _loadgen_connect(const char* path);
+static int      _loadgen_io(int fd, void* buf, size_t len, int out);
+static void*    _loadgen_client(void* args);
+static int      _loadgen_cmp_double(const void* a, const void* b);
+
+
+int main(int argc, char* argv[])
+{
+    const char* path = LOADGEN_DEFAULT_SOCKET;
+    size_t n_clients = 8;
+    size_t n_requests = 10000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:c:n:")) != -1)
+    {
+        switch (opt)
+        {
+            case 's':
+                path = optarg;
+                break;
+
+            case 'c':
+                n_clients = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'n':
+                n_requests = strtoul(optarg, NULL, 10);
+                break;
+
+            default:
+                errx(-1, "Usage: %s [-s socket] [-c connections] "
+                         "[-n requests]", argv[0]);
+        }
+    }
+
+    if (n_clients == 0 || n_requests < n_clients)
+        errx(-1, "LOADGEN::ERROR::CONFIG: Need at least one request "
+                 "per connection");
+
+    // A closed connection fails its requests instead of killing the run
+    signal(SIGPIPE, SIG_IGN);
+
+    pthread_t* threads = malloc(n_clients * sizeof(pthread_t));
+    loadgen_client_t* clients = calloc(n_clients, sizeof(loadgen_client_t));
+    double* latency = malloc(n_requests * sizeof(double));
+    size_t offset = 0;
+
+    double start = get_time();
+
+    for (size_t c = 0; c < n_clients; c++)
+    {
+        clients[c].path = path;
+        clients[c].n = n_requests / n_clients
+                     + (c < n_requests % n_clients);
+        clients[c].latency = latency + offset;
+        offset += clients[c].n;
+
+        pthread_create(&threads[c], NULL, _loadgen_client, &clients[c]);
+    }
+
+    size_t failed = 0;
+    size_t done = 0;
+
+    for (size_t c = 0; c < n_clients; c++)
+    {
+        pthread_join(threads[c], NULL);
+        failed += clients[c].failed;
+
+        // Latencies of answered requests only, packed at the front
+        memmove(latency + done, clients[c].latency,
+                clients[c].done * sizeof(double));
+        done += clients[c].done;
+    }
+
+    double elapsed = get_time() - start;
+
+    printf("[CLIENT] %zu requests over %zu connections in %.3fs, "
+           "%zu failed\n", n_requests, n_clients, elapsed, failed);
+
+    if (done > 0)
+    {
+        qsort(latency, done, sizeof(double), _loadgen_cmp_double);
+
+        printf("[CLIENT] %.0f req/s, p50 %.1fus, p99 %.1fus, max %.1fus\n",
+               done / elapsed, latency[done / 2] * 1e6,
+               latency[done * 99 / 100] * 1e6, latency[done - 1] * 1e6);
+    }
+
+    int fd = _loadgen_connect(path);
+    srv_header_t header = { .magic = SERVER_MAGIC, .type = SRV_STATS };
+    srv_stats_t stats;
+
+    if (_loadgen_io(fd, &header, sizeof(header), 1)
+        || _loadgen_io(fd, &stats, sizeof(stats), 0))
+    {
+        errx(-1, "LOADGEN::ERROR::IO: Connection closed by server");
+    }
+
+    close(fd);
+
+    printf("[SERVER] %lu requests, %lu batches (mean batch %.2f), "
+           "%lu connections, uptime %.1fs\n",
+           (unsigned long) stats.requests, (unsigned long) stats.batches,
+           stats.mean_batch, (unsigned long) stats.connections,
+           stats.uptime);
+    printf("[SERVER] %.0f req/s since start, p50 %.1fus, p99 %.1fus\n",
+           stats.throughput, stats.p50_us, stats.p99_us);
+
+    free(threads);
+    free(clients);
+    free(latency);
+
+    return failed != 0;
+}
+
+static int _loadgen_connect(const char* path)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (fd == -1 || connect(fd, (struct sockaddr*) &addr, sizeof(addr)))
+        err(-1, "LOADGEN::ERROR::CONNECT: Could not connect to %s", path);
+
+    return fd;
+}
+
+/**
+ * @brief  Send (out) or receive exactly len bytes
+ *
+ * @return int 0 on success, -1 if the connection failed or was closed
+ */
+static int _loadgen_io(int fd, void* buf, size_t len, int out)
+{
+    char* p = buf;
+
+    while (len > 0)
+    {
+        ssize_t r = out ? write(fd, p, len) : read(fd, p, len);
+
+        if (r <= 0)
+            return -1;
+
+        p += r;
+        len -= r;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Client thread: query the input / output sizes, then send its
+ *        predictions one at a time
+ *
+ * @param args loadgen_client_t
+ */
+static void* _loadgen_client(void* args)
+{
+    loadgen_client_t* client = args;
+    int fd = _loadgen_connect(client->path);
+
+    srv_header_t header = { .magic = SERVER_MAGIC, .type = SRV_INFO };
+    srv_info_t info;
+
+    if (_loadgen_io(fd, &header, sizeof(header), 1)
+        || _loadgen_io(fd, &info, sizeof(info), 0))
+    {
+        client->failed = client->n;
+        close(fd);
+
+        return NULL;
+    }
+
+    double* X = malloc(info.input_size * sizeof(double));
+    double* y = malloc(info.output_size * sizeof(double));
+    srv_reply_t reply;
+
+    header.type = SRV_PREDICT;
+
+    for (size_t i = 0; i < client->n; i++)
+    {
+        for (size_t k = 0; k < info.input_size; k++)
+            X[k] = normalized_rand();
+
+        double start = get_time();
+
+        // A lost connection fails this request and the remaining ones
+        if (_loadgen_io(fd, &header, sizeof(header), 1)
+            || _loadgen_io(fd, X, info.input_size * sizeof(double), 1)
+            || _loadgen_io(fd, &reply, sizeof(reply), 0)
+            || _loadgen_io(fd, y, info.output_size * sizeof(double), 0))
+        {
+            client->failed += client->n - i;
+            break;
+        }
+
+        client->latency[client->done++] = get_time() - start;
+        client->failed += reply.status != 0
+                       || reply.argmax >= info.output_size;
+    }
+
+    free(X);
+    free(y);
+    close(fd);
+
+    return NULL;
+}
+
+static int _loadgen_cmp_double(const void* a, const void* b)
+{
+    double x = *(const double*) a;
+    double y = *(const double*) b;
+
+    return (x > y) - (x < y);
+}
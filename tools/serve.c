@@ -0,0 +1,153 @@
+/**
+ * @file    serve.c
+ * @author  Philippe Bouchet (philippe.bouchet@epita.fr)
+ * @brief   DeepSea inference server. Loads a saved network once and
+ *          answers predictions on a Unix domain socket, batching
+ *          concurrent requests. Stops on SIGINT / SIGTERM. With -a,
+ *          the batch size, worker count and GEMM blocking come from the
+ *          autotune cache, tuned on a miss (see tune.h); -b and -t still
+ *          override them.
+ *
+ *          Usage: ./bin/deepsea-serve [-s socket] [-b max_batch]
+ *                                     [-w max_wait_us] [-t workers] [-a]
+ *                                     network.save
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include <err.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "backend.h"
+#include "dataset.h"
+#include "network.h"
+#include "server.h"
+#include "tune.h"
+
+#define SERVE_DEFAULT_SOCKET "/tmp/deepsea.sock"
+
+static server_t* server = NULL;
+
+static void _serve_stop(int sig)
+{
+    (void) sig;
+
+    if (server)
+        srv_stop(server);
+}
+
+/**
+ * @brief Tune net, or load its cached parameters, then use the inference
+ *        ones. The saved network carries no samples, tuning predicts on
+ *        blank inputs of its size.
+ *
+ * @param net Network to serve
+ * @param config Server configuration, max_batch and n_workers are set
+ *        unless given on the command line
+ * @param batch_set -b was given
+ * @param workers_set -t was given
+ */
+static void _serve_autotune(network_t* net, srv_config_t* config,
+                            int batch_set, int workers_set)
+{
+    train_config_t train = net_config_default(1);
+    tune_config_t tune = tune_config_default();
+    dataset_t* data = data_init(TUNE_SAMPLES, net->input_size,
+                                net->output_size);
+
+    // Loaded networks have no training batch, tune at the evaluation one
+    net->batch_size = net->max_batch;
+    tune.verbose = 1;
+
+    tune_params_t params = tune_get(net, data, &train, &tune);
+
+    backend_native_set_blocking(params.blocking);
+
+    if (!batch_set)
+        config->max_batch = params.infer_batch;
+
+    if (!workers_set)
+        config->n_workers = params.infer_threads;
+
+    data_free(data);
+}
+
+int main(int argc, char* argv[])
+{
+    const char* path = SERVE_DEFAULT_SOCKET;
+    srv_config_t config = srv_config_default();
+    int autotune = 0;
+    int batch_set = 0;
+    int workers_set = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:b:w:t:a")) != -1)
+    {
+        switch (opt)
+        {
+            case 's':
+                path = optarg;
+                break;
+
+            case 'b':
+                config.max_batch = strtoul(optarg, NULL, 10);
+                batch_set = 1;
+                break;
+
+            case 'w':
+                config.max_wait = strtod(optarg, NULL) * 1e-6;
+                break;
+
+            case 't':
+                config.n_workers = strtoul(optarg, NULL, 10);
+                workers_set = 1;
+                break;
+
+            case 'a':
+                autotune = 1;
+                break;
+
+            default:
+                errx(-1, "Usage: %s [-s socket] [-b max_batch] "
+                         "[-w max_wait_us] [-t workers] [-a] network.save",
+                     argv[0]);
+        }
+    }
+
+    if (optind != argc - 1)
+        errx(-1, "Usage: %s [-s socket] [-b max_batch] "
+                 "[-w max_wait_us] [-t workers] [-a] network.save", argv[0]);
+
+    network_t* net = net_load(argv[optind]);
+
+    if (autotune)
+        _serve_autotune(net, &config, batch_set, workers_set);
+
+    server = srv_init(net, path, &config);
+
+    struct sigaction sa = { .sa_handler = _serve_stop };
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    printf("Serving %s on %s (max batch %zu, max wait %.0fus, %zu workers)\n",
+           argv[optind], path, config.max_batch, config.max_wait * 1e6,
+           config.n_workers);
+
+    srv_run(server);
+
+    srv_stats_t stats = srv_stats(server);
+
+    printf("\nServed %lu requests in %lu batches (mean batch %.2f), "
+           "%.0f req/s, p50 %.1fus, p99 %.1fus\n",
+           (unsigned long) stats.requests, (unsigned long) stats.batches,
+           stats.mean_batch, stats.throughput, stats.p50_us, stats.p99_us);
+
+    srv_free(server);
+    net_free(net);
+
+    return 0;
+}
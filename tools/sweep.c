@@ -0,0 +1,186 @@
+/**
+ * @file    sweep.c
+ * @author  Philippe Bouchet (philippe.bouchet@epita.fr)
+ * @brief   DeepSea hyperparameter sweep. Loads MNIST once, holds out a
+ *          validation set, then trains a grid (or -r random draws) of
+ *          hidden sizes, batch sizes and learning rates concurrently,
+ *          -c CPUs per trial, stopping trials that fall below the median
+ *          (see hparam.h). Accuracy against wall-clock time is written to
+ *          a tab separated table.
+ *
+ *          Usage: ./bin/deepsea-sweep [-H hidden,...] [-B batch,...]
+ *                                     [-L lr,...] [-r trials] [-e epochs]
+ *                                     [-c cores] [-j parallel] [-n samples]
+ *                                     [-v val_fraction] [-g grace]
+ *                                     [-s seed] [-o results.tsv]
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hparam.h"
+#include "utils.h"
+
+#define TRAIN_IMAGE_DATA "data/train-images-idx3-ubyte"
+#define TRAIN_LABEL_DATA "data/train-labels-idx1-ubyte"
+
+#define MNIST_INPUT     784
+#define MNIST_OUTPUT    10
+
+static size_t _sweep_parse(const char* list, double* values)
+{
+    char buffer[256];
+    size_t n = 0;
+
+    snprintf(buffer, sizeof(buffer), "%s", list);
+
+    for (char* tok = strtok(buffer, ","); tok; tok = strtok(NULL, ","))
+    {
+        if (n == HPARAM_MAX_VALUES)
+            errx(-1, "SWEEP::ERROR: At most %d values per list",
+                 HPARAM_MAX_VALUES);
+
+        values[n++] = strtod(tok, NULL);
+    }
+
+    return n;
+}
+
+static size_t _sweep_parse_sizes(const char* list, size_t* values)
+{
+    double parsed[HPARAM_MAX_VALUES];
+    size_t n = _sweep_parse(list, parsed);
+
+    for (size_t i = 0; i < n; i++)
+        values[i] = (size_t) parsed[i];
+
+    return n;
+}
+
+int main(int argc, char* argv[])
+{
+    hparam_space_t space = { .n_random = 0 };
+    hparam_config_t config = hparam_config_default();
+    const char* hidden = "32,64,128";
+    const char* batch = "16,64";
+    const char* lr = "0.01,0.05,0.2";
+    const char* output = "sweep.tsv";
+    size_t n = 8192;
+    double val_split = 0.2f;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "H:B:L:r:e:c:j:n:v:g:s:o:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'H':
+                hidden = optarg;
+                break;
+
+            case 'B':
+                batch = optarg;
+                break;
+
+            case 'L':
+                lr = optarg;
+                break;
+
+            case 'r':
+                space.n_random = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'e':
+                config.epochs = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'c':
+                config.cores = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'j':
+                config.n_parallel = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'n':
+                n = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'v':
+                val_split = strtod(optarg, NULL);
+                break;
+
+            case 'g':
+                config.grace = strtoul(optarg, NULL, 10);
+                break;
+
+            case 's':
+                config.seed = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'o':
+                output = optarg;
+                break;
+
+            default:
+                errx(-1, "Usage: %s [-H hidden,...] [-B batch,...] "
+                         "[-L lr,...] [-r trials] [-e epochs] [-c cores] "
+                         "[-j parallel] [-n samples] [-v val_fraction] "
+                         "[-g grace] [-s seed] [-o results.tsv]",
+                     argv[0]);
+        }
+    }
+
+    space.n_hidden = _sweep_parse_sizes(hidden, space.hidden);
+    space.n_batch = _sweep_parse_sizes(batch, space.batch);
+    space.n_lr = _sweep_parse(lr, space.lr);
+
+    // Loaded once, every trial reads the same samples
+    srand(config.seed);
+
+    dataset_t* train = data_init(n, MNIST_INPUT, MNIST_OUTPUT);
+    data_load_mnist(TRAIN_IMAGE_DATA, train, LOAD_IMAGES);
+    data_load_mnist(TRAIN_LABEL_DATA, train, LOAD_LABELS);
+    data_shuffle(train);
+
+    dataset_t* val = data_split(train, (size_t) (n * val_split));
+    hparam_sweep_t* sweep = hparam_init(&space, &config, train, val);
+
+    printf("Sweeping %zu trials, %zu at a time on %zu CPUs each, over "
+           "%zu training and %zu validation samples\n", sweep->n_trials,
+           sweep->config.n_parallel, config.cores, train->n, val->n);
+
+    double start = get_time();
+    hparam_run(sweep);
+
+    hparam_trial_t* best = hparam_best(sweep);
+    size_t stopped = 0;
+
+    for (size_t i = 0; i < sweep->n_trials; i++)
+        stopped += sweep->trials[i].stopped;
+
+    printf("Swept in %.1fs, %zu trials stopped early. Best: hidden %zu, "
+           "batch %zu, lr %g - %.2f%%\n", get_time() - start, stopped,
+           best->hidden, best->batch, best->lr, best->accuracy * 100);
+
+    FILE* fp = fopen(output, "w");
+
+    if (fp == NULL)
+        err(-1, "SWEEP::ERROR: Could not open %s", output);
+
+    hparam_write(sweep, fp);
+    fclose(fp);
+
+    printf("Results written to %s\n", output);
+
+    hparam_free(sweep);
+    data_merge(train, val);
+    data_free(train);
+
+    return 0;
+}